@@ -12,6 +12,12 @@
 /* Define to enabled debug logging for all mudules. */
 #undef ENABLE_DEBUG_LOGGING
 
+/* Define to run crypto self-tests on first use instead of at init. */
+#undef ENABLE_LAZY_SELF_TEST
+
+/* Define to not run crypto self-tests. */
+#undef DISABLE_SELF_TEST
+
 /* Logging statments will be writen to this file. */
 #undef ERR_REPORTING_FILE
 
@@ -96,6 +102,9 @@
 /* Define to 1 if you have the <sys/int_types.h> header file. */
 #undef HAVE_SYS_INT_TYPES_H
 
+/* Define to 1 if you have the <sys/mman.h> header file. */
+#undef HAVE_SYS_MMAN_H
+
 /* Define to 1 if you have the <sys/socket.h> header file. */
 #undef HAVE_SYS_SOCKET_H
 
@@ -9,6 +9,12 @@
 /* Define to enabled debug logging for all mudules. */
 #cmakedefine ENABLE_DEBUG_LOGGING 1
 
+/* Define to run crypto self-tests on first use instead of at init. */
+#cmakedefine ENABLE_LAZY_SELF_TEST 1
+
+/* Define to not run crypto self-tests. */
+#cmakedefine DISABLE_SELF_TEST 1
+
 /* Logging statments will be writen to this file. */
 #cmakedefine ERR_REPORTING_FILE "@ERR_REPORTING_FILE@"
 
@@ -70,6 +76,9 @@
 /* Define to 1 if you have the <sys/int_types.h> header file. */
 #cmakedefine HAVE_SYS_INT_TYPES_H 1
 
+/* Define to 1 if you have the <sys/mman.h> header file. */
+#cmakedefine HAVE_SYS_MMAN_H 1
+
 /* Define to 1 if you have the <sys/socket.h> header file. */
 #cmakedefine HAVE_SYS_SOCKET_H 1
 
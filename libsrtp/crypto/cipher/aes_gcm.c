@@ -0,0 +1,646 @@
+/*
+ * aes_gcm.c
+ *
+ * AES Galois Counter Mode, built on the native AES implementation
+ *
+ * Cisco Systems, Inc.
+ *
+ */
+
+/*
+ *
+ * Copyright (c) 2013-2017, Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "aes_gcm.h"
+#include "alloc.h"
+#include "err.h" /* for srtp_debug */
+#include "crypto_types.h"
+#include "cipher_types.h"
+#include "cipher_test_cases.h"
+
+srtp_debug_module_t srtp_mod_aes_gcm = {
+    false,    /* debugging is off by default */
+    "aes gcm" /* printable module name       */
+};
+
+/*
+ * For now we only support 8 and 16 octet tags.  The spec allows for
+ * optional 12 byte tag, which may be supported in the future.
+ */
+#define GCM_AUTH_TAG_LEN 16
+#define GCM_AUTH_TAG_LEN_8 8
+
+/*
+ * Unlike the engines that wrap a crypto library, this one verifies the
+ * tag before it decrypts: srtp_aes_gcm_decrypt() runs GHASH over the
+ * ciphertext, compares the tag, and only runs the counter mode keystream
+ * over the payload once the packet is known to be authentic.  A forged
+ * packet therefore costs one GHASH pass and leaves the output buffer
+ * untouched.
+ */
+
+static uint64_t srtp_aes_gcm_load_be64(const uint8_t *p)
+{
+    uint64_t v = 0;
+
+    for (int i = 0; i < 8; i++) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+static void srtp_aes_gcm_store_be64(uint8_t *p, uint64_t v)
+{
+    for (int i = 7; i >= 0; i--) {
+        p[i] = (uint8_t)v;
+        v >>= 8;
+    }
+}
+
+/*
+ * srtp_aes_gcm_gen_table(k, h0, h1) fills in the multiples of the hash
+ * subkey H = (h0, h1) by each 4-bit field element, in the bit ordering of
+ * NIST SP 800-38D, in which element 8 is the field's 1
+ */
+static void srtp_aes_gcm_gen_table(srtp_aes_gcm_key_t *k,
+                                   uint64_t h0,
+                                   uint64_t h1)
+{
+    k->hh[0] = 0;
+    k->hl[0] = 0;
+    k->hh[8] = h0;
+    k->hl[8] = h1;
+    for (int i = 4; i > 0; i >>= 1) {
+        uint64_t mask = (uint64_t)0 - (h1 & 1);
+        h1 = (h1 >> 1) | (h0 << 63);
+        h0 = (h0 >> 1) ^ (0xe100000000000000ULL & mask);
+        k->hh[i] = h0;
+        k->hl[i] = h1;
+    }
+    for (int i = 2; i <= 8; i *= 2) {
+        for (int j = 1; j < i; j++) {
+            k->hh[i + j] = k->hh[i] ^ k->hh[j];
+            k->hl[i + j] = k->hl[i] ^ k->hl[j];
+        }
+    }
+}
+
+/*
+ * srtp_aes_gcm_last4[r] is the reduction of the four bits r shifted out
+ * of the low end of the field element, placed in the top 16 bits
+ */
+static const uint16_t srtp_aes_gcm_last4[16] = {
+    0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+/*
+ * srtp_aes_gcm_mult(x, k) sets x to x * H in GF(2^128), four bits at a
+ * time from the table of k (Shoup's method, as in the portable GHASH of
+ * OpenSSL and mbedTLS).  The table is indexed by the value being hashed,
+ * so its cache footprint depends on the data, as theirs does.
+ */
+static void srtp_aes_gcm_mult(uint64_t x[2], const srtp_aes_gcm_key_t *k)
+{
+    uint64_t zh = 0, zl = 0;
+
+    for (int i = 15; i >= 0; i--) {
+        uint8_t b = (uint8_t)(x[i >> 3] >> (56 - 8 * (i & 7)));
+
+        for (int shift = 0; shift <= 4; shift += 4) {
+            unsigned int n = (b >> shift) & 0xf;
+            unsigned int rem = (unsigned int)zl & 0xf;
+
+            zl = (zh << 60) | (zl >> 4);
+            zh = (zh >> 4) ^ ((uint64_t)srtp_aes_gcm_last4[rem] << 48);
+            zh ^= k->hh[n];
+            zl ^= k->hl[n];
+        }
+    }
+    x[0] = zh;
+    x[1] = zl;
+}
+
+static void srtp_aes_gcm_ghash_block(srtp_aes_gcm_ctx_t *c,
+                                     const uint8_t *block)
+{
+    c->x[0] ^= srtp_aes_gcm_load_be64(block);
+    c->x[1] ^= srtp_aes_gcm_load_be64(block + 8);
+    srtp_aes_gcm_mult(c->x, c->key);
+}
+
+/*
+ * srtp_aes_gcm_ghash_update() runs data into GHASH, holding back a
+ * trailing partial block so that the AAD may be given in pieces
+ */
+static void srtp_aes_gcm_ghash_update(srtp_aes_gcm_ctx_t *c,
+                                      const uint8_t *data,
+                                      size_t len)
+{
+    if (c->partial_len > 0) {
+        while (len > 0 && c->partial_len < 16) {
+            c->partial[c->partial_len++] = *data++;
+            len--;
+        }
+        if (c->partial_len < 16) {
+            return;
+        }
+        srtp_aes_gcm_ghash_block(c, c->partial);
+        c->partial_len = 0;
+    }
+
+    while (len >= 16) {
+        srtp_aes_gcm_ghash_block(c, data);
+        data += 16;
+        len -= 16;
+    }
+
+    memcpy(c->partial, data, len);
+    c->partial_len = len;
+}
+
+/* srtp_aes_gcm_ghash_pad() zero pads and hashes any partial block */
+static void srtp_aes_gcm_ghash_pad(srtp_aes_gcm_ctx_t *c)
+{
+    if (c->partial_len > 0) {
+        memset(c->partial + c->partial_len, 0, 16 - c->partial_len);
+        srtp_aes_gcm_ghash_block(c, c->partial);
+        c->partial_len = 0;
+    }
+}
+
+/* srtp_aes_gcm_start_text() closes the AAD before the first text octet */
+static void srtp_aes_gcm_start_text(srtp_aes_gcm_ctx_t *c)
+{
+    if (!c->aad_done) {
+        srtp_aes_gcm_ghash_pad(c);
+        c->aad_done = true;
+    }
+}
+
+/*
+ * srtp_aes_gcm_compute_tag() finishes GHASH and writes the full 16 octet
+ * tag E(K, J0) ^ S to tag
+ */
+static void srtp_aes_gcm_compute_tag(srtp_aes_gcm_ctx_t *c, uint8_t *tag)
+{
+    uint8_t lengths[16];
+    v128_t ek_j0;
+
+    srtp_aes_gcm_start_text(c);
+    srtp_aes_gcm_ghash_pad(c);
+
+    srtp_aes_gcm_store_be64(lengths, (uint64_t)c->aad_len * 8);
+    srtp_aes_gcm_store_be64(lengths + 8, (uint64_t)c->text_len * 8);
+    srtp_aes_gcm_ghash_block(c, lengths);
+
+    ek_j0 = c->j0;
+    srtp_aes_encrypt(&ek_j0, &c->key->expanded_key);
+
+    srtp_aes_gcm_store_be64(tag, c->x[0]);
+    srtp_aes_gcm_store_be64(tag + 8, c->x[1]);
+    for (int i = 0; i < 16; i++) {
+        tag[i] ^= ek_j0.v8[i];
+    }
+    octet_string_set_to_zero(&ek_j0, sizeof(ek_j0));
+}
+
+/*
+ * srtp_aes_gcm_ctr() exors the GCM keystream into len octets of src,
+ * writing the result to dst; src and dst may be the same buffer
+ */
+static void srtp_aes_gcm_ctr(srtp_aes_gcm_ctx_t *c,
+                             const uint8_t *src,
+                             uint8_t *dst,
+                             size_t len)
+{
+    while (len > 0) {
+        if (c->bytes_in_buffer == 0) {
+            uint32_t ctr = be32_to_cpu(c->counter.v32[3]) + 1;
+            c->counter.v32[3] = be32_to_cpu(ctr);
+            c->keystream_buffer = c->counter;
+            srtp_aes_encrypt(&c->keystream_buffer, &c->key->expanded_key);
+            c->bytes_in_buffer = sizeof(v128_t);
+        }
+        *dst++ = *src++ ^
+                 c->keystream_buffer.v8[sizeof(v128_t) - c->bytes_in_buffer];
+        c->bytes_in_buffer--;
+        len--;
+    }
+}
+
+/*
+ * the allocated state of a cipher is its per-packet state followed by the
+ * key that the per-packet state points to
+ */
+typedef struct {
+    srtp_aes_gcm_ctx_t ctx;
+    srtp_aes_gcm_key_t key;
+} srtp_aes_gcm_state_t;
+
+/*
+ * This function allocates a new instance of this crypto engine.
+ * The key_len parameter should be one of 28 or 44 for
+ * AES-128-GCM or AES-256-GCM respectively.  Note that the
+ * key length includes the 14 byte salt value that is used when
+ * initializing the KDF.
+ */
+static srtp_err_status_t srtp_aes_gcm_alloc(srtp_cipher_t **c,
+                                            size_t key_len,
+                                            size_t tlen)
+{
+    srtp_aes_gcm_state_t *gcm;
+
+    debug_print(srtp_mod_aes_gcm, "allocating cipher with key length %zu",
+                key_len);
+    debug_print(srtp_mod_aes_gcm, "allocating cipher with tag length %zu",
+                tlen);
+
+    /*
+     * Verify the key_len is valid for one of: AES-128/256
+     */
+    if (key_len != SRTP_AES_GCM_128_KEY_LEN_WSALT &&
+        key_len != SRTP_AES_GCM_256_KEY_LEN_WSALT) {
+        return (srtp_err_status_bad_param);
+    }
+
+    if (tlen != GCM_AUTH_TAG_LEN && tlen != GCM_AUTH_TAG_LEN_8) {
+        return (srtp_err_status_bad_param);
+    }
+
+    /* allocate memory a cipher of type aes_gcm */
+    *c = (srtp_cipher_t *)srtp_crypto_alloc(sizeof(srtp_cipher_t));
+    if (*c == NULL) {
+        return (srtp_err_status_alloc_fail);
+    }
+
+    gcm = (srtp_aes_gcm_state_t *)srtp_crypto_alloc(
+        sizeof(srtp_aes_gcm_state_t));
+    if (gcm == NULL) {
+        srtp_crypto_free(*c);
+        *c = NULL;
+        return (srtp_err_status_alloc_fail);
+    }
+
+    /* set pointers */
+    gcm->ctx.key = &gcm->key;
+    (*c)->state = &gcm->ctx;
+
+    /* setup cipher attributes */
+    switch (key_len) {
+    case SRTP_AES_GCM_128_KEY_LEN_WSALT:
+        (*c)->type = &srtp_aes_gcm_128;
+        (*c)->algorithm = SRTP_AES_GCM_128;
+        gcm->key.key_size = SRTP_AES_128_KEY_LEN;
+        gcm->key.tag_len = tlen;
+        break;
+    case SRTP_AES_GCM_256_KEY_LEN_WSALT:
+        (*c)->type = &srtp_aes_gcm_256;
+        (*c)->algorithm = SRTP_AES_GCM_256;
+        gcm->key.key_size = SRTP_AES_256_KEY_LEN;
+        gcm->key.tag_len = tlen;
+        break;
+    }
+
+    /* set key size        */
+    (*c)->key_len = key_len;
+
+    return (srtp_err_status_ok);
+}
+
+/*
+ * This function deallocates a GCM session
+ */
+static srtp_err_status_t srtp_aes_gcm_dealloc(srtp_cipher_t *c)
+{
+    srtp_aes_gcm_state_t *ctx;
+
+    ctx = (srtp_aes_gcm_state_t *)c->state;
+    if (ctx) {
+        /* zeroize the key material */
+        octet_string_set_to_zero(ctx, sizeof(srtp_aes_gcm_state_t));
+        srtp_crypto_free(ctx);
+    }
+
+    /* free memory */
+    srtp_crypto_free(c);
+
+    return (srtp_err_status_ok);
+}
+
+/*
+ * aes_gcm_context_init(...) initializes the aes_gcm_context
+ * using the value in key[], and derives the hash subkey from it.
+ *
+ * the key is the secret key
+ */
+static srtp_err_status_t srtp_aes_gcm_context_init(void *cv,
+                                                   const uint8_t *key)
+{
+    srtp_aes_gcm_ctx_t *c = (srtp_aes_gcm_ctx_t *)cv;
+    srtp_aes_gcm_key_t *k = c->key;
+    srtp_err_status_t status;
+    v128_t h;
+
+    c->dir = srtp_direction_any;
+
+    debug_print(srtp_mod_aes_gcm, "key:  %s",
+                srtp_octet_string_hex_string(key, k->key_size));
+
+    if (k->key_size != SRTP_AES_128_KEY_LEN &&
+        k->key_size != SRTP_AES_256_KEY_LEN) {
+        return (srtp_err_status_bad_param);
+    }
+
+    status =
+        srtp_aes_expand_encryption_key(key, k->key_size, &k->expanded_key);
+    if (status) {
+        return (srtp_err_status_init_fail);
+    }
+
+    v128_set_to_zero(&h);
+    srtp_aes_encrypt(&h, &k->expanded_key);
+    srtp_aes_gcm_gen_table(k, srtp_aes_gcm_load_be64(h.v8),
+                           srtp_aes_gcm_load_be64(h.v8 + 8));
+    octet_string_set_to_zero(&h, sizeof(h));
+
+    return (srtp_err_status_ok);
+}
+
+/*
+ * aes_gcm_set_iv(c, iv) sets up the pre-counter block from the 12 octet
+ * iv and resets the GHASH state for a new message
+ */
+static srtp_err_status_t srtp_aes_gcm_set_iv(void *cv,
+                                             uint8_t *iv,
+                                             srtp_cipher_direction_t direction)
+{
+    srtp_aes_gcm_ctx_t *c = (srtp_aes_gcm_ctx_t *)cv;
+
+    if (direction != srtp_direction_encrypt &&
+        direction != srtp_direction_decrypt) {
+        return (srtp_err_status_bad_param);
+    }
+    c->dir = direction;
+
+    debug_print(srtp_mod_aes_gcm, "setting iv: %s",
+                srtp_octet_string_hex_string(iv, 12));
+
+    memcpy(c->j0.v8, iv, 12);
+    c->j0.v32[3] = be32_to_cpu(1);
+    c->counter = c->j0;
+    c->bytes_in_buffer = 0;
+
+    c->x[0] = 0;
+    c->x[1] = 0;
+    c->partial_len = 0;
+    c->aad_len = 0;
+    c->text_len = 0;
+    c->aad_done = false;
+
+    return (srtp_err_status_ok);
+}
+
+/*
+ * This function processes the AAD; it may be called more than once
+ * before the text to give the AAD in pieces
+ *
+ * Parameters:
+ *	c	Crypto context
+ *	aad	Additional data to process for AEAD cipher suites
+ *	aad_len	length of aad buffer
+ */
+static srtp_err_status_t srtp_aes_gcm_set_aad(void *cv,
+                                              const uint8_t *aad,
+                                              size_t aad_len)
+{
+    srtp_aes_gcm_ctx_t *c = (srtp_aes_gcm_ctx_t *)cv;
+
+    debug_print(srtp_mod_aes_gcm, "setting AAD: %s",
+                srtp_octet_string_hex_string(aad, aad_len));
+
+    if (c->aad_done) {
+        return (srtp_err_status_algo_fail);
+    }
+
+    srtp_aes_gcm_ghash_update(c, aad, aad_len);
+    c->aad_len += aad_len;
+
+    return (srtp_err_status_ok);
+}
+
+/*
+ * This function encrypts a buffer using AES GCM mode; it may be called
+ * more than once to encrypt a message in pieces
+ *
+ * Parameters:
+ *	c	Crypto context
+ *	buf	data to encrypt
+ *	enc_len	length of encrypt buffer
+ */
+static srtp_err_status_t srtp_aes_gcm_encrypt(void *cv,
+                                              const uint8_t *src,
+                                              size_t src_len,
+                                              uint8_t *dst,
+                                              size_t *dst_len)
+{
+    srtp_aes_gcm_ctx_t *c = (srtp_aes_gcm_ctx_t *)cv;
+    if (c->dir != srtp_direction_encrypt && c->dir != srtp_direction_decrypt) {
+        return (srtp_err_status_bad_param);
+    }
+
+    if (*dst_len < src_len) {
+        return (srtp_err_status_buffer_small);
+    }
+
+    srtp_aes_gcm_start_text(c);
+    if (src_len > 0) {
+        srtp_aes_gcm_ctr(c, src, dst, src_len);
+        srtp_aes_gcm_ghash_update(c, dst, src_len);
+        c->text_len += src_len;
+    }
+    *dst_len = src_len;
+
+    return (srtp_err_status_ok);
+}
+
+/*
+ * This function calculates and returns the GCM tag for a given context.
+ * This should be called after encrypting the data.  The *len value
+ * is set to the tag size.  The caller must ensure that *buf has
+ * enough room to accept the appended tag.
+ *
+ * Parameters:
+ *	c	Crypto context
+ *	buf	data to encrypt
+ *	len	length of encrypt buffer
+ */
+static srtp_err_status_t srtp_aes_gcm_get_tag(void *cv,
+                                              uint8_t *buf,
+                                              size_t *len)
+{
+    srtp_aes_gcm_ctx_t *c = (srtp_aes_gcm_ctx_t *)cv;
+    uint8_t tag[GCM_AUTH_TAG_LEN];
+
+    srtp_aes_gcm_compute_tag(c, tag);
+    memcpy(buf, tag, c->key->tag_len);
+    *len = c->key->tag_len;
+
+    return (srtp_err_status_ok);
+}
+
+/*
+ * This function verifies and then decrypts a buffer using AES GCM mode.
+ * The last tag_len octets of src are the tag; dst is only written once
+ * the tag has been found to be correct.
+ *
+ * Parameters:
+ *	c	Crypto context
+ *	buf	data to encrypt
+ *	enc_len	length of encrypt buffer
+ */
+static srtp_err_status_t srtp_aes_gcm_decrypt(void *cv,
+                                              const uint8_t *src,
+                                              size_t src_len,
+                                              uint8_t *dst,
+                                              size_t *dst_len)
+{
+    srtp_aes_gcm_ctx_t *c = (srtp_aes_gcm_ctx_t *)cv;
+    uint8_t tag[GCM_AUTH_TAG_LEN];
+    size_t text_len;
+    bool match;
+
+    if (c->dir != srtp_direction_encrypt && c->dir != srtp_direction_decrypt) {
+        return (srtp_err_status_bad_param);
+    }
+
+    if (src_len < c->key->tag_len) {
+        return (srtp_err_status_auth_fail);
+    }
+    text_len = src_len - c->key->tag_len;
+
+    if (*dst_len < text_len) {
+        return (srtp_err_status_buffer_small);
+    }
+
+    /*
+     * Check the tag first, over the AAD and the ciphertext as received
+     */
+    srtp_aes_gcm_start_text(c);
+    srtp_aes_gcm_ghash_update(c, src, text_len);
+    c->text_len += text_len;
+    srtp_aes_gcm_compute_tag(c, tag);
+    match = srtp_octet_string_equal(tag, src + text_len, c->key->tag_len);
+    octet_string_set_to_zero(tag, sizeof(tag));
+    if (!match) {
+        return (srtp_err_status_auth_fail);
+    }
+
+    /*
+     * Only now run the keystream over the payload
+     */
+    if (text_len > 0) {
+        srtp_aes_gcm_ctr(c, src, dst, text_len);
+    }
+
+    /*
+     * Reduce the buffer size by the tag length since the tag
+     * is not part of the original payload
+     */
+    *dst_len = text_len;
+
+    return (srtp_err_status_ok);
+}
+
+/*
+ * aes_gcm_start_call(...) sets up a per-packet state that refers to the
+ * key of an initialized context; set_iv then starts the message
+ */
+static void srtp_aes_gcm_start_call(const void *cv, void *call_state)
+{
+    const srtp_aes_gcm_ctx_t *c = (const srtp_aes_gcm_ctx_t *)cv;
+    srtp_aes_gcm_ctx_t *call = (srtp_aes_gcm_ctx_t *)call_state;
+
+    call->dir = srtp_direction_any;
+    call->key = c->key;
+}
+
+/*
+ * Name of this crypto engine
+ */
+static const char srtp_aes_gcm_128_description[] = "AES-128 GCM";
+static const char srtp_aes_gcm_256_description[] = "AES-256 GCM";
+
+/*
+ * This is the vector function table for this crypto engine.
+ */
+const srtp_cipher_type_t srtp_aes_gcm_128 = {
+    srtp_aes_gcm_alloc,
+    srtp_aes_gcm_dealloc,
+    srtp_aes_gcm_context_init,
+    srtp_aes_gcm_set_aad,
+    srtp_aes_gcm_encrypt,
+    srtp_aes_gcm_decrypt,
+    srtp_aes_gcm_set_iv,
+    srtp_aes_gcm_get_tag,
+    srtp_aes_gcm_128_description,
+    &srtp_aes_gcm_128_test_case_0,
+    SRTP_AES_GCM_128,
+    sizeof(srtp_aes_gcm_ctx_t),
+    srtp_aes_gcm_start_call
+};
+
+/*
+ * This is the vector function table for this crypto engine.
+ */
+const srtp_cipher_type_t srtp_aes_gcm_256 = {
+    srtp_aes_gcm_alloc,
+    srtp_aes_gcm_dealloc,
+    srtp_aes_gcm_context_init,
+    srtp_aes_gcm_set_aad,
+    srtp_aes_gcm_encrypt,
+    srtp_aes_gcm_decrypt,
+    srtp_aes_gcm_set_iv,
+    srtp_aes_gcm_get_tag,
+    srtp_aes_gcm_256_description,
+    &srtp_aes_gcm_256_test_case_0,
+    SRTP_AES_GCM_256,
+    sizeof(srtp_aes_gcm_ctx_t),
+    srtp_aes_gcm_start_call
+};
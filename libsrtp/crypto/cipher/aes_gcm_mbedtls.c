@@ -404,7 +404,9 @@ const srtp_cipher_type_t srtp_aes_gcm_128 = {
     srtp_aes_gcm_mbedtls_get_tag,
     srtp_aes_gcm_128_mbedtls_description,
     &srtp_aes_gcm_128_test_case_0,
-    SRTP_AES_GCM_128
+    SRTP_AES_GCM_128,
+    0,
+    NULL
 };
 
 /*
@@ -421,5 +423,7 @@ const srtp_cipher_type_t srtp_aes_gcm_256 = {
     srtp_aes_gcm_mbedtls_get_tag,
     srtp_aes_gcm_256_mbedtls_description,
     &srtp_aes_gcm_256_test_case_0,
-    SRTP_AES_GCM_256
+    SRTP_AES_GCM_256,
+    0,
+    NULL
 };
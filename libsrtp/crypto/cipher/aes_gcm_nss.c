@@ -445,7 +445,9 @@ const srtp_cipher_type_t srtp_aes_gcm_128 = {
     srtp_aes_gcm_nss_get_tag,
     srtp_aes_gcm_128_nss_description,
     &srtp_aes_gcm_128_test_case_0,
-    SRTP_AES_GCM_128
+    SRTP_AES_GCM_128,
+    0,
+    NULL
 };
 /* clang-format on */
 
@@ -464,6 +466,8 @@ const srtp_cipher_type_t srtp_aes_gcm_256 = {
     srtp_aes_gcm_nss_get_tag,
     srtp_aes_gcm_256_nss_description,
     &srtp_aes_gcm_256_test_case_0,
-    SRTP_AES_GCM_256
+    SRTP_AES_GCM_256,
+    0,
+    NULL
 };
 /* clang-format on */
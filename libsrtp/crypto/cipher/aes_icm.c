@@ -93,11 +93,20 @@ srtp_debug_module_t srtp_mod_aes_icm = {
  *
  */
 
+/*
+ * the allocated state of a cipher is its per-packet state followed by the
+ * key that the per-packet state points to
+ */
+typedef struct {
+    srtp_aes_icm_ctx_t ctx;
+    srtp_aes_icm_key_t key;
+} srtp_aes_icm_state_t;
+
 static srtp_err_status_t srtp_aes_icm_alloc(srtp_cipher_t **c,
                                             size_t key_len,
                                             size_t tlen)
 {
-    srtp_aes_icm_ctx_t *icm;
+    srtp_aes_icm_state_t *icm;
     (void)tlen;
 
     debug_print(srtp_mod_aes_icm, "allocating cipher with key length %zu",
@@ -120,7 +129,8 @@ static srtp_err_status_t srtp_aes_icm_alloc(srtp_cipher_t **c,
         return srtp_err_status_alloc_fail;
     }
 
-    icm = (srtp_aes_icm_ctx_t *)srtp_crypto_alloc(sizeof(srtp_aes_icm_ctx_t));
+    icm = (srtp_aes_icm_state_t *)srtp_crypto_alloc(
+        sizeof(srtp_aes_icm_state_t));
     if (icm == NULL) {
         srtp_crypto_free(*c);
         *c = NULL;
@@ -128,7 +138,8 @@ static srtp_err_status_t srtp_aes_icm_alloc(srtp_cipher_t **c,
     }
 
     /* set pointers */
-    (*c)->state = icm;
+    icm->ctx.key = &icm->key;
+    (*c)->state = &icm->ctx;
 
     switch (key_len) {
     case SRTP_AES_ICM_256_KEY_LEN_WSALT:
@@ -142,7 +153,7 @@ static srtp_err_status_t srtp_aes_icm_alloc(srtp_cipher_t **c,
     }
 
     /* set key size        */
-    icm->key_size = key_len;
+    icm->key.key_size = key_len;
     (*c)->key_len = key_len;
 
     return srtp_err_status_ok;
@@ -150,16 +161,16 @@ static srtp_err_status_t srtp_aes_icm_alloc(srtp_cipher_t **c,
 
 static srtp_err_status_t srtp_aes_icm_dealloc(srtp_cipher_t *c)
 {
-    srtp_aes_icm_ctx_t *ctx;
+    srtp_aes_icm_state_t *ctx;
 
     if (c == NULL) {
         return srtp_err_status_bad_param;
     }
 
-    ctx = (srtp_aes_icm_ctx_t *)c->state;
+    ctx = (srtp_aes_icm_state_t *)c->state;
     if (ctx) {
         /* zeroize the key material */
-        octet_string_set_to_zero(ctx, sizeof(srtp_aes_icm_ctx_t));
+        octet_string_set_to_zero(ctx, sizeof(srtp_aes_icm_state_t));
         srtp_crypto_free(ctx);
     }
 
@@ -182,12 +193,13 @@ static srtp_err_status_t srtp_aes_icm_dealloc(srtp_cipher_t *c)
 static srtp_err_status_t srtp_aes_icm_context_init(void *cv, const uint8_t *key)
 {
     srtp_aes_icm_ctx_t *c = (srtp_aes_icm_ctx_t *)cv;
+    srtp_aes_icm_key_t *k = c->key;
     srtp_err_status_t status;
     size_t base_key_len, copy_len;
 
-    if (c->key_size == SRTP_AES_ICM_128_KEY_LEN_WSALT ||
-        c->key_size == SRTP_AES_ICM_256_KEY_LEN_WSALT) {
-        base_key_len = c->key_size - SRTP_SALT_LEN;
+    if (k->key_size == SRTP_AES_ICM_128_KEY_LEN_WSALT ||
+        k->key_size == SRTP_AES_ICM_256_KEY_LEN_WSALT) {
+        base_key_len = k->key_size - SRTP_SALT_LEN;
     } else {
         return srtp_err_status_bad_param;
     }
@@ -197,9 +209,9 @@ static srtp_err_status_t srtp_aes_icm_context_init(void *cv, const uint8_t *key)
      * go past the end of the key buffer
      */
     v128_set_to_zero(&c->counter);
-    v128_set_to_zero(&c->offset);
+    v128_set_to_zero(&k->offset);
 
-    copy_len = c->key_size - base_key_len;
+    copy_len = k->key_size - base_key_len;
     /* force last two octets of the offset to be left zero (for srtp
      * compatibility) */
     if (copy_len > SRTP_SALT_LEN) {
@@ -207,18 +219,18 @@ static srtp_err_status_t srtp_aes_icm_context_init(void *cv, const uint8_t *key)
     }
 
     memcpy(&c->counter, key + base_key_len, copy_len);
-    memcpy(&c->offset, key + base_key_len, copy_len);
+    memcpy(&k->offset, key + base_key_len, copy_len);
 
     debug_print(srtp_mod_aes_icm, "key:  %s",
                 srtp_octet_string_hex_string(key, base_key_len));
-    debug_print(srtp_mod_aes_icm, "offset: %s", v128_hex_string(&c->offset));
+    debug_print(srtp_mod_aes_icm, "offset: %s", v128_hex_string(&k->offset));
 
     /* expand key */
     status =
-        srtp_aes_expand_encryption_key(key, base_key_len, &c->expanded_key);
+        srtp_aes_expand_encryption_key(key, base_key_len, &k->expanded_key);
     if (status) {
         v128_set_to_zero(&c->counter);
-        v128_set_to_zero(&c->offset);
+        v128_set_to_zero(&k->offset);
         return status;
     }
 
@@ -246,7 +258,7 @@ static srtp_err_status_t srtp_aes_icm_set_iv(void *cv,
 
     debug_print(srtp_mod_aes_icm, "setting iv: %s", v128_hex_string(&nonce));
 
-    v128_xor(&c->counter, &c->offset, &nonce);
+    v128_xor(&c->counter, &c->key->offset, &nonce);
 
     debug_print(srtp_mod_aes_icm, "set_counter: %s",
                 v128_hex_string(&c->counter));
@@ -267,7 +279,7 @@ static void srtp_aes_icm_advance(srtp_aes_icm_ctx_t *c)
 {
     /* fill buffer with new keystream */
     v128_copy(&c->keystream_buffer, &c->counter);
-    srtp_aes_encrypt(&c->keystream_buffer, &c->expanded_key);
+    srtp_aes_encrypt(&c->keystream_buffer, &c->key->expanded_key);
     c->bytes_in_buffer = sizeof(v128_t);
 
     debug_print(srtp_mod_aes_icm, "counter:    %s",
@@ -413,6 +425,20 @@ static srtp_err_status_t srtp_aes_icm_encrypt(void *cv,
     return srtp_err_status_ok;
 }
 
+/*
+ * aes_icm_start_call(...) sets up a per-packet state that refers to the
+ * key of an initialized context
+ */
+static void srtp_aes_icm_start_call(const void *cv, void *call_state)
+{
+    const srtp_aes_icm_ctx_t *c = (const srtp_aes_icm_ctx_t *)cv;
+    srtp_aes_icm_ctx_t *call = (srtp_aes_icm_ctx_t *)call_state;
+
+    v128_copy(&call->counter, &c->key->offset);
+    call->bytes_in_buffer = 0;
+    call->key = c->key;
+}
+
 static const char srtp_aes_icm_128_description[] =
     "AES-128 integer counter mode";
 static const char srtp_aes_icm_256_description[] =
@@ -433,7 +459,9 @@ const srtp_cipher_type_t srtp_aes_icm_128 = {
     0,                             /* get_tag */
     srtp_aes_icm_128_description,  /* */
     &srtp_aes_icm_128_test_case_0, /* */
-    SRTP_AES_ICM_128               /* */
+    SRTP_AES_ICM_128,              /* */
+    sizeof(srtp_aes_icm_ctx_t),    /* */
+    srtp_aes_icm_start_call        /* */
 };
 
 const srtp_cipher_type_t srtp_aes_icm_256 = {
@@ -447,5 +475,7 @@ const srtp_cipher_type_t srtp_aes_icm_256 = {
     0,                             /* get_tag */
     srtp_aes_icm_256_description,  /* */
     &srtp_aes_icm_256_test_case_0, /* */
-    SRTP_AES_ICM_256               /* */
+    SRTP_AES_ICM_256,              /* */
+    sizeof(srtp_aes_icm_ctx_t),    /* */
+    srtp_aes_icm_start_call        /* */
 };
@@ -342,7 +342,9 @@ const srtp_cipher_type_t srtp_aes_icm_128 = {
     0,                                    /* get_tag */
     srtp_aes_icm_128_mbedtls_description, /* */
     &srtp_aes_icm_128_test_case_0,        /* */
-    SRTP_AES_ICM_128                      /* */
+    SRTP_AES_ICM_128,                     /* */
+    0,                                    /* call_state_len */
+    NULL                                  /* start_call */
 };
 
 /*
@@ -360,7 +362,9 @@ const srtp_cipher_type_t srtp_aes_icm_192 = {
     0,                                    /* get_tag */
     srtp_aes_icm_192_mbedtls_description, /* */
     &srtp_aes_icm_192_test_case_0,        /* */
-    SRTP_AES_ICM_192                      /* */
+    SRTP_AES_ICM_192,                     /* */
+    0,                                    /* call_state_len */
+    NULL                                  /* start_call */
 };
 
 /*
@@ -378,5 +382,7 @@ const srtp_cipher_type_t srtp_aes_icm_256 = {
     0,                                    /* get_tag */
     srtp_aes_icm_256_mbedtls_description, /* */
     &srtp_aes_icm_256_test_case_0,        /* */
-    SRTP_AES_ICM_256                      /* */
+    SRTP_AES_ICM_256,                     /* */
+    0,                                    /* call_state_len */
+    NULL                                  /* start_call */
 };
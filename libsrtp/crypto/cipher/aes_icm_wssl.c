@@ -353,7 +353,9 @@ const srtp_cipher_type_t srtp_aes_icm_128 = {
     0,                                    /* get_tag */
     srtp_aes_icm_128_wolfssl_description, /* */
     &srtp_aes_icm_128_test_case_0,        /* */
-    SRTP_AES_ICM_128                      /* */
+    SRTP_AES_ICM_128,                     /* */
+    0,                                    /* call_state_len */
+    NULL                                  /* start_call */
 };
 
 /*
@@ -371,7 +373,9 @@ const srtp_cipher_type_t srtp_aes_icm_192 = {
     0,                                    /* get_tag */
     srtp_aes_icm_192_wolfssl_description, /* */
     &srtp_aes_icm_192_test_case_0,        /* */
-    SRTP_AES_ICM_192                      /* */
+    SRTP_AES_ICM_192,                     /* */
+    0,                                    /* call_state_len */
+    NULL                                  /* start_call */
 };
 
 /*
@@ -389,5 +393,7 @@ const srtp_cipher_type_t srtp_aes_icm_256 = {
     0,                                    /* get_tag */
     srtp_aes_icm_256_wolfssl_description, /* */
     &srtp_aes_icm_256_test_case_0,        /* */
-    SRTP_AES_ICM_256                      /* */
+    SRTP_AES_ICM_256,                     /* */
+    0,                                    /* call_state_len */
+    NULL                                  /* start_call */
 };
@@ -172,6 +172,26 @@ size_t srtp_cipher_get_key_length(const srtp_cipher_t *c)
     return c->key_len;
 }
 
+bool srtp_cipher_has_call_state(const srtp_cipher_t *c)
+{
+    return c->type->start_call != NULL &&
+           c->type->call_state_len <= SRTP_MAX_CIPHER_CALL_STATE_LEN;
+}
+
+srtp_cipher_t *srtp_cipher_start_call(srtp_cipher_t *c,
+                                      srtp_cipher_call_t *call)
+{
+    if (c == NULL || !srtp_cipher_has_call_state(c)) {
+        return c;
+    }
+
+    call->cipher = *c;
+    call->cipher.state = call->state;
+    c->type->start_call(c->state, call->state);
+
+    return &call->cipher;
+}
+
 /*
  * A trivial platform independent random source.
  * For use in test only.
@@ -132,6 +132,15 @@ static srtp_err_status_t srtp_null_cipher_encrypt(void *cv,
     return srtp_err_status_ok;
 }
 
+/*
+ * the null cipher keeps no state, so a call needs none of its own
+ */
+static void srtp_null_cipher_start_call(const void *cv, void *call_state)
+{
+    (void)cv;
+    (void)call_state;
+}
+
 static const char srtp_null_cipher_description[] = "null cipher";
 
 static const srtp_cipher_test_case_t srtp_null_cipher_test_0 = {
@@ -163,5 +172,7 @@ const srtp_cipher_type_t srtp_null_cipher = {
     0,                            /* get_tag */
     srtp_null_cipher_description, /* */
     &srtp_null_cipher_test_0,     /* */
-    SRTP_NULL_CIPHER              /* */
+    SRTP_NULL_CIPHER,             /* */
+    0,                            /* call_state_len */
+    srtp_null_cipher_start_call   /* */
 };
@@ -63,6 +63,25 @@ size_t srtp_auth_get_key_length(const srtp_auth_t *a)
     return a->key_len;
 }
 
+bool srtp_auth_has_call_state(const srtp_auth_t *a)
+{
+    return a->type->start_call != NULL &&
+           a->type->call_state_len <= SRTP_MAX_AUTH_CALL_STATE_LEN;
+}
+
+srtp_auth_t *srtp_auth_start_call(srtp_auth_t *a, srtp_auth_call_t *call)
+{
+    if (a == NULL || !srtp_auth_has_call_state(a)) {
+        return a;
+    }
+
+    call->auth = *a;
+    call->auth.state = call->state;
+    a->type->start_call(a->state, call->state);
+
+    return &call->auth;
+}
+
 size_t srtp_auth_get_tag_length(const srtp_auth_t *a)
 {
     return a->out_len;
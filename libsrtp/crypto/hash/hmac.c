@@ -58,6 +58,15 @@ srtp_debug_module_t srtp_mod_hmac = {
     "hmac sha-1" /* printable name for module   */
 };
 
+/*
+ * the allocated state of an auth function is its per-message state
+ * followed by the key that the per-message state points to
+ */
+typedef struct {
+    srtp_hmac_ctx_t ctx;
+    srtp_hmac_key_t key;
+} srtp_hmac_state_t;
+
 static srtp_err_status_t srtp_hmac_alloc(srtp_auth_t **a,
                                          size_t key_len,
                                          size_t out_len)
@@ -83,8 +92,8 @@ static srtp_err_status_t srtp_hmac_alloc(srtp_auth_t **a,
         return srtp_err_status_bad_param;
     }
 
-    /* allocate memory for auth and srtp_hmac_ctx_t structures */
-    pointer = (uint8_t *)srtp_crypto_alloc(sizeof(srtp_hmac_ctx_t) +
+    /* allocate memory for auth and srtp_hmac_state_t structures */
+    pointer = (uint8_t *)srtp_crypto_alloc(sizeof(srtp_hmac_state_t) +
                                            sizeof(srtp_auth_t));
     if (pointer == NULL) {
         return srtp_err_status_alloc_fail;
@@ -94,6 +103,8 @@ static srtp_err_status_t srtp_hmac_alloc(srtp_auth_t **a,
     *a = (srtp_auth_t *)pointer;
     (*a)->type = &srtp_hmac;
     (*a)->state = pointer + sizeof(srtp_auth_t);
+    ((srtp_hmac_state_t *)(*a)->state)->ctx.key =
+        &((srtp_hmac_state_t *)(*a)->state)->key;
     (*a)->out_len = out_len;
     (*a)->key_len = key_len;
     (*a)->prefix_len = 0;
@@ -104,7 +115,8 @@ static srtp_err_status_t srtp_hmac_alloc(srtp_auth_t **a,
 static srtp_err_status_t srtp_hmac_dealloc(srtp_auth_t *a)
 {
     /* zeroize entire state*/
-    octet_string_set_to_zero(a, sizeof(srtp_hmac_ctx_t) + sizeof(srtp_auth_t));
+    octet_string_set_to_zero(a,
+                             sizeof(srtp_hmac_state_t) + sizeof(srtp_auth_t));
 
     /* free memory */
     srtp_crypto_free(a);
@@ -117,6 +129,7 @@ static srtp_err_status_t srtp_hmac_init(void *statev,
                                         size_t key_len)
 {
     srtp_hmac_ctx_t *state = (srtp_hmac_ctx_t *)statev;
+    srtp_hmac_key_t *k = state->key;
     uint8_t ipad[64];
 
     /*
@@ -133,23 +146,23 @@ static srtp_err_status_t srtp_hmac_init(void *statev,
      */
     for (size_t i = 0; i < key_len; i++) {
         ipad[i] = key[i] ^ 0x36;
-        state->opad[i] = key[i] ^ 0x5c;
+        k->opad[i] = key[i] ^ 0x5c;
     }
     /* set the rest of ipad, opad to constant values */
     for (size_t i = key_len; i < 64; i++) {
         ipad[i] = 0x36;
-        ((uint8_t *)state->opad)[i] = 0x5c;
+        ((uint8_t *)k->opad)[i] = 0x5c;
     }
 
     debug_print(srtp_mod_hmac, "ipad: %s",
                 srtp_octet_string_hex_string(ipad, 64));
 
     /* initialize sha1 context */
-    srtp_sha1_init(&state->init_ctx);
+    srtp_sha1_init(&k->init_ctx);
 
     /* hash ipad ^ key */
-    srtp_sha1_update(&state->init_ctx, ipad, 64);
-    memcpy(&state->ctx, &state->init_ctx, sizeof(srtp_sha1_ctx_t));
+    srtp_sha1_update(&k->init_ctx, ipad, 64);
+    memcpy(&state->ctx, &k->init_ctx, sizeof(srtp_sha1_ctx_t));
 
     return srtp_err_status_ok;
 }
@@ -158,11 +171,20 @@ static srtp_err_status_t srtp_hmac_start(void *statev)
 {
     srtp_hmac_ctx_t *state = (srtp_hmac_ctx_t *)statev;
 
-    memcpy(&state->ctx, &state->init_ctx, sizeof(srtp_sha1_ctx_t));
+    memcpy(&state->ctx, &state->key->init_ctx, sizeof(srtp_sha1_ctx_t));
 
     return srtp_err_status_ok;
 }
 
+static void srtp_hmac_start_call(const void *statev, void *call_state)
+{
+    const srtp_hmac_ctx_t *state = (const srtp_hmac_ctx_t *)statev;
+    srtp_hmac_ctx_t *call = (srtp_hmac_ctx_t *)call_state;
+
+    call->key = state->key;
+    memcpy(&call->ctx, &state->key->init_ctx, sizeof(srtp_sha1_ctx_t));
+}
+
 static srtp_err_status_t srtp_hmac_update(void *statev,
                                           const uint8_t *message,
                                           size_t msg_octets)
@@ -209,7 +231,7 @@ static srtp_err_status_t srtp_hmac_compute(void *statev,
     srtp_sha1_init(&state->ctx);
 
     /* hash opad ^ key  */
-    srtp_sha1_update(&state->ctx, (uint8_t *)state->opad, 64);
+    srtp_sha1_update(&state->ctx, (uint8_t *)state->key->opad, 64);
 
     /* hash the result of the inner hash */
     srtp_sha1_update(&state->ctx, (uint8_t *)H, 20);
@@ -236,13 +258,15 @@ static const char srtp_hmac_description[] =
  */
 
 const srtp_auth_type_t srtp_hmac = {
-    srtp_hmac_alloc,        /* */
-    srtp_hmac_dealloc,      /* */
-    srtp_hmac_init,         /* */
-    srtp_hmac_compute,      /* */
-    srtp_hmac_update,       /* */
-    srtp_hmac_start,        /* */
-    srtp_hmac_description,  /* */
-    &srtp_hmac_test_case_0, /* */
-    SRTP_HMAC_SHA1          /* */
+    srtp_hmac_alloc,         /* */
+    srtp_hmac_dealloc,       /* */
+    srtp_hmac_init,          /* */
+    srtp_hmac_compute,       /* */
+    srtp_hmac_update,        /* */
+    srtp_hmac_start,         /* */
+    srtp_hmac_description,   /* */
+    &srtp_hmac_test_case_0,  /* */
+    SRTP_HMAC_SHA1,          /* */
+    sizeof(srtp_hmac_ctx_t), /* */
+    srtp_hmac_start_call     /* */
 };
@@ -224,5 +224,7 @@ const srtp_auth_type_t srtp_hmac = {
     srtp_hmac_wolfssl_start,       /* */
     srtp_hmac_wolfssl_description, /* */
     &srtp_hmac_test_case_0,        /* */
-    SRTP_HMAC_SHA1                 /* */
+    SRTP_HMAC_SHA1,                /* */
+    0,                             /* call_state_len */
+    NULL                           /* start_call */
 };
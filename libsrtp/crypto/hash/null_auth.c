@@ -147,6 +147,15 @@ static srtp_err_status_t srtp_null_auth_start(void *statev)
     return srtp_err_status_ok;
 }
 
+/*
+ * the null auth function keeps no state, so a call needs none of its own
+ */
+static void srtp_null_auth_start_call(const void *statev, void *call_state)
+{
+    (void)statev;
+    (void)call_state;
+}
+
 /*
  * srtp_auth_type_t - defines description, test case, and null_auth
  * metaobject
@@ -177,5 +186,7 @@ const srtp_auth_type_t srtp_null_auth = {
     srtp_null_auth_start,        /* */
     srtp_null_auth_description,  /* */
     &srtp_null_auth_test_case_0, /* */
-    SRTP_NULL_AUTH               /* */
+    SRTP_NULL_AUTH,              /* */
+    0,                           /* call_state_len */
+    srtp_null_auth_start_call    /* */
 };
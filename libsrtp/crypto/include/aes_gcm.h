@@ -134,4 +134,49 @@ typedef struct {
 
 #endif /* NSS */
 
+#if !defined(OPENSSL) && !defined(WOLFSSL) && !defined(MBEDTLS) &&            \
+    !defined(NSS)
+
+#include "aes.h"
+
+/*
+ * the built-in AES-GCM keeps GHASH state as two host order 64-bit halves
+ * of the field element, most significant half first
+ */
+
+/*
+ * srtp_aes_gcm_key_t is the part of the context that is set by init and
+ * only read afterwards, so it can be shared by concurrent calls.  hh and
+ * hl hold the high and low halves of the multiples of the hash subkey by
+ * each 4-bit field element, for the table driven GHASH.
+ */
+typedef struct {
+    size_t key_size;
+    size_t tag_len;
+    srtp_aes_expanded_key_t expanded_key;
+    uint64_t hh[16];                /* high halves of i * H             */
+    uint64_t hl[16];                /* low halves of i * H              */
+} srtp_aes_gcm_key_t;
+
+/*
+ * srtp_aes_gcm_ctx_t is the per-packet state; it is also the call state
+ * of the cipher type
+ */
+typedef struct {
+    uint64_t x[2];                  /* running GHASH value              */
+    v128_t j0;                      /* pre-counter block                */
+    v128_t counter;                 /* last counter block used          */
+    v128_t keystream_buffer;        /* buffers bytes of keystream       */
+    size_t bytes_in_buffer;         /* number of unused bytes in buffer */
+    uint8_t partial[16];            /* GHASH input not yet a full block */
+    size_t partial_len;
+    size_t aad_len;
+    size_t text_len;
+    bool aad_done;                  /* AAD has been padded and hashed   */
+    srtp_cipher_direction_t dir;
+    srtp_aes_gcm_key_t *key;        /* the key this state belongs to    */
+} srtp_aes_gcm_ctx_t;
+
+#endif /* !OPENSSL && !WOLFSSL && !MBEDTLS && !NSS */
+
 #endif /* AES_GCM_H */
@@ -50,13 +50,25 @@
 #include "aes.h"
 #include "cipher.h"
 
+/*
+ * srtp_aes_icm_key_t is the part of the context that is set by init and
+ * only read afterwards, so it can be shared by concurrent calls
+ */
 typedef struct {
-    v128_t counter;                       /* holds the counter value          */
     v128_t offset;                        /* initial offset value             */
-    v128_t keystream_buffer;              /* buffers bytes of keystream       */
     srtp_aes_expanded_key_t expanded_key; /* the cipher key                   */
-    size_t bytes_in_buffer;               /* number of unused bytes in buffer */
     size_t key_size;                      /* AES key size + 14 byte SALT */
+} srtp_aes_icm_key_t;
+
+/*
+ * srtp_aes_icm_ctx_t is the per-packet state; it is also the call state
+ * of the cipher type
+ */
+typedef struct {
+    v128_t counter;                       /* holds the counter value          */
+    v128_t keystream_buffer;              /* buffers bytes of keystream       */
+    size_t bytes_in_buffer;               /* number of unused bytes in buffer */
+    srtp_aes_icm_key_t *key;              /* the key this state belongs to   */
 } srtp_aes_icm_ctx_t;
 
 #endif /* AES_ICM_H */
@@ -78,6 +78,13 @@ typedef srtp_err_status_t (*srtp_auth_update_func)(void *state,
 
 typedef srtp_err_status_t (*srtp_auth_start_func)(void *state);
 
+/*
+ * a srtp_auth_start_call_func prepares call_state, of the type's
+ * call_state_len octets, to authenticate one packet with the key in the
+ * state of an initialized auth function, which is only read
+ */
+typedef void (*srtp_auth_start_call_func)(const void *state, void *call_state);
+
 /* some syntactic sugar on these function types */
 #define srtp_auth_type_alloc(at, a, klen, outlen)                              \
     ((at)->alloc((a), (klen), (outlen)))
@@ -131,6 +138,8 @@ typedef struct srtp_auth_type_t {
     const char *description;
     const srtp_auth_test_case_t *test_data;
     srtp_auth_type_id_t id;
+    size_t call_state_len;                /* 0 if no start_call */
+    srtp_auth_start_call_func start_call; /* may be NULL        */
 } srtp_auth_type_t;
 
 typedef struct srtp_auth_t {
@@ -141,6 +150,35 @@ typedef struct srtp_auth_t {
     size_t prefix_len; /* length of keystream prefix     */
 } srtp_auth_t;
 
+/*
+ * SRTP_MAX_AUTH_CALL_STATE_LEN is the largest call state that fits in an
+ * srtp_auth_call_t
+ */
+#define SRTP_MAX_AUTH_CALL_STATE_LEN 128
+
+/*
+ * srtp_auth_call_t holds an auth function and its state for one packet;
+ * it is meant to live on the caller's stack
+ */
+typedef struct {
+    srtp_auth_t auth;
+    uint64_t state[SRTP_MAX_AUTH_CALL_STATE_LEN / sizeof(uint64_t)];
+} srtp_auth_call_t;
+
+/*
+ * srtp_auth_start_call(a, call) returns the auth function to use for one
+ * packet: a copy of a in call with its own state, if the type of a
+ * supports that, or a itself otherwise
+ */
+srtp_auth_t *srtp_auth_start_call(srtp_auth_t *a, srtp_auth_call_t *call);
+
+/*
+ * srtp_auth_has_call_state(a) is true if srtp_auth_start_call() gives a
+ * its own state for each packet, so that a may be used for several
+ * packets at once
+ */
+bool srtp_auth_has_call_state(const srtp_auth_t *a);
+
 /*
  * srtp_auth_type_self_test() tests an auth_type against test cases
  * provided in an array of values of key/message/tag that is known to
@@ -126,6 +126,15 @@ typedef srtp_err_status_t (*srtp_cipher_get_tag_func_t)(void *state,
                                                         uint8_t *tag,
                                                         size_t *len);
 
+/*
+ * a srtp_cipher_start_call_func_t prepares call_state, of the type's
+ * call_state_len octets, to process one packet with the key in the state
+ * of an initialized cipher.  The cipher's state is only read, so that
+ * calls with their own call state can share one cipher.
+ */
+typedef void (*srtp_cipher_start_call_func_t)(const void *state,
+                                              void *call_state);
+
 /*
  * srtp_cipher_test_case_t is a (list of) key, salt, plaintext, ciphertext,
  * and aad values that are known to be correct for a
@@ -161,6 +170,8 @@ typedef struct srtp_cipher_type_t {
     const char *description;
     const srtp_cipher_test_case_t *test_data;
     srtp_cipher_type_id_t id;
+    size_t call_state_len;                    /* 0 if no start_call */
+    srtp_cipher_start_call_func_t start_call; /* may be NULL        */
 } srtp_cipher_type_t;
 
 /*
@@ -174,6 +185,36 @@ typedef struct srtp_cipher_t {
     srtp_cipher_type_id_t algorithm;
 } srtp_cipher_t;
 
+/*
+ * SRTP_MAX_CIPHER_CALL_STATE_LEN is the largest call state that fits in an
+ * srtp_cipher_call_t
+ */
+#define SRTP_MAX_CIPHER_CALL_STATE_LEN 128
+
+/*
+ * srtp_cipher_call_t holds a cipher and its state for processing one
+ * packet; it is meant to live on the caller's stack
+ */
+typedef struct {
+    srtp_cipher_t cipher;
+    uint64_t state[SRTP_MAX_CIPHER_CALL_STATE_LEN / sizeof(uint64_t)];
+} srtp_cipher_call_t;
+
+/*
+ * srtp_cipher_start_call(c, call) returns the cipher to use for one
+ * packet: a copy of c in call that has its own per-packet state, if the
+ * type of c supports that, or c itself otherwise.  c may be NULL.
+ */
+srtp_cipher_t *srtp_cipher_start_call(srtp_cipher_t *c,
+                                      srtp_cipher_call_t *call);
+
+/*
+ * srtp_cipher_has_call_state(c) is true if srtp_cipher_start_call() gives
+ * c its own state for each packet, so that c may be used for several
+ * packets at once
+ */
+bool srtp_cipher_has_call_state(const srtp_cipher_t *c);
+
 /* some bookkeeping functions */
 size_t srtp_cipher_get_key_length(const srtp_cipher_t *c);
 
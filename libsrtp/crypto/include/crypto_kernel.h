@@ -67,11 +67,30 @@ typedef enum {
 } srtp_crypto_kernel_state_t;
 
 /*
- * linked list of cipher types
+ * packet size classes used to choose among several implementations of
+ * one cipher; packets of up to SRTP_CRYPTO_SMALL_PACKET_LEN octets are
+ * small
+ */
+#define SRTP_CRYPTO_SMALL_PACKET_LEN 256
+#define SRTP_CRYPTO_LARGE_PACKET_LEN 1200
+
+typedef enum {
+    srtp_crypto_size_class_small = 0,
+    srtp_crypto_size_class_large = 1
+} srtp_crypto_size_class_t;
+
+#define SRTP_CRYPTO_NUM_SIZE_CLASSES 2
+
+/*
+ * linked list of cipher types; an id may have several entries, each a
+ * different implementation (backend) of the same cipher
  */
 typedef struct srtp_kernel_cipher_type {
     srtp_cipher_type_id_t id;
     const srtp_cipher_type_t *cipher_type;
+    bool tested;  /* self-test has passed                       */
+    int priority; /* higher is preferred among entries of an id */
+    uint64_t rate[SRTP_CRYPTO_NUM_SIZE_CLASSES]; /* bits/s, 0 if unknown */
     struct srtp_kernel_cipher_type *next;
 } srtp_kernel_cipher_type_t;
 
@@ -81,6 +100,7 @@ typedef struct srtp_kernel_cipher_type {
 typedef struct srtp_kernel_auth_type {
     srtp_auth_type_id_t id;
     const srtp_auth_type_t *auth_type;
+    bool tested; /* self-test has passed */
     struct srtp_kernel_auth_type *next;
 } srtp_kernel_auth_type_t;
 
@@ -146,6 +166,21 @@ srtp_err_status_t srtp_crypto_kernel_shutdown(void);
  */
 srtp_err_status_t srtp_crypto_kernel_status(void);
 
+/*
+ * srtp_crypto_kernel_set_lazy_self_test(lazy) selects whether the
+ * self-test of a cipher or auth type is run when the type is loaded
+ * (false), or when it is first allocated (true).  It applies to types
+ * loaded afterwards; the default is true if ENABLE_LAZY_SELF_TEST is
+ * defined.  A deferred self-test runs once even if several threads
+ * allocate the type at the same time.
+ *
+ * Self-test results are kept for the life of the process, so a type is
+ * tested once even if the kernel is shut down and initialized again.
+ * If DISABLE_SELF_TEST is defined no self-tests are run at all, except
+ * by srtp_crypto_kernel_status().
+ */
+void srtp_crypto_kernel_set_lazy_self_test(bool lazy);
+
 /*
  * srtp_crypto_kernel_list_debug_modules() outputs a list of debugging modules
  *
@@ -160,6 +195,40 @@ srtp_err_status_t srtp_crypto_kernel_load_cipher_type(
     const srtp_cipher_type_t *ct,
     srtp_cipher_type_id_t id);
 
+/*
+ * srtp_crypto_kernel_add_cipher_type(ct, id, priority)
+ *
+ * registers ct as an additional implementation of the cipher id, for
+ * example one backed by a different crypto library.  ct must produce
+ * the same output as the implementation already loaded for id, which
+ * is checked against that implementation's test data.
+ *
+ * Allocations of id use the implementation with the highest priority;
+ * the built-in implementations have priority 0, and among equal
+ * priorities the one added last is used.  Returns:
+ *
+ *    srtp_err_status_ok           ct was added
+ *    srtp_err_status_bad_param    no cipher id is loaded, or ct already is
+ *    <other>                      ct failed its self-test or cross-check
+ */
+srtp_err_status_t srtp_crypto_kernel_add_cipher_type(
+    const srtp_cipher_type_t *ct,
+    srtp_cipher_type_id_t id,
+    int priority);
+
+/*
+ * srtp_crypto_kernel_benchmark_cipher_types()
+ *
+ * measures the throughput of every cipher that has more than one
+ * implementation, for a small and a large packet.  Afterwards
+ * srtp_crypto_kernel_alloc_cipher_for_len() picks the fastest
+ * implementation for the size class of the packet length it is given;
+ * streams are allocated with the expected_payload_len of their policy.
+ * This takes a few milliseconds per implementation, so it is meant to
+ * be called once at startup.
+ */
+srtp_err_status_t srtp_crypto_kernel_benchmark_cipher_types(void);
+
 srtp_err_status_t srtp_crypto_kernel_load_auth_type(const srtp_auth_type_t *ct,
                                                     srtp_auth_type_id_t id);
 
@@ -181,6 +250,21 @@ srtp_err_status_t srtp_crypto_kernel_alloc_cipher(srtp_cipher_type_id_t id,
                                                   size_t key_len,
                                                   size_t tag_len);
 
+/*
+ * srtp_crypto_kernel_alloc_cipher_for_len(id, cp, key_len, tag_len, len);
+ *
+ * is like srtp_crypto_kernel_alloc_cipher(), but if there are several
+ * implementations of id and all have been benchmarked, it allocates the
+ * one that is fastest for packets of len octets.  A len of 0 selects by
+ * priority alone.
+ */
+srtp_err_status_t srtp_crypto_kernel_alloc_cipher_for_len(
+    srtp_cipher_type_id_t id,
+    srtp_cipher_pointer_t *cp,
+    size_t key_len,
+    size_t tag_len,
+    size_t len);
+
 /*
  * srtp_crypto_kernel_alloc_auth(id, ap, key_len, tag_len);
  *
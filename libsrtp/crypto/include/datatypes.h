@@ -259,6 +259,15 @@ void bitvector_set_to_zero(bitvector_t *x);
 
 void bitvector_left_shift(bitvector_t *x, size_t index);
 
+/*
+ * srtp_datatypes_use_simd(enable) switches v128_left_shift() and
+ * bitvector_left_shift() between their SIMD and generic versions, where
+ * both are built and the CPU supports the SIMD one; it returns whether
+ * the SIMD versions are in use afterwards.  The choice is made when the
+ * library is loaded, this is for tests that compare the two.
+ */
+bool srtp_datatypes_use_simd(bool enable);
+
 #ifdef __cplusplus
 }
 #endif
@@ -110,6 +110,13 @@ srtp_err_status_t srtp_install_err_report_handler(
 void srtp_err_report(srtp_err_reporting_level_t level, const char *format, ...)
     LIBSRTP_FORMAT_PRINTF(2, 3);
 
+/*
+ * srtp_err_set_level sets the most verbose level that is reported; more
+ * verbose reports are dropped before they are formatted
+ */
+
+void srtp_err_set_level(srtp_err_reporting_level_t level);
+
 /*
  * debug_module_t defines a debug module
  */
@@ -119,31 +126,35 @@ typedef struct {
     const char *name; /* printable name for debug module      */
 } srtp_debug_module_t;
 
-#ifdef ENABLE_DEBUG_LOGGING
+/*
+ * srtp_err_report_enabled returns true if a report at the given level,
+ * from the debug module mod (or NULL for none), would be output.  Callers
+ * use it to skip building the arguments of a report.
+ *
+ * A module that is switched off reports nothing, at any level; reports
+ * that do not belong to a module pass NULL.  In builds with
+ * ENABLE_DEBUG_LOGGING the crypto kernel switches each module on as it
+ * is loaded, so every module reports until it is switched off.
+ */
 
-#define debug_print0(mod, format)                                              \
-    srtp_err_report(srtp_err_level_debug, ("%s: " format "\n"), mod.name)
-#define debug_print(mod, format, arg)                                          \
-    srtp_err_report(srtp_err_level_debug, ("%s: " format "\n"), mod.name, arg)
-#define debug_print2(mod, format, arg1, arg2)                                  \
-    srtp_err_report(srtp_err_level_debug, ("%s: " format "\n"), mod.name,      \
-                    arg1, arg2)
+bool srtp_err_report_enabled(srtp_err_reporting_level_t level,
+                             const srtp_debug_module_t *mod);
 
-#else
+/* a module that is off costs a single test of its flag */
+#define srtp_debug_enabled(mod)                                                \
+    ((mod).on && srtp_err_report_enabled(srtp_err_level_debug, &(mod)))
 
 #define debug_print0(mod, format)                                              \
-    if (mod.on)                                                                \
+    if (srtp_debug_enabled(mod))                                               \
     srtp_err_report(srtp_err_level_debug, ("%s: " format "\n"), mod.name)
 #define debug_print(mod, format, arg)                                          \
-    if (mod.on)                                                                \
+    if (srtp_debug_enabled(mod))                                               \
     srtp_err_report(srtp_err_level_debug, ("%s: " format "\n"), mod.name, arg)
 #define debug_print2(mod, format, arg1, arg2)                                  \
-    if (mod.on)                                                                \
+    if (srtp_debug_enabled(mod))                                               \
     srtp_err_report(srtp_err_level_debug, ("%s: " format "\n"), mod.name,      \
                     arg1, arg2)
 
-#endif
-
 #ifdef __cplusplus
 }
 #endif
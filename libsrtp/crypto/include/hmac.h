@@ -49,10 +49,18 @@
 #include "auth.h"
 #include "sha1.h"
 
+/*
+ * srtp_hmac_key_t is set by init and only read afterwards; srtp_hmac_ctx_t
+ * is the per-message state, and the call state of the auth type
+ */
 typedef struct {
     uint8_t opad[64];
-    srtp_sha1_ctx_t ctx;
     srtp_sha1_ctx_t init_ctx;
+} srtp_hmac_key_t;
+
+typedef struct {
+    srtp_sha1_ctx_t ctx;
+    srtp_hmac_key_t *key;
 } srtp_hmac_ctx_t;
 
 #endif /* HMAC_H */
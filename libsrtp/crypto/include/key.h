@@ -63,20 +63,45 @@ typedef enum {
 srtp_err_status_t srtp_key_limit_set(srtp_key_limit_t key,
                                      const srtp_xtd_seq_num_t s);
 
+/*
+ * srtp_key_limit_clone(original, new_key) allocates a usage shard that
+ * draws on the budget of original (or on the budget original itself
+ * draws on, if it is a shard).  A shard leases uses from the shared
+ * budget in batches of up to SRTP_KEY_LIMIT_BATCH, so streams cloned
+ * from one template do not all write the same counter on every packet.
+ * Uses are leased before they are made, so the hard limit is never
+ * exceeded; instead the soft limit can be signalled, and a stream can
+ * expire, up to SRTP_KEY_LIMIT_BATCH - 1 uses per shard early.  Batches
+ * are only leased while the budget stays above its soft limit.  The
+ * shard must be released with srtp_key_limit_flush() and freed before
+ * the original is.
+ */
 srtp_err_status_t srtp_key_limit_clone(srtp_key_limit_t original,
                                        srtp_key_limit_t *new_key);
 
 srtp_key_event_t srtp_key_limit_update(srtp_key_limit_t key);
 
+/*
+ * srtp_key_limit_flush(key) gives the uses a shard has leased but not
+ * made back to the shared budget; it does nothing for a key that is not
+ * a shard
+ */
+void srtp_key_limit_flush(srtp_key_limit_t key);
+
 typedef enum {
     srtp_key_state_normal,
     srtp_key_state_past_soft_limit,
     srtp_key_state_expired
 } srtp_key_state_t;
 
+#define SRTP_KEY_LIMIT_BATCH 256
+
 typedef struct srtp_key_limit_ctx_t {
     srtp_xtd_seq_num_t num_left;
     srtp_key_state_t state;
+    struct srtp_key_limit_ctx_t *parent; /* shared budget, NULL if none */
+    uint32_t leased;                     /* uses taken from parent but */
+                                         /* not yet made               */
 } srtp_key_limit_ctx_t;
 
 #ifdef __cplusplus
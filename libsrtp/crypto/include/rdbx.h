@@ -80,12 +80,28 @@ typedef uint64_t srtp_xtd_seq_num_t;
 /*
  * An srtp_rdbx_t is a replay database with extended range; it uses an
  * xtd_seq_num_t and a bitmask of recently received indices.
+ *
+ * The window is fixed unless window_max is larger than window_min, in
+ * which case srtp_rdbx_add_index() resizes it between those bounds:
+ * adapt_depth is the deepest reordering seen among the last adapt_count
+ * accepted indices.
  */
 typedef struct {
     srtp_xtd_seq_num_t index;
     bitvector_t bitmask;
+    size_t window_min;
+    size_t window_max;
+    uint32_t adapt_count;
+    uint32_t adapt_depth;
 } srtp_rdbx_t;
 
+/*
+ * SRTP_RDBX_ADAPT_PERIOD is the number of accepted indices after which an
+ * adaptive window that saw no reordering deeper than a quarter of its
+ * size is halved
+ */
+#define SRTP_RDBX_ADAPT_PERIOD 1024
+
 /*
  * srtp_rdbx_init(rdbx_ptr, ws)
  *
@@ -94,6 +110,19 @@ typedef struct {
  */
 srtp_err_status_t srtp_rdbx_init(srtp_rdbx_t *rdbx, size_t ws);
 
+/*
+ * srtp_rdbx_set_window_bounds(rdbx_ptr, min_ws, max_ws)
+ *
+ * makes the window of an initialized rdbx adaptive: it doubles when an
+ * accepted index is reordered by more than three quarters of the window,
+ * and halves after SRTP_RDBX_ADAPT_PERIOD quiet indices, never leaving
+ * [min_ws, max_ws].  The current window size must lie within the bounds;
+ * min_ws == max_ws makes the window fixed again.
+ */
+srtp_err_status_t srtp_rdbx_set_window_bounds(srtp_rdbx_t *rdbx,
+                                              size_t min_ws,
+                                              size_t max_ws);
+
 /*
  * srtp_rdbx_dealloc(rdbx_ptr)
  *
@@ -126,7 +155,8 @@ srtp_err_status_t srtp_rdbx_check(const srtp_rdbx_t *rdbx, ssize_t difference);
  * srtp_replay_add_index(rdbx, delta)
  *
  * adds the srtp_xtd_seq_num_t at rdbx->window_start + delta to replay_db
- * (and does *not* check if that xtd_seq_num_t appears in db)
+ * (and does *not* check if that xtd_seq_num_t appears in db); an adaptive
+ * window is resized here, so only authenticated indices can change it
  *
  * this function should be called *only* after replay_check has
  * indicated that the index does not appear in the rdbx, and a mutex
@@ -164,6 +194,16 @@ srtp_xtd_seq_num_t srtp_rdbx_get_packet_index(const srtp_rdbx_t *rdbx);
  */
 size_t srtp_rdbx_get_window_size(const srtp_rdbx_t *rdbx);
 
+/*
+ * srtp_rdbx_get_window_bounds(rdbx_ptr, min_ws, max_ws)
+ *
+ * gets the bounds of the window; both equal the window size when it is
+ * fixed
+ */
+void srtp_rdbx_get_window_bounds(const srtp_rdbx_t *rdbx,
+                                 size_t *min_ws,
+                                 size_t *max_ws);
+
 /* index_init(&pi) initializes a packet index pi (sets it to zero) */
 void srtp_index_init(srtp_xtd_seq_num_t *pi);
 
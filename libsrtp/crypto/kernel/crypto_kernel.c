@@ -70,6 +70,268 @@ static srtp_crypto_kernel_t crypto_kernel = {
 
 #define MAX_RNG_TRIALS 25
 
+#ifdef ENABLE_LAZY_SELF_TEST
+static bool srtp_lazy_self_test = true;
+#else
+static bool srtp_lazy_self_test = false;
+#endif
+
+/*
+ * results of the self-tests run by this process, indexed by type; these
+ * outlive srtp_crypto_kernel_shutdown() so that a type is tested once
+ */
+#define MAX_SELF_TEST_RESULTS 32
+
+typedef struct {
+    const void *type;
+    srtp_err_status_t status;
+} srtp_self_test_result_t;
+
+static srtp_self_test_result_t self_test_results[MAX_SELF_TEST_RESULTS];
+static size_t num_self_test_results = 0;
+
+static bool srtp_self_test_lookup(const void *type, srtp_err_status_t *status)
+{
+    for (size_t i = 0; i < num_self_test_results; i++) {
+        if (self_test_results[i].type == type) {
+            *status = self_test_results[i].status;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void srtp_self_test_record(const void *type, srtp_err_status_t status)
+{
+    for (size_t i = 0; i < num_self_test_results; i++) {
+        if (self_test_results[i].type == type) {
+            self_test_results[i].status = status;
+            return;
+        }
+    }
+
+    /* if the table is full the type is simply tested again next time */
+    if (num_self_test_results < MAX_SELF_TEST_RESULTS) {
+        self_test_results[num_self_test_results].type = type;
+        self_test_results[num_self_test_results].status = status;
+        num_self_test_results++;
+    }
+}
+
+static srtp_err_status_t srtp_crypto_kernel_cipher_self_test(
+    const srtp_cipher_type_t *ct)
+{
+    srtp_err_status_t status;
+
+    if (srtp_self_test_lookup(ct, &status)) {
+        return status;
+    }
+
+#ifdef DISABLE_SELF_TEST
+    /* only srtp_crypto_kernel_status() runs self-tests */
+    return srtp_err_status_ok;
+#else
+    debug_print(srtp_mod_crypto_kernel, "running self-test for cipher %s",
+                ct->description);
+    status = srtp_cipher_type_self_test(ct);
+    srtp_self_test_record(ct, status);
+
+    return status;
+#endif
+}
+
+static srtp_err_status_t srtp_crypto_kernel_auth_self_test(
+    const srtp_auth_type_t *at)
+{
+    srtp_err_status_t status;
+
+    if (srtp_self_test_lookup(at, &status)) {
+        return status;
+    }
+
+#ifdef DISABLE_SELF_TEST
+    /* only srtp_crypto_kernel_status() runs self-tests */
+    return srtp_err_status_ok;
+#else
+    debug_print(srtp_mod_crypto_kernel, "running self-test for auth %s",
+                at->description);
+    status = srtp_auth_type_self_test(at);
+    srtp_self_test_record(at, status);
+
+    return status;
+#endif
+}
+
+/*
+ * srtp_crypto_kernel_alloc_cipher() and srtp_crypto_kernel_alloc_auth()
+ * may be called from several threads at once, e.g. by concurrent
+ * srtp_create() calls, so a deferred self-test runs under a lock, and
+ * the tested flag of a type is published with a release store once the
+ * test has passed.  Without atomic operations the lock does nothing, and
+ * streams must not be allocated concurrently while a type is untested.
+ */
+#if defined(__GNUC__)
+
+static int self_test_busy = 0;
+
+static void srtp_self_test_lock(void)
+{
+    while (__atomic_exchange_n(&self_test_busy, 1, __ATOMIC_ACQUIRE)) {
+    }
+}
+
+static void srtp_self_test_unlock(void)
+{
+    __atomic_store_n(&self_test_busy, 0, __ATOMIC_RELEASE);
+}
+
+static bool srtp_type_is_tested(const bool *tested)
+{
+    return __atomic_load_n(tested, __ATOMIC_ACQUIRE);
+}
+
+static void srtp_type_set_tested(bool *tested)
+{
+    __atomic_store_n(tested, true, __ATOMIC_RELEASE);
+}
+
+#elif defined(_MSC_VER)
+
+#include <intrin.h>
+
+static volatile long self_test_busy = 0;
+
+static void srtp_self_test_lock(void)
+{
+    while (_InterlockedExchange(&self_test_busy, 1)) {
+    }
+}
+
+static void srtp_self_test_unlock(void)
+{
+    _InterlockedExchange(&self_test_busy, 0);
+}
+
+static bool srtp_type_is_tested(const bool *tested)
+{
+    return _InterlockedCompareExchange8((volatile char *)tested, 0, 0) != 0;
+}
+
+static void srtp_type_set_tested(bool *tested)
+{
+    _InterlockedExchange8((volatile char *)tested, 1);
+}
+
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L &&            \
+    !defined(__STDC_NO_ATOMICS__)
+
+#include <stdatomic.h>
+
+static atomic_flag self_test_busy = ATOMIC_FLAG_INIT;
+
+static void srtp_self_test_lock(void)
+{
+    while (atomic_flag_test_and_set_explicit(&self_test_busy,
+                                             memory_order_acquire)) {
+    }
+}
+
+static void srtp_self_test_unlock(void)
+{
+    atomic_flag_clear_explicit(&self_test_busy, memory_order_release);
+}
+
+/* the flag is a plain bool, so it is read and written under the lock */
+static bool srtp_type_is_tested(const bool *tested)
+{
+    bool v;
+
+    srtp_self_test_lock();
+    v = *tested;
+    srtp_self_test_unlock();
+
+    return v;
+}
+
+static void srtp_type_set_tested(bool *tested)
+{
+    *tested = true;
+}
+
+#else
+
+static void srtp_self_test_lock(void)
+{
+}
+
+static void srtp_self_test_unlock(void)
+{
+}
+
+static bool srtp_type_is_tested(const bool *tested)
+{
+    return *tested;
+}
+
+static void srtp_type_set_tested(bool *tested)
+{
+    *tested = true;
+}
+
+#endif
+
+/*
+ * srtp_crypto_kernel_deferred_cipher_test(ctype) runs the self-test of a
+ * cipher type that has not passed it yet; only one thread runs it
+ */
+static srtp_err_status_t srtp_crypto_kernel_deferred_cipher_test(
+    srtp_kernel_cipher_type_t *ctype)
+{
+    srtp_err_status_t status = srtp_err_status_ok;
+
+    if (srtp_type_is_tested(&ctype->tested)) {
+        return srtp_err_status_ok;
+    }
+
+    srtp_self_test_lock();
+    if (!ctype->tested) {
+        status = srtp_crypto_kernel_cipher_self_test(ctype->cipher_type);
+        if (status == srtp_err_status_ok) {
+            srtp_type_set_tested(&ctype->tested);
+        }
+    }
+    srtp_self_test_unlock();
+
+    return status;
+}
+
+/* as srtp_crypto_kernel_deferred_cipher_test(), for an auth type */
+static srtp_err_status_t srtp_crypto_kernel_deferred_auth_test(
+    srtp_kernel_auth_type_t *atype)
+{
+    srtp_err_status_t status = srtp_err_status_ok;
+
+    if (srtp_type_is_tested(&atype->tested)) {
+        return srtp_err_status_ok;
+    }
+
+    srtp_self_test_lock();
+    if (!atype->tested) {
+        status = srtp_crypto_kernel_auth_self_test(atype->auth_type);
+        if (status == srtp_err_status_ok) {
+            srtp_type_set_tested(&atype->tested);
+        }
+    }
+    srtp_self_test_unlock();
+
+    return status;
+}
+
+void srtp_crypto_kernel_set_lazy_self_test(bool lazy)
+{
+    srtp_lazy_self_test = lazy;
+}
+
 srtp_err_status_t srtp_crypto_kernel_init(void)
 {
     srtp_err_status_t status;
@@ -78,9 +340,30 @@ srtp_err_status_t srtp_crypto_kernel_init(void)
     if (crypto_kernel.state == srtp_crypto_kernel_state_secure) {
         /*
          * we're already in the secure state, but we've been asked to
-         * re-initialize, so we just re-run the self-tests and then return
+         * re-initialize, so we just re-check the self-tests and then
+         * return; types that have been tested are not tested again
          */
-        return srtp_crypto_kernel_status();
+        srtp_kernel_cipher_type_t *ctype = crypto_kernel.cipher_type_list;
+        srtp_kernel_auth_type_t *atype = crypto_kernel.auth_type_list;
+
+        for (; ctype != NULL; ctype = ctype->next) {
+            if (!srtp_lazy_self_test || ctype->tested) {
+                status =
+                    srtp_crypto_kernel_cipher_self_test(ctype->cipher_type);
+                if (status) {
+                    return status;
+                }
+            }
+        }
+        for (; atype != NULL; atype = atype->next) {
+            if (!srtp_lazy_self_test || atype->tested) {
+                status = srtp_crypto_kernel_auth_self_test(atype->auth_type);
+                if (status) {
+                    return status;
+                }
+            }
+        }
+        return srtp_err_status_ok;
     }
 
     /* initialize error reporting system */
@@ -127,12 +410,14 @@ srtp_err_status_t srtp_crypto_kernel_init(void)
     if (status) {
         return status;
     }
-#ifdef GCM
+#if defined(OPENSSL) || defined(WOLFSSL) || defined(MBEDTLS) || defined(NSS)
     status = srtp_crypto_kernel_load_cipher_type(&srtp_aes_icm_192,
                                                  SRTP_AES_ICM_192);
     if (status) {
         return status;
     }
+#endif
+#ifdef GCM
     status = srtp_crypto_kernel_load_cipher_type(&srtp_aes_gcm_128,
                                                  SRTP_AES_GCM_128);
     if (status) {
@@ -181,12 +466,14 @@ srtp_err_status_t srtp_crypto_kernel_status(void)
                         ctype->cipher_type->description);
         srtp_err_report(srtp_err_level_info, "  self-test: ");
         status = srtp_cipher_type_self_test(ctype->cipher_type);
+        srtp_self_test_record(ctype->cipher_type, status);
         if (status) {
             srtp_err_report(srtp_err_level_error, "failed with error code %d\n",
                             status);
             exit(status);
         }
         srtp_err_report(srtp_err_level_info, "passed\n");
+        ctype->tested = true;
         ctype = ctype->next;
     }
 
@@ -196,12 +483,14 @@ srtp_err_status_t srtp_crypto_kernel_status(void)
                         atype->auth_type->description);
         srtp_err_report(srtp_err_level_info, "  self-test: ");
         status = srtp_auth_type_self_test(atype->auth_type);
+        srtp_self_test_record(atype->auth_type, status);
         if (status) {
             srtp_err_report(srtp_err_level_error, "failed with error code %d\n",
                             status);
             exit(status);
         }
         srtp_err_report(srtp_err_level_info, "passed\n");
+        atype->tested = true;
         atype = atype->next;
     }
 
@@ -269,6 +558,31 @@ srtp_err_status_t srtp_crypto_kernel_shutdown(void)
     return srtp_err_status_ok;
 }
 
+/*
+ * srtp_crypto_kernel_find_cipher_type(id) returns the preferred entry for
+ * the cipher id: the one with the highest priority, and of those the one
+ * nearest the head of the list, which is the one added last
+ */
+static srtp_kernel_cipher_type_t *srtp_crypto_kernel_find_cipher_type(
+    srtp_cipher_type_id_t id)
+{
+    srtp_kernel_cipher_type_t *ctype;
+    srtp_kernel_cipher_type_t *best = NULL;
+
+    /* walk down list, looking for id  */
+    ctype = crypto_kernel.cipher_type_list;
+    while (ctype != NULL) {
+        if (id == ctype->id &&
+            (best == NULL || ctype->priority > best->priority)) {
+            best = ctype;
+        }
+        ctype = ctype->next;
+    }
+
+    /* if we haven't found the right one, best is NULL */
+    return best;
+}
+
 static inline srtp_err_status_t srtp_crypto_kernel_do_load_cipher_type(
     const srtp_cipher_type_t *new_ct,
     srtp_cipher_type_id_t id,
@@ -287,30 +601,43 @@ static inline srtp_err_status_t srtp_crypto_kernel_do_load_cipher_type(
         return srtp_err_status_bad_param;
     }
 
-    /* check cipher type by running self-test */
-    status = srtp_cipher_type_self_test(new_ct);
-    if (status) {
-        return status;
+    /*
+     * check cipher type by running self-test, unless that is deferred to
+     * the first allocation
+     */
+    if (!srtp_lazy_self_test) {
+        status = srtp_crypto_kernel_cipher_self_test(new_ct);
+        if (status) {
+            return status;
+        }
     }
 
-    /* walk down list, checking if this type is in the list already  */
-    ctype = crypto_kernel.cipher_type_list;
-    while (ctype != NULL) {
-        if (id == ctype->id) {
-            if (!replace) {
-                return srtp_err_status_bad_param;
-            }
-            status =
-                srtp_cipher_type_test(new_ct, ctype->cipher_type->test_data);
-            if (status) {
-                return status;
-            }
-            new_ctype = ctype;
-            break;
-        } else if (new_ct == ctype->cipher_type) {
+    /*
+     * check if this type is in the list already; if there are several
+     * implementations of id, the preferred one is replaced
+     */
+    ctype = srtp_crypto_kernel_find_cipher_type(id);
+
+    /*
+     * a cipher type may only be registered once, so it must not appear
+     * under another id or as another implementation of this one
+     */
+    for (srtp_kernel_cipher_type_t *t = crypto_kernel.cipher_type_list;
+         t != NULL; t = t->next) {
+        if (new_ct == t->cipher_type && t != ctype) {
             return srtp_err_status_bad_param;
         }
-        ctype = ctype->next;
+    }
+
+    if (ctype != NULL) {
+        if (!replace) {
+            return srtp_err_status_bad_param;
+        }
+        status = srtp_cipher_type_test(new_ct, ctype->cipher_type->test_data);
+        if (status) {
+            return status;
+        }
+        new_ctype = ctype;
     }
 
     /* if not found, put new_ct at the head of the list */
@@ -330,6 +657,10 @@ static inline srtp_err_status_t srtp_crypto_kernel_do_load_cipher_type(
     /* set fields */
     new_ctype->cipher_type = new_ct;
     new_ctype->id = id;
+    new_ctype->tested = !srtp_lazy_self_test;
+    for (int i = 0; i < SRTP_CRYPTO_NUM_SIZE_CLASSES; i++) {
+        new_ctype->rate[i] = 0;
+    }
 
     return srtp_err_status_ok;
 }
@@ -341,6 +672,141 @@ srtp_err_status_t srtp_crypto_kernel_load_cipher_type(
     return srtp_crypto_kernel_do_load_cipher_type(new_ct, id, false);
 }
 
+srtp_err_status_t srtp_crypto_kernel_add_cipher_type(
+    const srtp_cipher_type_t *new_ct,
+    srtp_cipher_type_id_t id,
+    int priority)
+{
+    srtp_kernel_cipher_type_t *ctype;
+    srtp_kernel_cipher_type_t *new_ctype;
+    srtp_err_status_t status;
+
+    /* defensive coding */
+    if (new_ct == NULL) {
+        return srtp_err_status_bad_param;
+    }
+
+    if (new_ct->id != id) {
+        return srtp_err_status_bad_param;
+    }
+
+    /* an implementation of id must already be loaded */
+    ctype = srtp_crypto_kernel_find_cipher_type(id);
+    if (ctype == NULL) {
+        return srtp_err_status_bad_param;
+    }
+
+    for (srtp_kernel_cipher_type_t *t = crypto_kernel.cipher_type_list;
+         t != NULL; t = t->next) {
+        if (new_ct == t->cipher_type) {
+            return srtp_err_status_bad_param;
+        }
+    }
+
+    if (!srtp_lazy_self_test) {
+        status = srtp_crypto_kernel_cipher_self_test(new_ct);
+        if (status) {
+            return status;
+        }
+    }
+
+    /* the new implementation must agree with the existing one */
+    status = srtp_cipher_type_test(new_ct, ctype->cipher_type->test_data);
+    if (status) {
+        return status;
+    }
+
+    new_ctype = (srtp_kernel_cipher_type_t *)srtp_crypto_alloc(
+        sizeof(srtp_kernel_cipher_type_t));
+    if (new_ctype == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+
+    new_ctype->id = id;
+    new_ctype->cipher_type = new_ct;
+    new_ctype->tested = !srtp_lazy_self_test;
+    new_ctype->priority = priority;
+    new_ctype->next = crypto_kernel.cipher_type_list;
+    crypto_kernel.cipher_type_list = new_ctype;
+
+    debug_print2(srtp_mod_crypto_kernel, "added cipher %s with priority %d",
+                 new_ct->description, priority);
+
+    return srtp_err_status_ok;
+}
+
+/*
+ * the benchmark encrypts about SRTP_CRYPTO_BENCHMARK_OCTETS octets per
+ * implementation and size class
+ */
+#define SRTP_CRYPTO_BENCHMARK_OCTETS (256 * 1024)
+
+static const size_t
+    srtp_crypto_size_class_len[SRTP_CRYPTO_NUM_SIZE_CLASSES] = {
+        SRTP_CRYPTO_SMALL_PACKET_LEN, SRTP_CRYPTO_LARGE_PACKET_LEN
+    };
+
+static uint64_t srtp_crypto_kernel_cipher_rate(const srtp_cipher_type_t *ct,
+                                               size_t len)
+{
+    const srtp_cipher_test_case_t *tc = ct->test_data;
+    srtp_cipher_t *c;
+    uint64_t rate = 0;
+
+    if (tc == NULL) {
+        return 0;
+    }
+    if (ct->alloc(&c, tc->key_length_octets, tc->tag_length_octets)) {
+        return 0;
+    }
+    if (srtp_cipher_init(c, tc->key) == srtp_err_status_ok) {
+        rate = srtp_cipher_bits_per_second(
+            c, len, SRTP_CRYPTO_BENCHMARK_OCTETS / len);
+    }
+    srtp_cipher_dealloc(c);
+
+    return rate;
+}
+
+srtp_err_status_t srtp_crypto_kernel_benchmark_cipher_types(void)
+{
+    srtp_kernel_cipher_type_t *ctype;
+    srtp_err_status_t status;
+
+    if (crypto_kernel.state != srtp_crypto_kernel_state_secure) {
+        return srtp_err_status_init_fail;
+    }
+
+    for (ctype = crypto_kernel.cipher_type_list; ctype != NULL;
+         ctype = ctype->next) {
+        srtp_kernel_cipher_type_t *t;
+
+        /* only ciphers with a choice of implementation are measured */
+        for (t = crypto_kernel.cipher_type_list; t != NULL; t = t->next) {
+            if (t != ctype && t->id == ctype->id) {
+                break;
+            }
+        }
+        if (t == NULL) {
+            continue;
+        }
+
+        status = srtp_crypto_kernel_deferred_cipher_test(ctype);
+        if (status) {
+            return status;
+        }
+
+        for (int i = 0; i < SRTP_CRYPTO_NUM_SIZE_CLASSES; i++) {
+            ctype->rate[i] = srtp_crypto_kernel_cipher_rate(
+                ctype->cipher_type, srtp_crypto_size_class_len[i]);
+            debug_print2(srtp_mod_crypto_kernel, "%s: %" PRIu64 " bits/s",
+                         ctype->cipher_type->description, ctype->rate[i]);
+        }
+    }
+
+    return srtp_err_status_ok;
+}
+
 srtp_err_status_t srtp_replace_cipher_type(const srtp_cipher_type_t *new_ct,
                                            srtp_cipher_type_id_t id)
 {
@@ -365,10 +831,15 @@ srtp_err_status_t srtp_crypto_kernel_do_load_auth_type(
         return srtp_err_status_bad_param;
     }
 
-    /* check auth type by running self-test */
-    status = srtp_auth_type_self_test(new_at);
-    if (status) {
-        return status;
+    /*
+     * check auth type by running self-test, unless that is deferred to
+     * the first allocation
+     */
+    if (!srtp_lazy_self_test) {
+        status = srtp_crypto_kernel_auth_self_test(new_at);
+        if (status) {
+            return status;
+        }
     }
 
     /* walk down list, checking if this type is in the list already  */
@@ -407,6 +878,7 @@ srtp_err_status_t srtp_crypto_kernel_do_load_auth_type(
     /* set fields */
     new_atype->auth_type = new_at;
     new_atype->id = id;
+    new_atype->tested = !srtp_lazy_self_test;
 
     return srtp_err_status_ok;
 }
@@ -426,20 +898,48 @@ srtp_err_status_t srtp_replace_auth_type(const srtp_auth_type_t *new_at,
 
 const srtp_cipher_type_t *srtp_crypto_kernel_get_cipher_type(
     srtp_cipher_type_id_t id)
+{
+    srtp_kernel_cipher_type_t *ctype = srtp_crypto_kernel_find_cipher_type(id);
+
+    return ctype != NULL ? ctype->cipher_type : NULL;
+}
+
+/*
+ * srtp_crypto_kernel_select_cipher_type(id, len) returns the fastest
+ * implementation of id for packets of len octets if every implementation
+ * has been measured, and the preferred one otherwise
+ */
+static srtp_kernel_cipher_type_t *srtp_crypto_kernel_select_cipher_type(
+    srtp_cipher_type_id_t id,
+    size_t len)
 {
     srtp_kernel_cipher_type_t *ctype;
+    srtp_kernel_cipher_type_t *fastest = NULL;
+    srtp_crypto_size_class_t size_class;
 
-    /* walk down list, looking for id  */
-    ctype = crypto_kernel.cipher_type_list;
-    while (ctype != NULL) {
-        if (id == ctype->id) {
-            return ctype->cipher_type;
+    if (len == 0) {
+        return srtp_crypto_kernel_find_cipher_type(id);
+    }
+
+    size_class = len <= SRTP_CRYPTO_SMALL_PACKET_LEN
+                     ? srtp_crypto_size_class_small
+                     : srtp_crypto_size_class_large;
+
+    for (ctype = crypto_kernel.cipher_type_list; ctype != NULL;
+         ctype = ctype->next) {
+        if (ctype->id != id) {
+            continue;
+        }
+        if (ctype->rate[size_class] == 0) {
+            return srtp_crypto_kernel_find_cipher_type(id);
+        }
+        if (fastest == NULL ||
+            ctype->rate[size_class] > fastest->rate[size_class]) {
+            fastest = ctype;
         }
-        ctype = ctype->next;
     }
 
-    /* haven't found the right one, indicate failure by returning NULL */
-    return NULL;
+    return fastest;
 }
 
 srtp_err_status_t srtp_crypto_kernel_alloc_cipher(srtp_cipher_type_id_t id,
@@ -447,7 +947,20 @@ srtp_err_status_t srtp_crypto_kernel_alloc_cipher(srtp_cipher_type_id_t id,
                                                   size_t key_len,
                                                   size_t tag_len)
 {
+    return srtp_crypto_kernel_alloc_cipher_for_len(id, cp, key_len, tag_len,
+                                                   0);
+}
+
+srtp_err_status_t srtp_crypto_kernel_alloc_cipher_for_len(
+    srtp_cipher_type_id_t id,
+    srtp_cipher_pointer_t *cp,
+    size_t key_len,
+    size_t tag_len,
+    size_t len)
+{
+    srtp_kernel_cipher_type_t *ctype;
     const srtp_cipher_type_t *ct;
+    srtp_err_status_t status;
 
     /*
      * if the crypto_kernel is not yet initialized, we refuse to allocate
@@ -457,15 +970,23 @@ srtp_err_status_t srtp_crypto_kernel_alloc_cipher(srtp_cipher_type_id_t id,
         return srtp_err_status_init_fail;
     }
 
-    ct = srtp_crypto_kernel_get_cipher_type(id);
-    if (!ct) {
+    ctype = srtp_crypto_kernel_select_cipher_type(id, len);
+    if (!ctype) {
         return srtp_err_status_fail;
     }
+    ct = ctype->cipher_type;
+
+    /* run a deferred self-test on first use */
+    status = srtp_crypto_kernel_deferred_cipher_test(ctype);
+    if (status) {
+        return status;
+    }
 
     return ((ct)->alloc(cp, key_len, tag_len));
 }
 
-const srtp_auth_type_t *srtp_crypto_kernel_get_auth_type(srtp_auth_type_id_t id)
+static srtp_kernel_auth_type_t *srtp_crypto_kernel_find_auth_type(
+    srtp_auth_type_id_t id)
 {
     srtp_kernel_auth_type_t *atype;
 
@@ -473,7 +994,7 @@ const srtp_auth_type_t *srtp_crypto_kernel_get_auth_type(srtp_auth_type_id_t id)
     atype = crypto_kernel.auth_type_list;
     while (atype != NULL) {
         if (id == atype->id) {
-            return atype->auth_type;
+            return atype;
         }
         atype = atype->next;
     }
@@ -482,12 +1003,21 @@ const srtp_auth_type_t *srtp_crypto_kernel_get_auth_type(srtp_auth_type_id_t id)
     return NULL;
 }
 
+const srtp_auth_type_t *srtp_crypto_kernel_get_auth_type(srtp_auth_type_id_t id)
+{
+    srtp_kernel_auth_type_t *atype = srtp_crypto_kernel_find_auth_type(id);
+
+    return atype != NULL ? atype->auth_type : NULL;
+}
+
 srtp_err_status_t srtp_crypto_kernel_alloc_auth(srtp_auth_type_id_t id,
                                                 srtp_auth_pointer_t *ap,
                                                 size_t key_len,
                                                 size_t tag_len)
 {
+    srtp_kernel_auth_type_t *atype;
     const srtp_auth_type_t *at;
+    srtp_err_status_t status;
 
     /*
      * if the crypto_kernel is not yet initialized, we refuse to allocate
@@ -497,10 +1027,17 @@ srtp_err_status_t srtp_crypto_kernel_alloc_auth(srtp_auth_type_id_t id,
         return srtp_err_status_init_fail;
     }
 
-    at = srtp_crypto_kernel_get_auth_type(id);
-    if (!at) {
+    atype = srtp_crypto_kernel_find_auth_type(id);
+    if (!atype) {
         return srtp_err_status_fail;
     }
+    at = atype->auth_type;
+
+    /* run a deferred self-test on first use */
+    status = srtp_crypto_kernel_deferred_auth_test(atype);
+    if (status) {
+        return status;
+    }
 
     return ((at)->alloc(ap, key_len, tag_len));
 }
@@ -539,6 +1076,11 @@ srtp_err_status_t srtp_crypto_kernel_load_debug_module(
     /* set head of list to new cipher type */
     crypto_kernel.debug_module_list = new;
 
+#ifdef ENABLE_DEBUG_LOGGING
+    /* every module reports until it is switched off */
+    new_dm->on = true;
+#endif
+
     return srtp_err_status_ok;
 }
 
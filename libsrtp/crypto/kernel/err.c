@@ -54,6 +54,26 @@
 
 static FILE *srtp_err_file = NULL;
 
+static srtp_err_report_handler_func_t *srtp_err_report_handler = NULL;
+
+/*
+ * srtp_err_level is the most verbose level that is reported, and
+ * srtp_err_active_level is that level while there is a file or a handler
+ * to report to, or -1 otherwise, so that one comparison rejects a report
+ * before any formatting is done
+ */
+static srtp_err_reporting_level_t srtp_err_level = srtp_err_level_debug;
+static int srtp_err_active_level = -1;
+
+static void srtp_err_update_active_level(void)
+{
+    if (srtp_err_file != NULL || srtp_err_report_handler != NULL) {
+        srtp_err_active_level = (int)srtp_err_level;
+    } else {
+        srtp_err_active_level = -1;
+    }
+}
+
 srtp_err_status_t srtp_err_reporting_init(void)
 {
 #ifdef ERR_REPORTING_STDOUT
@@ -65,23 +85,43 @@ srtp_err_status_t srtp_err_reporting_init(void)
         return srtp_err_status_init_fail;
     }
 #endif
+    srtp_err_update_active_level();
 
     return srtp_err_status_ok;
 }
 
-static srtp_err_report_handler_func_t *srtp_err_report_handler = NULL;
-
 srtp_err_status_t srtp_install_err_report_handler(
     srtp_err_report_handler_func_t func)
 {
     srtp_err_report_handler = func;
+    srtp_err_update_active_level();
     return srtp_err_status_ok;
 }
 
+void srtp_err_set_level(srtp_err_reporting_level_t level)
+{
+    srtp_err_level = level;
+    srtp_err_update_active_level();
+}
+
+bool srtp_err_report_enabled(srtp_err_reporting_level_t level,
+                             const srtp_debug_module_t *mod)
+{
+    if ((int)level > srtp_err_active_level) {
+        return false;
+    }
+    return mod == NULL || mod->on;
+}
+
 void srtp_err_report(srtp_err_reporting_level_t level, const char *format, ...)
 {
     char msg[512];
     va_list args;
+    int len;
+
+    if ((int)level > srtp_err_active_level) {
+        return;
+    }
     if (srtp_err_file != NULL) {
         va_start(args, format);
         vfprintf(srtp_err_file, format, args);
@@ -89,19 +129,26 @@ void srtp_err_report(srtp_err_reporting_level_t level, const char *format, ...)
     }
     if (srtp_err_report_handler != NULL) {
         va_start(args, format);
-        if (vsnprintf(msg, sizeof(msg), format, args) > 0) {
+        len = vsnprintf(msg, sizeof(msg), format, args);
+        if (len > 0) {
+            /* vsnprintf() returns the untruncated length */
+            size_t l = (size_t)len;
+            if (l >= sizeof(msg)) {
+                l = sizeof(msg) - 1;
+            }
             /* strip trailing \n, callback should not have one */
-            size_t l = strlen(msg);
-            if (l && msg[l - 1] == '\n') {
+            if (msg[l - 1] == '\n') {
                 msg[l - 1] = '\0';
             }
             srtp_err_report_handler(level, msg);
             /*
+             * only the formatted part of msg can hold data worth wiping
+             *
              * NOTE, need to be carefull, there is a potential that
              * octet_string_set_to_zero() could
              * call srtp_err_report() in the future, leading to recursion
              */
-            octet_string_set_to_zero(msg, sizeof(msg));
+            octet_string_set_to_zero(msg, l + 1);
         }
         va_end(args);
     }
@@ -47,9 +47,241 @@
 #endif
 
 #include "key.h"
+#include "alloc.h"
 
 #define soft_limit 0x10000
 
+/*
+ * a budget shared by several shards is updated from whichever thread
+ * processes a packet for one of its streams, so its count and state are
+ * only accessed through these
+ */
+#if defined(__GNUC__)
+
+static inline srtp_xtd_seq_num_t key_limit_load_left(srtp_key_limit_t key)
+{
+    return __atomic_load_n(&key->num_left, __ATOMIC_RELAXED);
+}
+
+static inline bool key_limit_cas_left(srtp_key_limit_t key,
+                                      srtp_xtd_seq_num_t *expected,
+                                      srtp_xtd_seq_num_t desired)
+{
+    return __atomic_compare_exchange_n(&key->num_left, expected, desired,
+                                       false, __ATOMIC_RELAXED,
+                                       __ATOMIC_RELAXED);
+}
+
+static inline srtp_key_state_t key_limit_load_state(srtp_key_limit_t key)
+{
+    return __atomic_load_n(&key->state, __ATOMIC_RELAXED);
+}
+
+static inline void key_limit_store_state(srtp_key_limit_t key,
+                                         srtp_key_state_t state)
+{
+    __atomic_store_n(&key->state, state, __ATOMIC_RELAXED);
+}
+
+static inline bool key_limit_cas_state(srtp_key_limit_t key,
+                                       srtp_key_state_t *expected,
+                                       srtp_key_state_t desired)
+{
+    return __atomic_compare_exchange_n(&key->state, expected, desired, false,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+#elif defined(_MSC_VER)
+
+#include <intrin.h>
+
+/* srtp_key_state_t is an int, and a long is 32 bits wide on Windows */
+
+static inline srtp_xtd_seq_num_t key_limit_load_left(srtp_key_limit_t key)
+{
+    return (srtp_xtd_seq_num_t)_InterlockedCompareExchange64(
+        (volatile __int64 *)&key->num_left, 0, 0);
+}
+
+static inline bool key_limit_cas_left(srtp_key_limit_t key,
+                                      srtp_xtd_seq_num_t *expected,
+                                      srtp_xtd_seq_num_t desired)
+{
+    srtp_xtd_seq_num_t prev = (srtp_xtd_seq_num_t)_InterlockedCompareExchange64(
+        (volatile __int64 *)&key->num_left, (__int64)desired,
+        (__int64)*expected);
+
+    if (prev == *expected) {
+        return true;
+    }
+    *expected = prev;
+    return false;
+}
+
+static inline srtp_key_state_t key_limit_load_state(srtp_key_limit_t key)
+{
+    return (srtp_key_state_t)_InterlockedCompareExchange(
+        (volatile long *)&key->state, 0, 0);
+}
+
+static inline void key_limit_store_state(srtp_key_limit_t key,
+                                         srtp_key_state_t state)
+{
+    _InterlockedExchange((volatile long *)&key->state, (long)state);
+}
+
+static inline bool key_limit_cas_state(srtp_key_limit_t key,
+                                       srtp_key_state_t *expected,
+                                       srtp_key_state_t desired)
+{
+    srtp_key_state_t prev = (srtp_key_state_t)_InterlockedCompareExchange(
+        (volatile long *)&key->state, (long)desired, (long)*expected);
+
+    if (prev == *expected) {
+        return true;
+    }
+    *expected = prev;
+    return false;
+}
+
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L &&            \
+    !defined(__STDC_NO_ATOMICS__)
+
+#include <stdatomic.h>
+
+/*
+ * the count and state are plain objects, which C11 atomics cannot
+ * operate on, so every access takes one lock shared by all budgets
+ */
+static atomic_flag key_limit_busy = ATOMIC_FLAG_INIT;
+
+static void key_limit_lock(void)
+{
+    while (atomic_flag_test_and_set_explicit(&key_limit_busy,
+                                             memory_order_acquire)) {
+    }
+}
+
+static void key_limit_unlock(void)
+{
+    atomic_flag_clear_explicit(&key_limit_busy, memory_order_release);
+}
+
+static inline srtp_xtd_seq_num_t key_limit_load_left(srtp_key_limit_t key)
+{
+    srtp_xtd_seq_num_t v;
+
+    key_limit_lock();
+    v = key->num_left;
+    key_limit_unlock();
+
+    return v;
+}
+
+static inline bool key_limit_cas_left(srtp_key_limit_t key,
+                                      srtp_xtd_seq_num_t *expected,
+                                      srtp_xtd_seq_num_t desired)
+{
+    bool ok;
+
+    key_limit_lock();
+    ok = key->num_left == *expected;
+    if (ok) {
+        key->num_left = desired;
+    } else {
+        *expected = key->num_left;
+    }
+    key_limit_unlock();
+
+    return ok;
+}
+
+static inline srtp_key_state_t key_limit_load_state(srtp_key_limit_t key)
+{
+    srtp_key_state_t v;
+
+    key_limit_lock();
+    v = key->state;
+    key_limit_unlock();
+
+    return v;
+}
+
+static inline void key_limit_store_state(srtp_key_limit_t key,
+                                         srtp_key_state_t state)
+{
+    key_limit_lock();
+    key->state = state;
+    key_limit_unlock();
+}
+
+static inline bool key_limit_cas_state(srtp_key_limit_t key,
+                                       srtp_key_state_t *expected,
+                                       srtp_key_state_t desired)
+{
+    bool ok;
+
+    key_limit_lock();
+    ok = key->state == *expected;
+    if (ok) {
+        key->state = desired;
+    } else {
+        *expected = key->state;
+    }
+    key_limit_unlock();
+
+    return ok;
+}
+
+#else
+
+/*
+ * without atomic operations a shared budget is only correct when the
+ * streams that draw on it are used from a single thread
+ */
+
+static inline srtp_xtd_seq_num_t key_limit_load_left(srtp_key_limit_t key)
+{
+    return key->num_left;
+}
+
+static inline bool key_limit_cas_left(srtp_key_limit_t key,
+                                      srtp_xtd_seq_num_t *expected,
+                                      srtp_xtd_seq_num_t desired)
+{
+    if (key->num_left != *expected) {
+        *expected = key->num_left;
+        return false;
+    }
+    key->num_left = desired;
+    return true;
+}
+
+static inline srtp_key_state_t key_limit_load_state(srtp_key_limit_t key)
+{
+    return key->state;
+}
+
+static inline void key_limit_store_state(srtp_key_limit_t key,
+                                         srtp_key_state_t state)
+{
+    key->state = state;
+}
+
+static inline bool key_limit_cas_state(srtp_key_limit_t key,
+                                       srtp_key_state_t *expected,
+                                       srtp_key_state_t desired)
+{
+    if (key->state != *expected) {
+        *expected = key->state;
+        return false;
+    }
+    key->state = desired;
+    return true;
+}
+
+#endif
+
 srtp_err_status_t srtp_key_limit_set(srtp_key_limit_t key,
                                      const srtp_xtd_seq_num_t s)
 {
@@ -64,27 +296,122 @@ srtp_err_status_t srtp_key_limit_set(srtp_key_limit_t key,
 srtp_err_status_t srtp_key_limit_clone(srtp_key_limit_t original,
                                        srtp_key_limit_t *new_key)
 {
+    srtp_key_limit_t shard;
+
     if (original == NULL) {
         return srtp_err_status_bad_param;
     }
-    *new_key = original;
+    shard = (srtp_key_limit_t)srtp_crypto_alloc(sizeof(*shard));
+    if (shard == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+    shard->parent = original->parent != NULL ? original->parent : original;
+    shard->num_left = key_limit_load_left(shard->parent);
+    shard->state = key_limit_load_state(shard->parent);
+    shard->leased = 0;
+    *new_key = shard;
     return srtp_err_status_ok;
 }
 
-srtp_key_event_t srtp_key_limit_update(srtp_key_limit_t key)
+/*
+ * srtp_key_limit_event(key, next) returns the event for a budget that
+ * was just lowered to next uses, and updates its state to match
+ */
+static srtp_key_event_t srtp_key_limit_event(srtp_key_limit_t key,
+                                             srtp_xtd_seq_num_t next)
 {
-    key->num_left--;
-    if (key->num_left >= soft_limit) {
+    srtp_key_state_t state = srtp_key_state_normal;
+
+    if (next >= soft_limit) {
         return srtp_key_event_normal; /* we're above the soft limit */
     }
-    if (key->state == srtp_key_state_normal) {
-        /* we just passed the soft limit, so change the state */
-        key->state = srtp_key_state_past_soft_limit;
-    }
-    if (key->num_left < 1) {
+    if (next < 1) {
         /* we just hit the hard limit */
-        key->state = srtp_key_state_expired;
+        key_limit_store_state(key, srtp_key_state_expired);
         return srtp_key_event_hard_limit;
     }
+    /* we may have just passed the soft limit, so change the state */
+    key_limit_cas_state(key, &state, srtp_key_state_past_soft_limit);
     return srtp_key_event_soft_limit;
 }
+
+/*
+ * srtp_key_limit_lease(key) takes the current use from the budget of the
+ * parent of the shard key, together with a batch of later ones as long as
+ * the budget stays above the soft limit.  Uses are leased before they
+ * happen, so the parent never counts fewer uses than were made and the
+ * hard limit is never exceeded; a shard may instead expire while others
+ * still hold leases, by at most the number of shards times
+ * SRTP_KEY_LIMIT_BATCH - 1 uses.
+ */
+static srtp_key_event_t srtp_key_limit_lease(srtp_key_limit_t key)
+{
+    srtp_key_limit_t parent = key->parent;
+    srtp_xtd_seq_num_t left = key_limit_load_left(parent);
+    srtp_xtd_seq_num_t n, next;
+    srtp_key_event_t event;
+
+    do {
+        n = left >= soft_limit + SRTP_KEY_LIMIT_BATCH ? SRTP_KEY_LIMIT_BATCH
+                                                      : 1;
+        next = left > n ? left - n : 0;
+    } while (!key_limit_cas_left(parent, &left, next));
+
+    event = srtp_key_limit_event(parent, next);
+    switch (event) {
+    case srtp_key_event_normal:
+        key->leased = (uint32_t)(n - 1);
+        break;
+    case srtp_key_event_soft_limit:
+        key->state = srtp_key_state_past_soft_limit;
+        break;
+    case srtp_key_event_hard_limit:
+    default:
+        key->state = srtp_key_state_expired;
+        break;
+    }
+    return event;
+}
+
+srtp_key_event_t srtp_key_limit_update(srtp_key_limit_t key)
+{
+    srtp_xtd_seq_num_t left, next;
+
+    if (key->parent != NULL) {
+        /* a shard spends what it has leased before it leases more */
+        if (key->leased > 0) {
+            key->leased--;
+            return srtp_key_event_normal;
+        }
+        return srtp_key_limit_lease(key);
+    }
+
+    left = key_limit_load_left(key);
+    do {
+        next = left > 1 ? left - 1 : 0;
+    } while (!key_limit_cas_left(key, &left, next));
+
+    return srtp_key_limit_event(key, next);
+}
+
+void srtp_key_limit_flush(srtp_key_limit_t key)
+{
+    srtp_key_limit_t parent = key->parent;
+    srtp_xtd_seq_num_t left, next;
+
+    if (parent == NULL || key->leased == 0) {
+        return;
+    }
+
+    /*
+     * unused uses go back to the budget while it is above the soft limit;
+     * after that they are dropped, which only brings the limits closer
+     */
+    if (key_limit_load_state(parent) == srtp_key_state_normal) {
+        left = key_limit_load_left(parent);
+        do {
+            next = left != 0 ? left + key->leased : 0;
+        } while (!key_limit_cas_left(parent, &left, next));
+    }
+    key->leased = 0;
+}
@@ -58,6 +58,19 @@
 #include <tmmintrin.h>
 #endif
 
+/*
+ * On x86 the SSSE3 versions of the shift functions are built even when
+ * the library as a whole targets a baseline without SSSE3, as distribution
+ * packages do, and the version to use is chosen when the library is loaded.
+ */
+#if !defined(__SSSE3__) && defined(__SSE2__) &&                                \
+    (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SRTP_SSSE3_DISPATCH 1
+#define SRTP_TARGET_SSSE3 __attribute__((target("ssse3")))
+#elif defined(__SSSE3__)
+#define SRTP_TARGET_SSSE3
+#endif
+
 #if defined(_MSC_VER)
 #define ALIGNMENT(N) __declspec(align(N))
 #else
@@ -170,7 +183,7 @@ void v128_copy_octet_string(v128_t *x, const uint8_t s[16])
 #endif /* defined(__SSE2__) */
 }
 
-#if defined(__SSSE3__)
+#if defined(SRTP_TARGET_SSSE3)
 
 /* clang-format off */
 
@@ -203,7 +216,8 @@ static const uint8_t left_shift_masks[4][16] = {
 
 /* clang-format on */
 
-void v128_left_shift(v128_t *x, size_t shift)
+SRTP_TARGET_SSSE3
+static void v128_left_shift_ssse3(v128_t *x, size_t shift)
 {
     if (shift > 127) {
         v128_set_to_zero(x);
@@ -226,9 +240,11 @@ void v128_left_shift(v128_t *x, size_t shift)
     _mm_storeu_si128((__m128i *)x, mm1);
 }
 
-#else /* defined(__SSSE3__) */
+#endif /* defined(SRTP_TARGET_SSSE3) */
 
-void v128_left_shift(v128_t *x, size_t shift)
+#if !defined(__SSSE3__)
+
+static void v128_left_shift_generic(v128_t *x, size_t shift)
 {
     const size_t base_index = shift >> 5;
     const size_t bit_index = shift & 31;
@@ -256,7 +272,7 @@ void v128_left_shift(v128_t *x, size_t shift)
     }
 }
 
-#endif /* defined(__SSSE3__) */
+#endif /* !defined(__SSSE3__) */
 
 /* functions manipulating bitvector_t */
 
@@ -305,9 +321,10 @@ void bitvector_set_to_zero(bitvector_t *x)
     memset(x->word, 0, x->length >> 3);
 }
 
-#if defined(__SSSE3__)
+#if defined(SRTP_TARGET_SSSE3)
 
-void bitvector_left_shift(bitvector_t *x, size_t shift)
+SRTP_TARGET_SSSE3
+static void bitvector_left_shift_ssse3(bitvector_t *x, size_t shift)
 {
     if ((uint32_t)shift >= x->length) {
         bitvector_set_to_zero(x);
@@ -370,9 +387,11 @@ void bitvector_left_shift(bitvector_t *x, size_t shift)
     }
 }
 
-#else /* defined(__SSSE3__) */
+#endif /* defined(SRTP_TARGET_SSSE3) */
 
-void bitvector_left_shift(bitvector_t *x, size_t shift)
+#if !defined(__SSSE3__)
+
+static void bitvector_left_shift_generic(bitvector_t *x, size_t shift)
 {
     const size_t base_index = shift >> 5;
     const size_t bit_index = shift & 31;
@@ -402,7 +421,96 @@ void bitvector_left_shift(bitvector_t *x, size_t shift)
     }
 }
 
-#endif /* defined(__SSSE3__) */
+#endif /* !defined(__SSSE3__) */
+
+#if defined(SRTP_SSSE3_DISPATCH)
+
+/*
+ * the generic versions are used until srtp_datatypes_init() has run, so
+ * a call from another constructor is still correct
+ */
+static void (*v128_left_shift_impl)(v128_t *x, size_t shift) =
+    v128_left_shift_generic;
+static void (*bitvector_left_shift_impl)(bitvector_t *x, size_t shift) =
+    bitvector_left_shift_generic;
+
+static bool srtp_cpu_has_ssse3(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("ssse3");
+}
+
+static void srtp_datatypes_select(bool use_simd)
+{
+    if (use_simd) {
+        v128_left_shift_impl = v128_left_shift_ssse3;
+        bitvector_left_shift_impl = bitvector_left_shift_ssse3;
+    } else {
+        v128_left_shift_impl = v128_left_shift_generic;
+        bitvector_left_shift_impl = bitvector_left_shift_generic;
+    }
+}
+
+__attribute__((constructor)) static void srtp_datatypes_init(void)
+{
+    srtp_datatypes_select(srtp_cpu_has_ssse3());
+}
+
+void v128_left_shift(v128_t *x, size_t shift)
+{
+    v128_left_shift_impl(x, shift);
+}
+
+void bitvector_left_shift(bitvector_t *x, size_t shift)
+{
+    bitvector_left_shift_impl(x, shift);
+}
+
+bool srtp_datatypes_use_simd(bool enable)
+{
+    bool use_simd = enable && srtp_cpu_has_ssse3();
+
+    srtp_datatypes_select(use_simd);
+    return use_simd;
+}
+
+#elif defined(__SSSE3__)
+
+void v128_left_shift(v128_t *x, size_t shift)
+{
+    v128_left_shift_ssse3(x, shift);
+}
+
+void bitvector_left_shift(bitvector_t *x, size_t shift)
+{
+    bitvector_left_shift_ssse3(x, shift);
+}
+
+bool srtp_datatypes_use_simd(bool enable)
+{
+    (void)enable;
+    return true;
+}
+
+#else
+
+void v128_left_shift(v128_t *x, size_t shift)
+{
+    v128_left_shift_generic(x, shift);
+}
+
+void bitvector_left_shift(bitvector_t *x, size_t shift)
+{
+    bitvector_left_shift_generic(x, shift);
+}
+
+bool srtp_datatypes_use_simd(bool enable)
+{
+    (void)enable;
+    return false;
+}
+
+#endif /* SRTP_SSSE3_DISPATCH */
 
 bool srtp_octet_string_equal(const uint8_t *a, const uint8_t *b, size_t length)
 {
@@ -165,9 +165,103 @@ srtp_err_status_t srtp_rdbx_init(srtp_rdbx_t *rdbx, size_t ws)
 
     srtp_index_init(&rdbx->index);
 
+    rdbx->window_min = bitvector_get_length(&rdbx->bitmask);
+    rdbx->window_max = rdbx->window_min;
+    rdbx->adapt_count = 0;
+    rdbx->adapt_depth = 0;
+
+    return srtp_err_status_ok;
+}
+
+srtp_err_status_t srtp_rdbx_set_window_bounds(srtp_rdbx_t *rdbx,
+                                              size_t min_ws,
+                                              size_t max_ws)
+{
+    size_t ws = bitvector_get_length(&rdbx->bitmask);
+
+    if (min_ws == 0 || min_ws > ws || max_ws < ws) {
+        return srtp_err_status_bad_param;
+    }
+
+    rdbx->window_min = min_ws;
+    rdbx->window_max = max_ws;
+    rdbx->adapt_count = 0;
+    rdbx->adapt_depth = 0;
+
     return srtp_err_status_ok;
 }
 
+/*
+ * srtp_rdbx_resize(&r, ws) replaces the bitmask of r with one of ws bits
+ * (rounded up to a whole word, as bitvector_alloc() does), keeping the
+ * bits of the most recent indices.  Growing the window brings indices
+ * that had already fallen out of it back in; they are marked as received,
+ * since any of them may have been accepted before, so a larger window
+ * never lets a replay through.
+ */
+static srtp_err_status_t srtp_rdbx_resize(srtp_rdbx_t *rdbx, size_t ws)
+{
+    bitvector_t v;
+    size_t old_words = bitvector_get_length(&rdbx->bitmask) / bits_per_word;
+    size_t new_words;
+
+    if (!bitvector_alloc(&v, ws)) {
+        return srtp_err_status_alloc_fail;
+    }
+    new_words = bitvector_get_length(&v) / bits_per_word;
+
+    if (new_words >= old_words) {
+        memset(v.word, 0xff, (new_words - old_words) * bytes_per_word);
+        memcpy(v.word + (new_words - old_words), rdbx->bitmask.word,
+               old_words * bytes_per_word);
+    } else {
+        memcpy(v.word, rdbx->bitmask.word + (old_words - new_words),
+               new_words * bytes_per_word);
+    }
+
+    bitvector_dealloc(&rdbx->bitmask);
+    rdbx->bitmask = v;
+    rdbx->adapt_count = 0;
+    rdbx->adapt_depth = 0;
+
+    return srtp_err_status_ok;
+}
+
+/*
+ * srtp_rdbx_adapt(&r, depth) accounts for an accepted index that was
+ * depth positions behind the highest one, growing the window of r when
+ * depth comes close to its size and shrinking it after a quiet period.
+ * The window is best effort: if a new bitmask cannot be allocated the
+ * current one is kept.
+ */
+static void srtp_rdbx_adapt(srtp_rdbx_t *rdbx, size_t depth)
+{
+    size_t ws = bitvector_get_length(&rdbx->bitmask);
+
+    if (depth > rdbx->adapt_depth) {
+        rdbx->adapt_depth = (uint32_t)depth;
+    }
+
+    if (depth >= ws - ws / 4 && ws < rdbx->window_max) {
+        srtp_rdbx_resize(rdbx, ws * 2 < rdbx->window_max ? ws * 2
+                                                         : rdbx->window_max);
+        return;
+    }
+
+    if (++rdbx->adapt_count < SRTP_RDBX_ADAPT_PERIOD) {
+        return;
+    }
+
+    if (rdbx->adapt_depth < ws / 4 && ws > rdbx->window_min) {
+        srtp_rdbx_resize(rdbx, ws / 2 > rdbx->window_min ? ws / 2
+                                                         : rdbx->window_min);
+        return;
+    }
+
+    rdbx->adapt_count = 0;
+    rdbx->adapt_depth = 0;
+}
+
 /*
  *  srtp_rdbx_dealloc(&r) frees memory for the srtp_rdbx_t pointed to by r
  */
@@ -220,6 +314,14 @@ size_t srtp_rdbx_get_window_size(const srtp_rdbx_t *rdbx)
     return bitvector_get_length(&rdbx->bitmask);
 }
 
+void srtp_rdbx_get_window_bounds(const srtp_rdbx_t *rdbx,
+                                 size_t *min_ws,
+                                 size_t *max_ws)
+{
+    *min_ws = rdbx->window_min;
+    *max_ws = rdbx->window_max;
+}
+
 /*
  * srtp_rdbx_check(&r, delta) checks to see if the srtp_xtd_seq_num_t
  * which is at rdbx->index + delta is in the rdb
@@ -252,6 +354,8 @@ srtp_err_status_t srtp_rdbx_check(const srtp_rdbx_t *rdbx, ssize_t delta)
  */
 srtp_err_status_t srtp_rdbx_add_index(srtp_rdbx_t *rdbx, ssize_t delta)
 {
+    size_t depth = 0;
+
     if (delta > 0) {
         /* shift forward by delta */
         srtp_index_advance(&rdbx->index, (srtp_sequence_number_t)delta);
@@ -262,10 +366,15 @@ srtp_err_status_t srtp_rdbx_add_index(srtp_rdbx_t *rdbx, ssize_t delta)
         /* delta is in window */
         bitvector_set_bit(&rdbx->bitmask,
                           bitvector_get_length(&rdbx->bitmask) - 1 + delta);
+        depth = (size_t)-delta;
     }
 
     /* note that we need not consider the case that delta == 0 */
 
+    if (rdbx->window_max > rdbx->window_min) {
+        srtp_rdbx_adapt(rdbx, depth);
+    }
+
     return srtp_err_status_ok;
 }
 
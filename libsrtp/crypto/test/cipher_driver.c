@@ -55,11 +55,19 @@
 
 #include <stdio.h> /* for printf() */
 #include <stdlib.h>
+#include <time.h> /* for clock() */
 
 #define PRINT_DEBUG 0
 
 void cipher_driver_test_throughput(srtp_cipher_t *c);
 
+/*
+ * cipher_driver_test_reject_throughput(c) times the decryption of forged
+ * messages, which an AEAD cipher must reject
+ */
+
+void cipher_driver_test_reject_throughput(srtp_cipher_t *c);
+
 srtp_err_status_t cipher_driver_self_test(srtp_cipher_type_t *ct);
 
 srtp_err_status_t cipher_driver_test_api(srtp_cipher_type_t *ct, int key_len);
@@ -118,8 +126,10 @@ void check_status(srtp_err_status_t s)
 extern srtp_cipher_type_t srtp_null_cipher;
 extern srtp_cipher_type_t srtp_aes_icm_128;
 extern srtp_cipher_type_t srtp_aes_icm_256;
-#ifdef GCM
+#if defined(OPENSSL) || defined(WOLFSSL) || defined(MBEDTLS) || defined(NSS)
 extern srtp_cipher_type_t srtp_aes_icm_192;
+#endif
+#ifdef GCM
 extern srtp_cipher_type_t srtp_aes_gcm_128;
 extern srtp_cipher_type_t srtp_aes_gcm_256;
 #endif
@@ -192,12 +202,13 @@ int main(int argc, char *argv[])
                 &srtp_aes_icm_256, SRTP_AES_ICM_256_KEY_LEN_WSALT, num_cipher);
         }
 
-#ifdef GCM
+#if defined(OPENSSL) || defined(WOLFSSL) || defined(MBEDTLS) || defined(NSS)
         for (num_cipher = 1; num_cipher < max_num_cipher; num_cipher *= 8) {
             cipher_driver_test_array_throughput(
                 &srtp_aes_icm_192, SRTP_AES_ICM_192_KEY_LEN_WSALT, num_cipher);
         }
-
+#endif
+#ifdef GCM
         for (num_cipher = 1; num_cipher < max_num_cipher; num_cipher *= 8) {
             cipher_driver_test_array_throughput(
                 &srtp_aes_gcm_128, SRTP_AES_GCM_128_KEY_LEN_WSALT, num_cipher);
@@ -214,8 +225,10 @@ int main(int argc, char *argv[])
         cipher_driver_self_test(&srtp_null_cipher);
         cipher_driver_self_test(&srtp_aes_icm_128);
         cipher_driver_self_test(&srtp_aes_icm_256);
-#ifdef GCM
+#if defined(OPENSSL) || defined(WOLFSSL) || defined(MBEDTLS) || defined(NSS)
         cipher_driver_self_test(&srtp_aes_icm_192);
+#endif
+#ifdef GCM
         cipher_driver_self_test(&srtp_aes_gcm_128);
         cipher_driver_self_test(&srtp_aes_gcm_256);
 #endif
@@ -298,6 +311,7 @@ int main(int argc, char *argv[])
     check_status(status);
     if (do_timing_test) {
         cipher_driver_test_throughput(c);
+        cipher_driver_test_reject_throughput(c);
     }
 
     // GCM ciphers don't do buffering; they're "one shot"
@@ -316,6 +330,7 @@ int main(int argc, char *argv[])
     check_status(status);
     if (do_timing_test) {
         cipher_driver_test_throughput(c);
+        cipher_driver_test_reject_throughput(c);
     }
 
     // GCM ciphers don't do buffering; they're "one shot"
@@ -342,6 +357,64 @@ void cipher_driver_test_throughput(srtp_cipher_t *c)
     }
 }
 
+void cipher_driver_test_reject_throughput(srtp_cipher_t *c)
+{
+    size_t min_enc_len = 32;
+    size_t max_enc_len = 2048; /* should be a power of two */
+    size_t num_trials = 1000000;
+    uint8_t aad[4] = { 0, 0, 0, 0 };
+    uint8_t *buf;
+    v128_t nonce;
+
+    buf = (uint8_t *)srtp_crypto_alloc(max_enc_len + SRTP_MAX_TAG_LEN);
+    if (buf == NULL) {
+        fprintf(stderr, "error: can't allocate buffer\n");
+        exit(srtp_err_status_alloc_fail);
+    }
+    v128_set_to_zero(&nonce);
+
+    printf("timing %s forgery rejection, key length %zu:\n",
+           c->type->description, c->key_len);
+    fflush(stdout);
+    for (size_t len = min_enc_len; len <= max_enc_len; len = len * 2) {
+        size_t enc_len = len;
+        size_t tag_len = SRTP_MAX_TAG_LEN;
+        clock_t timer;
+
+        /* a genuine message whose tag is then damaged */
+        if (srtp_cipher_set_iv(c, (uint8_t *)&nonce, srtp_direction_encrypt) ||
+            srtp_cipher_set_aad(c, aad, sizeof(aad)) ||
+            srtp_cipher_encrypt(c, buf, len, buf, &enc_len) ||
+            srtp_cipher_get_tag(c, buf + len, &tag_len)) {
+            fprintf(stderr, "error: can't encrypt message\n");
+            exit(srtp_err_status_algo_fail);
+        }
+        buf[len] ^= 1;
+
+        timer = clock();
+        for (size_t i = 0; i < num_trials; i++) {
+            size_t out_len = len;
+
+            if (srtp_cipher_set_iv(c, (uint8_t *)&nonce,
+                                   srtp_direction_decrypt) ||
+                srtp_cipher_set_aad(c, aad, sizeof(aad)) ||
+                srtp_cipher_decrypt(c, buf, len + tag_len, buf, &out_len) !=
+                    srtp_err_status_auth_fail) {
+                fprintf(stderr, "error: forged message not rejected\n");
+                exit(srtp_err_status_algo_fail);
+            }
+        }
+        timer = clock() - timer;
+        if (timer == 0) {
+            timer = 1;
+        }
+        printf("msg len: %zu\tgigabits per second: %f\n", len,
+               (double)CLOCKS_PER_SEC * num_trials * 8 * len / timer / 1e9);
+    }
+
+    srtp_crypto_free(buf);
+}
+
 srtp_err_status_t cipher_driver_self_test(srtp_cipher_type_t *ct)
 {
     srtp_err_status_t status;
@@ -64,6 +64,8 @@ void test_bswap(void);
 
 void test_set_to_zero(void);
 
+void test_simd_shifts(void);
+
 int main(void)
 {
     /*
@@ -133,6 +135,7 @@ int main(void)
 
     test_bswap();
     test_set_to_zero();
+    test_simd_shifts();
 
     return 0;
 }
@@ -224,3 +227,66 @@ void test_set_to_zero(void)
     }
 #undef BUFFER_SIZE
 }
+
+/*
+ * test_simd_shifts() checks that the SIMD and the generic shifts agree,
+ * if this build and CPU have both
+ */
+void test_simd_shifts(void)
+{
+    static const size_t lengths[] = { 128, 256, 1024, 4096 };
+    v128_t x, y;
+    bitvector_t a, b;
+
+    if (!srtp_datatypes_use_simd(true)) {
+        printf("no SIMD shifts to compare\n");
+        return;
+    }
+
+    for (size_t shift = 0; shift < 130; shift++) {
+        for (size_t i = 0; i < 16; i++) {
+            x.v8[i] = (uint8_t)rand();
+        }
+        y = x;
+        srtp_datatypes_use_simd(true);
+        v128_left_shift(&x, shift);
+        srtp_datatypes_use_simd(false);
+        v128_left_shift(&y, shift);
+        if (memcmp(&x, &y, sizeof(x)) != 0) {
+            fprintf(stderr, "v128_left_shift() differs for shift %zu\n",
+                    shift);
+            abort();
+        }
+    }
+
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+        size_t length = lengths[l];
+
+        if (!bitvector_alloc(&a, length) || !bitvector_alloc(&b, length)) {
+            fprintf(stderr, "bitvector_alloc() failed\n");
+            abort();
+        }
+        for (size_t shift = 0; shift <= length; shift += 7) {
+            for (size_t i = 0; i < length / 32; i++) {
+                a.word[i] = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+            }
+            memcpy(b.word, a.word, length / 8);
+            srtp_datatypes_use_simd(true);
+            bitvector_left_shift(&a, shift);
+            srtp_datatypes_use_simd(false);
+            bitvector_left_shift(&b, shift);
+            if (memcmp(a.word, b.word, length / 8) != 0) {
+                fprintf(stderr,
+                        "bitvector_left_shift() differs for length %zu "
+                        "shift %zu\n",
+                        length, shift);
+                abort();
+            }
+        }
+        bitvector_dealloc(&a);
+        bitvector_dealloc(&b);
+    }
+
+    srtp_datatypes_use_simd(true);
+    printf("SIMD and generic shifts agree\n");
+}
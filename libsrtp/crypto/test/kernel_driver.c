@@ -48,28 +48,224 @@
 
 #include "getopt_s.h"
 #include "crypto_kernel.h"
+#include "cipher_types.h"
 
 #include <stdio.h> /* for printf() */
 #include <stdlib.h>
+#include <time.h> /* for clock() */
+
+#define NUM_INIT_CYCLES 1000
 
 void usage(char *prog_name)
 {
-    printf("usage: %s [ -v ][ -d debug_module ]*\n", prog_name);
+    printf("usage: %s [ -v ][ -t ][ -l ][ -d debug_module ]*\n", prog_name);
     exit(255);
 }
 
+static double elapsed_usec(clock_t timer)
+{
+    return (double)timer * 1000000.0 / CLOCKS_PER_SEC;
+}
+
+/*
+ * alloc_types() allocates and frees one context of the types that
+ * srtp_create() uses by default, which runs their self-tests if those
+ * were deferred
+ */
+static srtp_err_status_t alloc_types(void)
+{
+    srtp_err_status_t status;
+    srtp_cipher_t *c;
+    srtp_auth_t *a;
+
+    status = srtp_crypto_kernel_alloc_cipher(SRTP_AES_ICM_128, &c, 30, 0);
+    if (status) {
+        return status;
+    }
+    status = srtp_cipher_dealloc(c);
+    if (status) {
+        return status;
+    }
+
+    status = srtp_crypto_kernel_alloc_auth(SRTP_HMAC_SHA1, &a, 20, 10);
+    if (status) {
+        return status;
+    }
+    return srtp_auth_dealloc(a);
+}
+
+/*
+ * alt_aes_icm_128 stands in for a second implementation of AES-128 ICM,
+ * as a crypto library backend would be; it counts its allocations
+ */
+static srtp_cipher_type_t alt_aes_icm_128;
+static int alt_allocs = 0;
+
+static srtp_err_status_t alt_alloc(srtp_cipher_t **c,
+                                   size_t key_len,
+                                   size_t tag_len)
+{
+    alt_allocs++;
+    return srtp_aes_icm_128.alloc(c, key_len, tag_len);
+}
+
+/*
+ * check_backend(len, expected_allocs) allocates an AES-128 ICM cipher for
+ * packets of len octets and checks that alt_aes_icm_128 was used
+ * expected_allocs times, unless that is negative
+ */
+static srtp_err_status_t check_backend(size_t len, int expected_allocs)
+{
+    srtp_err_status_t status;
+    srtp_cipher_t *c;
+    int allocs = alt_allocs;
+
+    status = srtp_crypto_kernel_alloc_cipher_for_len(SRTP_AES_ICM_128, &c, 30,
+                                                     0, len);
+    if (status) {
+        return status;
+    }
+    status = srtp_cipher_dealloc(c);
+    if (status) {
+        return status;
+    }
+    if (expected_allocs >= 0 && alt_allocs - allocs != expected_allocs) {
+        return srtp_err_status_algo_fail;
+    }
+    return srtp_err_status_ok;
+}
+
+static srtp_err_status_t check_backends(void)
+{
+    srtp_err_status_t status;
+
+    alt_aes_icm_128 = srtp_aes_icm_128;
+    alt_aes_icm_128.alloc = alt_alloc;
+    alt_aes_icm_128.description = "alternative AES-128 ICM";
+
+    status = srtp_crypto_kernel_add_cipher_type(&alt_aes_icm_128,
+                                                SRTP_AES_ICM_128, 1);
+    if (status) {
+        return status;
+    }
+
+    /* a type can only be added once, and only to a loaded id */
+    if (srtp_crypto_kernel_add_cipher_type(&alt_aes_icm_128, SRTP_AES_ICM_128,
+                                           2) != srtp_err_status_bad_param) {
+        return srtp_err_status_algo_fail;
+    }
+    if (srtp_crypto_kernel_add_cipher_type(&srtp_aes_icm_128, SRTP_AES_ICM_256,
+                                           2) != srtp_err_status_bad_param) {
+        return srtp_err_status_algo_fail;
+    }
+
+    /* nor can a loaded type replace another implementation */
+    if (srtp_replace_cipher_type(&srtp_aes_icm_128, SRTP_AES_ICM_128) !=
+        srtp_err_status_bad_param) {
+        return srtp_err_status_algo_fail;
+    }
+
+    /*
+     * the higher priority wins until the implementations are measured;
+     * the first allocation may also run a deferred self-test
+     */
+    status = check_backend(0, -1);
+    if (status) {
+        return status;
+    }
+    status = check_backend(0, 1);
+    if (status) {
+        return status;
+    }
+    status = check_backend(SRTP_CRYPTO_SMALL_PACKET_LEN, 1);
+    if (status) {
+        return status;
+    }
+
+    status = srtp_crypto_kernel_benchmark_cipher_types();
+    if (status) {
+        return status;
+    }
+
+    /* either may now be picked by size, but priority still decides at 0 */
+    status = check_backend(0, 1);
+    if (status) {
+        return status;
+    }
+    status = check_backend(SRTP_CRYPTO_SMALL_PACKET_LEN, -1);
+    if (status) {
+        return status;
+    }
+    return check_backend(SRTP_CRYPTO_LARGE_PACKET_LEN, -1);
+}
+
+static srtp_err_status_t time_kernel(clock_t first_init)
+{
+    srtp_err_status_t status;
+    clock_t timer;
+
+    printf("first srtp_crypto_kernel_init():\t%10.1f usec\n",
+           elapsed_usec(first_init));
+
+    timer = clock();
+    status = alloc_types();
+    timer = clock() - timer;
+    if (status) {
+        return status;
+    }
+    printf("first cipher and auth allocation:\t%10.1f usec\n",
+           elapsed_usec(timer));
+
+    timer = clock();
+    for (int i = 0; i < NUM_INIT_CYCLES; i++) {
+        status = srtp_crypto_kernel_shutdown();
+        if (status) {
+            return status;
+        }
+        status = srtp_crypto_kernel_init();
+        if (status) {
+            return status;
+        }
+    }
+    timer = clock() - timer;
+    printf("shutdown and init (cached self-tests):\t%10.1f usec\n",
+           elapsed_usec(timer) / NUM_INIT_CYCLES);
+
+    timer = clock();
+    status = srtp_crypto_kernel_status();
+    timer = clock() - timer;
+    if (status) {
+        return status;
+    }
+    printf("all self-tests (kernel status):\t\t%10.1f usec\n",
+           elapsed_usec(timer));
+
+    return srtp_err_status_ok;
+}
+
 int main(int argc, char *argv[])
 {
     int q;
     int do_validation = 0;
+    int do_timing = 0;
     srtp_err_status_t status;
+    clock_t timer;
 
     if (argc == 1) {
         usage(argv[0]);
     }
 
+    /* lazy self-tests must be selected before the kernel is initialized */
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '-' && argv[i][1] == 'l' && argv[i][2] == '\0') {
+            srtp_crypto_kernel_set_lazy_self_test(true);
+        }
+    }
+
     /* initialize kernel - we need to do this before anything else */
+    timer = clock();
     status = srtp_crypto_kernel_init();
+    timer = clock() - timer;
     if (status) {
         printf("error: srtp_crypto_kernel init failed\n");
         exit(1);
@@ -78,7 +274,7 @@ int main(int argc, char *argv[])
 
     /* process input arguments */
     while (1) {
-        q = getopt_s(argc, argv, "vd:");
+        q = getopt_s(argc, argv, "vtld:");
         if (q == -1) {
             break;
         }
@@ -86,6 +282,11 @@ int main(int argc, char *argv[])
         case 'v':
             do_validation = 1;
             break;
+        case 't':
+            do_timing = 1;
+            break;
+        case 'l':
+            break;
         case 'd':
             status = srtp_crypto_kernel_set_debug_module(optarg_s, true);
             if (status) {
@@ -98,7 +299,27 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (do_timing) {
+        status = time_kernel(timer);
+        if (status) {
+            printf("error: timing failed with error code %d\n", status);
+            exit(1);
+        }
+    }
+
     if (do_validation) {
+        printf("checking srtp_crypto_kernel allocation...\n");
+        status = alloc_types();
+        if (status) {
+            printf("failed\n");
+            exit(1);
+        }
+        printf("checking srtp_crypto_kernel cipher backends...\n");
+        status = check_backends();
+        if (status) {
+            printf("failed\n");
+            exit(1);
+        }
         printf("checking srtp_crypto_kernel status...\n");
         status = srtp_crypto_kernel_status();
         if (status) {
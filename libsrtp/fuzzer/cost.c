@@ -0,0 +1,184 @@
+/* Per-call cost measurement for the fuzzer's --cost_budget mode.
+ *
+ * The cost of each srtp_unprotect()/srtp_unprotect_rtcp() call is
+ * measured in retired instructions (Linux perf events), TSC cycles
+ * (x86) or nanoseconds, whichever is requested and available.
+ * Instructions are preferred: unlike time they do not depend on
+ * machine load, so a slow input found once stays slow when it is
+ * replayed.
+ *
+ * The log2 of the most expensive call of an input is also reported to
+ * libFuzzer as an extra coverage counter, so inputs reaching a new cost
+ * class are kept in the corpus and mutated further.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "cost.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define FUZZ_HAVE_TSC
+#endif
+
+enum fuzz_cost_metric {
+    fuzz_cost_instructions,
+    fuzz_cost_cycles,
+    fuzz_cost_nsec,
+};
+
+static enum fuzz_cost_metric g_metric = fuzz_cost_nsec;
+static int g_perf_fd = -1;
+static uint64_t g_start;
+static uint64_t g_max;
+
+#if defined(__linux__) && defined(__clang__)
+/* One counter per power of two of the most expensive call */
+__attribute__((used, section("__libfuzzer_extra_counters"))) static uint8_t
+    g_cost_counters[64];
+#endif
+
+static uint64_t fuzz_nsec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+#ifdef __linux__
+static int fuzz_open_instruction_counter(void)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+static uint64_t fuzz_cost_now(void)
+{
+    switch (g_metric) {
+#ifdef __linux__
+    case fuzz_cost_instructions: {
+        uint64_t count = 0;
+        if (read(g_perf_fd, &count, sizeof(count)) != sizeof(count)) {
+            /* measure time for the rest of the run */
+            printf("Instruction counter failed, measuring nsec\n");
+            close(g_perf_fd);
+            g_perf_fd = -1;
+            g_metric = fuzz_cost_nsec;
+            return fuzz_nsec();
+        }
+        return count;
+    }
+#endif
+#ifdef FUZZ_HAVE_TSC
+    case fuzz_cost_cycles:
+        return __rdtsc();
+#endif
+    default:
+        return fuzz_nsec();
+    }
+}
+
+/* Selects the metric; an unavailable metric falls back to the next
+ * cheaper one, so that the fuzzer still runs on any host.  Returns
+ * false only for an unknown metric name. */
+bool fuzz_cost_init(const char *metric)
+{
+    if (metric == NULL || strcmp(metric, "instructions") == 0) {
+        g_metric = fuzz_cost_instructions;
+    } else if (strcmp(metric, "cycles") == 0) {
+        g_metric = fuzz_cost_cycles;
+    } else if (strcmp(metric, "nsec") == 0) {
+        g_metric = fuzz_cost_nsec;
+    } else {
+        return false;
+    }
+
+    if (g_metric == fuzz_cost_instructions) {
+#ifdef __linux__
+        g_perf_fd = fuzz_open_instruction_counter();
+#endif
+        if (g_perf_fd < 0) {
+            printf("Instruction counter unavailable, measuring cycles\n");
+            g_metric = fuzz_cost_cycles;
+        }
+    }
+#ifndef FUZZ_HAVE_TSC
+    if (g_metric == fuzz_cost_cycles) {
+        g_metric = fuzz_cost_nsec;
+    }
+#endif
+
+    return true;
+}
+
+const char *fuzz_cost_metric_name(void)
+{
+    switch (g_metric) {
+    case fuzz_cost_instructions:
+        return "instructions";
+    case fuzz_cost_cycles:
+        return "cycles";
+    default:
+        return "nsec";
+    }
+}
+
+void fuzz_cost_reset(void)
+{
+    g_max = 0;
+}
+
+void fuzz_cost_begin(void)
+{
+    g_start = fuzz_cost_now();
+}
+
+void fuzz_cost_end(void)
+{
+    enum fuzz_cost_metric metric = g_metric;
+    uint64_t now = fuzz_cost_now();
+    uint64_t cost;
+
+    /* g_start is in other units if the metric fell back during the call */
+    if (g_metric != metric || now < g_start) {
+        return;
+    }
+    cost = now - g_start;
+
+    if (cost > g_max) {
+        g_max = cost;
+#if defined(__linux__) && defined(__clang__)
+        {
+            unsigned int bucket = 0;
+            while ((cost >> bucket) > 1 && bucket < 63) {
+                bucket++;
+            }
+            g_cost_counters[bucket] = 1;
+        }
+#endif
+    }
+}
+
+uint64_t fuzz_cost_max(void)
+{
+    return g_max;
+}
@@ -0,0 +1,8 @@
+#include <stdbool.h>
+#include <stdint.h>
+bool fuzz_cost_init(const char *metric);
+const char *fuzz_cost_metric_name(void);
+void fuzz_cost_reset(void);
+void fuzz_cost_begin(void);
+void fuzz_cost_end(void);
+uint64_t fuzz_cost_max(void);
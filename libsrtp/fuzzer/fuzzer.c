@@ -11,12 +11,16 @@
 #include "fuzzer.h"
 #include "mt19937.h"
 #include "testmem.h"
+#include "cost.h"
 
 /* Global variables */
 static bool g_no_align = false; /* Can be enabled with --no_align */
 static bool g_post_init =
     false; /* Set to true once past initialization phase */
 static bool g_write_input = false;
+static uint64_t g_cost_budget = 0; /* Set with --cost_budget=<n> */
+static const char *g_cost_dir = "slow"; /* Set with --cost_dir=<dir> */
+static bool g_cost_abort = false;       /* Can be enabled with --cost_abort */
 
 #ifdef FUZZ_32BIT
 #include <sys/mman.h>
@@ -199,7 +203,16 @@ static srtp_err_status_t fuzz_srtp_unprotect(srtp_t srtp_sender,
                                              size_t *len,
                                              size_t mki)
 {
-    return srtp_unprotect(srtp_sender, hdr, *len, hdr, len);
+    srtp_err_status_t s;
+
+    if (g_cost_budget != 0) {
+        fuzz_cost_begin();
+    }
+    s = srtp_unprotect(srtp_sender, hdr, *len, hdr, len);
+    if (g_cost_budget != 0) {
+        fuzz_cost_end();
+    }
+    return s;
 }
 
 static srtp_err_status_t fuzz_srtp_protect_rtcp(srtp_t srtp_sender,
@@ -219,7 +232,16 @@ static srtp_err_status_t fuzz_srtp_unprotect_rtcp(srtp_t srtp_sender,
                                                   size_t *len,
                                                   size_t mki)
 {
-    return srtp_unprotect_rtcp(srtp_sender, hdr, *len, hdr, len);
+    srtp_err_status_t s;
+
+    if (g_cost_budget != 0) {
+        fuzz_cost_begin();
+    }
+    s = srtp_unprotect_rtcp(srtp_sender, hdr, *len, hdr, len);
+    if (g_cost_budget != 0) {
+        fuzz_cost_end();
+    }
+    return s;
 }
 
 /* Get protect length functions */
@@ -681,11 +703,47 @@ static void fuzz_write_input(const uint8_t *data, size_t size)
     fclose(fp);
 }
 
+/* Stores an input whose most expensive unprotect call exceeded the cost
+ * budget in g_cost_dir, named after a hash of its contents so that
+ * rediscovering the same input does not create duplicates.
+ */
+static void fuzz_write_slow_input(const uint8_t *data,
+                                  size_t size,
+                                  uint64_t cost)
+{
+    char path[PATH_MAX];
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    FILE *fp;
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+    }
+
+    snprintf(path, sizeof(path), "%s/slow-%016llx", g_cost_dir,
+             (unsigned long long)hash);
+
+    printf("Slow input: %llu %s per call exceeds budget of %llu, "
+           "saved as %s\n",
+           (unsigned long long)cost, fuzz_cost_metric_name(),
+           (unsigned long long)g_cost_budget, path);
+
+    fp = fopen(path, "wb");
+    if (fp == NULL) {
+        return;
+    }
+    if (size != 0 && fwrite(data, size, 1, fp) != 1) {
+        printf("Cannot write\n");
+    }
+    fclose(fp);
+}
+
 int LLVMFuzzerInitialize(int *argc, char ***argv)
 {
     char **_argv = *argv;
     int i;
     bool no_custom_event_handler = false;
+    const char *cost_metric = NULL;
 
     if (srtp_init() != srtp_err_status_ok) {
         /* Shouldn't happen */
@@ -699,6 +757,14 @@ int LLVMFuzzerInitialize(int *argc, char ***argv)
             no_custom_event_handler = true;
         } else if (strcmp("--write_input", _argv[i]) == 0) {
             g_write_input = true;
+        } else if (strncmp("--cost_budget=", _argv[i], 14) == 0) {
+            g_cost_budget = strtoull(_argv[i] + 14, NULL, 0);
+        } else if (strncmp("--cost_metric=", _argv[i], 14) == 0) {
+            cost_metric = _argv[i] + 14;
+        } else if (strncmp("--cost_dir=", _argv[i], 11) == 0) {
+            g_cost_dir = _argv[i] + 11;
+        } else if (strcmp("--cost_abort", _argv[i]) == 0) {
+            g_cost_abort = true;
         }
 #ifdef FUZZ_32BIT
         else if (strcmp("--no_mmap", _argv[i]) == 0) {
@@ -711,6 +777,15 @@ int LLVMFuzzerInitialize(int *argc, char ***argv)
         }
     }
 
+    if (g_cost_budget != 0) {
+        if (fuzz_cost_init(cost_metric) == false) {
+            printf("Invalid cost metric: %s\n", cost_metric);
+            exit(0);
+        }
+        printf("Cost budget: %llu %s per unprotect call\n",
+               (unsigned long long)g_cost_budget, fuzz_cost_metric_name());
+    }
+
     if (no_custom_event_handler == false) {
         if (srtp_install_event_handler(fuzz_srtp_event_handler) !=
             srtp_err_status_ok) {
@@ -736,6 +811,8 @@ int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
     srtp_policy_t *policy_chain = NULL, *policy_chain_2 = NULL;
     uint32_t randseed;
     static bool firstrun = true;
+    const uint8_t *input = data;
+    const size_t input_size = size;
 
     if (firstrun == true) {
         /* TODO version check etc and send it to MSAN */
@@ -751,6 +828,10 @@ int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
         fuzz_write_input(data, size);
     }
 
+    if (g_cost_budget != 0) {
+        fuzz_cost_reset();
+    }
+
     EXTRACT_IF(&randseed, data, size, sizeof(randseed));
     fuzz_mt19937_init(randseed);
     srand(randseed);
@@ -831,5 +912,12 @@ end:
     }
     fuzz_mt19937_destroy();
 
+    if (g_cost_budget != 0 && fuzz_cost_max() > g_cost_budget) {
+        fuzz_write_slow_input(input, input_size, fuzz_cost_max());
+        if (g_cost_abort == true) {
+            abort();
+        }
+    }
+
     return 0;
 }
@@ -220,6 +220,8 @@ typedef enum {
 
 typedef struct srtp_ctx_t_ srtp_ctx_t;
 
+typedef struct srtp_stream_ctx_t_ srtp_stream_ctx_t;
+
 /**
  * @brief srtp_sec_serv_t describes a set of security services.
  *
@@ -352,6 +354,18 @@ typedef struct srtp_policy_t {
     size_t enc_xtn_hdr_count;   /**< Number of entries in list of header */
                                 /**<  ids.                               */
     struct srtp_policy_t *next; /**< Pointer to next stream policy.      */
+    size_t window_size_max;     /**< If non-zero, the replay window of   */
+                                /**< each stream adapts to the observed  */
+                                /**< reordering, between window_size and */
+                                /**< this size.                          */
+    bool exportable;            /**< Whether the streams keep copies of  */
+                                /**< their derived session keys, so that */
+                                /**< srtp_session_export() can write     */
+                                /**< them out.                           */
+    size_t expected_payload_len; /**< Typical RTP payload length, or 0.  */
+                                 /**< Where a cipher has several         */
+                                 /**< implementations, the one that is   */
+                                 /**< fastest for this length is used.   */
 } srtp_policy_t;
 
 /**
@@ -368,6 +382,16 @@ typedef struct srtp_policy_t {
  */
 typedef srtp_ctx_t *srtp_t;
 
+/**
+ * @brief An srtp_stream_t points to an SRTP stream structure.
+ *
+ * Streams are normally created and owned by a session.  The typedef is
+ * exposed, and is opaque, so that a stream can be built apart from its
+ * session with srtp_stream_create() and handed over with
+ * srtp_stream_attach().
+ */
+typedef srtp_stream_ctx_t *srtp_stream_t;
+
 /**
  * @brief srtp_init() initializes the srtp library.
  *
@@ -434,6 +458,99 @@ srtp_err_status_t srtp_protect(srtp_t ctx,
                                size_t *srtp_len,
                                size_t mki_index);
 
+/**
+ * @brief srtp_protect_ticket_t is a packet index reserved by
+ * srtp_protect_reserve() for a later srtp_protect_complete().
+ *
+ * The contents are private to libSRTP.
+ */
+typedef struct srtp_protect_ticket_t {
+    srtp_stream_t stream; /**< stream the index was reserved on      */
+    size_t mki_index;     /**< master key to protect the packet with */
+    uint64_t index;       /**< reserved packet index (ROC and SEQ)   */
+} srtp_protect_ticket_t;
+
+/**
+ * @brief srtp_protect_reserve() does the part of srtp_protect() that
+ * has to be serialized per stream.
+ *
+ * srtp_protect() is split in two so that the packets of one stream can
+ * be encrypted on several threads.  srtp_protect_reserve() finds (or
+ * clones) the stream, counts the packet against the key usage limit and
+ * claims its packet index in the replay database; it is cheap, and must
+ * be called in packet order under the same serialization as
+ * srtp_protect().  srtp_protect_complete() then encrypts and
+ * authenticates the packet and may run on any thread, concurrently with
+ * other srtp_protect_complete() calls on the same stream.  Keeping the
+ * output in the order the tickets were issued preserves packet order.
+ *
+ * Concurrent completion needs transforms that keep their per-packet
+ * state apart from the stream, as the built-in AES-ICM, AES-GCM and
+ * HMAC-SHA1 do.  The transforms of the external crypto libraries keep
+ * it in the stream; for their streams srtp_protect_reserve() returns
+ * srtp_err_status_no_such_op and srtp_protect() must be used instead.
+ *
+ * The stream must not be removed, nor the session updated or
+ * deallocated, while a ticket for it is outstanding.
+ *
+ * @param ctx is the session to use for processing the packet.
+ *
+ * @param rtp is a pointer to the RTP packet.
+ *
+ * @param rtp_len is the length in octets of the RTP packet.
+ *
+ * @param srtp_len is the length of the output buffer that will be given
+ * to srtp_protect_complete(), so that no index is used up on a packet
+ * that does not fit it.
+ *
+ * @param mki_index is the index of the master key to use, as for
+ * srtp_protect().
+ *
+ * @param ticket is filled in for srtp_protect_complete().
+ *
+ * @return the same values as srtp_protect(), and
+ *    - srtp_err_status_no_such_op    the stream's transforms cannot be
+ *                                    used by concurrent completions
+ */
+srtp_err_status_t srtp_protect_reserve(srtp_t ctx,
+                                       const uint8_t *rtp,
+                                       size_t rtp_len,
+                                       size_t srtp_len,
+                                       size_t mki_index,
+                                       srtp_protect_ticket_t *ticket);
+
+/**
+ * @brief srtp_protect_complete() encrypts and authenticates a packet
+ * whose index was reserved with srtp_protect_reserve().
+ *
+ * @param ticket is the ticket srtp_protect_reserve() returned for the
+ * packet.
+ *
+ * @param rtp is a pointer to the RTP packet, unchanged since it was
+ * passed to srtp_protect_reserve().
+ *
+ * @param rtp_len is the length in octets of the RTP packet.
+ *
+ * @param srtp is a pointer to the output buffer, which may be rtp.
+ *
+ * @param srtp_len is the length of the output buffer before the call,
+ * and of the SRTP packet after it.
+ *
+ * @return
+ *    - srtp_err_status_ok            no problems
+ *    - srtp_err_status_bad_param     the packet is not the one the ticket
+ *                                    was issued for
+ *    - srtp_err_status_buffer_small  the output buffer is smaller than
+ *                                    the one given to
+ *                                    srtp_protect_reserve()
+ *    - [other]                       error in the cryptographic mechanisms
+ */
+srtp_err_status_t srtp_protect_complete(const srtp_protect_ticket_t *ticket,
+                                        const uint8_t *rtp,
+                                        size_t rtp_len,
+                                        uint8_t *srtp,
+                                        size_t *srtp_len);
+
 /**
  * @brief srtp_unprotect() is the Secure RTP receiver-side packet
  * processing function.
@@ -485,6 +602,214 @@ srtp_err_status_t srtp_unprotect(srtp_t ctx,
                                  uint8_t *rtp,
                                  size_t *rtp_len);
 
+/**
+ * @brief srtp_unprotect_resume_t records where srtp_unprotect_partial()
+ * stopped decrypting, so that srtp_unprotect_finish() can carry on.
+ *
+ * The contents are private to libSRTP; the struct is public only so that
+ * it can be kept next to the packet buffer.
+ */
+typedef struct srtp_unprotect_resume_t {
+    uint32_t ssrc;      /**< SSRC of the packet in host byte order       */
+    uint64_t index;     /**< packet index the keystream was derived from */
+    size_t mki_index;   /**< index of the master key that was used       */
+    size_t enc_start;   /**< offset of the encrypted payload             */
+    size_t offset;      /**< octets of the packet that are plaintext     */
+    size_t length;      /**< length of the complete RTP packet           */
+} srtp_unprotect_resume_t;
+
+/**
+ * @brief srtp_unprotect_partial() authenticates an SRTP packet but
+ * decrypts only the start of its payload.
+ *
+ * The call does everything srtp_unprotect() does - the packet is
+ * authenticated, the replay database and key usage are updated, and
+ * encrypted header extensions are decrypted - except that only the first
+ * payload_len octets of the payload are decrypted.  That is enough for a
+ * middlebox to read a codec payload descriptor and decide whether to
+ * forward the packet; the rest of the payload is copied to rtp still
+ * encrypted, and srtp_unprotect_finish() decrypts it if the packet is
+ * kept.  A packet that is dropped needs no further call.
+ *
+ * AEAD ciphers authenticate and decrypt in one pass, so with them the
+ * whole payload is decrypted here and srtp_unprotect_finish() has
+ * nothing left to do.
+ *
+ * @param ctx is the srtp_t which applies to the particular packet.
+ *
+ * @param srtp is a pointer to the header of the SRTP packet.
+ *
+ * @param srtp_len is the length in octets of the SRTP packet.
+ *
+ * @param rtp is a pointer to the output buffer, which may be srtp.
+ *
+ * @param rtp_len is a pointer to the length of the rtp buffer before the
+ * call, and of the complete RTP packet after it.
+ *
+ * @param payload_len is the number of payload octets to decrypt.
+ *
+ * @param resume is filled in for srtp_unprotect_finish().
+ *
+ * @return the same values as srtp_unprotect().
+ */
+srtp_err_status_t srtp_unprotect_partial(srtp_t ctx,
+                                         const uint8_t *srtp,
+                                         size_t srtp_len,
+                                         uint8_t *rtp,
+                                         size_t *rtp_len,
+                                         size_t payload_len,
+                                         srtp_unprotect_resume_t *resume);
+
+/**
+ * @brief srtp_unprotect_finish() decrypts the part of a packet that
+ * srtp_unprotect_partial() left encrypted.
+ *
+ * The packet is decrypted in place.  It is not authenticated again and
+ * the replay database is not consulted, as both were done by
+ * srtp_unprotect_partial().  The stream must still be in the session.
+ *
+ * @param ctx is the srtp_t that was passed to srtp_unprotect_partial().
+ *
+ * @param rtp is the packet returned by srtp_unprotect_partial().
+ *
+ * @param rtp_len is the length of the packet returned by
+ * srtp_unprotect_partial().
+ *
+ * @param resume is the state filled in by srtp_unprotect_partial().
+ *
+ * @return
+ *    - srtp_err_status_ok          if the packet is now fully decrypted.
+ *    - srtp_err_status_no_ctx      if the stream has been removed.
+ *    - srtp_err_status_bad_param   if rtp_len or resume do not match.
+ *    - [other]  if there has been an error in the cryptographic mechanisms.
+ */
+srtp_err_status_t srtp_unprotect_finish(srtp_t ctx,
+                                        uint8_t *rtp,
+                                        size_t rtp_len,
+                                        const srtp_unprotect_resume_t *resume);
+
+/**
+ * @brief srtp_protect_double() applies the RFC 8723 double transform to
+ * an RTP packet.
+ *
+ * The inner (end-to-end) transform is applied with the session inner to
+ * the payload and to the RTP header without its extension.  Its tag and
+ * an original header block (OHB) recording no header changes are
+ * appended, and the outer (hop-by-hop) transform is applied with the
+ * session outer to the whole packet, as in srtp_protect().  An AEAD
+ * layer is encrypted in one call over its whole text, so the GCM layers
+ * of the profile below run one after the other; layers of AES-CM with
+ * HMAC-SHA1 are run together over each chunk of the payload.
+ *
+ * For the DOUBLE_AEAD_AES_128_GCM_AEAD_AES_128_GCM profile the first half
+ * of the double master key and salt keys the inner session and the second
+ * half the outer session.  Streams of either session must use
+ * confidentiality and authentication and must not use an MKI.
+ *
+ * @param inner is the end-to-end session.
+ *
+ * @param outer is the hop-by-hop session; it must differ from inner.
+ *
+ * @param rtp is a pointer to the RTP packet.
+ *
+ * @param rtp_len is the length of the RTP packet in octets.
+ *
+ * @param srtp is a pointer to the output buffer; it may equal rtp.
+ *
+ * @param srtp_len is the size of the output buffer before the call and
+ * the length of the protected packet after it.  The buffer needs room for
+ * both tags and one octet of OHB.
+ *
+ * @return
+ *    - srtp_err_status_ok            if the packet was protected.
+ *    - srtp_err_status_buffer_small  if the output buffer is too small.
+ *    - srtp_err_status_bad_param     if a stream does not fit the double
+ *                                    transform.
+ *    - [other]  if there has been an error in the cryptographic mechanisms.
+ */
+srtp_err_status_t srtp_protect_double(srtp_t inner,
+                                      srtp_t outer,
+                                      const uint8_t *rtp,
+                                      size_t rtp_len,
+                                      uint8_t *srtp,
+                                      size_t *srtp_len);
+
+/**
+ * @brief srtp_unprotect_double() removes the RFC 8723 double transform
+ * from an SRTP packet.
+ *
+ * The outer transform is verified and removed with the session outer,
+ * the RTP header is restored from the OHB, and the inner transform is
+ * verified and removed with the session inner.  The payload is
+ * authenticated and decrypted in one walk per layer.  If an error is
+ * returned the contents of the output buffer are undefined.
+ *
+ * @param inner is the end-to-end session.
+ *
+ * @param outer is the hop-by-hop session; it must differ from inner.
+ *
+ * @param srtp is a pointer to the SRTP packet.
+ *
+ * @param srtp_len is the length of the SRTP packet in octets.
+ *
+ * @param rtp is a pointer to the output buffer; it may equal srtp.
+ *
+ * @param rtp_len is the size of the output buffer before the call and the
+ * length of the RTP packet after it.
+ *
+ * @return
+ *    - srtp_err_status_ok          if the RTP packet is valid.
+ *    - srtp_err_status_auth_fail   if either layer failed authentication.
+ *    - srtp_err_status_replay_fail if the packet is a replay in either
+ *                                  layer.
+ *    - srtp_err_status_parse_err   if the packet or its OHB is malformed.
+ *    - [other]  if there has been an error in the cryptographic mechanisms.
+ */
+srtp_err_status_t srtp_unprotect_double(srtp_t inner,
+                                        srtp_t outer,
+                                        const uint8_t *srtp,
+                                        size_t srtp_len,
+                                        uint8_t *rtp,
+                                        size_t *rtp_len);
+
+/**
+ * @brief srtp_reprotect_outer() replaces the hop-by-hop layer of an RFC
+ * 8723 double protected packet, as done by a media distributor.
+ *
+ * The outer transform of the incoming hop is verified and removed with
+ * the session outer_in and the packet is protected again with the session
+ * outer_out in the same walk.  The inner ciphertext, the inner tag and the
+ * OHB are passed through unchanged, so the distributor never sees the
+ * media.  The header is not modified.  If an error is returned the
+ * contents of the output buffer are undefined.
+ *
+ * @param outer_in is the hop-by-hop session of the incoming hop.
+ *
+ * @param outer_out is the hop-by-hop session of the outgoing hop.
+ *
+ * @param srtp_in is a pointer to the incoming SRTP packet.
+ *
+ * @param srtp_in_len is the length of the incoming SRTP packet in octets.
+ *
+ * @param srtp_out is a pointer to the output buffer; it may equal srtp_in.
+ *
+ * @param srtp_out_len is the size of the output buffer before the call and
+ * the length of the outgoing packet after it.
+ *
+ * @return
+ *    - srtp_err_status_ok          if the packet was protected again.
+ *    - srtp_err_status_auth_fail   if the incoming hop failed
+ *                                  authentication.
+ *    - srtp_err_status_replay_fail if the packet is a replay.
+ *    - [other]  if there has been an error in the cryptographic mechanisms.
+ */
+srtp_err_status_t srtp_reprotect_outer(srtp_t outer_in,
+                                       srtp_t outer_out,
+                                       const uint8_t *srtp_in,
+                                       size_t srtp_in_len,
+                                       uint8_t *srtp_out,
+                                       size_t *srtp_out_len);
+
 /**
  * @brief srtp_create() allocates and initializes an SRTP session.
  *
@@ -551,6 +876,94 @@ srtp_err_status_t srtp_stream_add(srtp_t session, const srtp_policy_t *policy);
  */
 srtp_err_status_t srtp_stream_remove(srtp_t session, uint32_t ssrc);
 
+/**
+ * @brief srtp_stream_create() allocates and initializes an SRTP stream
+ * that does not belong to any session.
+ *
+ * The function call srtp_stream_create(&stream, policy) does the work of
+ * srtp_stream_add() that does not touch a session: it allocates the
+ * stream and derives and initializes the session keys for every master
+ * key in the policy.  It may therefore be called on any thread, without
+ * being serialized with packet processing, and the result later attached
+ * to a session with srtp_stream_attach().
+ *
+ * @param stream is set to the new stream on success.
+ *
+ * @param policy describes the stream.  Only the first element of a
+ * policy list is used, and its SSRC type must be ssrc_specific.
+ *
+ * @return
+ *    - srtp_err_status_ok           if stream creation succeeded.
+ *    - srtp_err_status_bad_param    if the policy is not for a specific
+ *                                   SSRC.
+ *    - srtp_err_status_alloc_fail   if stream allocation failed
+ *    - srtp_err_status_init_fail    if stream initialization failed.
+ */
+srtp_err_status_t srtp_stream_create(srtp_stream_t *stream,
+                                     const srtp_policy_t *policy);
+
+/**
+ * @brief srtp_stream_attach() adds a stream created by
+ * srtp_stream_create() to a session.
+ *
+ * No keys are derived; the stream is inserted into the session's stream
+ * list in amortized constant time.  Like srtp_stream_add(), the call must
+ * be serialized with other calls on the same session.  On success the
+ * session owns the stream; on failure the caller still does.
+ *
+ * @param session is the SRTP session to which the stream is added.
+ *
+ * @param stream is the stream to add.
+ *
+ * @return
+ *    - srtp_err_status_ok           if the stream was attached.
+ *    - srtp_err_status_bad_param    if the session already has a stream
+ *                                   with the same SSRC.
+ *    - srtp_err_status_alloc_fail   if the stream list could not grow.
+ *    - [other]                      otherwise.
+ */
+srtp_err_status_t srtp_stream_attach(srtp_t session, srtp_stream_t stream);
+
+/**
+ * @brief srtp_stream_detach() removes a stream from a session without
+ * deallocating it.
+ *
+ * The function call srtp_stream_detach(session, ssrc, &stream) is the
+ * reverse of srtp_stream_attach(): the stream is taken out of the
+ * session and handed to the caller, who can free it with
+ * srtp_stream_destroy() on any thread.  Streams that the session
+ * cloned from its wildcard template share their keys with it and own
+ * little else, so those are deallocated immediately and stream is set
+ * to NULL.
+ *
+ * @param session is the SRTP session from which the stream is removed.
+ *
+ * @param ssrc is the SSRC value of the stream in host byte order.
+ *
+ * @param stream is set to the detached stream, or to NULL.
+ *
+ * @return
+ *    - srtp_err_status_ok     if the stream was removed.
+ *    - srtp_err_status_no_ctx if the session has no stream for ssrc.
+ *    - [other]                otherwise.
+ */
+srtp_err_status_t srtp_stream_detach(srtp_t session,
+                                     uint32_t ssrc,
+                                     srtp_stream_t *stream);
+
+/**
+ * @brief srtp_stream_destroy() deallocates a stream that is not attached
+ * to a session.
+ *
+ * @param stream is a stream returned by srtp_stream_create() or
+ * srtp_stream_detach(); it may be NULL.
+ *
+ * @return
+ *    - srtp_err_status_ok     if the stream was deallocated.
+ *    - [other]                otherwise.
+ */
+srtp_err_status_t srtp_stream_destroy(srtp_stream_t stream);
+
 /**
  * @brief srtp_update() updates all streams in the session.
  *
@@ -1010,7 +1423,9 @@ typedef enum {
     srtp_profile_null_sha1_80 = 5,
     srtp_profile_null_sha1_32 = 6,
     srtp_profile_aead_aes_128_gcm = 7,
-    srtp_profile_aead_aes_256_gcm = 8
+    srtp_profile_aead_aes_256_gcm = 8,
+    srtp_profile_double_aead_aes_128_gcm_aead_aes_128_gcm = 9,
+    srtp_profile_double_aead_aes_256_gcm_aead_aes_256_gcm = 10
 } srtp_profile_t;
 
 /**
@@ -1212,6 +1627,547 @@ srtp_err_status_t srtp_unprotect_rtcp(srtp_t ctx,
                                       uint8_t *rtcp,
                                       size_t *rtcp_len);
 
+/**
+ * @brief srtp_framed_packet_t describes one packet processed by
+ * srtp_unprotect_framed().
+ */
+typedef struct srtp_framed_packet_t {
+    size_t offset; /**< Offset of the unprotected packet from the start */
+                   /**< of the buffer; 32-bit aligned where possible.  */
+    size_t len;    /**< Length of the unprotected packet, zero if      */
+                   /**< status is not srtp_err_status_ok.              */
+    bool is_rtcp;  /**< Whether the packet was demultiplexed as RTCP. */
+    srtp_err_status_t status; /**< Result of unprotecting the packet. */
+} srtp_framed_packet_t;
+
+/**
+ * @brief srtp_unprotect_framed() unprotects a run of RFC 4571 framed
+ * SRTP and SRTCP packets, as received over ICE-TCP or TURN-TCP.
+ *
+ * The buffer holds packets each preceded by a 16-bit length in
+ * network byte order.  Packets are demultiplexed as described in RFC
+ * 5761, unprotected in place with srtp_unprotect() or
+ * srtp_unprotect_rtcp(), and described in order in packets.  A
+ * trailing incomplete frame is left untouched, so a caller can keep
+ * the unconsumed bytes and prepend them to its next read.
+ *
+ * The buffer need not be aligned.  Before a packet is unprotected it
+ * is moved down to the first 32-bit aligned offset after the previous
+ * packet, into the room freed by the length prefixes and the removed
+ * SRTP trailers.  Only when that room is too small, which happens to
+ * the first packet if buf is one octet past a 32-bit boundary and
+ * otherwise only for streams without an authentication tag, is the
+ * packet copied to an aligned scratch buffer, unprotected there and
+ * copied back to its original offset.  The contents of the consumed
+ * part of the buffer outside the reported packets are undefined.
+ *
+ * @param ctx is the srtp_t which applies to the packets.
+ *
+ * @param buf is a pointer to the framed packets.
+ *
+ * @param buf_len is the number of octets in buf.
+ *
+ * @param consumed is set to the number of octets of buf that were
+ * processed, always the end of a complete frame.
+ *
+ * @param packets is an array receiving one entry per processed packet.
+ *
+ * @param num_packets is a pointer to the capacity of packets before
+ * the call, and to the number of entries filled in after it.
+ * Processing stops early when packets is full.
+ *
+ * @return
+ *    - srtp_err_status_ok         if the buffer was processed; the result
+ *                                 of each packet is in its status field.
+ *    - srtp_err_status_bad_param  if a required argument is NULL.
+ */
+srtp_err_status_t srtp_unprotect_framed(srtp_t ctx,
+                                        uint8_t *buf,
+                                        size_t buf_len,
+                                        size_t *consumed,
+                                        srtp_framed_packet_t *packets,
+                                        size_t *num_packets);
+
+/**
+ * @brief srtp_packet_info_t describes a packet unprotected by
+ * srtp_unprotect_mux().
+ */
+typedef struct srtp_packet_info_t {
+    bool is_rtcp;         /**< Whether the packet was demultiplexed as  */
+                          /**< RTCP.                                    */
+    uint8_t payload_type; /**< RTP payload type, or RTCP packet type.   */
+    uint16_t seq;         /**< RTP sequence number, zero for RTCP.      */
+    uint32_t ssrc;        /**< SSRC of the packet, in host order.       */
+    size_t header_len;    /**< Octets before the payload: the RTP       */
+                          /**< header with its CSRCs and extension, or  */
+                          /**< the first RTCP header.                   */
+    size_t payload_len;   /**< Octets after header_len, RTP padding     */
+                          /**< included.                                */
+} srtp_packet_info_t;
+
+/**
+ * @brief srtp_unprotect_mux() unprotects an SRTP or SRTCP packet received
+ * on a transport shared by RTP and RTCP.
+ *
+ * The packet is demultiplexed as described in RFC 5761, by the payload
+ * type range 64-95 in its second octet, and unprotected as by
+ * srtp_unprotect() or srtp_unprotect_rtcp(), with a single lookup of its
+ * SSRC.  On success the parsed header of the unprotected packet is
+ * described in info, so that the caller does not need to parse it again.
+ *
+ * @param ctx is the srtp_t which applies to the packet.
+ *
+ * @param srtp is a pointer to the SRTP or SRTCP packet.
+ *
+ * @param srtp_len is the length in octets of the protected packet.
+ *
+ * @param out is the buffer for the unprotected packet; it may be srtp.
+ *
+ * @param out_len is a pointer to the size of out before the call, and to
+ * the length of the unprotected packet after it.
+ *
+ * @param info is filled in on success; it may be NULL.
+ *
+ * @return
+ *    - srtp_err_status_ok         if the packet was unprotected.
+ *    - srtp_err_status_bad_param  if a required argument is NULL or the
+ *                                 packet is shorter than its fixed header.
+ *    - any other error that srtp_unprotect() or srtp_unprotect_rtcp()
+ *      returns.
+ */
+srtp_err_status_t srtp_unprotect_mux(srtp_t ctx,
+                                     const uint8_t *srtp,
+                                     size_t srtp_len,
+                                     uint8_t *out,
+                                     size_t *out_len,
+                                     srtp_packet_info_t *info);
+
+/**
+ * @brief srtp_mux_packet_t describes one packet passed to
+ * srtp_unprotect_mux_batch().
+ */
+typedef struct srtp_mux_packet_t {
+    uint8_t *data;            /**< Packet, unprotected in place.         */
+    size_t len;               /**< Length of the packet; after the call  */
+                              /**< the length of the unprotected packet, */
+                              /**< or zero if status is not ok.          */
+    srtp_packet_info_t info;  /**< Filled in if status is ok.            */
+    srtp_err_status_t status; /**< Result of unprotecting the packet.    */
+} srtp_mux_packet_t;
+
+/**
+ * @brief srtp_unprotect_mux_batch() unprotects a batch of packets, in
+ * place, as srtp_unprotect_mux() does.
+ *
+ * Consecutive packets of the same SSRC share one stream lookup.  Each
+ * packet's result is stored in its status field.  A packet that is not
+ * 32-bit aligned is unprotected in an aligned copy and copied back.
+ *
+ * @return
+ *    - srtp_err_status_ok         if the batch was processed.
+ *    - srtp_err_status_bad_param  if ctx is NULL, or packets is NULL and
+ *                                 num_packets is not zero.
+ */
+srtp_err_status_t srtp_unprotect_mux_batch(srtp_t ctx,
+                                           srtp_mux_packet_t *packets,
+                                           size_t num_packets);
+
+/**
+ * @brief An srtp_demux_t routes inbound packets for many sessions.
+ *
+ * A server with many sessions first has to find the session for a
+ * packet, typically from its transport 5-tuple, and srtp_unprotect() then
+ * looks the SSRC up again in the session.  A demultiplexer holds the
+ * streams of many sessions in a single hash table keyed by a
+ * caller-chosen context id and the SSRC, so srtp_demux_unprotect() finds
+ * the stream with one lookup.
+ *
+ * Each context id names one session.  A session's streams are indexed
+ * when it is added, and streams the session clones from its template are
+ * indexed when their first packet is unprotected through the
+ * demultiplexer.  Every srtp_stream_remove() and srtp_stream_detach() on
+ * a session, including those srtp_update() and srtp_stream_update() make,
+ * advances a counter in the session; the demultiplexer drops the entries
+ * it made at an earlier count and looks those streams up again, so a
+ * removed or detached stream is never used.  srtp_demux_stream_remove()
+ * removes a stream and its entry together.
+ *
+ * The demultiplexer does not own its sessions; a session must be removed
+ * with srtp_demux_remove_session() before it is deallocated.  Like a
+ * session, a demultiplexer must not be used from more than one thread at
+ * a time.
+ */
+typedef struct srtp_demux_ctx_t_ *srtp_demux_t;
+
+/**
+ * @brief srtp_demux_packet_t describes one packet passed to
+ * srtp_demux_unprotect_batch().
+ */
+typedef struct srtp_demux_packet_t {
+    uint64_t context_id; /**< Context the packet arrived on.           */
+    uint8_t *data;       /**< Packet, unprotected in place.            */
+    size_t len;          /**< Length of the packet; after the call the */
+                         /**< length of the unprotected packet, or     */
+                         /**< zero if status is not ok.                */
+    bool is_rtcp;        /**< Whether the packet is SRTCP.             */
+    srtp_err_status_t status; /**< Result of unprotecting the packet.  */
+} srtp_demux_packet_t;
+
+/**
+ * @brief srtp_demux_create() allocates an empty demultiplexer.
+ *
+ * @return
+ *    - srtp_err_status_ok          on success.
+ *    - srtp_err_status_alloc_fail  if allocation failed.
+ */
+srtp_err_status_t srtp_demux_create(srtp_demux_t *demux);
+
+/**
+ * @brief srtp_demux_dealloc() frees a demultiplexer, but not the
+ * sessions it holds.
+ */
+srtp_err_status_t srtp_demux_dealloc(srtp_demux_t demux);
+
+/**
+ * @brief srtp_demux_add_session() makes session the session for
+ * context_id and indexes its streams.
+ *
+ * Adding a session under a context id that is already in use replaces
+ * the earlier session.
+ *
+ * @return
+ *    - srtp_err_status_ok          on success.
+ *    - srtp_err_status_alloc_fail  if the table could not grow.
+ */
+srtp_err_status_t srtp_demux_add_session(srtp_demux_t demux,
+                                         uint64_t context_id,
+                                         srtp_t session);
+
+/**
+ * @brief srtp_demux_remove_session() removes the session for context_id
+ * and all of its streams from the demultiplexer.  The session itself is
+ * left alone.
+ *
+ * @return
+ *    - srtp_err_status_ok      on success.
+ *    - srtp_err_status_no_ctx  if no session was added for context_id.
+ */
+srtp_err_status_t srtp_demux_remove_session(srtp_demux_t demux,
+                                            uint64_t context_id);
+
+/**
+ * @brief srtp_demux_stream_remove() is srtp_stream_remove() for a session
+ * held in a demultiplexer.
+ *
+ * @param ssrc is the SSRC value of the stream in host byte order.
+ */
+srtp_err_status_t srtp_demux_stream_remove(srtp_demux_t demux,
+                                           uint64_t context_id,
+                                           uint32_t ssrc);
+
+/**
+ * @brief srtp_demux_unprotect() is srtp_unprotect() on the session for
+ * context_id.
+ *
+ * @return the values returned by srtp_unprotect(), and
+ * srtp_err_status_no_ctx if no session was added for context_id.
+ */
+srtp_err_status_t srtp_demux_unprotect(srtp_demux_t demux,
+                                       uint64_t context_id,
+                                       const uint8_t *srtp,
+                                       size_t srtp_len,
+                                       uint8_t *rtp,
+                                       size_t *rtp_len);
+
+/**
+ * @brief srtp_demux_unprotect_rtcp() is srtp_unprotect_rtcp() on the
+ * session for context_id, with the stream found in the demultiplexer.
+ *
+ * @return the values returned by srtp_unprotect_rtcp(), and
+ * srtp_err_status_no_ctx if no session was added for context_id.
+ */
+srtp_err_status_t srtp_demux_unprotect_rtcp(srtp_demux_t demux,
+                                            uint64_t context_id,
+                                            const uint8_t *srtcp,
+                                            size_t srtcp_len,
+                                            uint8_t *rtcp,
+                                            size_t *rtcp_len);
+
+/**
+ * @brief srtp_demux_unprotect_batch() unprotects a batch of packets, in
+ * place, that may belong to any of the demultiplexer's sessions.
+ *
+ * Where the compiler supports it, the hash table slots for the whole
+ * batch are prefetched before the first packet is processed, so that
+ * the memory accesses overlap.  Each packet's result is stored in its
+ * status field.
+ *
+ * @return
+ *    - srtp_err_status_ok         if the batch was processed.
+ *    - srtp_err_status_bad_param  if an argument is NULL.
+ */
+srtp_err_status_t srtp_demux_unprotect_batch(srtp_demux_t demux,
+                                             srtp_demux_packet_t *packets,
+                                             size_t num_packets);
+
+/**
+ * @brief srtp_ring_desc_t describes one packet in a memory region
+ * shared with a packet ring, e.g. an AF_XDP UMEM or a packet_mmap
+ * area.
+ *
+ * The packet occupies len octets at offset; headroom octets before it
+ * and tailroom octets after it are available to the library.  SRTP
+ * places the MKI and the authentication tag behind the payload, so
+ * only the tailroom is used: srtp_process_ring() fails a protect with
+ * srtp_err_status_buffer_small if it cannot hold the trailer.  The
+ * headroom is carried through, for the caller's own encapsulation.
+ */
+typedef struct srtp_ring_desc_t {
+    size_t offset;    /**< Offset of the packet in the region.          */
+    size_t len;       /**< Length of the packet; updated on completion. */
+    size_t headroom;  /**< Octets available in front of the packet.     */
+    size_t tailroom;  /**< Octets available behind the packet.          */
+    bool is_rtcp;     /**< Process as SRTCP instead of SRTP.            */
+    size_t mki_index; /**< MKI index used when protecting.              */
+    srtp_err_status_t status; /**< Result, set on completion.          */
+    void *user_data;  /**< Caller's cookie, passed through unchanged.   */
+} srtp_ring_desc_t;
+
+/**
+ * @brief srtp_ring_t is a single-producer, single-consumer ring of
+ * srtp_ring_desc_t.
+ *
+ * size must be a power of two.  producer and consumer are free running
+ * counters; entry i lives in desc[i & (size - 1)], the ring holds
+ * producer - consumer entries and is full when that equals size.
+ */
+typedef struct srtp_ring_t {
+    srtp_ring_desc_t *desc;
+    uint32_t size;
+    uint32_t producer; /**< Advanced by the side posting entries.   */
+    uint32_t consumer; /**< Advanced by the side removing entries.  */
+} srtp_ring_t;
+
+/**
+ * @brief srtp_ring_op_t selects the operation of srtp_process_ring().
+ */
+typedef enum {
+    srtp_ring_protect = 1,   /**< Protect every packet.   */
+    srtp_ring_unprotect = 2, /**< Unprotect every packet. */
+} srtp_ring_op_t;
+
+/**
+ * @brief srtp_process_ring() protects or unprotects the packets queued
+ * on a ring, in place in the memory region they live in.
+ *
+ * Descriptors are taken from in, processed with srtp_protect(),
+ * srtp_unprotect() or their RTCP counterparts, and posted with their
+ * new length and status to out.  Processing stops when in is empty, out
+ * is full or budget packets were processed (zero means no limit).  A
+ * packet whose descriptor lies outside the region completes with
+ * srtp_err_status_bad_param.
+ *
+ * The rings are read and advanced without memory barriers; a caller
+ * sharing them with another thread or with a device must provide its
+ * own ordering around the call.
+ *
+ * @param ctx is the srtp_t which applies to the packets.
+ *
+ * @param region is the start of the memory region.
+ *
+ * @param region_len is the size of the region in octets.
+ *
+ * @param in is the ring of packets to process.
+ *
+ * @param out is the ring receiving the completions.
+ *
+ * @param op selects protection or unprotection.
+ *
+ * @param budget is the maximum number of packets to process, or 0.
+ *
+ * @param processed is set to the number of packets posted to out.
+ *
+ * @return
+ *    - srtp_err_status_ok         if the rings were processed; the result
+ *                                 of each packet is in its status field.
+ *    - srtp_err_status_bad_param  if an argument is invalid.
+ */
+srtp_err_status_t srtp_process_ring(srtp_t ctx,
+                                    uint8_t *region,
+                                    size_t region_len,
+                                    srtp_ring_t *in,
+                                    srtp_ring_t *out,
+                                    srtp_ring_op_t op,
+                                    size_t budget,
+                                    size_t *processed);
+
+/**
+ * @brief srtp_protect_segments() protects a packed buffer of RTP packets
+ * laid out for UDP segmentation offload.
+ *
+ * The packets are stored back to back, each stride octets long except
+ * the last, which may be shorter; this is the layout the Linux
+ * UDP_SEGMENT socket option sends as one buffer.  Every packet is
+ * protected in place and moved so that it is followed by its MKI and
+ * authentication tag, and the result is again a packed buffer, with a
+ * stride longer by the trailer length, that can be handed to the socket
+ * as is.
+ *
+ * All packets must get a trailer of the same length, i.e. their streams
+ * must use the same tag and MKI lengths.  buf must be 32-bit aligned and
+ * stride a multiple of four, so that every packet can be protected at
+ * its own offset; they are protected last one first.  Every header and
+ * length is checked before anything is moved, so when one of them is
+ * rejected the buffer is left as it was.  If srtp_protect() itself
+ * fails on a packet, the contents of the buffer are unspecified.
+ *
+ * @param ctx is the srtp_t which applies to the packets.
+ *
+ * @param buf is the packed buffer.
+ *
+ * @param buf_size is the size of buf in octets; it must have room for
+ * one trailer per packet after the len octets of packets.
+ *
+ * @param len is the total length of the packets in buf.
+ *
+ * @param stride is the length of every packet but the last, a multiple
+ * of four.
+ *
+ * @param mki_index is the MKI index used for every packet.
+ *
+ * @param out_len is set to the total length of the protected packets.
+ *
+ * @param out_stride is set to the length of every protected packet but
+ * the last, the segment size to send the buffer with.
+ *
+ * @return
+ *    - srtp_err_status_ok           if every packet was protected.
+ *    - srtp_err_status_bad_param    if an argument is invalid, buf or
+ *                                   stride is not 32-bit aligned, a
+ *                                   header is malformed or the
+ *                                   trailer lengths differ.
+ *    - srtp_err_status_buffer_small if buf cannot hold the trailers.
+ *    - srtp_err_status_no_ctx       if a packet has no stream.
+ *    - any other error that srtp_protect() returns.
+ */
+srtp_err_status_t srtp_protect_segments(srtp_t ctx,
+                                        uint8_t *buf,
+                                        size_t buf_size,
+                                        size_t len,
+                                        size_t stride,
+                                        size_t mki_index,
+                                        size_t *out_len,
+                                        size_t *out_stride);
+
+/**
+ * @brief srtp_unprotect_segments() unprotects a packed buffer of packets
+ * as received with UDP receive offload.
+ *
+ * The Linux UDP_GRO socket option delivers datagrams of the same length
+ * as one buffer, each stride octets long except the last.  Each segment
+ * is unprotected in place, at its own offset, as
+ * srtp_unprotect_mux_batch() does; its start, new length and result are
+ * stored in the corresponding element of packets.  Segments that are not
+ * 32-bit aligned, as with a stride that is not a multiple of four, are
+ * unprotected in an aligned copy and copied back.
+ *
+ * @param ctx is the srtp_t which applies to the packets.
+ *
+ * @param buf is the packed buffer.
+ *
+ * @param len is the length of the buffer as received.
+ *
+ * @param stride is the segment size reported with the buffer.
+ *
+ * @param packets is an array that receives one entry per segment.
+ *
+ * @param num_packets is a pointer to the number of elements in packets
+ * before the call, and to the number of segments after it.
+ *
+ * @return
+ *    - srtp_err_status_ok           if the buffer was processed; the
+ *                                   result of each segment is in its
+ *                                   status field.
+ *    - srtp_err_status_bad_param    if an argument is invalid.
+ *    - srtp_err_status_buffer_small if packets has too few elements.
+ */
+srtp_err_status_t srtp_unprotect_segments(srtp_t ctx,
+                                          uint8_t *buf,
+                                          size_t len,
+                                          size_t stride,
+                                          srtp_mux_packet_t *packets,
+                                          size_t *num_packets);
+
+/**
+ * @brief srtp_session_export() writes a relocatable image of a session.
+ *
+ * The image holds every stream of the session, including the template,
+ * the derived session keys, the rollover counters and the replay
+ * windows.  It contains no pointers: records refer to each other by
+ * offsets from the start of the region, so the region may be copied to,
+ * or mapped at, a different address in another process and passed to
+ * srtp_session_import() there.  The image is only valid for the same
+ * libSRTP build on the same architecture.
+ *
+ * The image contains secret keys and must be protected and zeroized by
+ * the caller like any other key material.  Only sessions whose policies
+ * set exportable keep the derived keys that the image needs; for any
+ * other session the export fails.  The copies are zeroized when the
+ * session is deallocated.  A session created by srtp_session_import()
+ * can be exported again.
+ *
+ * The importer continues from the packet indices in the image, so once
+ * an export succeeds the session can no longer send: srtp_protect(),
+ * srtp_protect_rtcp() and the other sending functions return
+ * srtp_err_status_key_expired for its streams, including those cloned
+ * from its template later.  It can still unprotect packets, but they are
+ * not reflected in the image.
+ *
+ * @param session is the session to export.
+ *
+ * @param region is the region that receives the image, or NULL to query
+ * the required size.
+ *
+ * @param region_len is the size of the region in octets.
+ *
+ * @param image_len is set to the size of the image in octets.
+ *
+ * @return
+ *    - srtp_err_status_ok            if the image was written.
+ *    - srtp_err_status_buffer_small  if region is NULL or too small;
+ *                                    image_len holds the required size.
+ *    - srtp_err_status_bad_param     if an argument is invalid, or a
+ *                                    stream was not set up exportable.
+ */
+srtp_err_status_t srtp_session_export(srtp_t session,
+                                      uint8_t *region,
+                                      size_t region_len,
+                                      size_t *image_len);
+
+/**
+ * @brief srtp_session_import() creates a session from an image written by
+ * srtp_session_export().
+ *
+ * The cipher and authentication contexts are initialized directly from
+ * the session keys in the image, so no key derivation is run, and
+ * processing continues with the rollover counters and replay windows
+ * recorded in the image.  The region is only read during the call.
+ *
+ * @param session is set to the new session.
+ *
+ * @param region is the image.
+ *
+ * @param region_len is the size of the region in octets.
+ *
+ * @return
+ *    - srtp_err_status_ok         if the session was created.
+ *    - srtp_err_status_bad_param  if the image is malformed.
+ *    - srtp_err_status_alloc_fail if memory could not be allocated.
+ */
+srtp_err_status_t srtp_session_import(srtp_t *session,
+                                      const uint8_t *region,
+                                      size_t region_len);
+
 /**
  * @defgroup User data associated to a SRTP session.
  * @ingroup  SRTP
@@ -1348,6 +2304,16 @@ typedef void(srtp_event_handler_func_t)(srtp_event_data_t *data);
  */
 srtp_err_status_t srtp_install_event_handler(srtp_event_handler_func_t func);
 
+/**
+ * @brief srtp_event_reporter() is the default event handler.
+ *
+ * It reports each event as a single warning through the log handler, and
+ * does nothing when warnings are filtered out by srtp_set_log_level().
+ * It can be passed to srtp_install_event_handler() to restore the
+ * default after another handler was installed.
+ */
+void srtp_event_reporter(srtp_event_data_t *data);
+
 /**
  * @brief Returns the version string of the library.
  *
@@ -1366,6 +2332,9 @@ unsigned int srtp_get_version(void);
  * sets dynamic debugging to the value v (false for off, true for on) for the
  * debug module with the name mod_name
  *
+ * in builds configured with debug logging every module starts switched on;
+ * switching a module on or off does not change any other module
+ *
  * returns err_status_ok on success, err_status_fail otherwise
  */
 srtp_err_status_t srtp_set_debug_module(const char *mod_name, bool v);
@@ -1421,6 +2390,27 @@ typedef void(srtp_log_handler_func_t)(srtp_log_level_t level,
 srtp_err_status_t srtp_install_log_handler(srtp_log_handler_func_t func,
                                            void *data);
 
+/**
+ * @brief sets the most verbose level of log messages that is reported.
+ *
+ * Messages more verbose than level are dropped before they are formatted,
+ * so filtering here is much cheaper than in the log handler.  The
+ * default, srtp_log_level_debug, reports everything; messages from a
+ * debug module, at any level, are further limited to the modules switched
+ * on with srtp_set_debug_module().
+ * Events raised from the packet path, such as key usage limits, are
+ * reported as warnings by the default event handler; an application that
+ * wants them without any formatting can install its own handler with
+ * srtp_install_event_handler().
+ *
+ * @param level is the most verbose srtp_log_level_t to report.
+ *
+ * @return
+ *    - srtp_err_status_ok         on success
+ *    - srtp_err_status_bad_param  if level is not a valid log level
+ */
+srtp_err_status_t srtp_set_log_level(srtp_log_level_t level);
+
 /**
  * @brief srtp_get_protect_trailer_length(session, use_mki, mki_index, length)
  *
@@ -1478,6 +2468,174 @@ srtp_err_status_t srtp_stream_get_roc(srtp_t session,
                                       uint32_t ssrc,
                                       uint32_t *roc);
 
+/**
+ * @brief srtp_checkpoint_open(session, path, max_streams)
+ *
+ * Keeps the packet indices that the session sends with in the checkpoint
+ * file at path, so that a sender that restarts with the same keys does
+ * not reuse any of them.
+ *
+ * The file is memory mapped.  For each SSRC the session protects RTP or
+ * RTCP on, it records a high-water mark that is reserved 4096 packets
+ * ahead of the stream, so the file is written to only once per 4096
+ * packets.  Those writes survive a crash of the process immediately and
+ * are scheduled for writeback to disk at once; srtp_checkpoint_sync()
+ * waits for them.
+ *
+ * If the file already exists, a stream of an SSRC recorded in it resumes
+ * past the recorded marks the first time it is protected: every RTP
+ * index up to the mark is treated as used, so the sender should continue
+ * from the index returned by srtp_checkpoint_get_resume_index().  The file
+ * holds up to max_streams SSRCs when it is created; once it is full,
+ * protecting for a further SSRC fails with srtp_err_status_alloc_fail.
+ * A file belongs to one set of master keys and should be removed when
+ * the session is rekeyed with new ones.
+ *
+ * The file is released by srtp_dealloc().  Streams that allow repeated
+ * transmissions (allow_repeat_tx) can still repeat indices.
+ *
+ * @param session is the session whose sending streams are checkpointed.
+ *
+ * @param path is the name of the checkpoint file; it is created if it
+ * does not exist.
+ *
+ * @param max_streams is the number of SSRCs a new file has room for.
+ *
+ * @return
+ *    - srtp_err_status_ok            the file is in use.
+ *    - srtp_err_status_bad_param     an argument is invalid, or the session
+ *                                    already has a checkpoint file.
+ *    - srtp_err_status_parse_err     the file is not a checkpoint file.
+ *    - srtp_err_status_no_such_op    memory mapped files are not supported
+ *                                    on this platform.
+ *    - [other]                       the file could not be opened or mapped.
+ */
+srtp_err_status_t srtp_checkpoint_open(srtp_t session,
+                                       const char *path,
+                                       size_t max_streams);
+
+/**
+ * @brief srtp_checkpoint_sync(session)
+ *
+ * Waits until the checkpoint file of the session is written to disk.  This
+ * is not needed to survive a crash of the process, only one of the whole
+ * system, and may be called from a thread other than the one protecting
+ * packets.
+ *
+ * returns srtp_err_status_ok on success, srtp_err_status_bad_param if the
+ * session has no checkpoint file
+ */
+srtp_err_status_t srtp_checkpoint_sync(srtp_t session);
+
+/**
+ * @brief srtp_checkpoint_get_resume_index(session, ssrc, index)
+ *
+ * Gets the highest RTP packet index reserved for ssrc in the checkpoint
+ * file of the session.  A sender that restarts should continue with the
+ * packet index *index + 1, that is with sequence number
+ * (*index + 1) & 0xffff, since lower indices are rejected.
+ *
+ * returns srtp_err_status_ok on success, srtp_err_status_bad_param if the
+ * session has no checkpoint file or the file has no record for ssrc
+ */
+srtp_err_status_t srtp_checkpoint_get_resume_index(srtp_t session,
+                                                   uint32_t ssrc,
+                                                   uint64_t *index);
+
+/**
+ * @brief srtp_keylog_entry_t is one master key read back from a key log.
+ *
+ * The policies and key are those the stream or template was set up with,
+ * and mki holds its MKI if MKIs were in use.
+ */
+typedef struct srtp_keylog_entry_t {
+    uint64_t session_id;           /**< Number of the session in the log. */
+    srtp_ssrc_t ssrc;              /**< SSRC or template type.            */
+    srtp_crypto_policy_t rtp;      /**< SRTP crypto policy.               */
+    srtp_crypto_policy_t rtcp;     /**< SRTCP crypto policy.              */
+    uint8_t key[SRTP_MAX_KEY_LEN]; /**< Master key and salt.              */
+    size_t key_len;                /**< Length of key in octets.          */
+    uint8_t mki[SRTP_MAX_MKI_LEN]; /**< MKI of the master key.            */
+    size_t mki_len;                /**< Length of mki, 0 without MKI.     */
+} srtp_keylog_entry_t;
+
+/**
+ * @brief srtp_keylog_open(path, max_records) starts logging master keys.
+ *
+ * Once a key log is open, srtp_create(), srtp_stream_add() and
+ * srtp_update() append the master keys of every stream and template
+ * they set up to the file at path, much like SSLKEYLOGFILE does for TLS,
+ * so that captures of the traffic can be decrypted afterwards, for
+ * instance by rtp_decoder -K.  A stream made by srtp_stream_create()
+ * while the log is open is logged when srtp_stream_attach() adds it to
+ * a session; until then it keeps a copy of its master keys, which is
+ * wiped when it is logged or destroyed.  Each record holds the session
+ * it belongs to, the SSRC or template type, the crypto policies, the
+ * master key and salt, and the MKI.  Packet processing never touches the
+ * log.
+ *
+ * The file is created with room for max_records master keys and memory
+ * mapped; an existing key log is appended to.  When it is full, further
+ * keys are not logged and a warning is reported.  The log applies to the
+ * whole process and is closed by srtp_keylog_close() or srtp_shutdown().
+ * Calls that set up streams may run concurrently on different sessions;
+ * their appends are serialized.
+ *
+ * @warning The key log holds the master keys in the clear.  It must only
+ * be enabled for debugging, and must be protected like the keys
+ * themselves.
+ *
+ * @return
+ *    - srtp_err_status_ok            the key log is open.
+ *    - srtp_err_status_bad_param     an argument is invalid, or a key log
+ *                                    is open already.
+ *    - srtp_err_status_parse_err     the file is not a key log.
+ *    - srtp_err_status_no_such_op    memory mapped files are not supported
+ *                                    on this platform.
+ *    - [other]                       the file could not be opened or mapped.
+ */
+srtp_err_status_t srtp_keylog_open(const char *path, size_t max_records);
+
+/**
+ * @brief srtp_keylog_close() writes out and closes the key log, if one is
+ * open.
+ *
+ * returns srtp_err_status_ok on success, srtp_err_status_write_fail if the
+ * log could not be written to disk
+ */
+srtp_err_status_t srtp_keylog_close(void);
+
+/**
+ * @brief srtp_keylog_find(log, log_len, ssrc, skip, entries, max_entries,
+ * num_entries) looks up the keys of an SSRC in a key log.
+ *
+ * log points to the contents of a key log file, which must be 8 octet
+ * aligned, as a mapping or a buffer returned by malloc() is.  The lookup
+ * goes through the index of the file rather than the records.  The
+ * candidates for an SSRC (in host order) are the policies logged for it,
+ * then those of outbound templates and then those of inbound templates,
+ * each newest first and across every session and srtp_update() in the
+ * log.  The master keys of the candidate after the first skip are
+ * copied, one per entry, into entries, so a caller that cannot decrypt
+ * with one candidate can retry with skip one larger.
+ *
+ * @return
+ *    - srtp_err_status_ok            *num_entries keys were found.
+ *    - srtp_err_status_no_ctx        the log has no more than skip
+ *                                    candidates for ssrc.
+ *    - srtp_err_status_buffer_small  the policy has more than max_entries
+ *                                    master keys.
+ *    - srtp_err_status_parse_err     log is not a key log.
+ *    - srtp_err_status_bad_param     an argument is invalid.
+ */
+srtp_err_status_t srtp_keylog_find(const uint8_t *log,
+                                   size_t log_len,
+                                   uint32_t ssrc,
+                                   size_t skip,
+                                   srtp_keylog_entry_t *entries,
+                                   size_t max_entries,
+                                   size_t *num_entries);
+
 /**
  * @}
  */
@@ -63,10 +63,16 @@ extern "C" {
 #define SRTP_VER_STRING PACKAGE_STRING
 #define SRTP_VERSION PACKAGE_VERSION
 
-typedef struct srtp_stream_ctx_t_ srtp_stream_ctx_t;
-typedef srtp_stream_ctx_t *srtp_stream_t;
 typedef struct srtp_stream_list_ctx_t_ *srtp_stream_list_t;
 
+/*
+ * srtp_checkpoint_t is an open index checkpoint file, and
+ * srtp_checkpoint_slot_t the record of one sending SSRC within it; both
+ * are defined in srtp.c
+ */
+typedef struct srtp_checkpoint_t srtp_checkpoint_t;
+typedef struct srtp_checkpoint_slot_t srtp_checkpoint_slot_t;
+
 /*
  * the following declarations are libSRTP internal functions
  */
@@ -86,10 +92,32 @@ typedef enum direction_t {
     dir_srtp_receiver = 2
 } direction_t;
 
+/*
+ * SRTP_MAX_SESSION_KEY_LEN is the longest derived cipher (key plus salt)
+ * or authentication key that is retained in srtp_retained_keys_t
+ */
+#define SRTP_MAX_SESSION_KEY_LEN 64
+
+/*
+ * srtp_retained_keys_t holds copies of the derived keys used to initialize
+ * the ciphers and auth functions, so that srtp_session_export() can write
+ * them out; only streams with an exportable policy keep them
+ */
+typedef struct srtp_retained_keys_t {
+    uint8_t rtp_cipher_key[SRTP_MAX_SESSION_KEY_LEN];
+    uint8_t rtp_xtn_hdr_cipher_key[SRTP_MAX_SESSION_KEY_LEN];
+    uint8_t rtp_auth_key[SRTP_MAX_SESSION_KEY_LEN];
+    uint8_t rtcp_cipher_key[SRTP_MAX_SESSION_KEY_LEN];
+    uint8_t rtcp_auth_key[SRTP_MAX_SESSION_KEY_LEN];
+} srtp_retained_keys_t;
+
 /*
  * srtp_session_keys_t will contain the encryption, hmac, salt keys
  * for both SRTP and SRTCP.  The session keys will also contain the
  * MKI ID which is used to identify the session keys.
+ *
+ * retained is NULL unless the policy was exportable and every derived
+ * key fit into it.
  */
 typedef struct srtp_session_keys_t {
     srtp_cipher_t *rtp_cipher;
@@ -101,6 +129,7 @@ typedef struct srtp_session_keys_t {
     uint8_t c_salt[SRTP_AEAD_SALT_LEN];
     uint8_t *mki_id;
     srtp_key_limit_ctx_t *limit;
+    srtp_retained_keys_t *retained;
 } srtp_session_keys_t;
 
 /*
@@ -125,6 +154,11 @@ typedef struct srtp_stream_ctx_t_ {
     uint8_t *enc_xtn_hdr;
     size_t enc_xtn_hdr_count;
     uint32_t pending_roc;
+    srtp_checkpoint_slot_t *checkpoint;
+    bool is_clone; /* shares its ciphers and auths with the template */
+    bool exported; /* written out by srtp_session_export(), no protect */
+    struct srtp_keylog_record_t_ *keylog; /* key log records, written */
+    size_t keylog_num_records;            /* when the stream attaches  */
 } strp_stream_ctx_t_;
 
 /*
@@ -135,8 +169,21 @@ typedef struct srtp_ctx_t_ {
     struct srtp_stream_ctx_t_ *stream_template; /* act as template for other  */
                                                 /* streams                    */
     void *user_data;                            /* user custom data           */
+    srtp_checkpoint_t *checkpoint;              /* index checkpoint, or NULL  */
+    uint64_t keylog_id;                         /* id in the key log, or 0    */
+    uint64_t stream_gen; /* advanced whenever a stream leaves the list */
 } srtp_ctx_t_;
 
+/*
+ * stream_get_protect_trailer_length() sets length to the number of
+ * octets srtp_protect() (is_rtp) or srtp_protect_rtcp() adds to a packet
+ * of stream with the master key of mki_index
+ */
+srtp_err_status_t stream_get_protect_trailer_length(srtp_stream_ctx_t *stream,
+                                                    bool is_rtp,
+                                                    size_t mki_index,
+                                                    size_t *length);
+
 /*
  * srtp_hdr_t represents an RTP or SRTP header.  The bit-fields in
  * this structure should be declared "unsigned int" instead of
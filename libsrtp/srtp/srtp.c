@@ -74,11 +74,18 @@
 #endif
 
 #include <limits.h>
+#include <stddef.h> /* for offsetof() */
 #ifdef HAVE_NETINET_IN_H
 #include <netinet/in.h>
 #elif defined(HAVE_WINSOCK2_H)
 #include <winsock2.h>
 #endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 /* the debug module for srtp */
 srtp_debug_module_t mod_srtp = {
@@ -191,6 +198,10 @@ unsigned int srtp_get_version(void)
     return rv;
 }
 
+static void srtp_keylog_drop(srtp_stream_ctx_t *stream);
+
+static void srtp_drop_retained_keys(srtp_session_keys_t *session_keys);
+
 static srtp_err_status_t srtp_stream_dealloc(
     srtp_stream_ctx_t *stream,
     const srtp_stream_ctx_t *stream_template)
@@ -282,12 +293,6 @@ static srtp_err_status_t srtp_stream_dealloc(
                 }
             }
 
-            /*
-             * zeroize the salt value
-             */
-            octet_string_set_to_zero(session_keys->salt, SRTP_AEAD_SALT_LEN);
-            octet_string_set_to_zero(session_keys->c_salt, SRTP_AEAD_SALT_LEN);
-
             if (session_keys->mki_id) {
                 octet_string_set_to_zero(session_keys->mki_id,
                                          stream->mki_size);
@@ -295,6 +300,8 @@ static srtp_err_status_t srtp_stream_dealloc(
                 session_keys->mki_id = NULL;
             }
 
+            srtp_drop_retained_keys(session_keys);
+
             /*
              * deallocate key usage limit, if it is not the same as that in
              * template
@@ -303,9 +310,18 @@ static srtp_err_status_t srtp_stream_dealloc(
                 session_keys->limit == template_session_keys->limit) {
                 /* do nothing */
             } else if (session_keys->limit) {
+                srtp_key_limit_flush(session_keys->limit);
                 srtp_crypto_free(session_keys->limit);
             }
         }
+
+        /*
+         * zeroize the salts of every master key in one pass, rather than
+         * field by field
+         */
+        octet_string_set_to_zero(
+            stream->session_keys,
+            sizeof(srtp_session_keys_t) * stream->num_master_keys);
         srtp_crypto_free(stream->session_keys);
     }
 
@@ -321,6 +337,9 @@ static srtp_err_status_t srtp_stream_dealloc(
         srtp_crypto_free(stream->enc_xtn_hdr);
     }
 
+    /* a stream that was never attached still holds its master keys */
+    srtp_keylog_drop(stream);
+
     /* deallocate srtp stream context */
     srtp_crypto_free(stream);
 
@@ -458,10 +477,11 @@ static srtp_err_status_t srtp_stream_alloc(srtp_stream_ctx_t **str_ptr,
     for (i = 0; i < str->num_master_keys; i++) {
         session_keys = &str->session_keys[i];
 
-        /* allocate cipher */
-        stat = srtp_crypto_kernel_alloc_cipher(
+        /* allocate cipher, the implementation suiting the payload size */
+        stat = srtp_crypto_kernel_alloc_cipher_for_len(
             p->rtp.cipher_type, &session_keys->rtp_cipher,
-            p->rtp.cipher_key_len, p->rtp.auth_tag_len);
+            p->rtp.cipher_key_len, p->rtp.auth_tag_len,
+            p->expected_payload_len);
         if (stat) {
             srtp_stream_dealloc(str, NULL);
             return stat;
@@ -583,6 +603,7 @@ static srtp_err_status_t srtp_stream_clone(
     srtp_stream_ctx_t *str;
     srtp_session_keys_t *session_keys = NULL;
     const srtp_session_keys_t *template_session_keys = NULL;
+    size_t min_ws, max_ws;
 
     debug_print(mod_srtp, "cloning stream (SSRC: 0x%08x)", ntohl(ssrc));
 
@@ -592,6 +613,10 @@ static srtp_err_status_t srtp_stream_clone(
         return srtp_err_status_alloc_fail;
     }
     *str_ptr = str;
+    str->is_clone = true;
+
+    /* the importer of an exported template clones the same streams */
+    str->exported = stream_template->exported;
 
     str->num_master_keys = stream_template->num_master_keys;
     str->session_keys = (srtp_session_keys_t *)srtp_crypto_alloc(
@@ -634,7 +659,7 @@ static srtp_err_status_t srtp_stream_clone(
         memcpy(session_keys->c_salt, template_session_keys->c_salt,
                SRTP_AEAD_SALT_LEN);
 
-        /* set key limit to point to that of the template */
+        /* give the stream its own usage shard of the template's limit */
         status = srtp_key_limit_clone(template_session_keys->limit,
                                       &session_keys->limit);
         if (status) {
@@ -648,8 +673,11 @@ static srtp_err_status_t srtp_stream_clone(
     str->mki_size = stream_template->mki_size;
 
     /* initialize replay databases */
-    status = srtp_rdbx_init(
-        &str->rtp_rdbx, srtp_rdbx_get_window_size(&stream_template->rtp_rdbx));
+    srtp_rdbx_get_window_bounds(&stream_template->rtp_rdbx, &min_ws, &max_ws);
+    status = srtp_rdbx_init(&str->rtp_rdbx, min_ws);
+    if (!status) {
+        status = srtp_rdbx_set_window_bounds(&str->rtp_rdbx, min_ws, max_ws);
+    }
     if (status) {
         srtp_stream_dealloc(*str_ptr, stream_template);
         *str_ptr = NULL;
@@ -1030,6 +1058,52 @@ void srtp_inject_mki(uint8_t *mki_tag_location,
     }
 }
 
+/*
+ * srtp_alloc_retained_keys() gives session keys room to retain copies of
+ * the derived keys, and srtp_drop_retained_keys() zeroizes and frees it
+ */
+static srtp_err_status_t srtp_alloc_retained_keys(
+    srtp_session_keys_t *session_keys)
+{
+    session_keys->retained = (srtp_retained_keys_t *)srtp_crypto_alloc(
+        sizeof(srtp_retained_keys_t));
+    if (session_keys->retained == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+    return srtp_err_status_ok;
+}
+
+static void srtp_drop_retained_keys(srtp_session_keys_t *session_keys)
+{
+    if (session_keys->retained == NULL) {
+        return;
+    }
+    octet_string_set_to_zero(session_keys->retained,
+                             sizeof(srtp_retained_keys_t));
+    srtp_crypto_free(session_keys->retained);
+    session_keys->retained = NULL;
+}
+
+/*
+ * srtp_retain_session_key() keeps a copy of a derived key at offset in
+ * the retained keys, if there are any, so that the session can later be
+ * exported without the master key; a key that does not fit drops them
+ */
+static void srtp_retain_session_key(srtp_session_keys_t *session_keys,
+                                    size_t offset,
+                                    const uint8_t *key,
+                                    size_t len)
+{
+    if (session_keys->retained == NULL) {
+        return;
+    }
+    if (len > SRTP_MAX_SESSION_KEY_LEN) {
+        srtp_drop_retained_keys(session_keys);
+        return;
+    }
+    memcpy((uint8_t *)session_keys->retained + offset, key, len);
+}
+
 srtp_err_status_t srtp_stream_init_keys(srtp_session_keys_t *session_keys,
                                         const srtp_master_key_t *master_key,
                                         size_t mki_size)
@@ -1167,6 +1241,9 @@ srtp_err_status_t srtp_stream_init_keys(srtp_session_keys_t *session_keys,
         octet_string_set_to_zero(tmp_key, MAX_SRTP_KEY_LEN);
         return srtp_err_status_init_fail;
     }
+    srtp_retain_session_key(session_keys,
+                            offsetof(srtp_retained_keys_t, rtp_cipher_key),
+                            tmp_key, rtp_keylen);
 
     if (session_keys->rtp_xtn_hdr_cipher) {
         /* generate extensions header encryption key  */
@@ -1276,6 +1353,10 @@ srtp_err_status_t srtp_stream_init_keys(srtp_session_keys_t *session_keys,
             octet_string_set_to_zero(tmp_key, MAX_SRTP_KEY_LEN);
             return srtp_err_status_init_fail;
         }
+        srtp_retain_session_key(
+            session_keys,
+            offsetof(srtp_retained_keys_t, rtp_xtn_hdr_cipher_key), tmp_key,
+            rtp_xtn_hdr_keylen);
 
         if (xtn_hdr_kdf != &kdf) {
             /* release memory for custom header extension encryption kdf */
@@ -1307,6 +1388,10 @@ srtp_err_status_t srtp_stream_init_keys(srtp_session_keys_t *session_keys,
         octet_string_set_to_zero(tmp_key, MAX_SRTP_KEY_LEN);
         return srtp_err_status_init_fail;
     }
+    srtp_retain_session_key(session_keys,
+                            offsetof(srtp_retained_keys_t, rtp_auth_key),
+                            tmp_key,
+                            srtp_auth_get_key_length(session_keys->rtp_auth));
 
     /*
      * ...now initialize SRTCP keys
@@ -1359,6 +1444,9 @@ srtp_err_status_t srtp_stream_init_keys(srtp_session_keys_t *session_keys,
         octet_string_set_to_zero(tmp_key, MAX_SRTP_KEY_LEN);
         return srtp_err_status_init_fail;
     }
+    srtp_retain_session_key(session_keys,
+                            offsetof(srtp_retained_keys_t, rtcp_cipher_key),
+                            tmp_key, rtcp_keylen);
 
     /* generate authentication key */
     stat = srtp_kdf_generate(&kdf, label_rtcp_msg_auth, tmp_key,
@@ -1381,6 +1469,10 @@ srtp_err_status_t srtp_stream_init_keys(srtp_session_keys_t *session_keys,
         octet_string_set_to_zero(tmp_key, MAX_SRTP_KEY_LEN);
         return srtp_err_status_init_fail;
     }
+    srtp_retain_session_key(session_keys,
+                            offsetof(srtp_retained_keys_t, rtcp_auth_key),
+                            tmp_key,
+                            srtp_auth_get_key_length(session_keys->rtcp_auth));
 
     /* clear memory then return */
     stat = srtp_kdf_clear(&kdf);
@@ -1406,6 +1498,12 @@ srtp_err_status_t srtp_stream_init_all_master_keys(srtp_stream_ctx_t *srtp,
         srtp->mki_size = 0;
         single_master_key.key = p->key;
         single_master_key.mki_id = NULL;
+        if (p->exportable) {
+            status = srtp_alloc_retained_keys(&srtp->session_keys[0]);
+            if (status) {
+                return status;
+            }
+        }
         status = srtp_stream_init_keys(&srtp->session_keys[0],
                                        &single_master_key, 0);
     } else {
@@ -1421,6 +1519,12 @@ srtp_err_status_t srtp_stream_init_all_master_keys(srtp_stream_ctx_t *srtp,
         srtp->mki_size = p->mki_size;
 
         for (size_t i = 0; i < srtp->num_master_keys; i++) {
+            if (p->exportable) {
+                status = srtp_alloc_retained_keys(&srtp->session_keys[i]);
+                if (status) {
+                    return status;
+                }
+            }
             status = srtp_stream_init_keys(&srtp->session_keys[i], p->keys[i],
                                            srtp->mki_size);
             if (status) {
@@ -1465,6 +1569,25 @@ static srtp_err_status_t srtp_stream_init(srtp_stream_ctx_t *srtp,
         return err;
     }
 
+    /*
+     * a larger window_size_max makes the window adaptive, starting from
+     * (and never shrinking below) window_size
+     */
+    if (p->window_size_max != 0) {
+        size_t min_ws = p->window_size != 0 ? p->window_size : 128;
+        if (p->window_size_max < min_ws || p->window_size_max >= 0x8000) {
+            srtp_rdbx_dealloc(&srtp->rtp_rdbx);
+            return srtp_err_status_bad_param;
+        }
+        err = srtp_rdbx_set_window_bounds(
+            &srtp->rtp_rdbx, srtp_rdbx_get_window_size(&srtp->rtp_rdbx),
+            p->window_size_max);
+        if (err) {
+            srtp_rdbx_dealloc(&srtp->rtp_rdbx);
+            return err;
+        }
+    }
+
     /* set the SSRC value */
     srtp->ssrc = htonl(p->ssrc.value);
 
@@ -1507,29 +1630,32 @@ static srtp_err_status_t srtp_stream_init(srtp_stream_ctx_t *srtp,
 
 void srtp_event_reporter(srtp_event_data_t *data)
 {
-    srtp_err_report(srtp_err_level_warning,
-                    "srtp: in stream 0x%x: ", data->ssrc);
+    const char *event;
+
+    /* events are raised from the packet path, so check before formatting */
+    if (!srtp_err_report_enabled(srtp_err_level_warning, NULL)) {
+        return;
+    }
 
     switch (data->event) {
     case event_ssrc_collision:
-        srtp_err_report(srtp_err_level_warning, "\tSSRC collision\n");
+        event = "SSRC collision";
         break;
     case event_key_soft_limit:
-        srtp_err_report(srtp_err_level_warning,
-                        "\tkey usage soft limit reached\n");
+        event = "key usage soft limit reached";
         break;
     case event_key_hard_limit:
-        srtp_err_report(srtp_err_level_warning,
-                        "\tkey usage hard limit reached\n");
+        event = "key usage hard limit reached";
         break;
     case event_packet_index_limit:
-        srtp_err_report(srtp_err_level_warning,
-                        "\tpacket index limit reached\n");
+        event = "packet index limit reached";
         break;
     default:
-        srtp_err_report(srtp_err_level_warning,
-                        "\tunknown event reported to handler\n");
+        event = "unknown event reported to handler";
     }
+
+    srtp_err_report(srtp_err_level_warning, "srtp: in stream 0x%x: %s\n",
+                    data->ssrc, event);
 }
 
 /*
@@ -1787,6 +1913,71 @@ srtp_err_status_t srtp_get_session_keys_for_packet(
     return srtp_err_status_bad_mki;
 }
 
+/*
+ * srtp_session_keys_call_t holds what one call of srtp_protect() and the
+ * like changes while processing a packet: a copy of the session keys
+ * whose ciphers and auth functions keep their per-packet state here, on
+ * the caller's stack.  The contexts in the stream, which cloned streams
+ * share with their template, are then only read, so that streams cloned
+ * from one template can be processed concurrently.  Types that do not
+ * support this are used in place, as before.
+ */
+typedef struct {
+    srtp_session_keys_t keys;
+    srtp_cipher_call_t cipher;
+    srtp_cipher_call_t xtn_hdr_cipher;
+    srtp_auth_call_t auth;
+} srtp_session_keys_call_t;
+
+static srtp_session_keys_t *srtp_start_session_keys_call(
+    srtp_session_keys_t *session_keys,
+    bool rtcp,
+    srtp_session_keys_call_t *call)
+{
+    srtp_session_keys_t *keys = &call->keys;
+
+    keys->rtp_cipher = session_keys->rtp_cipher;
+    keys->rtp_xtn_hdr_cipher = session_keys->rtp_xtn_hdr_cipher;
+    keys->rtp_auth = session_keys->rtp_auth;
+    keys->rtcp_cipher = session_keys->rtcp_cipher;
+    keys->rtcp_auth = session_keys->rtcp_auth;
+    if (rtcp) {
+        keys->rtcp_cipher =
+            srtp_cipher_start_call(session_keys->rtcp_cipher, &call->cipher);
+        keys->rtcp_auth =
+            srtp_auth_start_call(session_keys->rtcp_auth, &call->auth);
+    } else {
+        keys->rtp_cipher =
+            srtp_cipher_start_call(session_keys->rtp_cipher, &call->cipher);
+        keys->rtp_xtn_hdr_cipher = srtp_cipher_start_call(
+            session_keys->rtp_xtn_hdr_cipher, &call->xtn_hdr_cipher);
+        keys->rtp_auth =
+            srtp_auth_start_call(session_keys->rtp_auth, &call->auth);
+    }
+    memcpy(keys->salt, session_keys->salt, SRTP_AEAD_SALT_LEN);
+    memcpy(keys->c_salt, session_keys->c_salt, SRTP_AEAD_SALT_LEN);
+    keys->mki_id = session_keys->mki_id;
+    keys->limit = session_keys->limit;
+    keys->retained = NULL;
+
+    return keys;
+}
+
+/*
+ * srtp_session_keys_concurrent() tells whether every RTP transform of
+ * session_keys gets its own per-packet state from
+ * srtp_start_session_keys_call(), so that several packets can be
+ * protected with them at once
+ */
+static bool srtp_session_keys_concurrent(
+    const srtp_session_keys_t *session_keys)
+{
+    return srtp_cipher_has_call_state(session_keys->rtp_cipher) &&
+           (session_keys->rtp_xtn_hdr_cipher == NULL ||
+            srtp_cipher_has_call_state(session_keys->rtp_xtn_hdr_cipher)) &&
+           srtp_auth_has_call_state(session_keys->rtp_auth);
+}
+
 static srtp_err_status_t srtp_estimate_index(srtp_rdbx_t *rdbx,
                                              uint32_t roc,
                                              srtp_xtd_seq_num_t *est,
@@ -1835,21 +2026,20 @@ static srtp_err_status_t srtp_get_est_pkt_index(const srtp_hdr_t *hdr,
 /*
  * This function handles outgoing SRTP packets while in AEAD mode,
  * which currently supports AES-GCM encryption.  All packets are
- * encrypted and authenticated.
+ * encrypted and authenticated.  The packet index est has already been
+ * reserved by srtp_protect_reserve_index().
  */
-static srtp_err_status_t srtp_protect_aead(srtp_ctx_t *ctx,
-                                           srtp_stream_ctx_t *stream,
+static srtp_err_status_t srtp_protect_aead(srtp_stream_ctx_t *stream,
                                            const uint8_t *rtp,
                                            size_t rtp_len,
                                            uint8_t *srtp,
                                            size_t *srtp_len,
-                                           srtp_session_keys_t *session_keys)
+                                           srtp_session_keys_t *session_keys,
+                                           srtp_xtd_seq_num_t est)
 {
     const srtp_hdr_t *hdr = (const srtp_hdr_t *)rtp;
     size_t enc_start;         /* offset to start of encrypted portion  */
     size_t enc_octet_len = 0; /* number of octets in encrypted portion  */
-    srtp_xtd_seq_num_t est;   /* estimated xtd_seq_num_t of *hdr        */
-    ssize_t delta;            /* delta of local pkt idx and that in hdr */
     srtp_err_status_t status;
     size_t tag_len;
     v128_t iv;
@@ -1857,23 +2047,6 @@ static srtp_err_status_t srtp_protect_aead(srtp_ctx_t *ctx,
 
     debug_print0(mod_srtp, "function srtp_protect_aead");
 
-    /*
-     * update the key usage limit, and check it to make sure that we
-     * didn't just hit either the soft limit or the hard limit, and call
-     * the event handler if we hit either.
-     */
-    switch (srtp_key_limit_update(session_keys->limit)) {
-    case srtp_key_event_normal:
-        break;
-    case srtp_key_event_hard_limit:
-        srtp_handle_event(ctx, stream, event_key_hard_limit);
-        return srtp_err_status_key_expired;
-    case srtp_key_event_soft_limit:
-    default:
-        srtp_handle_event(ctx, stream, event_key_soft_limit);
-        break;
-    }
-
     /* get tag length from stream */
     tag_len = srtp_auth_get_tag_length(session_keys->rtp_auth);
 
@@ -1904,33 +2077,6 @@ static srtp_err_status_t srtp_protect_aead(srtp_ctx_t *ctx,
         memcpy(srtp, rtp, enc_start);
     }
 
-    /*
-     * estimate the packet index using the start of the replay window
-     * and the sequence number from the header
-     */
-    status = srtp_get_est_pkt_index(hdr, stream, &est, &delta);
-
-    if (status && (status != srtp_err_status_pkt_idx_adv)) {
-        return status;
-    }
-
-    if (status == srtp_err_status_pkt_idx_adv) {
-        srtp_rdbx_set_roc_seq(&stream->rtp_rdbx, (uint32_t)(est >> 16),
-                              (uint16_t)(est & 0xFFFF));
-        stream->pending_roc = 0;
-        srtp_rdbx_add_index(&stream->rtp_rdbx, 0);
-    } else {
-        status = srtp_rdbx_check(&stream->rtp_rdbx, delta);
-        if (status) {
-            if (status != srtp_err_status_replay_fail ||
-                !stream->allow_repeat_tx)
-                return status; /* we've been asked to reuse an index */
-        }
-        srtp_rdbx_add_index(&stream->rtp_rdbx, delta);
-    }
-
-    debug_print(mod_srtp, "estimated packet index: %016" PRIx64, est);
-
     /*
      * AEAD uses a new IV formation method
      */
@@ -2083,11 +2229,6 @@ static srtp_err_status_t srtp_unprotect_aead(srtp_ctx_t *ctx,
         return srtp_err_status_buffer_small;
     }
 
-    /* if not-inplace then need to copy full rtp header */
-    if (srtp != rtp) {
-        memcpy(rtp, srtp, enc_start);
-    }
-
     /*
      * update the key usage limit, and check it to make sure that we
      * didn't just hit either the soft limit or the hard limit, and call
@@ -2124,6 +2265,15 @@ static srtp_err_status_t srtp_unprotect_aead(srtp_ctx_t *ctx,
         return status;
     }
 
+    /*
+     * if not-inplace then need to copy full rtp header; this is left
+     * until the tag has been checked so that a packet that fails
+     * authentication does not write to rtp
+     */
+    if (srtp != rtp) {
+        memcpy(rtp, srtp, enc_start);
+    }
+
     if (hdr->x == 1 && session_keys->rtp_xtn_hdr_cipher) {
         /*
          * extensions header encryption RFC 6904
@@ -2204,39 +2354,201 @@ static srtp_err_status_t srtp_unprotect_aead(srtp_ctx_t *ctx,
     return srtp_err_status_ok;
 }
 
-srtp_err_status_t srtp_protect(srtp_t ctx,
-                               const uint8_t *rtp,
-                               size_t rtp_len,
-                               uint8_t *srtp,
-                               size_t *srtp_len,
-                               size_t mki_index)
+/*
+ * srtp_set_rtp_iv(c, ssrc, est, direction) sets the IV of an RTP cipher
+ * for the packet with the given SSRC (in network order) and index
+ */
+static srtp_err_status_t srtp_set_rtp_iv(srtp_cipher_t *c,
+                                         uint32_t ssrc,
+                                         srtp_xtd_seq_num_t est,
+                                         srtp_cipher_direction_t direction)
 {
-    const srtp_hdr_t *hdr = (const srtp_hdr_t *)rtp;
-    size_t enc_start;         /* offset to start of encrypted portion  */
-    uint8_t *auth_start;      /* pointer to start of auth. portion      */
-    size_t enc_octet_len = 0; /* number of octets in encrypted portion  */
-    srtp_xtd_seq_num_t est;   /* estimated xtd_seq_num_t of *hdr        */
-    ssize_t delta;            /* delta of local pkt idx and that in hdr */
-    uint8_t *auth_tag = NULL; /* location of auth_tag within packet     */
-    srtp_err_status_t status;
-    size_t tag_len;
-    srtp_stream_ctx_t *stream;
-    size_t prefix_len;
-    srtp_session_keys_t *session_keys = NULL;
+    v128_t iv;
 
-    debug_print0(mod_srtp, "function srtp_protect");
+    if (c->type->id == SRTP_AES_ICM_128 || c->type->id == SRTP_AES_ICM_192 ||
+        c->type->id == SRTP_AES_ICM_256) {
+        /* aes counter mode */
+        iv.v32[0] = 0;
+        iv.v32[1] = ssrc;
+        iv.v64[1] = be64_to_cpu(est << 16);
+    } else {
+        /* no particular format - set the iv to the packet index */
+        iv.v64[0] = 0;
+        iv.v64[1] = be64_to_cpu(est);
+    }
 
-    /* Verify RTP header */
-    status = srtp_validate_rtp_header(rtp, rtp_len);
-    if (status) {
-        return status;
+    return srtp_cipher_set_iv(c, (uint8_t *)&iv, direction);
+}
+
+/*
+ * index checkpointing
+ *
+ * A checkpoint file holds, for each SSRC that a session sends on, the
+ * highest RTP and SRTCP index that the session may have used.  Indices
+ * are reserved SRTP_CHECKPOINT_INTERVAL packets ahead of the stream, so
+ * the file is written once per interval rather than once per packet,
+ * and a restarted sender resumes past the reservation.  The file is a
+ * shared mapping: a store reaches the page cache at once and survives
+ * a crash of the process, and msync(MS_ASYNC) starts its writeback,
+ * which then has at least another interval of packets to complete
+ * before the stream runs into the reserved indices.  The file is in
+ * host byte order and is not meant to move between machines.
+ */
+#define SRTP_CHECKPOINT_MAGIC 0x53434b50 /* "SCKP" */
+#define SRTP_CHECKPOINT_VERSION 1
+#define SRTP_CHECKPOINT_INTERVAL 4096
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_slots;
+    uint32_t num_used;
+} srtp_checkpoint_hdr_t;
+
+struct srtp_checkpoint_slot_t {
+    uint32_t ssrc; /* network order, as in srtp_stream_ctx_t */
+    uint32_t rtcp_high_water;
+    uint64_t rtp_high_water;
+};
+
+struct srtp_checkpoint_t {
+    srtp_checkpoint_hdr_t *hdr;
+    srtp_checkpoint_slot_t *slots;
+    size_t map_len;
+};
+
+static srtp_checkpoint_slot_t *srtp_checkpoint_find(srtp_checkpoint_t *cp,
+                                                    uint32_t ssrc)
+{
+    for (uint32_t i = 0; i < cp->hdr->num_used; i++) {
+        if (cp->slots[i].ssrc == ssrc) {
+            return &cp->slots[i];
+        }
     }
+    return NULL;
+}
 
-    /* check the packet length - it must at least contain a full header */
-    if (rtp_len < octets_in_rtp_header) {
-        return srtp_err_status_bad_param;
+static srtp_err_status_t srtp_checkpoint_flush(srtp_checkpoint_t *cp,
+                                               bool wait)
+{
+#ifdef HAVE_SYS_MMAN_H
+    if (msync(cp->hdr, cp->map_len, wait ? MS_SYNC : MS_ASYNC) != 0) {
+        return srtp_err_status_write_fail;
+    }
+#else
+    (void)cp;
+    (void)wait;
+#endif
+    return srtp_err_status_ok;
+}
+
+static void srtp_checkpoint_close(srtp_checkpoint_t *cp)
+{
+    srtp_checkpoint_flush(cp, true);
+#ifdef HAVE_SYS_MMAN_H
+    munmap(cp->hdr, cp->map_len);
+#endif
+    srtp_crypto_free(cp);
+}
+
+/*
+ * srtp_checkpoint_attach(cp, stream) gives a sending stream the slot of
+ * its SSRC, taking a free one if there is none yet.  A slot that exists
+ * already was left by an earlier run: the stream moves past both of its
+ * reservations, with every RTP index up to the reservation marked as
+ * used in the replay database, so none of them can be sent again.
+ */
+static srtp_err_status_t srtp_checkpoint_attach(srtp_checkpoint_t *cp,
+                                                srtp_stream_ctx_t *stream)
+{
+    srtp_checkpoint_slot_t *slot;
+    srtp_rdbx_t *rdbx = &stream->rtp_rdbx;
+
+    slot = srtp_checkpoint_find(cp, stream->ssrc);
+    if (slot != NULL) {
+        if (slot->rtp_high_water > rdbx->index) {
+            rdbx->index = slot->rtp_high_water;
+            memset(rdbx->bitmask.word, 0xff,
+                   bitvector_get_length(&rdbx->bitmask) / 8);
+        }
+        if (slot->rtcp_high_water > stream->rtcp_rdb.window_start) {
+            stream->rtcp_rdb.window_start = slot->rtcp_high_water;
+        }
+        debug_print2(mod_srtp, "checkpoint resumes SSRC 0x%08x at %016" PRIx64,
+                     ntohl(stream->ssrc), rdbx->index);
+        stream->checkpoint = slot;
+        return srtp_err_status_ok;
+    }
+
+    if (cp->hdr->num_used == cp->hdr->num_slots) {
+        return srtp_err_status_alloc_fail;
+    }
+
+    /* the slot is only counted once it is filled in */
+    slot = &cp->slots[cp->hdr->num_used];
+    slot->ssrc = stream->ssrc;
+    slot->rtcp_high_water = 0;
+    slot->rtp_high_water = 0;
+    cp->hdr->num_used++;
+    stream->checkpoint = slot;
+
+    return srtp_err_status_ok;
+}
+
+/*
+ * srtp_checkpoint_reserve_rtp(cp, slot, est) is called when the RTP
+ * index est comes within an interval of the reservation of slot, and
+ * moves the reservation two intervals past est
+ */
+static void srtp_checkpoint_reserve_rtp(srtp_checkpoint_t *cp,
+                                        srtp_checkpoint_slot_t *slot,
+                                        srtp_xtd_seq_num_t est)
+{
+    slot->rtp_high_water = est + 2 * SRTP_CHECKPOINT_INTERVAL;
+    srtp_checkpoint_flush(cp, false);
+}
+
+/*
+ * srtp_checkpoint_rtcp(cp, stream) does for SRTCP what
+ * srtp_checkpoint_attach() and srtp_checkpoint_reserve_rtp() do for
+ * RTP, ahead of the index that the next srtp_rdb_increment() gives out
+ */
+static srtp_err_status_t srtp_checkpoint_rtcp(srtp_checkpoint_t *cp,
+                                              srtp_stream_ctx_t *stream)
+{
+    srtp_err_status_t status;
+    uint32_t next;
+
+    if (stream->checkpoint == NULL) {
+        status = srtp_checkpoint_attach(cp, stream);
+        if (status) {
+            return status;
+        }
+    }
+
+    next = stream->rtcp_rdb.window_start + 1;
+    if (next + SRTP_CHECKPOINT_INTERVAL > stream->checkpoint->rtcp_high_water) {
+        next += 2 * SRTP_CHECKPOINT_INTERVAL;
+        stream->checkpoint->rtcp_high_water =
+            next < SRTCP_INDEX_MASK ? next : SRTCP_INDEX_MASK;
+        srtp_checkpoint_flush(cp, false);
     }
 
+    return srtp_err_status_ok;
+}
+
+/*
+ * srtp_protect_get_stream(ctx, hdr, stream) finds the stream for an
+ * outgoing packet, cloning one from the template if need be, and marks
+ * it as a sender
+ */
+static srtp_err_status_t srtp_protect_get_stream(srtp_ctx_t *ctx,
+                                                 const srtp_hdr_t *hdr,
+                                                 srtp_stream_ctx_t **str_ptr)
+{
+    srtp_err_status_t status;
+    srtp_stream_ctx_t *stream;
+
     /*
      * look up ssrc in srtp_stream list, and process the packet with
      * the appropriate stream.  if we haven't seen this stream before,
@@ -2289,19 +2601,42 @@ srtp_err_status_t srtp_protect(srtp_t ctx,
         }
     }
 
-    status = srtp_get_session_keys(stream, mki_index, &session_keys);
-    if (status) {
-        return status;
+    /* the importer of the session now sends with this keystream */
+    if (stream->exported) {
+        return srtp_err_status_key_expired;
     }
 
+    *str_ptr = stream;
+
+    return srtp_err_status_ok;
+}
+
+/*
+ * srtp_protect_reserve_index(ctx, stream, session_keys, hdr, est) is the
+ * part of srtp_protect() that must be serialized per stream: it counts
+ * the packet against the key usage limit and claims its index in the
+ * replay database
+ */
+static srtp_err_status_t srtp_protect_reserve_index(
+    srtp_ctx_t *ctx,
+    srtp_stream_ctx_t *stream,
+    srtp_session_keys_t *session_keys,
+    const srtp_hdr_t *hdr,
+    srtp_xtd_seq_num_t *est_ptr)
+{
+    srtp_err_status_t status;
+    srtp_xtd_seq_num_t est; /* estimated xtd_seq_num_t of *hdr        */
+    ssize_t delta;          /* delta of local pkt idx and that in hdr */
+
     /*
-     * Check if this is an AEAD stream (GCM mode).  If so, then dispatch
-     * the request to our AEAD handler.
+     * a stream sending under a checkpoint file gets its slot, and
+     * possibly resumes from it, before its first index is estimated
      */
-    if (session_keys->rtp_cipher->algorithm == SRTP_AES_GCM_128 ||
-        session_keys->rtp_cipher->algorithm == SRTP_AES_GCM_256) {
-        return srtp_protect_aead(ctx, stream, rtp, rtp_len, srtp, srtp_len,
-                                 session_keys);
+    if (ctx->checkpoint != NULL && stream->checkpoint == NULL) {
+        status = srtp_checkpoint_attach(ctx->checkpoint, stream);
+        if (status) {
+            return status;
+        }
     }
 
     /*
@@ -2322,19 +2657,120 @@ srtp_err_status_t srtp_protect(srtp_t ctx,
         break;
     }
 
-    /* get tag length from stream */
-    tag_len = srtp_auth_get_tag_length(session_keys->rtp_auth);
-
     /*
-     * find starting point for encryption and length of data to be
-     * encrypted - the encrypted portion starts after the rtp header
-     * extension, if present; otherwise, it starts after the last csrc,
-     * if any are present
+     * estimate the packet index using the start of the replay window
+     * and the sequence number from the header
      */
-    enc_start = srtp_get_rtp_hdr_len(hdr);
-    if (hdr->x == 1) {
-        enc_start += srtp_get_rtp_xtn_hdr_len(hdr, rtp);
-    }
+    status = srtp_get_est_pkt_index(hdr, stream, &est, &delta);
+
+    if (status && (status != srtp_err_status_pkt_idx_adv)) {
+        return status;
+    }
+
+    if (status == srtp_err_status_pkt_idx_adv) {
+        srtp_rdbx_set_roc_seq(&stream->rtp_rdbx, (uint32_t)(est >> 16),
+                              (uint16_t)(est & 0xFFFF));
+        stream->pending_roc = 0;
+        srtp_rdbx_add_index(&stream->rtp_rdbx, 0);
+    } else {
+        status = srtp_rdbx_check(&stream->rtp_rdbx, delta);
+        if (status) {
+            if (status != srtp_err_status_replay_fail ||
+                !stream->allow_repeat_tx)
+                return status; /* we've been asked to reuse an index */
+        }
+        srtp_rdbx_add_index(&stream->rtp_rdbx, delta);
+    }
+
+    /* reserving ahead keeps the checkpoint file off the per-packet path */
+    if (stream->checkpoint != NULL &&
+        est + SRTP_CHECKPOINT_INTERVAL > stream->checkpoint->rtp_high_water) {
+        srtp_checkpoint_reserve_rtp(ctx->checkpoint, stream->checkpoint, est);
+    }
+
+    debug_print(mod_srtp, "estimated packet index: %016" PRIx64, est);
+
+    *est_ptr = est;
+
+    return srtp_err_status_ok;
+}
+
+/*
+ * srtp_protect_len_check(stream, session_keys, rtp, rtp_len, srtp_len)
+ * checks that the packet parses and that the output buffer can hold it
+ */
+static srtp_err_status_t srtp_protect_len_check(
+    const srtp_stream_ctx_t *stream,
+    srtp_session_keys_t *session_keys,
+    const uint8_t *rtp,
+    size_t rtp_len,
+    size_t srtp_len)
+{
+    const srtp_hdr_t *hdr = (const srtp_hdr_t *)rtp;
+    size_t enc_start;
+
+    enc_start = srtp_get_rtp_hdr_len(hdr);
+    if (hdr->x == 1) {
+        enc_start += srtp_get_rtp_xtn_hdr_len(hdr, rtp);
+    }
+    if (enc_start > rtp_len) {
+        return srtp_err_status_parse_err;
+    }
+    if (srtp_len < rtp_len + stream->mki_size +
+                       srtp_auth_get_tag_length(session_keys->rtp_auth)) {
+        return srtp_err_status_buffer_small;
+    }
+
+    return srtp_err_status_ok;
+}
+
+/*
+ * srtp_protect_encrypt() is the part of srtp_protect() that only reads
+ * the stream: given a reserved packet index est and session keys set up
+ * with srtp_start_session_keys_call(), it encrypts and authenticates the
+ * packet, so it may run for several packets of a stream at once if
+ * srtp_session_keys_concurrent() holds for the keys
+ */
+static srtp_err_status_t srtp_protect_encrypt(srtp_stream_ctx_t *stream,
+                                              const uint8_t *rtp,
+                                              size_t rtp_len,
+                                              uint8_t *srtp,
+                                              size_t *srtp_len,
+                                              srtp_session_keys_t *session_keys,
+                                              srtp_xtd_seq_num_t est)
+{
+    const srtp_hdr_t *hdr = (const srtp_hdr_t *)rtp;
+    size_t enc_start;         /* offset to start of encrypted portion  */
+    uint8_t *auth_start;      /* pointer to start of auth. portion      */
+    size_t enc_octet_len = 0; /* number of octets in encrypted portion  */
+    uint8_t *auth_tag = NULL; /* location of auth_tag within packet     */
+    srtp_err_status_t status;
+    size_t tag_len;
+    size_t prefix_len;
+
+    /*
+     * Check if this is an AEAD stream (GCM mode).  If so, then dispatch
+     * the request to our AEAD handler.
+     */
+    if (session_keys->rtp_cipher->algorithm == SRTP_AES_GCM_128 ||
+        session_keys->rtp_cipher->algorithm == SRTP_AES_GCM_256) {
+        return srtp_protect_aead(stream, rtp, rtp_len, srtp, srtp_len,
+                                 session_keys, est);
+    }
+
+    /* get tag length from stream */
+    tag_len = srtp_auth_get_tag_length(session_keys->rtp_auth);
+
+    /*
+     * find starting point for encryption and length of data to be
+     * encrypted - the encrypted portion starts after the rtp header
+     * extension, if present; otherwise, it starts after the last csrc,
+     * if any are present
+     */
+    enc_start = srtp_get_rtp_hdr_len(hdr);
+    if (hdr->x == 1) {
+        enc_start += srtp_get_rtp_xtn_hdr_len(hdr, rtp);
+    }
 
     if (enc_start > rtp_len) {
         return srtp_err_status_parse_err;
@@ -2368,62 +2804,12 @@ srtp_err_status_t srtp_protect(srtp_t ctx,
         auth_tag = NULL;
     }
 
-    /*
-     * estimate the packet index using the start of the replay window
-     * and the sequence number from the header
-     */
-    status = srtp_get_est_pkt_index(hdr, stream, &est, &delta);
-
-    if (status && (status != srtp_err_status_pkt_idx_adv)) {
-        return status;
-    }
-
-    if (status == srtp_err_status_pkt_idx_adv) {
-        srtp_rdbx_set_roc_seq(&stream->rtp_rdbx, (uint32_t)(est >> 16),
-                              (uint16_t)(est & 0xFFFF));
-        stream->pending_roc = 0;
-        srtp_rdbx_add_index(&stream->rtp_rdbx, 0);
-    } else {
-        status = srtp_rdbx_check(&stream->rtp_rdbx, delta);
-        if (status) {
-            if (status != srtp_err_status_replay_fail ||
-                !stream->allow_repeat_tx)
-                return status; /* we've been asked to reuse an index */
-        }
-        srtp_rdbx_add_index(&stream->rtp_rdbx, delta);
-    }
-
-    debug_print(mod_srtp, "estimated packet index: %016" PRIx64, est);
-
-    /*
-     * if we're using rindael counter mode, set nonce and seq
-     */
-    if (session_keys->rtp_cipher->type->id == SRTP_AES_ICM_128 ||
-        session_keys->rtp_cipher->type->id == SRTP_AES_ICM_192 ||
-        session_keys->rtp_cipher->type->id == SRTP_AES_ICM_256) {
-        v128_t iv;
-
-        iv.v32[0] = 0;
-        iv.v32[1] = hdr->ssrc;
-        iv.v64[1] = be64_to_cpu(est << 16);
-        status = srtp_cipher_set_iv(session_keys->rtp_cipher, (uint8_t *)&iv,
-                                    srtp_direction_encrypt);
-        if (!status && session_keys->rtp_xtn_hdr_cipher) {
-            status = srtp_cipher_set_iv(session_keys->rtp_xtn_hdr_cipher,
-                                        (uint8_t *)&iv, srtp_direction_encrypt);
-        }
-    } else {
-        v128_t iv;
-
-        /* otherwise, set the index to est */
-        iv.v64[0] = 0;
-        iv.v64[1] = be64_to_cpu(est);
-        status = srtp_cipher_set_iv(session_keys->rtp_cipher, (uint8_t *)&iv,
-                                    srtp_direction_encrypt);
-        if (!status && session_keys->rtp_xtn_hdr_cipher) {
-            status = srtp_cipher_set_iv(session_keys->rtp_xtn_hdr_cipher,
-                                        (uint8_t *)&iv, srtp_direction_encrypt);
-        }
+    /* set the cipher's IV for the reserved index */
+    status = srtp_set_rtp_iv(session_keys->rtp_cipher, hdr->ssrc, est,
+                             srtp_direction_encrypt);
+    if (!status && session_keys->rtp_xtn_hdr_cipher) {
+        status = srtp_set_rtp_iv(session_keys->rtp_xtn_hdr_cipher, hdr->ssrc,
+                                 est, srtp_direction_encrypt);
     }
     if (status) {
         return srtp_err_status_cipher_fail;
@@ -2512,11 +2898,185 @@ srtp_err_status_t srtp_protect(srtp_t ctx,
     return srtp_err_status_ok;
 }
 
-srtp_err_status_t srtp_unprotect(srtp_t ctx,
-                                 const uint8_t *srtp,
-                                 size_t srtp_len,
-                                 uint8_t *rtp,
-                                 size_t *rtp_len)
+srtp_err_status_t srtp_protect(srtp_t ctx,
+                               const uint8_t *rtp,
+                               size_t rtp_len,
+                               uint8_t *srtp,
+                               size_t *srtp_len,
+                               size_t mki_index)
+{
+    const srtp_hdr_t *hdr = (const srtp_hdr_t *)rtp;
+    srtp_xtd_seq_num_t est;
+    srtp_err_status_t status;
+    srtp_stream_ctx_t *stream;
+    srtp_session_keys_t *session_keys = NULL;
+    srtp_session_keys_call_t call;
+
+    debug_print0(mod_srtp, "function srtp_protect");
+
+    /* Verify RTP header */
+    status = srtp_validate_rtp_header(rtp, rtp_len);
+    if (status) {
+        return status;
+    }
+
+    /* check the packet length - it must at least contain a full header */
+    if (rtp_len < octets_in_rtp_header) {
+        return srtp_err_status_bad_param;
+    }
+
+    status = srtp_protect_get_stream(ctx, hdr, &stream);
+    if (status) {
+        return status;
+    }
+
+    status = srtp_get_session_keys(stream, mki_index, &session_keys);
+    if (status) {
+        return status;
+    }
+
+    /* don't use up an index on a packet that cannot be protected */
+    status = srtp_protect_len_check(stream, session_keys, rtp, rtp_len,
+                                    *srtp_len);
+    if (status) {
+        return status;
+    }
+
+    status = srtp_protect_reserve_index(ctx, stream, session_keys, hdr, &est);
+    if (status) {
+        return status;
+    }
+
+    session_keys = srtp_start_session_keys_call(session_keys, false, &call);
+
+    return srtp_protect_encrypt(stream, rtp, rtp_len, srtp, srtp_len,
+                                session_keys, est);
+}
+
+srtp_err_status_t srtp_protect_reserve(srtp_t ctx,
+                                       const uint8_t *rtp,
+                                       size_t rtp_len,
+                                       size_t srtp_len,
+                                       size_t mki_index,
+                                       srtp_protect_ticket_t *ticket)
+{
+    const srtp_hdr_t *hdr = (const srtp_hdr_t *)rtp;
+    srtp_xtd_seq_num_t est;
+    srtp_err_status_t status;
+    srtp_stream_ctx_t *stream;
+    srtp_session_keys_t *session_keys = NULL;
+
+    debug_print0(mod_srtp, "function srtp_protect_reserve");
+
+    if (ctx == NULL || ticket == NULL) {
+        return srtp_err_status_bad_param;
+    }
+
+    /* Verify RTP header */
+    status = srtp_validate_rtp_header(rtp, rtp_len);
+    if (status) {
+        return status;
+    }
+
+    /* check the packet length - it must at least contain a full header */
+    if (rtp_len < octets_in_rtp_header) {
+        return srtp_err_status_bad_param;
+    }
+
+    status = srtp_protect_get_stream(ctx, hdr, &stream);
+    if (status) {
+        return status;
+    }
+
+    status = srtp_get_session_keys(stream, mki_index, &session_keys);
+    if (status) {
+        return status;
+    }
+
+    /* completions would share the per-packet state in the stream */
+    if (!srtp_session_keys_concurrent(session_keys)) {
+        return srtp_err_status_no_such_op;
+    }
+
+    /* nor may an index go to a packet that complete would reject */
+    status = srtp_protect_len_check(stream, session_keys, rtp, rtp_len,
+                                    srtp_len);
+    if (status) {
+        return status;
+    }
+
+    status = srtp_protect_reserve_index(ctx, stream, session_keys, hdr, &est);
+    if (status) {
+        return status;
+    }
+
+    ticket->stream = stream;
+    ticket->mki_index = mki_index;
+    ticket->index = est;
+
+    return srtp_err_status_ok;
+}
+
+srtp_err_status_t srtp_protect_complete(const srtp_protect_ticket_t *ticket,
+                                        const uint8_t *rtp,
+                                        size_t rtp_len,
+                                        uint8_t *srtp,
+                                        size_t *srtp_len)
+{
+    const srtp_hdr_t *hdr = (const srtp_hdr_t *)rtp;
+    srtp_err_status_t status;
+    srtp_stream_ctx_t *stream;
+    srtp_session_keys_t *session_keys = NULL;
+    srtp_session_keys_call_t call;
+
+    debug_print0(mod_srtp, "function srtp_protect_complete");
+
+    if (ticket == NULL || ticket->stream == NULL || srtp_len == NULL) {
+        return srtp_err_status_bad_param;
+    }
+    stream = ticket->stream;
+
+    if (rtp_len < octets_in_rtp_header) {
+        return srtp_err_status_bad_param;
+    }
+
+    /* the packet must be the one the index was reserved for */
+    if (hdr->ssrc != stream->ssrc ||
+        ntohs(hdr->seq) != (uint16_t)(ticket->index & 0xFFFF)) {
+        return srtp_err_status_bad_param;
+    }
+
+    status = srtp_get_session_keys(stream, ticket->mki_index, &session_keys);
+    if (status) {
+        return status;
+    }
+
+    status = srtp_protect_len_check(stream, session_keys, rtp, rtp_len,
+                                    *srtp_len);
+    if (status) {
+        return status;
+    }
+
+    session_keys = srtp_start_session_keys_call(session_keys, false, &call);
+
+    return srtp_protect_encrypt(stream, rtp, rtp_len, srtp, srtp_len,
+                                session_keys, ticket->index);
+}
+
+/*
+ * srtp_unprotect_rtp() is srtp_unprotect(), except that at most clear_len
+ * octets of the payload are decrypted; if resume is not NULL it records
+ * what srtp_unprotect_finish() needs to decrypt the rest, and if known is
+ * not NULL it is the packet's stream, already looked up by the caller
+ */
+static srtp_err_status_t srtp_unprotect_rtp(srtp_t ctx,
+                                            const uint8_t *srtp,
+                                            size_t srtp_len,
+                                            uint8_t *rtp,
+                                            size_t *rtp_len,
+                                            size_t clear_len,
+                                            srtp_unprotect_resume_t *resume,
+                                            srtp_stream_ctx_t *known)
 {
     const srtp_hdr_t *hdr = (const srtp_hdr_t *)srtp;
     size_t enc_start;               /* pointer to start of encrypted portion  */
@@ -2525,12 +3085,15 @@ srtp_err_status_t srtp_unprotect(srtp_t ctx,
     const uint8_t *auth_tag = NULL; /* location of auth_tag within packet     */
     srtp_xtd_seq_num_t est;         /* estimated xtd_seq_num_t of *hdr        */
     ssize_t delta;                  /* delta of local pkt idx and that in hdr */
-    v128_t iv;
+    srtp_xtd_seq_num_t index;
+    size_t mki_index;
+    size_t clear_octet_len;
     srtp_err_status_t status;
     srtp_stream_ctx_t *stream;
     uint8_t tmp_tag[SRTP_MAX_TAG_LEN];
     size_t tag_len, prefix_len;
     srtp_session_keys_t *session_keys = NULL;
+    srtp_session_keys_call_t call;
     bool advance_packet_index = false;
     uint32_t roc_to_set = 0;
     uint16_t seq_to_set = 0;
@@ -2555,7 +3118,7 @@ srtp_err_status_t srtp_unprotect(srtp_t ctx,
      * supports key-sharing, then we assume that a new stream using
      * that key has just started up
      */
-    stream = srtp_get_stream(ctx, hdr->ssrc);
+    stream = known != NULL ? known : srtp_get_stream(ctx, hdr->ssrc);
     if (stream == NULL) {
         if (ctx->stream_template != NULL) {
             stream = ctx->stream_template;
@@ -2605,6 +3168,8 @@ srtp_err_status_t srtp_unprotect(srtp_t ctx,
     if (status) {
         return status;
     }
+    mki_index = (size_t)(session_keys - stream->session_keys);
+    session_keys = srtp_start_session_keys_call(session_keys, false, &call);
 
     /*
      * Check if this is an AEAD stream (GCM mode).  If so, then dispatch
@@ -2612,8 +3177,19 @@ srtp_err_status_t srtp_unprotect(srtp_t ctx,
      */
     if (session_keys->rtp_cipher->algorithm == SRTP_AES_GCM_128 ||
         session_keys->rtp_cipher->algorithm == SRTP_AES_GCM_256) {
-        return srtp_unprotect_aead(ctx, stream, delta, est, srtp, srtp_len, rtp,
-                                   rtp_len, session_keys, advance_packet_index);
+        status = srtp_unprotect_aead(ctx, stream, delta, est, srtp, srtp_len,
+                                     rtp, rtp_len, session_keys,
+                                     advance_packet_index);
+        if (!status && resume != NULL) {
+            /* the whole payload has been decrypted */
+            resume->ssrc = ntohl(hdr->ssrc);
+            resume->index = est;
+            resume->mki_index = mki_index;
+            resume->enc_start = *rtp_len;
+            resume->offset = *rtp_len;
+            resume->length = *rtp_len;
+        }
+        return status;
     }
 
     /* get tag length from stream */
@@ -2623,35 +3199,18 @@ srtp_err_status_t srtp_unprotect(srtp_t ctx,
      * set the cipher's IV properly, depending on whatever cipher we
      * happen to be using
      */
-    if (session_keys->rtp_cipher->type->id == SRTP_AES_ICM_128 ||
-        session_keys->rtp_cipher->type->id == SRTP_AES_ICM_192 ||
-        session_keys->rtp_cipher->type->id == SRTP_AES_ICM_256) {
-        /* aes counter mode */
-        iv.v32[0] = 0;
-        iv.v32[1] = hdr->ssrc; /* still in network order */
-        iv.v64[1] = be64_to_cpu(est << 16);
-        status = srtp_cipher_set_iv(session_keys->rtp_cipher, (uint8_t *)&iv,
-                                    srtp_direction_decrypt);
-        if (!status && session_keys->rtp_xtn_hdr_cipher) {
-            status = srtp_cipher_set_iv(session_keys->rtp_xtn_hdr_cipher,
-                                        (uint8_t *)&iv, srtp_direction_decrypt);
-        }
-    } else {
-        /* no particular format - set the iv to the packet index */
-        iv.v64[0] = 0;
-        iv.v64[1] = be64_to_cpu(est);
-        status = srtp_cipher_set_iv(session_keys->rtp_cipher, (uint8_t *)&iv,
-                                    srtp_direction_decrypt);
-        if (!status && session_keys->rtp_xtn_hdr_cipher) {
-            status = srtp_cipher_set_iv(session_keys->rtp_xtn_hdr_cipher,
-                                        (uint8_t *)&iv, srtp_direction_decrypt);
-        }
+    status = srtp_set_rtp_iv(session_keys->rtp_cipher, hdr->ssrc, est,
+                             srtp_direction_decrypt);
+    if (!status && session_keys->rtp_xtn_hdr_cipher) {
+        status = srtp_set_rtp_iv(session_keys->rtp_xtn_hdr_cipher, hdr->ssrc,
+                                 est, srtp_direction_decrypt);
     }
     if (status) {
         return srtp_err_status_cipher_fail;
     }
 
     /* shift est, put into network byte order */
+    index = est;
     est = be64_to_cpu(est << 16);
 
     enc_start = srtp_get_rtp_hdr_len(hdr);
@@ -2768,13 +3327,23 @@ srtp_err_status_t srtp_unprotect(srtp_t ctx,
     }
 
     /* if we're decrypting, add keystream into ciphertext */
+    clear_octet_len = enc_octet_len;
     if (stream->rtp_services & sec_serv_conf) {
-        status =
-            srtp_cipher_decrypt(session_keys->rtp_cipher, srtp + enc_start,
-                                enc_octet_len, rtp + enc_start, &enc_octet_len);
+        if (clear_octet_len > clear_len) {
+            clear_octet_len = clear_len;
+        }
+        status = srtp_cipher_decrypt(session_keys->rtp_cipher,
+                                     srtp + enc_start, clear_octet_len,
+                                     rtp + enc_start, &clear_octet_len);
         if (status) {
             return srtp_err_status_cipher_fail;
         }
+        /* the rest is left for srtp_unprotect_finish() */
+        if (rtp != srtp && clear_octet_len < enc_octet_len) {
+            memcpy(rtp + enc_start + clear_octet_len,
+                   srtp + enc_start + clear_octet_len,
+                   enc_octet_len - clear_octet_len);
+        }
     } else if (rtp != srtp) {
         /* if no encryption and not-inplace then need to copy rest of packet */
         memcpy(rtp + enc_start, srtp + enc_start, enc_octet_len);
@@ -2844,450 +3413,2049 @@ srtp_err_status_t srtp_unprotect(srtp_t ctx,
 
     *rtp_len = enc_start + enc_octet_len;
 
+    if (resume != NULL) {
+        resume->ssrc = ntohl(hdr->ssrc);
+        resume->index = index;
+        resume->mki_index = mki_index;
+        resume->enc_start = enc_start;
+        resume->offset = enc_start + clear_octet_len;
+        resume->length = *rtp_len;
+    }
+
     return srtp_err_status_ok;
 }
 
-srtp_err_status_t srtp_init(void)
+srtp_err_status_t srtp_unprotect(srtp_t ctx,
+                                 const uint8_t *srtp,
+                                 size_t srtp_len,
+                                 uint8_t *rtp,
+                                 size_t *rtp_len)
 {
-    srtp_err_status_t status;
-
-    /* initialize crypto kernel */
-    status = srtp_crypto_kernel_init();
-    if (status) {
-        return status;
-    }
+    return srtp_unprotect_rtp(ctx, srtp, srtp_len, rtp, rtp_len, SIZE_MAX,
+                              NULL, NULL);
+}
 
-    /* load srtp debug module into the kernel */
-    status = srtp_crypto_kernel_load_debug_module(&mod_srtp);
-    if (status) {
-        return status;
+srtp_err_status_t srtp_unprotect_partial(srtp_t ctx,
+                                         const uint8_t *srtp,
+                                         size_t srtp_len,
+                                         uint8_t *rtp,
+                                         size_t *rtp_len,
+                                         size_t payload_len,
+                                         srtp_unprotect_resume_t *resume)
+{
+    if (resume == NULL) {
+        return srtp_err_status_bad_param;
     }
 
-    return srtp_err_status_ok;
+    return srtp_unprotect_rtp(ctx, srtp, srtp_len, rtp, rtp_len, payload_len,
+                              resume, NULL);
 }
 
-srtp_err_status_t srtp_shutdown(void)
+srtp_err_status_t srtp_unprotect_finish(srtp_t ctx,
+                                        uint8_t *rtp,
+                                        size_t rtp_len,
+                                        const srtp_unprotect_resume_t *resume)
 {
+    srtp_stream_ctx_t *stream;
+    srtp_session_keys_t *session_keys;
+    srtp_session_keys_call_t call;
+    uint8_t scratch[SRTP_MAX_TAG_LEN];
+    size_t skip, len;
     srtp_err_status_t status;
 
-    /* shut down crypto kernel */
-    status = srtp_crypto_kernel_shutdown();
-    if (status) {
-        return status;
-    }
-
-    /* shutting down crypto kernel frees the srtp debug module as well */
-
-    return srtp_err_status_ok;
-}
+    debug_print0(mod_srtp, "function srtp_unprotect_finish");
 
-srtp_stream_ctx_t *srtp_get_stream(srtp_t srtp, uint32_t ssrc)
-{
-    return srtp_stream_list_get(srtp->stream_list, ssrc);
-}
+    if (ctx == NULL || rtp == NULL || resume == NULL ||
+        rtp_len != resume->length || resume->offset > resume->length ||
+        resume->enc_start > resume->offset) {
+        return srtp_err_status_bad_param;
+    }
 
-srtp_err_status_t srtp_dealloc(srtp_t session)
-{
-    srtp_err_status_t status;
+    /* nothing was left encrypted */
+    if (resume->offset == resume->length) {
+        return srtp_err_status_ok;
+    }
 
-    /*
-     * we take a conservative deallocation strategy - if we encounter an
-     * error deallocating a stream, then we stop trying to deallocate
-     * memory and just return an error
-     */
+    stream = srtp_get_stream(ctx, htonl(resume->ssrc));
+    if (stream == NULL) {
+        return srtp_err_status_no_ctx;
+    }
+    if (resume->mki_index >= stream->num_master_keys) {
+        return srtp_err_status_bad_param;
+    }
+    session_keys = srtp_start_session_keys_call(
+        &stream->session_keys[resume->mki_index], false, &call);
 
-    /* deallocate streams */
-    status = srtp_remove_and_dealloc_streams(session->stream_list,
-                                             session->stream_template);
+    status = srtp_set_rtp_iv(session_keys->rtp_cipher, htonl(resume->ssrc),
+                             resume->index, srtp_direction_decrypt);
     if (status) {
-        return status;
+        return srtp_err_status_cipher_fail;
     }
 
-    /* deallocate stream template, if there is one */
-    if (session->stream_template != NULL) {
-        status = srtp_stream_dealloc(session->stream_template, NULL);
+    /*
+     * regenerate the keystream up to where srtp_unprotect_partial()
+     * stopped: the universal hash prefix, if any, then the payload octets
+     * that are already plaintext
+     */
+    if ((stream->rtp_services & sec_serv_auth) &&
+        session_keys->rtp_auth->prefix_len != 0) {
+        len = srtp_auth_get_prefix_length(session_keys->rtp_auth);
+        status = srtp_cipher_output(session_keys->rtp_cipher, scratch, &len);
         if (status) {
-            return status;
+            return srtp_err_status_cipher_fail;
+        }
+    }
+    skip = resume->offset - resume->enc_start;
+    while (skip > 0) {
+        len = skip < sizeof(scratch) ? skip : sizeof(scratch);
+        status = srtp_cipher_output(session_keys->rtp_cipher, scratch, &len);
+        if (status || len == 0) {
+            return srtp_err_status_cipher_fail;
         }
+        skip -= len;
     }
+    octet_string_set_to_zero(scratch, sizeof(scratch));
 
-    /* deallocate stream list */
-    status = srtp_stream_list_dealloc(session->stream_list);
+    len = resume->length - resume->offset;
+    status = srtp_cipher_decrypt(session_keys->rtp_cipher, rtp + resume->offset,
+                                 len, rtp + resume->offset, &len);
     if (status) {
-        return status;
+        return srtp_err_status_cipher_fail;
     }
 
-    /* deallocate session context */
-    srtp_crypto_free(session);
-
     return srtp_err_status_ok;
 }
 
-srtp_err_status_t srtp_stream_add(srtp_t session, const srtp_policy_t *policy)
+/*
+ * double encryption, RFC 8723
+ *
+ * The inner (end-to-end) and outer (hop-by-hop) transforms are held in two
+ * sessions.  Layers that are not AEAD are run one after the other over
+ * each chunk of the payload while it is in cache.  An AEAD layer is given
+ * its whole text in one call instead, since only some GCM engines carry
+ * the keystream and GHASH over from one encrypt call to the next; the
+ * others restart from the IV on each call.  The RFC 8723 profile is
+ * GCM in both layers, so it always encrypts one layer after the other;
+ * only combinations with an AES-CM/HMAC layer share the walk.  The inner
+ * transform covers a synthetic
+ * header without the header extension, and the original header block
+ * (OHB) is carried after the inner tag, inside the outer transform.
+ */
+
+#define SRTP_DOUBLE_CHUNK 256
+
+/* the largest fixed header with 15 CSRCs */
+#define SRTP_MAX_RTP_HDR_LEN (12 + 15 * 4)
+
+/* OHB config byte R R R R B M P Q, RFC 8723 section 4 */
+#define SRTP_OHB_Q 0x01 /* sequence number present */
+#define SRTP_OHB_P 0x02 /* payload type present    */
+#define SRTP_OHB_M 0x04 /* marker bit present      */
+#define SRTP_OHB_B 0x08 /* marker bit value        */
+#define SRTP_OHB_RESERVED 0xf0
+
+typedef struct {
+    srtp_ctx_t *ctx;
+    srtp_stream_ctx_t *stream;
+    srtp_session_keys_t *keys;
+    bool aead;
+    size_t tag_len;
+    srtp_xtd_seq_num_t est;
+    ssize_t delta;
+    bool advance;
+    uint32_t roc; /* ROC in network byte order, for the auth function */
+} srtp_double_layer_t;
+
+/*
+ * srtp_double_layer_init() finds the stream of one layer, estimates the
+ * packet index and checks it against the replay database
+ */
+static srtp_err_status_t srtp_double_layer_init(srtp_ctx_t *ctx,
+                                                const srtp_hdr_t *hdr,
+                                                direction_t direction,
+                                                srtp_double_layer_t *l)
 {
     srtp_err_status_t status;
-    srtp_stream_t tmp;
+    srtp_stream_ctx_t *stream;
 
-    /* sanity check arguments */
-    if (session == NULL) {
-        return srtp_err_status_bad_param;
+    l->ctx = ctx;
+    l->advance = false;
+
+    stream = srtp_get_stream(ctx, hdr->ssrc);
+    if (stream == NULL) {
+        if (ctx->stream_template == NULL) {
+            return srtp_err_status_no_ctx;
+        }
+        if (direction == dir_srtp_sender) {
+            status = srtp_stream_clone(ctx->stream_template, hdr->ssrc,
+                                       &stream);
+            if (status) {
+                return status;
+            }
+            status = srtp_insert_or_dealloc_stream(ctx->stream_list, stream,
+                                                   ctx->stream_template);
+            if (status) {
+                return status;
+            }
+            stream->direction = dir_srtp_sender;
+        } else {
+            /* provisional, cloned once the packet is authenticated */
+            stream = ctx->stream_template;
+            l->est = (srtp_xtd_seq_num_t)ntohs(hdr->seq);
+            l->delta = (ssize_t)l->est;
+        }
     }
 
-    status = srtp_valid_policy(policy);
-    if (status != srtp_err_status_ok) {
-        return status;
+    if (stream != ctx->stream_template) {
+        status = srtp_get_est_pkt_index(hdr, stream, &l->est, &l->delta);
+        if (status && (status != srtp_err_status_pkt_idx_adv)) {
+            return status;
+        }
+        if (status == srtp_err_status_pkt_idx_adv) {
+            l->advance = true;
+        } else {
+            status = srtp_rdbx_check(&stream->rtp_rdbx, l->delta);
+            if (status) {
+                if (direction != dir_srtp_sender ||
+                    status != srtp_err_status_replay_fail ||
+                    !stream->allow_repeat_tx) {
+                    return status;
+                }
+            }
+        }
     }
 
-    /* allocate stream  */
-    status = srtp_stream_alloc(&tmp, policy);
-    if (status) {
-        return status;
+    if (direction == dir_srtp_sender && stream->direction != dir_srtp_sender) {
+        if (stream->direction == dir_unknown) {
+            stream->direction = dir_srtp_sender;
+        } else {
+            srtp_handle_event(ctx, stream, event_ssrc_collision);
+        }
     }
 
-    /* initialize stream  */
-    status = srtp_stream_init(tmp, policy);
-    if (status) {
-        srtp_stream_dealloc(tmp, NULL);
-        return status;
+    if (direction == dir_srtp_sender && stream->exported) {
+        return srtp_err_status_key_expired;
     }
 
-    /*
-     * set the head of the stream list or the template to point to the
-     * stream that we've just alloced and init'ed, depending on whether
-     * or not it has a wildcard SSRC value or not
-     *
-     * if the template stream has already been set, then the policy is
-     * inconsistent, so we return a bad_param error code
-     */
-    switch (policy->ssrc.type) {
-    case (ssrc_any_outbound):
-        if (session->stream_template) {
-            srtp_stream_dealloc(tmp, NULL);
-            return srtp_err_status_bad_param;
-        }
-        session->stream_template = tmp;
-        session->stream_template->direction = dir_srtp_sender;
-        break;
-    case (ssrc_any_inbound):
-        if (session->stream_template) {
-            srtp_stream_dealloc(tmp, NULL);
-            return srtp_err_status_bad_param;
-        }
-        session->stream_template = tmp;
-        session->stream_template->direction = dir_srtp_receiver;
+    /* both layers always encrypt and authenticate, and carry no MKI */
+    if (stream->use_mki || stream->rtp_services != sec_serv_conf_and_auth) {
+        return srtp_err_status_bad_param;
+    }
+
+    l->stream = stream;
+    l->keys = &stream->session_keys[0];
+    l->aead = l->keys->rtp_cipher->algorithm == SRTP_AES_GCM_128 ||
+              l->keys->rtp_cipher->algorithm == SRTP_AES_GCM_256;
+    l->tag_len = srtp_auth_get_tag_length(l->keys->rtp_auth);
+    l->roc = htonl((uint32_t)(l->est >> 16));
+    if (!l->aead && srtp_auth_get_prefix_length(l->keys->rtp_auth) != 0) {
+        return srtp_err_status_bad_param;
+    }
+
+    switch (srtp_key_limit_update(l->keys->limit)) {
+    case srtp_key_event_normal:
         break;
-    case (ssrc_specific):
-        status = srtp_insert_or_dealloc_stream(session->stream_list, tmp,
-                                               session->stream_template);
-        if (status) {
-            return status;
-        }
+    case srtp_key_event_soft_limit:
+        srtp_handle_event(ctx, stream, event_key_soft_limit);
         break;
-    case (ssrc_undefined):
+    case srtp_key_event_hard_limit:
+        srtp_handle_event(ctx, stream, event_key_hard_limit);
+        return srtp_err_status_key_expired;
     default:
-        srtp_stream_dealloc(tmp, NULL);
-        return srtp_err_status_bad_param;
+        break;
     }
 
     return srtp_err_status_ok;
 }
 
-srtp_err_status_t srtp_create(srtp_t *session, /* handle for session     */
-                              const srtp_policy_t *policy)
-{ /* SRTP policy (list)     */
-    srtp_err_status_t stat;
-    srtp_ctx_t *ctx;
+static srtp_err_status_t srtp_double_layer_set_iv(
+    srtp_double_layer_t *l,
+    const srtp_hdr_t *hdr,
+    srtp_cipher_direction_t direction)
+{
+    srtp_err_status_t status;
+    v128_t iv;
+    v128_t icm_iv;
+
+    icm_iv.v32[0] = 0;
+    icm_iv.v32[1] = hdr->ssrc;
+    icm_iv.v64[1] = be64_to_cpu(l->est << 16);
+
+    if (l->aead) {
+        srtp_calc_aead_iv(l->keys, &iv, &l->est, hdr);
+    } else if (l->keys->rtp_cipher->type->id == SRTP_AES_ICM_128 ||
+               l->keys->rtp_cipher->type->id == SRTP_AES_ICM_192 ||
+               l->keys->rtp_cipher->type->id == SRTP_AES_ICM_256) {
+        iv = icm_iv;
+    } else {
+        iv.v64[0] = 0;
+        iv.v64[1] = be64_to_cpu(l->est);
+        icm_iv = iv;
+    }
 
-    /* sanity check arguments */
-    if (session == NULL) {
-        return srtp_err_status_bad_param;
+    status =
+        srtp_cipher_set_iv(l->keys->rtp_cipher, (uint8_t *)&iv, direction);
+    if (!status && l->keys->rtp_xtn_hdr_cipher) {
+        status = srtp_cipher_set_iv(l->keys->rtp_xtn_hdr_cipher,
+                                    (uint8_t *)&icm_iv, direction);
+    }
+    if (status) {
+        return srtp_err_status_cipher_fail;
     }
 
-    if (policy) {
-        stat = srtp_valid_policy(policy);
-        if (stat != srtp_err_status_ok) {
-            return stat;
+    return srtp_err_status_ok;
+}
+
+/* srtp_double_layer_start() runs the layer's header into its tag */
+static srtp_err_status_t srtp_double_layer_start(srtp_double_layer_t *l,
+                                                 const uint8_t *hdr,
+                                                 size_t hdr_len)
+{
+    srtp_err_status_t status;
+
+    if (l->aead) {
+        if (srtp_cipher_set_aad(l->keys->rtp_cipher, hdr, hdr_len)) {
+            return srtp_err_status_cipher_fail;
         }
+        return srtp_err_status_ok;
     }
 
-    /* allocate srtp context and set ctx_ptr */
-    ctx = (srtp_ctx_t *)srtp_crypto_alloc(sizeof(srtp_ctx_t));
-    if (ctx == NULL) {
-        return srtp_err_status_alloc_fail;
+    status = srtp_auth_start(l->keys->rtp_auth);
+    if (status) {
+        return status;
     }
-    *session = ctx;
+    return srtp_auth_update(l->keys->rtp_auth, hdr, hdr_len);
+}
 
-    ctx->stream_template = NULL;
-    ctx->stream_list = NULL;
-    ctx->user_data = NULL;
+static srtp_err_status_t srtp_double_layer_encrypt(srtp_double_layer_t *l,
+                                                   const uint8_t *src,
+                                                   uint8_t *dst,
+                                                   size_t len)
+{
+    size_t out_len = len;
 
-    /* allocate stream list */
-    stat = srtp_stream_list_alloc(&ctx->stream_list);
-    if (stat) {
-        /* clean up everything */
-        srtp_dealloc(*session);
-        *session = NULL;
-        return stat;
+    if (srtp_cipher_encrypt(l->keys->rtp_cipher, src, len, dst, &out_len)) {
+        return srtp_err_status_cipher_fail;
     }
+    if (l->aead) {
+        return srtp_err_status_ok;
+    }
+    return srtp_auth_update(l->keys->rtp_auth, dst, len);
+}
 
-    /*
-     * loop over elements in the policy list, allocating and
-     * initializing a stream for each element
-     */
-    while (policy != NULL) {
-        stat = srtp_stream_add(ctx, policy);
-        if (stat) {
-            /* clean up everything */
-            srtp_dealloc(*session);
-            *session = NULL;
-            return stat;
-        }
+/* only used for layers that are not AEAD, which are decrypted in chunks */
+static srtp_err_status_t srtp_double_layer_decrypt(srtp_double_layer_t *l,
+                                                   const uint8_t *src,
+                                                   uint8_t *dst,
+                                                   size_t len)
+{
+    srtp_err_status_t status;
+    size_t out_len = len;
 
-        /* set policy to next item in list  */
-        policy = policy->next;
+    status = srtp_auth_update(l->keys->rtp_auth, src, len);
+    if (status) {
+        return status;
+    }
+    if (srtp_cipher_decrypt(l->keys->rtp_cipher, src, len, dst, &out_len)) {
+        return srtp_err_status_cipher_fail;
     }
-
     return srtp_err_status_ok;
 }
 
-srtp_err_status_t srtp_stream_remove(srtp_t session, uint32_t ssrc)
+static srtp_err_status_t srtp_double_layer_tag(srtp_double_layer_t *l,
+                                               uint8_t *tag)
 {
-    srtp_stream_ctx_t *stream;
-    srtp_err_status_t status;
-
-    /* sanity check arguments */
-    if (session == NULL) {
-        return srtp_err_status_bad_param;
-    }
+    size_t tag_len = l->tag_len;
 
-    /* find and remove stream from the list */
-    stream = srtp_stream_list_get(session->stream_list, htonl(ssrc));
-    if (stream == NULL) {
-        return srtp_err_status_no_ctx;
+    if (l->aead) {
+        if (srtp_cipher_get_tag(l->keys->rtp_cipher, tag, &tag_len)) {
+            return srtp_err_status_cipher_fail;
+        }
+        return srtp_err_status_ok;
     }
+    return srtp_auth_compute(l->keys->rtp_auth, (uint8_t *)&l->roc, 4, tag);
+}
 
-    srtp_stream_list_remove(session->stream_list, stream);
+static srtp_err_status_t srtp_double_layer_verify(srtp_double_layer_t *l,
+                                                  const uint8_t *tag)
+{
+    uint8_t tmp_tag[SRTP_MAX_TAG_LEN];
 
-    /* deallocate the stream */
-    status = srtp_stream_dealloc(stream, session->stream_template);
-    if (status) {
-        return status;
+    if (srtp_auth_compute(l->keys->rtp_auth, (uint8_t *)&l->roc, 4,
+                          tmp_tag)) {
+        return srtp_err_status_auth_fail;
+    }
+    if (!srtp_octet_string_equal(tmp_tag, tag, l->tag_len)) {
+        return srtp_err_status_auth_fail;
     }
-
     return srtp_err_status_ok;
 }
 
-srtp_err_status_t srtp_update(srtp_t session, const srtp_policy_t *policy)
+/* srtp_double_layer_aead_decrypt() decrypts and verifies in one call */
+static srtp_err_status_t srtp_double_layer_aead_decrypt(
+    srtp_double_layer_t *l,
+    const uint8_t *aad,
+    size_t aad_len,
+    const uint8_t *src,
+    uint8_t *dst,
+    size_t len)
 {
-    srtp_err_status_t stat;
-
-    /* sanity check arguments */
-    if (session == NULL) {
-        return srtp_err_status_bad_param;
-    }
+    size_t out_len = len + l->tag_len;
 
-    stat = srtp_valid_policy(policy);
-    if (stat != srtp_err_status_ok) {
-        return stat;
+    if (srtp_cipher_set_aad(l->keys->rtp_cipher, aad, aad_len)) {
+        return srtp_err_status_cipher_fail;
     }
-
-    while (policy != NULL) {
-        stat = srtp_stream_update(session, policy);
-        if (stat) {
-            return stat;
-        }
-
-        /* set policy to next item in list  */
-        policy = policy->next;
+    if (srtp_cipher_decrypt(l->keys->rtp_cipher, src, len + l->tag_len, dst,
+                            &out_len)) {
+        return srtp_err_status_auth_fail;
     }
     return srtp_err_status_ok;
 }
 
-struct update_template_stream_data {
+/*
+ * srtp_double_layer_commit() adds the packet index to the replay database,
+ * replacing a provisional receive stream by a clone of the template
+ */
+static srtp_err_status_t srtp_double_layer_commit(srtp_double_layer_t *l,
+                                                  const srtp_hdr_t *hdr,
+                                                  direction_t direction)
+{
     srtp_err_status_t status;
-    srtp_t session;
-    srtp_stream_t new_stream_template;
-    srtp_stream_list_t new_stream_list;
-};
+    srtp_ctx_t *ctx = l->ctx;
+    srtp_stream_ctx_t *stream = l->stream;
 
-static bool update_template_stream_cb(srtp_stream_t stream, void *raw_data)
-{
-    struct update_template_stream_data *data =
-        (struct update_template_stream_data *)raw_data;
-    srtp_t session = data->session;
-    uint32_t ssrc = stream->ssrc;
-    srtp_xtd_seq_num_t old_index;
-    srtp_rdb_t old_rtcp_rdb;
+    if (direction == dir_srtp_receiver) {
+        if (stream->direction != dir_srtp_receiver) {
+            if (stream->direction == dir_unknown) {
+                stream->direction = dir_srtp_receiver;
+            } else {
+                srtp_handle_event(ctx, stream, event_ssrc_collision);
+            }
+        }
 
-    /* old / non-template streams are copied unchanged */
-    if (stream->session_keys[0].rtp_auth !=
-        session->stream_template->session_keys[0].rtp_auth) {
-        srtp_stream_list_remove(session->stream_list, stream);
-        data->status = srtp_insert_or_dealloc_stream(
-            data->new_stream_list, stream, session->stream_template);
-        if (data->status) {
-            return false;
+        if (stream == ctx->stream_template) {
+            status =
+                srtp_stream_clone(ctx->stream_template, hdr->ssrc, &stream);
+            if (status) {
+                return status;
+            }
+            status = srtp_insert_or_dealloc_stream(ctx->stream_list, stream,
+                                                   ctx->stream_template);
+            if (status) {
+                return status;
+            }
         }
-        return true;
     }
 
-    /* save old extended seq */
-    old_index = stream->rtp_rdbx.index;
-    old_rtcp_rdb = stream->rtcp_rdb;
-
-    /* remove stream */
-    data->status = srtp_stream_remove(session, ntohl(ssrc));
-    if (data->status) {
-        return false;
+    if (l->advance) {
+        srtp_rdbx_set_roc_seq(&stream->rtp_rdbx, (uint32_t)(l->est >> 16),
+                              (uint16_t)(l->est & 0xFFFF));
+        stream->pending_roc = 0;
+        srtp_rdbx_add_index(&stream->rtp_rdbx, 0);
+    } else {
+        srtp_rdbx_add_index(&stream->rtp_rdbx, l->delta);
     }
 
-    /* allocate and initialize a new stream */
-    data->status = srtp_stream_clone(data->new_stream_template, ssrc, &stream);
-    if (data->status) {
-        return false;
-    }
+    return srtp_err_status_ok;
+}
 
-    /* add new stream to the head of the new_stream_list */
-    data->status = srtp_insert_or_dealloc_stream(data->new_stream_list, stream,
-                                                 data->new_stream_template);
-    if (data->status) {
-        return false;
-    }
+/*
+ * srtp_double_inner_header() builds the header covered by the inner
+ * transform, which is the original header without its extension
+ */
+static size_t srtp_double_inner_header(const uint8_t *rtp, uint8_t *inner_hdr)
+{
+    size_t hdr_len = srtp_get_rtp_hdr_len((const srtp_hdr_t *)rtp);
 
-    /* restore old extended seq */
-    stream->rtp_rdbx.index = old_index;
-    stream->rtcp_rdb = old_rtcp_rdb;
+    memcpy(inner_hdr, rtp, hdr_len);
+    ((srtp_hdr_t *)inner_hdr)->x = 0;
 
-    return true;
+    return hdr_len;
 }
 
-static srtp_err_status_t is_update_policy_compatable(
-    srtp_stream_t stream,
-    const srtp_policy_t *policy)
+static size_t srtp_double_enc_start(const uint8_t *rtp)
 {
-    if (stream->use_mki != policy->use_mki) {
-        return srtp_err_status_bad_param;
-    }
+    const srtp_hdr_t *hdr = (const srtp_hdr_t *)rtp;
+    size_t enc_start = srtp_get_rtp_hdr_len(hdr);
 
-    if (stream->use_mki && stream->mki_size != policy->mki_size) {
-        return srtp_err_status_bad_param;
+    if (hdr->x == 1) {
+        enc_start += srtp_get_rtp_xtn_hdr_len(hdr, rtp);
     }
-
-    return srtp_err_status_ok;
+    return enc_start;
 }
 
-static srtp_err_status_t update_template_streams(srtp_t session,
-                                                 const srtp_policy_t *policy)
+srtp_err_status_t srtp_protect_double(srtp_t inner,
+                                      srtp_t outer,
+                                      const uint8_t *rtp,
+                                      size_t rtp_len,
+                                      uint8_t *srtp,
+                                      size_t *srtp_len)
 {
+    const srtp_hdr_t *hdr = (const srtp_hdr_t *)rtp;
     srtp_err_status_t status;
-    srtp_stream_t new_stream_template;
-    srtp_stream_list_t new_stream_list;
-
-    status = srtp_valid_policy(policy);
-    if (status != srtp_err_status_ok) {
-        return status;
-    }
-
-    if (session->stream_template == NULL) {
+    srtp_double_layer_t in;
+    srtp_double_layer_t out;
+    uint8_t inner_hdr[SRTP_MAX_RTP_HDR_LEN];
+    size_t inner_hdr_len;
+    size_t enc_start;
+    size_t payload_len;
+    size_t trailer_len;
+    uint8_t *trailer;
+
+    debug_print0(mod_srtp, "function srtp_protect_double");
+
+    if (inner == NULL || outer == NULL || inner == outer ||
+        srtp_len == NULL) {
         return srtp_err_status_bad_param;
     }
 
-    status = is_update_policy_compatable(session->stream_template, policy);
-    if (status != srtp_err_status_ok) {
-        return status;
-    }
-
-    /* allocate new template stream  */
-    status = srtp_stream_alloc(&new_stream_template, policy);
+    status = srtp_validate_rtp_header(rtp, rtp_len);
     if (status) {
         return status;
     }
+    enc_start = srtp_double_enc_start(rtp);
+    payload_len = rtp_len - enc_start;
 
-    /* initialize new template stream  */
-    status = srtp_stream_init(new_stream_template, policy);
+    status = srtp_double_layer_init(inner, hdr, dir_srtp_sender, &in);
     if (status) {
-        srtp_crypto_free(new_stream_template);
         return status;
     }
-
-    /* allocate new stream list */
-    status = srtp_stream_list_alloc(&new_stream_list);
+    status = srtp_double_layer_init(outer, hdr, dir_srtp_sender, &out);
     if (status) {
-        srtp_crypto_free(new_stream_template);
         return status;
     }
 
-    /* process streams */
-    struct update_template_stream_data data = { srtp_err_status_ok, session,
-                                                new_stream_template,
-                                                new_stream_list };
-    srtp_stream_list_for_each(session->stream_list, update_template_stream_cb,
-                              &data);
-    if (data.status) {
-        /* free new allocations */
-        srtp_remove_and_dealloc_streams(new_stream_list, new_stream_template);
-        srtp_stream_list_dealloc(new_stream_list);
-        srtp_stream_dealloc(new_stream_template, NULL);
-        return data.status;
+    /* inner tag and the one octet OHB, both inside the outer transform */
+    trailer_len = in.tag_len + 1 + out.tag_len;
+    if (*srtp_len < rtp_len + trailer_len) {
+        return srtp_err_status_buffer_small;
     }
 
-    /* dealloc old list / template */
-    srtp_remove_and_dealloc_streams(session->stream_list,
-                                    session->stream_template);
-    srtp_stream_list_dealloc(session->stream_list);
-    srtp_stream_dealloc(session->stream_template, NULL);
-
-    /* set new list / template */
-    session->stream_template = new_stream_template;
-    session->stream_list = new_stream_list;
-    return srtp_err_status_ok;
-}
-
-static srtp_err_status_t stream_update(srtp_t session,
-                                       const srtp_policy_t *policy)
-{
-    srtp_err_status_t status;
-    srtp_xtd_seq_num_t old_index;
-    srtp_rdb_t old_rtcp_rdb;
-    srtp_stream_t stream;
+    if (rtp != srtp) {
+        memcpy(srtp, rtp, enc_start);
+    }
+    inner_hdr_len = srtp_double_inner_header(rtp, inner_hdr);
 
-    status = srtp_valid_policy(policy);
-    if (status != srtp_err_status_ok) {
+    status = srtp_double_layer_set_iv(&in, hdr, srtp_direction_encrypt);
+    if (!status) {
+        status = srtp_double_layer_set_iv(&out, hdr, srtp_direction_encrypt);
+    }
+    if (status) {
         return status;
     }
 
-    stream = srtp_get_stream(session, htonl(policy->ssrc.value));
-    if (stream == NULL) {
-        return srtp_err_status_bad_param;
+    if (hdr->x == 1 && out.keys->rtp_xtn_hdr_cipher) {
+        status = srtp_process_header_encryption(
+            out.stream, srtp_get_rtp_xtn_hdr(hdr, srtp), out.keys);
+        if (status) {
+            return status;
+        }
     }
 
-    status = is_update_policy_compatable(stream, policy);
-    if (status != srtp_err_status_ok) {
+    status = srtp_double_layer_start(&in, inner_hdr, inner_hdr_len);
+    if (!status) {
+        status = srtp_double_layer_start(&out, srtp, enc_start);
+    }
+    if (status) {
         return status;
     }
 
-    /* save old extendard seq */
-    old_index = stream->rtp_rdbx.index;
-    old_rtcp_rdb = stream->rtcp_rdb;
+    /* the AEAD layers whole, the others together over each chunk */
+    if (in.aead) {
+        status = srtp_double_layer_encrypt(&in, rtp + enc_start,
+                                           srtp + enc_start, payload_len);
+        if (status) {
+            return status;
+        }
+    }
+    if (!in.aead || !out.aead) {
+        for (size_t off = enc_start; off < rtp_len;
+             off += SRTP_DOUBLE_CHUNK) {
+            size_t n = rtp_len - off;
 
-    status = srtp_stream_remove(session, policy->ssrc.value);
+            if (n > SRTP_DOUBLE_CHUNK) {
+                n = SRTP_DOUBLE_CHUNK;
+            }
+            if (!in.aead) {
+                status =
+                    srtp_double_layer_encrypt(&in, rtp + off, srtp + off, n);
+            }
+            if (!status && !out.aead) {
+                status =
+                    srtp_double_layer_encrypt(&out, srtp + off, srtp + off, n);
+            }
+            if (status) {
+                return status;
+            }
+        }
+    }
+
+    /* the inner tag and an OHB recording no changes */
+    trailer = srtp + enc_start + payload_len;
+    status = srtp_double_layer_tag(&in, trailer);
     if (status) {
         return status;
     }
+    trailer[in.tag_len] = 0;
 
-    status = srtp_stream_add(session, policy);
+    if (out.aead) {
+        status = srtp_double_layer_encrypt(&out, srtp + enc_start,
+                                           srtp + enc_start,
+                                           payload_len + in.tag_len + 1);
+    } else {
+        status =
+            srtp_double_layer_encrypt(&out, trailer, trailer, in.tag_len + 1);
+    }
+    if (!status) {
+        status = srtp_double_layer_tag(&out, trailer + in.tag_len + 1);
+    }
     if (status) {
         return status;
     }
 
-    stream = srtp_get_stream(session, htonl(policy->ssrc.value));
-    if (stream == NULL) {
-        return srtp_err_status_fail;
+    status = srtp_double_layer_commit(&in, hdr, dir_srtp_sender);
+    if (!status) {
+        status = srtp_double_layer_commit(&out, hdr, dir_srtp_sender);
+    }
+    if (status) {
+        return status;
     }
 
-    /* restore old extended seq */
-    stream->rtp_rdbx.index = old_index;
-    stream->rtcp_rdb = old_rtcp_rdb;
+    *srtp_len = rtp_len + trailer_len;
+
+    return srtp_err_status_ok;
+}
+
+srtp_err_status_t srtp_unprotect_double(srtp_t inner,
+                                        srtp_t outer,
+                                        const uint8_t *srtp,
+                                        size_t srtp_len,
+                                        uint8_t *rtp,
+                                        size_t *rtp_len)
+{
+    const srtp_hdr_t *hdr = (const srtp_hdr_t *)srtp;
+    srtp_hdr_t *out_hdr = (srtp_hdr_t *)rtp;
+    srtp_err_status_t status;
+    srtp_double_layer_t in;
+    srtp_double_layer_t out;
+    uint8_t inner_hdr[SRTP_MAX_RTP_HDR_LEN];
+    size_t inner_hdr_len;
+    size_t enc_start;
+    size_t enc_len;
+    size_t payload_len;
+    size_t ohb_len;
+    uint8_t config;
+    const uint8_t *ohb;
+
+    debug_print0(mod_srtp, "function srtp_unprotect_double");
+
+    if (inner == NULL || outer == NULL || inner == outer || rtp_len == NULL) {
+        return srtp_err_status_bad_param;
+    }
+
+    status = srtp_validate_rtp_header(srtp, srtp_len);
+    if (status) {
+        return status;
+    }
+    enc_start = srtp_double_enc_start(srtp);
+
+    /* outer layer, over the received header */
+    status = srtp_double_layer_init(outer, hdr, dir_srtp_receiver, &out);
+    if (status) {
+        return status;
+    }
+    if (srtp_len - enc_start < out.tag_len + 1) {
+        return srtp_err_status_parse_err;
+    }
+    enc_len = srtp_len - enc_start - out.tag_len;
+    if (*rtp_len < enc_start + enc_len) {
+        return srtp_err_status_buffer_small;
+    }
+
+    if (srtp != rtp) {
+        memcpy(rtp, srtp, enc_start);
+    }
+
+    status = srtp_double_layer_set_iv(&out, hdr, srtp_direction_decrypt);
+    if (status) {
+        return status;
+    }
+
+    if (out.aead) {
+        status = srtp_double_layer_aead_decrypt(
+            &out, srtp, enc_start, srtp + enc_start, rtp + enc_start, enc_len);
+    } else {
+        status = srtp_double_layer_start(&out, srtp, enc_start);
+        for (size_t off = enc_start; !status && off < enc_start + enc_len;
+             off += SRTP_DOUBLE_CHUNK) {
+            size_t n = enc_start + enc_len - off;
+
+            if (n > SRTP_DOUBLE_CHUNK) {
+                n = SRTP_DOUBLE_CHUNK;
+            }
+            status = srtp_double_layer_decrypt(&out, srtp + off, rtp + off, n);
+        }
+        if (!status) {
+            status = srtp_double_layer_verify(&out, srtp + enc_start + enc_len);
+        }
+    }
+    if (status) {
+        return status;
+    }
+
+    if (hdr->x == 1 && out.keys->rtp_xtn_hdr_cipher) {
+        status = srtp_process_header_encryption(
+            out.stream, srtp_get_rtp_xtn_hdr(hdr, rtp), out.keys);
+        if (status) {
+            return status;
+        }
+    }
+
+    /* restore the original header from the OHB */
+    config = rtp[enc_start + enc_len - 1];
+    if (config & SRTP_OHB_RESERVED) {
+        return srtp_err_status_parse_err;
+    }
+    ohb_len = 1;
+    ohb_len += (config & SRTP_OHB_P) ? 1 : 0;
+    ohb_len += (config & SRTP_OHB_Q) ? 2 : 0;
+    if (enc_len < ohb_len) {
+        return srtp_err_status_parse_err;
+    }
+    ohb = rtp + enc_start + enc_len - ohb_len;
+    if (config & SRTP_OHB_P) {
+        out_hdr->pt = *ohb++ & 0x7f;
+    }
+    if (config & SRTP_OHB_Q) {
+        memcpy(&out_hdr->seq, ohb, 2);
+    }
+    if (config & SRTP_OHB_M) {
+        out_hdr->m = (config & SRTP_OHB_B) ? 1 : 0;
+    }
+
+    /* inner layer, over the original header */
+    status = srtp_double_layer_init(inner, out_hdr, dir_srtp_receiver, &in);
+    if (status) {
+        return status;
+    }
+    if (enc_len - ohb_len < in.tag_len) {
+        return srtp_err_status_parse_err;
+    }
+    payload_len = enc_len - ohb_len - in.tag_len;
+    inner_hdr_len = srtp_double_inner_header(rtp, inner_hdr);
+
+    status = srtp_double_layer_set_iv(&in, out_hdr, srtp_direction_decrypt);
+    if (status) {
+        return status;
+    }
+
+    if (in.aead) {
+        status = srtp_double_layer_aead_decrypt(&in, inner_hdr, inner_hdr_len,
+                                                rtp + enc_start,
+                                                rtp + enc_start, payload_len);
+    } else {
+        status = srtp_double_layer_start(&in, inner_hdr, inner_hdr_len);
+        for (size_t off = enc_start; !status && off < enc_start + payload_len;
+             off += SRTP_DOUBLE_CHUNK) {
+            size_t n = enc_start + payload_len - off;
+
+            if (n > SRTP_DOUBLE_CHUNK) {
+                n = SRTP_DOUBLE_CHUNK;
+            }
+            status = srtp_double_layer_decrypt(&in, rtp + off, rtp + off, n);
+        }
+        if (!status) {
+            status =
+                srtp_double_layer_verify(&in, rtp + enc_start + payload_len);
+        }
+    }
+    if (status) {
+        return status;
+    }
+
+    status = srtp_double_layer_commit(&out, hdr, dir_srtp_receiver);
+    if (!status) {
+        status = srtp_double_layer_commit(&in, out_hdr, dir_srtp_receiver);
+    }
+    if (status) {
+        return status;
+    }
+
+    *rtp_len = enc_start + payload_len;
+
+    return srtp_err_status_ok;
+}
+
+srtp_err_status_t srtp_reprotect_outer(srtp_t outer_in,
+                                       srtp_t outer_out,
+                                       const uint8_t *srtp_in,
+                                       size_t srtp_in_len,
+                                       uint8_t *srtp_out,
+                                       size_t *srtp_out_len)
+{
+    const srtp_hdr_t *hdr = (const srtp_hdr_t *)srtp_in;
+    srtp_err_status_t status;
+    srtp_double_layer_t in;
+    srtp_double_layer_t out;
+    size_t enc_start;
+    size_t enc_len;
+
+    debug_print0(mod_srtp, "function srtp_reprotect_outer");
+
+    if (outer_in == NULL || outer_out == NULL || outer_in == outer_out ||
+        srtp_out_len == NULL) {
+        return srtp_err_status_bad_param;
+    }
+
+    status = srtp_validate_rtp_header(srtp_in, srtp_in_len);
+    if (status) {
+        return status;
+    }
+    enc_start = srtp_double_enc_start(srtp_in);
+
+    status = srtp_double_layer_init(outer_in, hdr, dir_srtp_receiver, &in);
+    if (status) {
+        return status;
+    }
+    status = srtp_double_layer_init(outer_out, hdr, dir_srtp_sender, &out);
+    if (status) {
+        return status;
+    }
+    if (srtp_in_len - enc_start < in.tag_len + 1) {
+        return srtp_err_status_parse_err;
+    }
+    enc_len = srtp_in_len - enc_start - in.tag_len;
+    if (*srtp_out_len < enc_start + enc_len + out.tag_len) {
+        return srtp_err_status_buffer_small;
+    }
+
+    if (srtp_in != srtp_out) {
+        memcpy(srtp_out, srtp_in, enc_start);
+    }
+
+    status = srtp_double_layer_set_iv(&in, hdr, srtp_direction_decrypt);
+    if (!status) {
+        status = srtp_double_layer_set_iv(&out, hdr, srtp_direction_encrypt);
+    }
+    if (status) {
+        return status;
+    }
+
+    /*
+     * an AEAD hop is decrypted and verified as a whole, otherwise the
+     * authentication of the incoming hop is folded into the walk below
+     */
+    if (in.aead) {
+        status = srtp_double_layer_aead_decrypt(&in, srtp_in, enc_start,
+                                                srtp_in + enc_start,
+                                                srtp_out + enc_start, enc_len);
+    } else {
+        status = srtp_double_layer_start(&in, srtp_in, enc_start);
+    }
+    if (status) {
+        return status;
+    }
+
+    if (hdr->x == 1 && in.keys->rtp_xtn_hdr_cipher) {
+        status = srtp_process_header_encryption(
+            in.stream, srtp_get_rtp_xtn_hdr(hdr, srtp_out), in.keys);
+        if (status) {
+            return status;
+        }
+    }
+    if (hdr->x == 1 && out.keys->rtp_xtn_hdr_cipher) {
+        status = srtp_process_header_encryption(
+            out.stream, srtp_get_rtp_xtn_hdr(hdr, srtp_out), out.keys);
+        if (status) {
+            return status;
+        }
+    }
+
+    status = srtp_double_layer_start(&out, srtp_out, enc_start);
+    if (status) {
+        return status;
+    }
+
+    /*
+     * the inner ciphertext, inner tag and OHB pass through unchanged; an
+     * AEAD outgoing hop encrypts them in one call after the walk
+     */
+    if (!in.aead || !out.aead) {
+        for (size_t off = enc_start; off < enc_start + enc_len;
+             off += SRTP_DOUBLE_CHUNK) {
+            size_t n = enc_start + enc_len - off;
+
+            if (n > SRTP_DOUBLE_CHUNK) {
+                n = SRTP_DOUBLE_CHUNK;
+            }
+            if (!in.aead) {
+                status = srtp_double_layer_decrypt(&in, srtp_in + off,
+                                                   srtp_out + off, n);
+            }
+            if (!status && !out.aead) {
+                status = srtp_double_layer_encrypt(&out, srtp_out + off,
+                                                   srtp_out + off, n);
+            }
+            if (status) {
+                return status;
+            }
+        }
+    }
+    if (out.aead) {
+        status = srtp_double_layer_encrypt(&out, srtp_out + enc_start,
+                                           srtp_out + enc_start, enc_len);
+        if (status) {
+            return status;
+        }
+    }
+
+    if (!in.aead) {
+        status = srtp_double_layer_verify(&in, srtp_in + enc_start + enc_len);
+        if (status) {
+            return status;
+        }
+    }
+
+    status = srtp_double_layer_tag(&out, srtp_out + enc_start + enc_len);
+    if (status) {
+        return status;
+    }
+
+    status = srtp_double_layer_commit(&in, hdr, dir_srtp_receiver);
+    if (!status) {
+        status = srtp_double_layer_commit(&out, hdr, dir_srtp_sender);
+    }
+    if (status) {
+        return status;
+    }
+
+    *srtp_out_len = enc_start + enc_len + out.tag_len;
+
+    return srtp_err_status_ok;
+}
+
+srtp_err_status_t srtp_init(void)
+{
+    srtp_err_status_t status;
+
+    /* initialize crypto kernel */
+    status = srtp_crypto_kernel_init();
+    if (status) {
+        return status;
+    }
+
+    /* load srtp debug module into the kernel */
+    status = srtp_crypto_kernel_load_debug_module(&mod_srtp);
+    if (status) {
+        return status;
+    }
+
+    return srtp_err_status_ok;
+}
+
+srtp_err_status_t srtp_shutdown(void)
+{
+    srtp_err_status_t status;
+
+    /* write out and release the key log, if there is one */
+    status = srtp_keylog_close();
+    if (status) {
+        return status;
+    }
+
+    /* shut down crypto kernel */
+    status = srtp_crypto_kernel_shutdown();
+    if (status) {
+        return status;
+    }
+
+    /* shutting down crypto kernel frees the srtp debug module as well */
+
+    return srtp_err_status_ok;
+}
+
+srtp_stream_ctx_t *srtp_get_stream(srtp_t srtp, uint32_t ssrc)
+{
+    return srtp_stream_list_get(srtp->stream_list, ssrc);
+}
+
+srtp_err_status_t srtp_dealloc(srtp_t session)
+{
+    srtp_err_status_t status;
+
+    /*
+     * we take a conservative deallocation strategy - if we encounter an
+     * error deallocating a stream, then we stop trying to deallocate
+     * memory and just return an error
+     */
+
+    /* deallocate streams */
+    status = srtp_remove_and_dealloc_streams(session->stream_list,
+                                             session->stream_template);
+    if (status) {
+        return status;
+    }
+
+    /* deallocate stream template, if there is one */
+    if (session->stream_template != NULL) {
+        status = srtp_stream_dealloc(session->stream_template, NULL);
+        if (status) {
+            return status;
+        }
+    }
+
+    /* deallocate stream list */
+    status = srtp_stream_list_dealloc(session->stream_list);
+    if (status) {
+        return status;
+    }
+
+    /* write out and release the checkpoint file, if there is one */
+    if (session->checkpoint != NULL) {
+        srtp_checkpoint_close(session->checkpoint);
+        session->checkpoint = NULL;
+    }
+
+    /* deallocate session context */
+    srtp_crypto_free(session);
+
+    return srtp_err_status_ok;
+}
+
+/*
+ * key log
+ *
+ * The key log is a preallocated, memory mapped file that the master keys
+ * of every stream and template are appended to as srtp_create(),
+ * srtp_stream_add(), srtp_stream_attach() and srtp_update() set them up,
+ * so that captures can be decrypted offline.  It is written to only when
+ * streams are set up, never when packets are processed.
+ *
+ * The file holds a header, a hash table and an array of fixed size
+ * records.  One policy adds a group of records, one per master key.  The
+ * hash table maps an SSRC, or the type of a template, to the first
+ * record of the newest group logged for it, using linear probing, and
+ * each group links to the previous one for the same SSRC or type, so
+ * that the groups of every session and every srtp_update() can be found.
+ * A group is counted in the header only after it and its hash table
+ * entry are written, so a reader never sees a partial one.  The file is
+ * in host byte order.
+ */
+#define SRTP_KEYLOG_MAGIC 0x534b4c47 /* "SKLG" */
+#define SRTP_KEYLOG_VERSION 2
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t max_records;
+    uint32_t num_buckets;
+    uint32_t num_records;
+    uint64_t next_session_id;
+} srtp_keylog_hdr_t;
+
+typedef struct {
+    uint32_t cipher_type;
+    uint32_t cipher_key_len;
+    uint32_t auth_type;
+    uint32_t auth_key_len;
+    uint32_t auth_tag_len;
+    uint32_t sec_serv;
+} srtp_keylog_policy_t;
+
+typedef struct srtp_keylog_record_t_ {
+    uint64_t session_id;
+    uint32_t ssrc_type;
+    uint32_t ssrc; /* host order, 0 for a template */
+    uint32_t key_index;
+    uint32_t num_keys;
+    uint32_t prev_group; /* first record of the previous group, plus one */
+    srtp_keylog_policy_t rtp;
+    srtp_keylog_policy_t rtcp;
+    uint32_t key_len;
+    uint32_t mki_len;
+    uint8_t key[SRTP_MAX_KEY_LEN];
+    uint8_t mki[SRTP_MAX_MKI_LEN];
+} srtp_keylog_record_t;
+
+/* the key log of the process, hdr is NULL while there is none */
+static struct {
+    srtp_keylog_hdr_t *hdr;
+    uint32_t *buckets;
+    srtp_keylog_record_t *records;
+    size_t map_len;
+} srtp_keylog = { NULL, NULL, NULL, 0 };
+
+/*
+ * srtp_keylog_lock() serializes appends to the key log, which
+ * srtp_create(), srtp_stream_add() and srtp_update() on different
+ * sessions may make from several threads at once.  Without atomic
+ * operations it does nothing, and stream setup must not run
+ * concurrently while a key log is open.
+ */
+#if defined(__GNUC__)
+
+static int srtp_keylog_busy = 0;
+
+static void srtp_keylog_lock(void)
+{
+    while (__atomic_exchange_n(&srtp_keylog_busy, 1, __ATOMIC_ACQUIRE)) {
+    }
+}
+
+static void srtp_keylog_unlock(void)
+{
+    __atomic_store_n(&srtp_keylog_busy, 0, __ATOMIC_RELEASE);
+}
+
+#elif defined(_MSC_VER)
+
+#include <intrin.h>
+
+static volatile long srtp_keylog_busy = 0;
+
+static void srtp_keylog_lock(void)
+{
+    while (_InterlockedExchange(&srtp_keylog_busy, 1)) {
+    }
+}
+
+static void srtp_keylog_unlock(void)
+{
+    _InterlockedExchange(&srtp_keylog_busy, 0);
+}
+
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L &&            \
+    !defined(__STDC_NO_ATOMICS__)
+
+#include <stdatomic.h>
+
+static atomic_flag srtp_keylog_busy = ATOMIC_FLAG_INIT;
+
+static void srtp_keylog_lock(void)
+{
+    while (atomic_flag_test_and_set_explicit(&srtp_keylog_busy,
+                                             memory_order_acquire)) {
+    }
+}
+
+static void srtp_keylog_unlock(void)
+{
+    atomic_flag_clear_explicit(&srtp_keylog_busy, memory_order_release);
+}
+
+#else
+
+static void srtp_keylog_lock(void)
+{
+}
+
+static void srtp_keylog_unlock(void)
+{
+}
+
+#endif
+
+static size_t srtp_keylog_size(uint32_t max_records, uint32_t num_buckets)
+{
+    return sizeof(srtp_keylog_hdr_t) + num_buckets * sizeof(uint32_t) +
+           max_records * sizeof(srtp_keylog_record_t);
+}
+
+/*
+ * srtp_keylog_bucket(hdr, buckets, records, type, ssrc) returns the
+ * bucket that holds, or would hold, the newest group for (type, ssrc)
+ */
+static uint32_t srtp_keylog_bucket(const srtp_keylog_hdr_t *hdr,
+                                   const uint32_t *buckets,
+                                   const srtp_keylog_record_t *records,
+                                   uint32_t type,
+                                   uint32_t ssrc)
+{
+    uint32_t mask = hdr->num_buckets - 1;
+    uint32_t b = ((ssrc ^ (type << 24)) * 2654435761u) & mask;
+
+    for (uint32_t n = 0; n < hdr->num_buckets; n++, b = (b + 1) & mask) {
+        uint32_t r = buckets[b];
+        if (r == 0 || r > hdr->max_records ||
+            (records[r - 1].ssrc_type == type &&
+             records[r - 1].ssrc == ssrc)) {
+            return b;
+        }
+    }
+    return 0;
+}
+
+static void srtp_keylog_put_policy(srtp_keylog_policy_t *out,
+                                   const srtp_crypto_policy_t *p)
+{
+    out->cipher_type = p->cipher_type;
+    out->cipher_key_len = (uint32_t)p->cipher_key_len;
+    out->auth_type = p->auth_type;
+    out->auth_key_len = (uint32_t)p->auth_key_len;
+    out->auth_tag_len = (uint32_t)p->auth_tag_len;
+    out->sec_serv = p->sec_serv;
+}
+
+static void srtp_keylog_get_policy(srtp_crypto_policy_t *out,
+                                   const srtp_keylog_policy_t *p)
+{
+    out->cipher_type = p->cipher_type;
+    out->cipher_key_len = p->cipher_key_len;
+    out->auth_type = p->auth_type;
+    out->auth_key_len = p->auth_key_len;
+    out->auth_tag_len = p->auth_tag_len;
+    out->sec_serv = (srtp_sec_serv_t)p->sec_serv;
+}
+
+/*
+ * srtp_keylog_fill(recs, policy) fills in a record for each master key of
+ * policy, all but the session id, and returns their number
+ */
+static uint32_t srtp_keylog_fill(srtp_keylog_record_t *recs,
+                                 const srtp_policy_t *policy)
+{
+    uint32_t num_keys;
+    uint32_t ssrc = 0;
+    size_t key_len;
+
+    num_keys = policy->key != NULL ? 1 : (uint32_t)policy->num_master_keys;
+
+    /* the caller's key buffer is as long as the longer cipher key */
+    key_len = policy->rtp.cipher_key_len > policy->rtcp.cipher_key_len
+                  ? policy->rtp.cipher_key_len
+                  : policy->rtcp.cipher_key_len;
+    if (key_len > SRTP_MAX_KEY_LEN) {
+        key_len = SRTP_MAX_KEY_LEN;
+    }
+
+    if (policy->ssrc.type == ssrc_specific) {
+        ssrc = policy->ssrc.value;
+    }
+
+    for (uint32_t i = 0; i < num_keys; i++) {
+        srtp_keylog_record_t *rec = &recs[i];
+        const uint8_t *key = policy->key;
+        const uint8_t *mki = NULL;
+
+        if (key == NULL) {
+            key = policy->keys[i]->key;
+            if (policy->use_mki) {
+                mki = policy->keys[i]->mki_id;
+            }
+        }
+
+        octet_string_set_to_zero(rec, sizeof(*rec));
+        rec->ssrc_type = policy->ssrc.type;
+        rec->ssrc = ssrc;
+        rec->key_index = i;
+        rec->num_keys = num_keys;
+        srtp_keylog_put_policy(&rec->rtp, &policy->rtp);
+        srtp_keylog_put_policy(&rec->rtcp, &policy->rtcp);
+        rec->key_len = (uint32_t)key_len;
+        memcpy(rec->key, key, key_len);
+        if (mki != NULL && policy->mki_size <= SRTP_MAX_MKI_LEN) {
+            rec->mki_len = (uint32_t)policy->mki_size;
+            memcpy(rec->mki, mki, policy->mki_size);
+        }
+    }
+
+    return num_keys;
+}
+
+/*
+ * srtp_keylog_commit(session, recs, num_keys) appends a group of records
+ * made by srtp_keylog_fill() for session, if a key log is open; a full
+ * log only raises a warning, it never fails the setup
+ */
+static void srtp_keylog_commit(srtp_ctx_t *session,
+                               const srtp_keylog_record_t *recs,
+                               uint32_t num_keys)
+{
+    srtp_keylog_hdr_t *hdr;
+    uint32_t first, b, prev;
+
+    if (num_keys == 0) {
+        return;
+    }
+
+    srtp_keylog_lock();
+
+    hdr = srtp_keylog.hdr;
+    if (hdr == NULL) {
+        srtp_keylog_unlock();
+        return;
+    }
+
+    if (num_keys > hdr->max_records - hdr->num_records) {
+        srtp_keylog_unlock();
+        srtp_err_report(srtp_err_level_warning, "srtp: key log is full\n");
+        return;
+    }
+
+    if (session->keylog_id == 0) {
+        session->keylog_id = ++hdr->next_session_id;
+    }
+
+    first = hdr->num_records;
+    b = srtp_keylog_bucket(hdr, srtp_keylog.buckets, srtp_keylog.records,
+                           recs[0].ssrc_type, recs[0].ssrc);
+    prev = srtp_keylog.buckets[b];
+    for (uint32_t i = 0; i < num_keys; i++) {
+        srtp_keylog.records[first + i] = recs[i];
+        srtp_keylog.records[first + i].session_id = session->keylog_id;
+        srtp_keylog.records[first + i].prev_group = prev;
+    }
+
+    srtp_keylog.buckets[b] = first + 1;
+    hdr->num_records = first + num_keys;
+
+#ifdef HAVE_SYS_MMAN_H
+    msync(hdr, srtp_keylog.map_len, MS_ASYNC);
+#endif
+
+    srtp_keylog_unlock();
+}
+
+/*
+ * srtp_keylog_append(session, policy) logs the master keys of a policy
+ * that has just been set up in session, if a key log is open
+ */
+static void srtp_keylog_append(srtp_ctx_t *session,
+                               const srtp_policy_t *policy)
+{
+    srtp_keylog_record_t recs[SRTP_MAX_NUM_MASTER_KEYS];
+    uint32_t num_keys;
+
+    if (srtp_keylog.hdr == NULL) {
+        return;
+    }
+
+    num_keys = srtp_keylog_fill(recs, policy);
+    srtp_keylog_commit(session, recs, num_keys);
+    octet_string_set_to_zero(recs, num_keys * sizeof(recs[0]));
+}
+
+/*
+ * srtp_keylog_hold(stream, policy) keeps the records for a stream built
+ * apart from any session, if a key log is open, so that they can be
+ * logged once the stream is attached
+ */
+static srtp_err_status_t srtp_keylog_hold(srtp_stream_ctx_t *stream,
+                                          const srtp_policy_t *policy)
+{
+    size_t num_keys;
+
+    if (srtp_keylog.hdr == NULL) {
+        return srtp_err_status_ok;
+    }
+
+    num_keys = policy->key != NULL ? 1 : policy->num_master_keys;
+    stream->keylog = (srtp_keylog_record_t *)srtp_crypto_alloc(
+        num_keys * sizeof(srtp_keylog_record_t));
+    if (stream->keylog == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+    stream->keylog_num_records = srtp_keylog_fill(stream->keylog, policy);
+
+    return srtp_err_status_ok;
+}
+
+static void srtp_keylog_drop(srtp_stream_ctx_t *stream)
+{
+    if (stream->keylog == NULL) {
+        return;
+    }
+    octet_string_set_to_zero(stream->keylog, stream->keylog_num_records *
+                                                 sizeof(srtp_keylog_record_t));
+    srtp_crypto_free(stream->keylog);
+    stream->keylog = NULL;
+    stream->keylog_num_records = 0;
+}
+
+srtp_err_status_t srtp_keylog_open(const char *path, size_t max_records)
+{
+#ifdef HAVE_SYS_MMAN_H
+    srtp_keylog_hdr_t *hdr;
+    struct stat st;
+    uint32_t num_buckets = 2;
+    size_t len;
+    void *map;
+    int fd;
+
+    if (path == NULL || srtp_keylog.hdr != NULL || max_records == 0 ||
+        max_records > (UINT32_MAX >> 2)) {
+        return srtp_err_status_bad_param;
+    }
+
+    /* at most half of the hash table is ever in use */
+    while (num_buckets < 2 * max_records) {
+        num_buckets <<= 1;
+    }
+
+    fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        return srtp_err_status_read_fail;
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return srtp_err_status_read_fail;
+    }
+
+    /* the whole file is allocated up front; an existing one is appended to */
+    if (st.st_size == 0) {
+        len = srtp_keylog_size((uint32_t)max_records, num_buckets);
+        if (ftruncate(fd, (off_t)len) != 0) {
+            close(fd);
+            return srtp_err_status_write_fail;
+        }
+    } else if ((size_t)st.st_size < sizeof(srtp_keylog_hdr_t)) {
+        close(fd);
+        return srtp_err_status_parse_err;
+    } else {
+        len = (size_t)st.st_size;
+    }
+
+    map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return srtp_err_status_read_fail;
+    }
+    hdr = (srtp_keylog_hdr_t *)map;
+
+    if (st.st_size == 0) {
+        hdr->magic = SRTP_KEYLOG_MAGIC;
+        hdr->version = SRTP_KEYLOG_VERSION;
+        hdr->record_size = sizeof(srtp_keylog_record_t);
+        hdr->max_records = (uint32_t)max_records;
+        hdr->num_buckets = num_buckets;
+        hdr->num_records = 0;
+        hdr->next_session_id = 0;
+    } else if (hdr->magic != SRTP_KEYLOG_MAGIC ||
+               hdr->version != SRTP_KEYLOG_VERSION ||
+               hdr->record_size != sizeof(srtp_keylog_record_t) ||
+               hdr->num_buckets == 0 ||
+               (hdr->num_buckets & (hdr->num_buckets - 1)) != 0 ||
+               hdr->num_buckets < 2 * hdr->max_records ||
+               hdr->num_records > hdr->max_records ||
+               srtp_keylog_size(hdr->max_records, hdr->num_buckets) > len) {
+        munmap(map, len);
+        return srtp_err_status_parse_err;
+    }
+
+    srtp_keylog_lock();
+    srtp_keylog.hdr = hdr;
+    srtp_keylog.buckets = (uint32_t *)(hdr + 1);
+    srtp_keylog.records =
+        (srtp_keylog_record_t *)(srtp_keylog.buckets + hdr->num_buckets);
+    srtp_keylog.map_len = len;
+    srtp_keylog_unlock();
+
+    return srtp_err_status_ok;
+#else
+    (void)path;
+    (void)max_records;
+    return srtp_err_status_no_such_op;
+#endif
+}
+
+srtp_err_status_t srtp_keylog_close(void)
+{
+    srtp_keylog_lock();
+
+    if (srtp_keylog.hdr == NULL) {
+        srtp_keylog_unlock();
+        return srtp_err_status_ok;
+    }
+
+#ifdef HAVE_SYS_MMAN_H
+    if (msync(srtp_keylog.hdr, srtp_keylog.map_len, MS_SYNC) != 0) {
+        srtp_keylog_unlock();
+        return srtp_err_status_write_fail;
+    }
+    munmap(srtp_keylog.hdr, srtp_keylog.map_len);
+#endif
+    srtp_keylog.hdr = NULL;
+    srtp_keylog.buckets = NULL;
+    srtp_keylog.records = NULL;
+    srtp_keylog.map_len = 0;
+
+    srtp_keylog_unlock();
+
+    return srtp_err_status_ok;
+}
+
+srtp_err_status_t srtp_keylog_find(const uint8_t *log,
+                                   size_t log_len,
+                                   uint32_t ssrc,
+                                   size_t skip,
+                                   srtp_keylog_entry_t *entries,
+                                   size_t max_entries,
+                                   size_t *num_entries)
+{
+    /* a specific SSRC is preferred over a template of either direction */
+    static const srtp_ssrc_type_t types[] = { ssrc_specific, ssrc_any_outbound,
+                                              ssrc_any_inbound };
+    const srtp_keylog_hdr_t *hdr = (const srtp_keylog_hdr_t *)log;
+    const uint32_t *buckets;
+    const srtp_keylog_record_t *records;
+
+    if (log == NULL || entries == NULL || num_entries == NULL ||
+        ((uintptr_t)log & 7) != 0) {
+        return srtp_err_status_bad_param;
+    }
+    if (log_len < sizeof(srtp_keylog_hdr_t) ||
+        hdr->magic != SRTP_KEYLOG_MAGIC ||
+        hdr->version != SRTP_KEYLOG_VERSION ||
+        hdr->record_size != sizeof(srtp_keylog_record_t) ||
+        hdr->num_buckets == 0 ||
+        (hdr->num_buckets & (hdr->num_buckets - 1)) != 0 ||
+        hdr->num_records > hdr->max_records ||
+        srtp_keylog_size(hdr->max_records, hdr->num_buckets) > log_len) {
+        return srtp_err_status_parse_err;
+    }
+    buckets = (const uint32_t *)(hdr + 1);
+    records = (const srtp_keylog_record_t *)(buckets + hdr->num_buckets);
+
+    for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+        uint32_t value = types[t] == ssrc_specific ? ssrc : 0;
+        uint32_t b = srtp_keylog_bucket(hdr, buckets, records, types[t], value);
+        uint32_t first = buckets[b];
+        uint32_t limit = hdr->num_records + 1;
+
+        /* walk the groups newest first; each links to an older one */
+        while (first != 0 && first < limit) {
+            const srtp_keylog_record_t *rec = &records[first - 1];
+
+            if (rec->ssrc_type != (uint32_t)types[t] || rec->ssrc != value ||
+                rec->num_keys > hdr->num_records - (first - 1)) {
+                break;
+            }
+            if (skip > 0) {
+                skip--;
+                limit = first;
+                first = rec->prev_group;
+                continue;
+            }
+            if (rec->num_keys > max_entries) {
+                return srtp_err_status_buffer_small;
+            }
+
+            for (uint32_t i = 0; i < records[first - 1].num_keys; i++, rec++) {
+                srtp_keylog_entry_t *e = &entries[i];
+                e->session_id = rec->session_id;
+                e->ssrc.type = (srtp_ssrc_type_t)rec->ssrc_type;
+                e->ssrc.value = rec->ssrc;
+                srtp_keylog_get_policy(&e->rtp, &rec->rtp);
+                srtp_keylog_get_policy(&e->rtcp, &rec->rtcp);
+                e->key_len = rec->key_len < SRTP_MAX_KEY_LEN
+                                 ? rec->key_len
+                                 : SRTP_MAX_KEY_LEN;
+                memcpy(e->key, rec->key, e->key_len);
+                e->mki_len = rec->mki_len < SRTP_MAX_MKI_LEN
+                                 ? rec->mki_len
+                                 : SRTP_MAX_MKI_LEN;
+                memcpy(e->mki, rec->mki, e->mki_len);
+            }
+            *num_entries = records[first - 1].num_keys;
+
+            return srtp_err_status_ok;
+        }
+    }
+
+    return srtp_err_status_no_ctx;
+}
+
+srtp_err_status_t srtp_stream_add(srtp_t session, const srtp_policy_t *policy)
+{
+    srtp_err_status_t status;
+    srtp_stream_t tmp;
+
+    /* sanity check arguments */
+    if (session == NULL) {
+        return srtp_err_status_bad_param;
+    }
+
+    status = srtp_valid_policy(policy);
+    if (status != srtp_err_status_ok) {
+        return status;
+    }
+
+    /* allocate stream  */
+    status = srtp_stream_alloc(&tmp, policy);
+    if (status) {
+        return status;
+    }
+
+    /* initialize stream  */
+    status = srtp_stream_init(tmp, policy);
+    if (status) {
+        srtp_stream_dealloc(tmp, NULL);
+        return status;
+    }
+
+    /*
+     * set the head of the stream list or the template to point to the
+     * stream that we've just alloced and init'ed, depending on whether
+     * or not it has a wildcard SSRC value or not
+     *
+     * if the template stream has already been set, then the policy is
+     * inconsistent, so we return a bad_param error code
+     */
+    switch (policy->ssrc.type) {
+    case (ssrc_any_outbound):
+        if (session->stream_template) {
+            srtp_stream_dealloc(tmp, NULL);
+            return srtp_err_status_bad_param;
+        }
+        session->stream_template = tmp;
+        session->stream_template->direction = dir_srtp_sender;
+        break;
+    case (ssrc_any_inbound):
+        if (session->stream_template) {
+            srtp_stream_dealloc(tmp, NULL);
+            return srtp_err_status_bad_param;
+        }
+        session->stream_template = tmp;
+        session->stream_template->direction = dir_srtp_receiver;
+        break;
+    case (ssrc_specific):
+        status = srtp_insert_or_dealloc_stream(session->stream_list, tmp,
+                                               session->stream_template);
+        if (status) {
+            return status;
+        }
+        break;
+    case (ssrc_undefined):
+    default:
+        srtp_stream_dealloc(tmp, NULL);
+        return srtp_err_status_bad_param;
+    }
+
+    srtp_keylog_append(session, policy);
+
+    return srtp_err_status_ok;
+}
+
+srtp_err_status_t srtp_create(srtp_t *session, /* handle for session     */
+                              const srtp_policy_t *policy)
+{ /* SRTP policy (list)     */
+    srtp_err_status_t stat;
+    srtp_ctx_t *ctx;
+
+    /* sanity check arguments */
+    if (session == NULL) {
+        return srtp_err_status_bad_param;
+    }
+
+    if (policy) {
+        stat = srtp_valid_policy(policy);
+        if (stat != srtp_err_status_ok) {
+            return stat;
+        }
+    }
+
+    /* allocate srtp context and set ctx_ptr */
+    ctx = (srtp_ctx_t *)srtp_crypto_alloc(sizeof(srtp_ctx_t));
+    if (ctx == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+    *session = ctx;
+
+    ctx->stream_template = NULL;
+    ctx->stream_list = NULL;
+    ctx->user_data = NULL;
+    ctx->checkpoint = NULL;
+    ctx->keylog_id = 0;
+    ctx->stream_gen = 0;
+
+    /* allocate stream list */
+    stat = srtp_stream_list_alloc(&ctx->stream_list);
+    if (stat) {
+        /* clean up everything */
+        srtp_dealloc(*session);
+        *session = NULL;
+        return stat;
+    }
+
+    /*
+     * loop over elements in the policy list, allocating and
+     * initializing a stream for each element
+     */
+    while (policy != NULL) {
+        stat = srtp_stream_add(ctx, policy);
+        if (stat) {
+            /* clean up everything */
+            srtp_dealloc(*session);
+            *session = NULL;
+            return stat;
+        }
+
+        /* set policy to next item in list  */
+        policy = policy->next;
+    }
+
+    return srtp_err_status_ok;
+}
+
+srtp_err_status_t srtp_stream_remove(srtp_t session, uint32_t ssrc)
+{
+    srtp_stream_ctx_t *stream;
+    srtp_err_status_t status;
+
+    /* sanity check arguments */
+    if (session == NULL) {
+        return srtp_err_status_bad_param;
+    }
+
+    /* find and remove stream from the list */
+    stream = srtp_stream_list_get(session->stream_list, htonl(ssrc));
+    if (stream == NULL) {
+        return srtp_err_status_no_ctx;
+    }
+
+    srtp_stream_list_remove(session->stream_list, stream);
+    session->stream_gen++;
+
+    /* deallocate the stream */
+    status = srtp_stream_dealloc(stream, session->stream_template);
+    if (status) {
+        return status;
+    }
+
+    return srtp_err_status_ok;
+}
+
+srtp_err_status_t srtp_stream_create(srtp_stream_t *stream,
+                                     const srtp_policy_t *policy)
+{
+    srtp_err_status_t status;
+    srtp_stream_t tmp;
+
+    /* sanity check arguments */
+    if (stream == NULL) {
+        return srtp_err_status_bad_param;
+    }
+
+    status = srtp_valid_policy(policy);
+    if (status != srtp_err_status_ok) {
+        return status;
+    }
+
+    /* a template is part of its session, so it cannot be built apart */
+    if (policy->ssrc.type != ssrc_specific) {
+        return srtp_err_status_bad_param;
+    }
+
+    /* allocate stream  */
+    status = srtp_stream_alloc(&tmp, policy);
+    if (status) {
+        return status;
+    }
+
+    /* initialize stream, deriving the keys for every master key */
+    status = srtp_stream_init(tmp, policy);
+    if (status == srtp_err_status_ok) {
+        status = srtp_keylog_hold(tmp, policy);
+    }
+    if (status) {
+        srtp_stream_dealloc(tmp, NULL);
+        return status;
+    }
+
+    *stream = tmp;
+
+    return srtp_err_status_ok;
+}
+
+srtp_err_status_t srtp_stream_attach(srtp_t session, srtp_stream_t stream)
+{
+    srtp_err_status_t status;
+
+    /* sanity check arguments */
+    if (session == NULL || stream == NULL) {
+        return srtp_err_status_bad_param;
+    }
+
+    /* a session holds at most one stream per SSRC */
+    if (srtp_stream_list_get(session->stream_list, stream->ssrc) != NULL) {
+        return srtp_err_status_bad_param;
+    }
+
+    /* on failure, ownership stays with the caller */
+    status = srtp_stream_list_insert(session->stream_list, stream);
+    if (status) {
+        return status;
+    }
+
+    /* the keys are logged now that the stream has a session */
+    srtp_keylog_commit(session, stream->keylog,
+                       (uint32_t)stream->keylog_num_records);
+    srtp_keylog_drop(stream);
+
+    return srtp_err_status_ok;
+}
+
+srtp_err_status_t srtp_stream_detach(srtp_t session,
+                                     uint32_t ssrc,
+                                     srtp_stream_t *stream)
+{
+    srtp_stream_ctx_t *str;
+
+    /* sanity check arguments */
+    if (session == NULL || stream == NULL) {
+        return srtp_err_status_bad_param;
+    }
+    *stream = NULL;
+
+    /* find and remove stream from the list */
+    str = srtp_stream_list_get(session->stream_list, htonl(ssrc));
+    if (str == NULL) {
+        return srtp_err_status_no_ctx;
+    }
+
+    srtp_stream_list_remove(session->stream_list, str);
+    session->stream_gen++;
+
+    /*
+     * a stream cloned from the template cannot outlive it, but freeing
+     * it only releases its per-stream state, so do that here
+     */
+    if (str->is_clone) {
+        return srtp_stream_dealloc(str, session->stream_template);
+    }
+
+    *stream = str;
+
+    return srtp_err_status_ok;
+}
+
+srtp_err_status_t srtp_stream_destroy(srtp_stream_t stream)
+{
+    if (stream == NULL) {
+        return srtp_err_status_ok;
+    }
+
+    return srtp_stream_dealloc(stream, NULL);
+}
+
+srtp_err_status_t srtp_update(srtp_t session, const srtp_policy_t *policy)
+{
+    srtp_err_status_t stat;
+
+    /* sanity check arguments */
+    if (session == NULL) {
+        return srtp_err_status_bad_param;
+    }
+
+    stat = srtp_valid_policy(policy);
+    if (stat != srtp_err_status_ok) {
+        return stat;
+    }
+
+    while (policy != NULL) {
+        stat = srtp_stream_update(session, policy);
+        if (stat) {
+            return stat;
+        }
+
+        /* set policy to next item in list  */
+        policy = policy->next;
+    }
+    return srtp_err_status_ok;
+}
+
+struct update_template_stream_data {
+    srtp_err_status_t status;
+    srtp_t session;
+    srtp_stream_t new_stream_template;
+    srtp_stream_list_t new_stream_list;
+};
+
+static bool update_template_stream_cb(srtp_stream_t stream, void *raw_data)
+{
+    struct update_template_stream_data *data =
+        (struct update_template_stream_data *)raw_data;
+    srtp_t session = data->session;
+    uint32_t ssrc = stream->ssrc;
+    srtp_xtd_seq_num_t old_index;
+    srtp_rdb_t old_rtcp_rdb;
+    srtp_checkpoint_slot_t *old_checkpoint;
+
+    /* old / non-template streams are copied unchanged */
+    if (stream->session_keys[0].rtp_auth !=
+        session->stream_template->session_keys[0].rtp_auth) {
+        srtp_stream_list_remove(session->stream_list, stream);
+        data->status = srtp_insert_or_dealloc_stream(
+            data->new_stream_list, stream, session->stream_template);
+        if (data->status) {
+            return false;
+        }
+        return true;
+    }
+
+    /* save old extended seq */
+    old_index = stream->rtp_rdbx.index;
+    old_rtcp_rdb = stream->rtcp_rdb;
+    old_checkpoint = stream->checkpoint;
+
+    /* remove stream */
+    data->status = srtp_stream_remove(session, ntohl(ssrc));
+    if (data->status) {
+        return false;
+    }
+
+    /* allocate and initialize a new stream */
+    data->status = srtp_stream_clone(data->new_stream_template, ssrc, &stream);
+    if (data->status) {
+        return false;
+    }
+
+    /* add new stream to the head of the new_stream_list */
+    data->status = srtp_insert_or_dealloc_stream(data->new_stream_list, stream,
+                                                 data->new_stream_template);
+    if (data->status) {
+        return false;
+    }
+
+    /* restore old extended seq */
+    stream->rtp_rdbx.index = old_index;
+    stream->rtcp_rdb = old_rtcp_rdb;
+    stream->checkpoint = old_checkpoint;
+
+    return true;
+}
+
+static srtp_err_status_t is_update_policy_compatable(
+    srtp_stream_t stream,
+    const srtp_policy_t *policy)
+{
+    if (stream->use_mki != policy->use_mki) {
+        return srtp_err_status_bad_param;
+    }
+
+    if (stream->use_mki && stream->mki_size != policy->mki_size) {
+        return srtp_err_status_bad_param;
+    }
+
+    return srtp_err_status_ok;
+}
+
+static srtp_err_status_t update_template_streams(srtp_t session,
+                                                 const srtp_policy_t *policy)
+{
+    srtp_err_status_t status;
+    srtp_stream_t new_stream_template;
+    srtp_stream_list_t new_stream_list;
+
+    status = srtp_valid_policy(policy);
+    if (status != srtp_err_status_ok) {
+        return status;
+    }
+
+    if (session->stream_template == NULL) {
+        return srtp_err_status_bad_param;
+    }
+
+    status = is_update_policy_compatable(session->stream_template, policy);
+    if (status != srtp_err_status_ok) {
+        return status;
+    }
+
+    /* allocate new template stream  */
+    status = srtp_stream_alloc(&new_stream_template, policy);
+    if (status) {
+        return status;
+    }
+
+    /* initialize new template stream  */
+    status = srtp_stream_init(new_stream_template, policy);
+    if (status) {
+        srtp_crypto_free(new_stream_template);
+        return status;
+    }
+
+    /* allocate new stream list */
+    status = srtp_stream_list_alloc(&new_stream_list);
+    if (status) {
+        srtp_crypto_free(new_stream_template);
+        return status;
+    }
+
+    /* process streams */
+    struct update_template_stream_data data = { srtp_err_status_ok, session,
+                                                new_stream_template,
+                                                new_stream_list };
+    srtp_stream_list_for_each(session->stream_list, update_template_stream_cb,
+                              &data);
+    if (data.status) {
+        /* free new allocations */
+        srtp_remove_and_dealloc_streams(new_stream_list, new_stream_template);
+        srtp_stream_list_dealloc(new_stream_list);
+        srtp_stream_dealloc(new_stream_template, NULL);
+        return data.status;
+    }
+
+    /* dealloc old list / template */
+    srtp_remove_and_dealloc_streams(session->stream_list,
+                                    session->stream_template);
+    srtp_stream_list_dealloc(session->stream_list);
+    srtp_stream_dealloc(session->stream_template, NULL);
+
+    /* set new list / template */
+    session->stream_template = new_stream_template;
+    session->stream_list = new_stream_list;
+    return srtp_err_status_ok;
+}
+
+static srtp_err_status_t stream_update(srtp_t session,
+                                       const srtp_policy_t *policy)
+{
+    srtp_err_status_t status;
+    srtp_xtd_seq_num_t old_index;
+    srtp_rdb_t old_rtcp_rdb;
+    srtp_checkpoint_slot_t *old_checkpoint;
+    srtp_stream_t stream;
+
+    status = srtp_valid_policy(policy);
+    if (status != srtp_err_status_ok) {
+        return status;
+    }
+
+    stream = srtp_get_stream(session, htonl(policy->ssrc.value));
+    if (stream == NULL) {
+        return srtp_err_status_bad_param;
+    }
+
+    status = is_update_policy_compatable(stream, policy);
+    if (status != srtp_err_status_ok) {
+        return status;
+    }
+
+    /* save old extendard seq */
+    old_index = stream->rtp_rdbx.index;
+    old_rtcp_rdb = stream->rtcp_rdb;
+    old_checkpoint = stream->checkpoint;
+
+    status = srtp_stream_remove(session, policy->ssrc.value);
+    if (status) {
+        return status;
+    }
+
+    status = srtp_stream_add(session, policy);
+    if (status) {
+        return status;
+    }
+
+    stream = srtp_get_stream(session, htonl(policy->ssrc.value));
+    if (stream == NULL) {
+        return srtp_err_status_fail;
+    }
+
+    /* restore old extended seq */
+    stream->rtp_rdbx.index = old_index;
+    stream->rtcp_rdb = old_rtcp_rdb;
+    stream->checkpoint = old_checkpoint;
 
     return srtp_err_status_ok;
 }
@@ -3297,1237 +5465,2894 @@ srtp_err_status_t srtp_stream_update(srtp_t session,
 {
     srtp_err_status_t status;
 
-    /* sanity check arguments */
-    if (session == NULL) {
+    /* sanity check arguments */
+    if (session == NULL) {
+        return srtp_err_status_bad_param;
+    }
+
+    status = srtp_valid_policy(policy);
+    if (status != srtp_err_status_ok) {
+        return status;
+    }
+
+    switch (policy->ssrc.type) {
+    case (ssrc_any_outbound):
+    case (ssrc_any_inbound):
+        status = update_template_streams(session, policy);
+        if (status == srtp_err_status_ok) {
+            srtp_keylog_append(session, policy);
+        }
+        break;
+    case (ssrc_specific):
+        status = stream_update(session, policy);
+        break;
+    case (ssrc_undefined):
+    default:
+        return srtp_err_status_bad_param;
+    }
+
+    return status;
+}
+
+/*
+ * The default policy - provides a convenient way for callers to use
+ * the default security policy
+ *
+ * The default policy is defined in RFC 3711
+ * (Section 5. Default and mandatory-to-implement Transforms)
+ *
+ */
+
+/*
+ * NOTE: cipher_key_len is really key len (128 bits) plus salt len
+ *  (112 bits)
+ */
+/* There are hard-coded 16's for base_key_len in the key generation code */
+
+void srtp_crypto_policy_set_rtp_default(srtp_crypto_policy_t *p)
+{
+    p->cipher_type = SRTP_AES_ICM_128;
+    p->cipher_key_len =
+        SRTP_AES_ICM_128_KEY_LEN_WSALT; /* default 128 bits per RFC 3711 */
+    p->auth_type = SRTP_HMAC_SHA1;
+    p->auth_key_len = 20; /* default 160 bits per RFC 3711 */
+    p->auth_tag_len = 10; /* default 80 bits per RFC 3711 */
+    p->sec_serv = sec_serv_conf_and_auth;
+}
+
+void srtp_crypto_policy_set_rtcp_default(srtp_crypto_policy_t *p)
+{
+    p->cipher_type = SRTP_AES_ICM_128;
+    p->cipher_key_len =
+        SRTP_AES_ICM_128_KEY_LEN_WSALT; /* default 128 bits per RFC 3711 */
+    p->auth_type = SRTP_HMAC_SHA1;
+    p->auth_key_len = 20; /* default 160 bits per RFC 3711 */
+    p->auth_tag_len = 10; /* default 80 bits per RFC 3711 */
+    p->sec_serv = sec_serv_conf_and_auth;
+}
+
+void srtp_crypto_policy_set_aes_cm_128_hmac_sha1_32(srtp_crypto_policy_t *p)
+{
+    /*
+     * corresponds to RFC 4568
+     *
+     * note that this crypto policy is intended for SRTP, but not SRTCP
+     */
+
+    p->cipher_type = SRTP_AES_ICM_128;
+    p->cipher_key_len =
+        SRTP_AES_ICM_128_KEY_LEN_WSALT; /* 128 bit key, 112 bit salt */
+    p->auth_type = SRTP_HMAC_SHA1;
+    p->auth_key_len = 20; /* 160 bit key               */
+    p->auth_tag_len = 4;  /* 32 bit tag                */
+    p->sec_serv = sec_serv_conf_and_auth;
+}
+
+void srtp_crypto_policy_set_aes_cm_128_null_auth(srtp_crypto_policy_t *p)
+{
+    /*
+     * corresponds to RFC 4568
+     *
+     * note that this crypto policy is intended for SRTP, but not SRTCP
+     */
+
+    p->cipher_type = SRTP_AES_ICM_128;
+    p->cipher_key_len =
+        SRTP_AES_ICM_128_KEY_LEN_WSALT; /* 128 bit key, 112 bit salt */
+    p->auth_type = SRTP_NULL_AUTH;
+    p->auth_key_len = 0;
+    p->auth_tag_len = 0;
+    p->sec_serv = sec_serv_conf;
+}
+
+void srtp_crypto_policy_set_null_cipher_hmac_sha1_80(srtp_crypto_policy_t *p)
+{
+    /*
+     * corresponds to RFC 4568
+     */
+
+    p->cipher_type = SRTP_NULL_CIPHER;
+    p->cipher_key_len =
+        SRTP_AES_ICM_128_KEY_LEN_WSALT; /* 128 bit key, 112 bit salt */
+    p->auth_type = SRTP_HMAC_SHA1;
+    p->auth_key_len = 20;
+    p->auth_tag_len = 10;
+    p->sec_serv = sec_serv_auth;
+}
+
+void srtp_crypto_policy_set_null_cipher_hmac_null(srtp_crypto_policy_t *p)
+{
+    /*
+     * Should only be used for testing
+     */
+
+    p->cipher_type = SRTP_NULL_CIPHER;
+    p->cipher_key_len =
+        SRTP_AES_ICM_128_KEY_LEN_WSALT; /* 128 bit key, 112 bit salt */
+    p->auth_type = SRTP_NULL_AUTH;
+    p->auth_key_len = 0;
+    p->auth_tag_len = 0;
+    p->sec_serv = sec_serv_none;
+}
+
+void srtp_crypto_policy_set_aes_cm_256_hmac_sha1_80(srtp_crypto_policy_t *p)
+{
+    /*
+     * corresponds to RFC 6188
+     */
+
+    p->cipher_type = SRTP_AES_ICM_256;
+    p->cipher_key_len = SRTP_AES_ICM_256_KEY_LEN_WSALT;
+    p->auth_type = SRTP_HMAC_SHA1;
+    p->auth_key_len = 20; /* default 160 bits per RFC 3711 */
+    p->auth_tag_len = 10; /* default 80 bits per RFC 3711 */
+    p->sec_serv = sec_serv_conf_and_auth;
+}
+
+void srtp_crypto_policy_set_aes_cm_256_hmac_sha1_32(srtp_crypto_policy_t *p)
+{
+    /*
+     * corresponds to RFC 6188
+     *
+     * note that this crypto policy is intended for SRTP, but not SRTCP
+     */
+
+    p->cipher_type = SRTP_AES_ICM_256;
+    p->cipher_key_len = SRTP_AES_ICM_256_KEY_LEN_WSALT;
+    p->auth_type = SRTP_HMAC_SHA1;
+    p->auth_key_len = 20; /* default 160 bits per RFC 3711 */
+    p->auth_tag_len = 4;  /* default 80 bits per RFC 3711 */
+    p->sec_serv = sec_serv_conf_and_auth;
+}
+
+/*
+ * AES-256 with no authentication.
+ */
+void srtp_crypto_policy_set_aes_cm_256_null_auth(srtp_crypto_policy_t *p)
+{
+    p->cipher_type = SRTP_AES_ICM_256;
+    p->cipher_key_len = SRTP_AES_ICM_256_KEY_LEN_WSALT;
+    p->auth_type = SRTP_NULL_AUTH;
+    p->auth_key_len = 0;
+    p->auth_tag_len = 0;
+    p->sec_serv = sec_serv_conf;
+}
+
+void srtp_crypto_policy_set_aes_cm_192_hmac_sha1_80(srtp_crypto_policy_t *p)
+{
+    /*
+     * corresponds to RFC 6188
+     */
+
+    p->cipher_type = SRTP_AES_ICM_192;
+    p->cipher_key_len = SRTP_AES_ICM_192_KEY_LEN_WSALT;
+    p->auth_type = SRTP_HMAC_SHA1;
+    p->auth_key_len = 20; /* default 160 bits per RFC 3711 */
+    p->auth_tag_len = 10; /* default 80 bits per RFC 3711 */
+    p->sec_serv = sec_serv_conf_and_auth;
+}
+
+void srtp_crypto_policy_set_aes_cm_192_hmac_sha1_32(srtp_crypto_policy_t *p)
+{
+    /*
+     * corresponds to RFC 6188
+     *
+     * note that this crypto policy is intended for SRTP, but not SRTCP
+     */
+
+    p->cipher_type = SRTP_AES_ICM_192;
+    p->cipher_key_len = SRTP_AES_ICM_192_KEY_LEN_WSALT;
+    p->auth_type = SRTP_HMAC_SHA1;
+    p->auth_key_len = 20; /* default 160 bits per RFC 3711 */
+    p->auth_tag_len = 4;  /* default 80 bits per RFC 3711 */
+    p->sec_serv = sec_serv_conf_and_auth;
+}
+
+/*
+ * AES-192 with no authentication.
+ */
+void srtp_crypto_policy_set_aes_cm_192_null_auth(srtp_crypto_policy_t *p)
+{
+    p->cipher_type = SRTP_AES_ICM_192;
+    p->cipher_key_len = SRTP_AES_ICM_192_KEY_LEN_WSALT;
+    p->auth_type = SRTP_NULL_AUTH;
+    p->auth_key_len = 0;
+    p->auth_tag_len = 0;
+    p->sec_serv = sec_serv_conf;
+}
+
+/*
+ * AES-128 GCM mode with 16 octet auth tag.
+ */
+void srtp_crypto_policy_set_aes_gcm_128_16_auth(srtp_crypto_policy_t *p)
+{
+    p->cipher_type = SRTP_AES_GCM_128;
+    p->cipher_key_len = SRTP_AES_GCM_128_KEY_LEN_WSALT;
+    p->auth_type = SRTP_NULL_AUTH; /* GCM handles the auth for us */
+    p->auth_key_len = 0;
+    p->auth_tag_len = 16; /* 16 octet tag length */
+    p->sec_serv = sec_serv_conf_and_auth;
+}
+
+/*
+ * AES-256 GCM mode with 16 octet auth tag.
+ */
+void srtp_crypto_policy_set_aes_gcm_256_16_auth(srtp_crypto_policy_t *p)
+{
+    p->cipher_type = SRTP_AES_GCM_256;
+    p->cipher_key_len = SRTP_AES_GCM_256_KEY_LEN_WSALT;
+    p->auth_type = SRTP_NULL_AUTH; /* GCM handles the auth for us */
+    p->auth_key_len = 0;
+    p->auth_tag_len = 16; /* 16 octet tag length */
+    p->sec_serv = sec_serv_conf_and_auth;
+}
+
+/*
+ * secure rtcp functions
+ */
+
+/*
+ * AEAD uses a new IV formation method.  This function implements
+ * section 9.1 (SRTCP IV Formation for AES-GCM) from RFC7714.
+ * The calculation is defined as, where (+) is the xor operation:
+ *
+ *                0  1  2  3  4  5  6  7  8  9 10 11
+ *               +--+--+--+--+--+--+--+--+--+--+--+--+
+ *               |00|00|    SSRC   |00|00|0+SRTCP Idx|---+
+ *               +--+--+--+--+--+--+--+--+--+--+--+--+   |
+ *                                                       |
+ *               +--+--+--+--+--+--+--+--+--+--+--+--+   |
+ *               |         Encryption Salt           |->(+)
+ *               +--+--+--+--+--+--+--+--+--+--+--+--+   |
+ *                                                       |
+ *               +--+--+--+--+--+--+--+--+--+--+--+--+   |
+ *               |       Initialization Vector       |<--+
+ *               +--+--+--+--+--+--+--+--+--+--+--+--+*
+ *
+ * Input:  *session_keys - pointer to SRTP stream context session keys,
+ *                        used to retrieve the SALT
+ *         *iv           - Pointer to recieve the calculated IV
+ *         seq_num       - The SEQ value to use for the IV calculation.
+ *         *hdr          - The RTP header, used to get the SSRC value
+ *
+ * Returns: srtp_err_status_ok if no error or srtp_err_status_bad_param
+ *          if seq_num is invalid
+ *
+ */
+static srtp_err_status_t srtp_calc_aead_iv_srtcp(
+    srtp_session_keys_t *session_keys,
+    v128_t *iv,
+    uint32_t seq_num,
+    const srtcp_hdr_t *hdr)
+{
+    v128_t in;
+    v128_t salt;
+
+    memset(&in, 0, sizeof(v128_t));
+    memset(&salt, 0, sizeof(v128_t));
+
+    in.v16[0] = 0;
+    memcpy(&in.v16[1], &hdr->ssrc, 4); /* still in network order! */
+    in.v16[3] = 0;
+
+    /*
+     *  The SRTCP index (seq_num) spans bits 0 through 30 inclusive.
+     *  The most significant bit should be zero.
+     */
+    if (seq_num & 0x80000000UL) {
+        return srtp_err_status_bad_param;
+    }
+    in.v32[2] = htonl(seq_num);
+
+    debug_print(mod_srtp, "Pre-salted RTCP IV = %s\n", v128_hex_string(&in));
+
+    /*
+     * Get the SALT value from the context
+     */
+    memcpy(salt.v8, session_keys->c_salt, 12);
+    debug_print(mod_srtp, "RTCP SALT = %s\n", v128_hex_string(&salt));
+
+    /*
+     * Finally, apply the SALT to the input
+     */
+    v128_xor(iv, &in, &salt);
+
+    return srtp_err_status_ok;
+}
+
+/*
+ * This code handles AEAD ciphers for outgoing RTCP.  We currently support
+ * AES-GCM mode with 128 or 256 bit keys.
+ */
+static srtp_err_status_t srtp_protect_rtcp_aead(
+    srtp_stream_ctx_t *stream,
+    const uint8_t *rtcp,
+    size_t rtcp_len,
+    uint8_t *srtcp,
+    size_t *srtcp_len,
+    srtp_session_keys_t *session_keys)
+{
+    const srtcp_hdr_t *hdr = (const srtcp_hdr_t *)rtcp;
+    size_t enc_start;         /* pointer to start of encrypted portion  */
+    uint8_t *trailer_p;       /* pointer to start of trailer            */
+    uint32_t trailer;         /* trailer value                          */
+    size_t enc_octet_len = 0; /* number of octets in encrypted portion  */
+    uint8_t *auth_tag = NULL; /* location of auth_tag within packet     */
+    srtp_err_status_t status;
+    size_t tag_len;
+    uint32_t seq_num;
+    v128_t iv;
+
+    /* get tag length from stream context */
+    tag_len = srtp_auth_get_tag_length(session_keys->rtcp_auth);
+
+    /*
+     * set encryption start and encryption length - if we're not
+     * providing confidentiality, set enc_start to NULL
+     */
+    enc_start = octets_in_rtcp_header;
+    enc_octet_len = rtcp_len - enc_start;
+
+    /* check output length */
+    if (*srtcp_len <
+        rtcp_len + sizeof(srtcp_trailer_t) + stream->mki_size + tag_len) {
+        return srtp_err_status_buffer_small;
+    }
+
+    /* if not-inplace then need to copy full rtcp header */
+    if (rtcp != srtcp) {
+        memcpy(srtcp, rtcp, enc_start);
+    }
+
+    /* NOTE: hdr->length is not usable - it refers to only the first
+     * RTCP report in the compound packet!
+     */
+    trailer_p = srtcp + enc_start + enc_octet_len + tag_len;
+
+    if (stream->rtcp_services & sec_serv_conf) {
+        trailer = htonl(SRTCP_E_BIT); /* set encrypt bit */
+    } else {
+        /* 0 is network-order independant */
+        trailer = 0x00000000; /* set encrypt bit */
+    }
+
+    if (stream->use_mki) {
+        srtp_inject_mki(srtcp + rtcp_len + tag_len + sizeof(srtcp_trailer_t),
+                        session_keys, stream->mki_size);
+    }
+
+    /*
+     * set the auth_tag pointer to the proper location, which is after
+     * the payload, but before the trailer
+     * (note that srtcp *always* provides authentication, unlike srtp)
+     */
+    /* Note: This would need to change for optional mikey data */
+    auth_tag = srtcp + rtcp_len;
+
+    /*
+     * check sequence number for overruns, and copy it into the packet
+     * if its value isn't too big
+     */
+    status = srtp_rdb_increment(&stream->rtcp_rdb);
+    if (status) {
+        return status;
+    }
+    seq_num = srtp_rdb_get_value(&stream->rtcp_rdb);
+    trailer |= htonl(seq_num);
+    debug_print(mod_srtp, "srtcp index: %x", seq_num);
+
+    memcpy(trailer_p, &trailer, sizeof(trailer));
+
+    /*
+     * Calculate and set the IV
+     */
+    status = srtp_calc_aead_iv_srtcp(session_keys, &iv, seq_num, hdr);
+    if (status) {
+        return srtp_err_status_cipher_fail;
+    }
+    status = srtp_cipher_set_iv(session_keys->rtcp_cipher, (uint8_t *)&iv,
+                                srtp_direction_encrypt);
+    if (status) {
+        return srtp_err_status_cipher_fail;
+    }
+
+    /*
+     * Set the AAD for GCM mode
+     */
+    if (stream->rtcp_services & sec_serv_conf) {
+        /*
+         * If payload encryption is enabled, then the AAD consist of
+         * the RTCP header and the seq# at the end of the packet
+         */
+        status = srtp_cipher_set_aad(session_keys->rtcp_cipher, rtcp,
+                                     octets_in_rtcp_header);
+        if (status) {
+            return srtp_err_status_cipher_fail;
+        }
+    } else {
+        /*
+         * Since payload encryption is not enabled, we must authenticate
+         * the entire packet as described in RFC 7714 (Section 9.3. Data
+         * Types in Unencrypted SRTCP Compound Packets)
+         */
+        status = srtp_cipher_set_aad(session_keys->rtcp_cipher, rtcp, rtcp_len);
+        if (status) {
+            return (srtp_err_status_cipher_fail);
+        }
+    }
+    /*
+     * Process the sequence# as AAD
+     */
+    status = srtp_cipher_set_aad(session_keys->rtcp_cipher, (uint8_t *)&trailer,
+                                 sizeof(trailer));
+    if (status) {
+        return (srtp_err_status_cipher_fail);
+    }
+
+    /* if we're encrypting, exor keystream into the message */
+    if (stream->rtcp_services & sec_serv_conf) {
+        size_t outlen = *srtcp_len - enc_start;
+        status =
+            srtp_cipher_encrypt(session_keys->rtcp_cipher, rtcp + enc_start,
+                                enc_octet_len, srtcp + enc_start, &outlen);
+        enc_octet_len = outlen;
+        if (status) {
+            return srtp_err_status_cipher_fail;
+        }
+        /*
+         * Get the tag and append that to the output
+         */
+        status =
+            srtp_cipher_get_tag(session_keys->rtcp_cipher, auth_tag, &tag_len);
+        if (status) {
+            return (srtp_err_status_cipher_fail);
+        }
+    } else {
+        /* if no encryption and not-inplace then need to copy rest of packet */
+        if (rtcp != srtcp) {
+            memcpy(srtcp + enc_start, rtcp + enc_start, enc_octet_len);
+        }
+
+        /*
+         * Even though we're not encrypting the payload, we need
+         * to run the cipher to get the auth tag.
+         */
+        size_t nolen = 0;
+        status = srtp_cipher_encrypt(session_keys->rtcp_cipher, NULL, 0, NULL,
+                                     &nolen);
+        if (status) {
+            return srtp_err_status_cipher_fail;
+        }
+        /*
+         * Get the tag and append that to the output
+         */
+        status =
+            srtp_cipher_get_tag(session_keys->rtcp_cipher, auth_tag, &tag_len);
+        if (status) {
+            return (srtp_err_status_cipher_fail);
+        }
+    }
+
+    *srtcp_len = octets_in_rtcp_header + enc_octet_len;
+
+    /* increase the packet length by the length of the auth tag and seq_num*/
+    *srtcp_len += (tag_len + sizeof(srtcp_trailer_t));
+
+    /* increase the packet by the mki_size */
+    *srtcp_len += stream->mki_size;
+
+    return srtp_err_status_ok;
+}
+
+/*
+ * This function handles incoming SRTCP packets while in AEAD mode,
+ * which currently supports AES-GCM encryption.  Note, the auth tag is
+ * at the end of the packet stream and is automatically checked by GCM
+ * when decrypting the payload.
+ */
+static srtp_err_status_t srtp_unprotect_rtcp_aead(
+    srtp_t ctx,
+    srtp_stream_ctx_t *stream,
+    const uint8_t *srtcp,
+    size_t srtcp_len,
+    uint8_t *rtcp,
+    size_t *rtcp_len,
+    srtp_session_keys_t *session_keys)
+{
+    const srtcp_hdr_t *hdr = (const srtcp_hdr_t *)srtcp;
+    size_t enc_start;               /* pointer to start of encrypted portion  */
+    const uint8_t *trailer_p;       /* pointer to start of trailer            */
+    uint32_t trailer;               /* trailer value                          */
+    size_t enc_octet_len = 0;       /* number of octets in encrypted portion */
+    const uint8_t *auth_tag = NULL; /* location of auth_tag within packet     */
+    srtp_err_status_t status;
+    size_t tag_len;
+    size_t tmp_len;
+    uint32_t seq_num;
+    v128_t iv;
+
+    /* get tag length from stream context */
+    tag_len = srtp_auth_get_tag_length(session_keys->rtcp_auth);
+
+    enc_start = octets_in_rtcp_header;
+
+    /*
+     * set encryption start, encryption length, and trailer
+     */
+    /* index & E (encryption) bit follow normal data. hdr->len is the number of
+     * words (32-bit) in the normal packet minus 1
+     */
+    /* This should point trailer to the word past the end of the normal data. */
+    /* This would need to be modified for optional mikey data */
+    trailer_p = srtcp + srtcp_len - sizeof(srtcp_trailer_t) - stream->mki_size;
+    memcpy(&trailer, trailer_p, sizeof(trailer));
+
+    /*
+     * We pass the tag down to the cipher when doing GCM mode
+     */
+    enc_octet_len = srtcp_len - (octets_in_rtcp_header +
+                                 sizeof(srtcp_trailer_t) + stream->mki_size);
+    auth_tag = srtcp + (srtcp_len - tag_len - stream->mki_size -
+                        sizeof(srtcp_trailer_t));
+
+    /*
+     * check the sequence number for replays
+     */
+    /* this is easier than dealing with bitfield access */
+    seq_num = ntohl(trailer) & SRTCP_INDEX_MASK;
+    debug_print(mod_srtp, "srtcp index: %x", seq_num);
+    status = srtp_rdb_check(&stream->rtcp_rdb, seq_num);
+    if (status) {
+        return status;
+    }
+
+    /*
+     * Calculate and set the IV
+     */
+    status = srtp_calc_aead_iv_srtcp(session_keys, &iv, seq_num, hdr);
+    if (status) {
+        return srtp_err_status_cipher_fail;
+    }
+    status = srtp_cipher_set_iv(session_keys->rtcp_cipher, (uint8_t *)&iv,
+                                srtp_direction_decrypt);
+    if (status) {
+        return srtp_err_status_cipher_fail;
+    }
+
+    /* check output length */
+    if (*rtcp_len <
+        srtcp_len - sizeof(srtcp_trailer_t) - stream->mki_size - tag_len) {
+        return srtp_err_status_buffer_small;
+    }
+
+    /* if not inplace need to copy rtcp header */
+    if (srtcp != rtcp) {
+        memcpy(rtcp, srtcp, enc_start);
+    }
+
+    /*
+     * Set the AAD for GCM mode
+     */
+    if (*trailer_p & SRTCP_E_BYTE_BIT) {
+        /*
+         * If payload encryption is enabled, then the AAD consist of
+         * the RTCP header and the seq# at the end of the packet
+         */
+        status = srtp_cipher_set_aad(session_keys->rtcp_cipher, srtcp,
+                                     octets_in_rtcp_header);
+        if (status) {
+            return srtp_err_status_cipher_fail;
+        }
+    } else {
+        /*
+         * Since payload encryption is not enabled, we must authenticate
+         * the entire packet as described in RFC 7714 (Section 9.3. Data
+         * Types in Unencrypted SRTCP Compound Packets)
+         */
+        status = srtp_cipher_set_aad(
+            session_keys->rtcp_cipher, srtcp,
+            (srtcp_len - tag_len - sizeof(srtcp_trailer_t) - stream->mki_size));
+        if (status) {
+            return (srtp_err_status_cipher_fail);
+        }
+    }
+
+    /*
+     * Process the sequence# as AAD
+     */
+    status = srtp_cipher_set_aad(session_keys->rtcp_cipher, (uint8_t *)&trailer,
+                                 sizeof(trailer));
+    if (status) {
+        return (srtp_err_status_cipher_fail);
+    }
+
+    /* if we're decrypting, exor keystream into the message */
+    if (*trailer_p & SRTCP_E_BYTE_BIT) {
+        status = srtp_cipher_decrypt(session_keys->rtcp_cipher,
+                                     srtcp + enc_start, enc_octet_len,
+                                     rtcp + enc_start, &enc_octet_len);
+        if (status) {
+            return status;
+        }
+    } else {
+        /* if no encryption and not-inplace then need to copy rest of packet */
+        if (rtcp != srtcp) {
+            memcpy(rtcp + enc_start, srtcp + enc_start, enc_octet_len);
+        }
+
+        /*
+         * Still need to run the cipher to check the tag
+         */
+        tmp_len = 0;
+        status = srtp_cipher_decrypt(session_keys->rtcp_cipher, auth_tag,
+                                     tag_len, NULL, &tmp_len);
+        if (status) {
+            return status;
+        }
+    }
+
+    *rtcp_len = srtcp_len;
+
+    /* decrease the packet length by the length of the auth tag and seq_num*/
+    *rtcp_len -= (tag_len + sizeof(srtcp_trailer_t) + stream->mki_size);
+
+    /*
+     * verify that stream is for received traffic - this check will
+     * detect SSRC collisions, since a stream that appears in both
+     * srtp_protect() and srtp_unprotect() will fail this test in one of
+     * those functions.
+     *
+     * we do this check *after* the authentication check, so that the
+     * latter check will catch any attempts to fool us into thinking
+     * that we've got a collision
+     */
+    if (stream->direction != dir_srtp_receiver) {
+        if (stream->direction == dir_unknown) {
+            stream->direction = dir_srtp_receiver;
+        } else {
+            srtp_handle_event(ctx, stream, event_ssrc_collision);
+        }
+    }
+
+    /*
+     * if the stream is a 'provisional' one, in which the template context
+     * is used, then we need to allocate a new stream at this point, since
+     * the authentication passed
+     */
+    if (stream == ctx->stream_template) {
+        srtp_stream_ctx_t *new_stream;
+
+        /*
+         * allocate and initialize a new stream
+         *
+         * note that we indicate failure if we can't allocate the new
+         * stream, and some implementations will want to not return
+         * failure here
+         */
+        status =
+            srtp_stream_clone(ctx->stream_template, hdr->ssrc, &new_stream);
+        if (status) {
+            return status;
+        }
+
+        /* add new stream to the list */
+        status = srtp_insert_or_dealloc_stream(ctx->stream_list, new_stream,
+                                               ctx->stream_template);
+        if (status) {
+            return status;
+        }
+
+        /* set stream (the pointer used in this function) */
+        stream = new_stream;
+    }
+
+    /* we've passed the authentication check, so add seq_num to the rdb */
+    srtp_rdb_add_index(&stream->rtcp_rdb, seq_num);
+
+    return srtp_err_status_ok;
+}
+
+srtp_err_status_t srtp_protect_rtcp(srtp_t ctx,
+                                    const uint8_t *rtcp,
+                                    size_t rtcp_len,
+                                    uint8_t *srtcp,
+                                    size_t *srtcp_len,
+                                    size_t mki_index)
+{
+    const srtcp_hdr_t *hdr = (const srtcp_hdr_t *)rtcp;
+    size_t enc_start;         /* pointer to start of encrypted portion  */
+    uint8_t *auth_start;      /* pointer to start of auth. portion      */
+    uint8_t *trailer_p;       /* pointer to start of trailer            */
+    uint32_t trailer;         /* trailer value                          */
+    size_t enc_octet_len = 0; /* number of octets in encrypted portion */
+    uint8_t *auth_tag = NULL; /* location of auth_tag within packet     */
+    srtp_err_status_t status;
+    size_t tag_len;
+    srtp_stream_ctx_t *stream;
+    size_t prefix_len;
+    uint32_t seq_num;
+    srtp_session_keys_t *session_keys = NULL;
+    srtp_session_keys_call_t call;
+
+    /* check the packet length - it must at least contain a full header */
+    if (rtcp_len < octets_in_rtcp_header) {
+        return srtp_err_status_bad_param;
+    }
+
+    /*
+     * look up ssrc in srtp_stream list, and process the packet with
+     * the appropriate stream.  if we haven't seen this stream before,
+     * there's only one key for this srtp_session, and the cipher
+     * supports key-sharing, then we assume that a new stream using
+     * that key has just started up
+     */
+    stream = srtp_get_stream(ctx, hdr->ssrc);
+    if (stream == NULL) {
+        if (ctx->stream_template != NULL) {
+            srtp_stream_ctx_t *new_stream;
+
+            /* allocate and initialize a new stream */
+            status =
+                srtp_stream_clone(ctx->stream_template, hdr->ssrc, &new_stream);
+            if (status) {
+                return status;
+            }
+
+            /* add new stream to the list */
+            status = srtp_insert_or_dealloc_stream(ctx->stream_list, new_stream,
+                                                   ctx->stream_template);
+            if (status) {
+                return status;
+            }
+
+            /* set stream (the pointer used in this function) */
+            stream = new_stream;
+        } else {
+            /* no template stream, so we return an error */
+            return srtp_err_status_no_ctx;
+        }
+    }
+
+    /*
+     * verify that stream is for sending traffic - this check will
+     * detect SSRC collisions, since a stream that appears in both
+     * srtp_protect() and srtp_unprotect() will fail this test in one of
+     * those functions.
+     */
+    if (stream->direction != dir_srtp_sender) {
+        if (stream->direction == dir_unknown) {
+            stream->direction = dir_srtp_sender;
+        } else {
+            srtp_handle_event(ctx, stream, event_ssrc_collision);
+        }
+    }
+
+    if (stream->exported) {
+        return srtp_err_status_key_expired;
+    }
+
+    if (ctx->checkpoint != NULL) {
+        status = srtp_checkpoint_rtcp(ctx->checkpoint, stream);
+        if (status) {
+            return status;
+        }
+    }
+
+    status = srtp_get_session_keys(stream, mki_index, &session_keys);
+    if (status) {
+        return status;
+    }
+    session_keys = srtp_start_session_keys_call(session_keys, true, &call);
+
+    /*
+     * Check if this is an AEAD stream (GCM mode).  If so, then dispatch
+     * the request to our AEAD handler.
+     */
+    if (session_keys->rtp_cipher->algorithm == SRTP_AES_GCM_128 ||
+        session_keys->rtp_cipher->algorithm == SRTP_AES_GCM_256) {
+        return srtp_protect_rtcp_aead(stream, rtcp, rtcp_len, srtcp, srtcp_len,
+                                      session_keys);
+    }
+
+    /* get tag length from stream context */
+    tag_len = srtp_auth_get_tag_length(session_keys->rtcp_auth);
+
+    /*
+     * set encryption start and encryption length
+     */
+    enc_start = octets_in_rtcp_header;
+    enc_octet_len = rtcp_len - enc_start;
+
+    /* check output length */
+    if (*srtcp_len <
+        rtcp_len + sizeof(srtcp_trailer_t) + stream->mki_size + tag_len) {
+        return srtp_err_status_buffer_small;
+    }
+
+    /* if not in place then need to copy rtcp header */
+    if (rtcp != srtcp) {
+        memcpy(srtcp, rtcp, enc_start);
+    }
+
+    /* all of the packet, except the header, gets encrypted */
+    /*
+     * NOTE: hdr->length is not usable - it refers to only the first RTCP report
+     * in the compound packet!
+     */
+    trailer_p = srtcp + enc_start + enc_octet_len;
+
+    if (stream->rtcp_services & sec_serv_conf) {
+        trailer = htonl(SRTCP_E_BIT); /* set encrypt bit */
+    } else {
+        /* 0 is network-order independant */
+        trailer = 0x00000000; /* set encrypt bit */
+    }
+
+    if (stream->use_mki) {
+        srtp_inject_mki(srtcp + rtcp_len + sizeof(srtcp_trailer_t),
+                        session_keys, stream->mki_size);
+    }
+
+    /*
+     * set the auth_start and auth_tag pointers to the proper locations
+     * (note that srtpc *always* provides authentication, unlike srtp)
+     */
+    /* Note: This would need to change for optional mikey data */
+    auth_start = srtcp;
+    auth_tag = srtcp + rtcp_len + sizeof(srtcp_trailer_t) + stream->mki_size;
+
+    /*
+     * check sequence number for overruns, and copy it into the packet
+     * if its value isn't too big
+     */
+    status = srtp_rdb_increment(&stream->rtcp_rdb);
+    if (status) {
+        return status;
+    }
+    seq_num = srtp_rdb_get_value(&stream->rtcp_rdb);
+    trailer |= htonl(seq_num);
+    debug_print(mod_srtp, "srtcp index: %x", seq_num);
+
+    memcpy(trailer_p, &trailer, sizeof(trailer));
+
+    /*
+     * if we're using rindael counter mode, set nonce and seq
+     */
+    if (session_keys->rtcp_cipher->type->id == SRTP_AES_ICM_128 ||
+        session_keys->rtcp_cipher->type->id == SRTP_AES_ICM_192 ||
+        session_keys->rtcp_cipher->type->id == SRTP_AES_ICM_256) {
+        v128_t iv;
+
+        iv.v32[0] = 0;
+        iv.v32[1] = hdr->ssrc; /* still in network order! */
+        iv.v32[2] = htonl(seq_num >> 16);
+        iv.v32[3] = htonl(seq_num << 16);
+        status = srtp_cipher_set_iv(session_keys->rtcp_cipher, (uint8_t *)&iv,
+                                    srtp_direction_encrypt);
+
+    } else {
+        v128_t iv;
+
+        /* otherwise, just set the index to seq_num */
+        iv.v32[0] = 0;
+        iv.v32[1] = 0;
+        iv.v32[2] = 0;
+        iv.v32[3] = htonl(seq_num);
+        status = srtp_cipher_set_iv(session_keys->rtcp_cipher, (uint8_t *)&iv,
+                                    srtp_direction_encrypt);
+    }
+    if (status) {
+        return srtp_err_status_cipher_fail;
+    }
+
+    /*
+     * if we're authenticating using a universal hash, put the keystream
+     * prefix into the authentication tag
+     */
+
+    /* if auth_start is non-null, then put keystream into tag  */
+    if (auth_start) {
+        /* put keystream prefix into auth_tag */
+        prefix_len = srtp_auth_get_prefix_length(session_keys->rtcp_auth);
+        status = srtp_cipher_output(session_keys->rtcp_cipher, auth_tag,
+                                    &prefix_len);
+
+        debug_print(mod_srtp, "keystream prefix: %s",
+                    srtp_octet_string_hex_string(auth_tag, prefix_len));
+
+        if (status) {
+            return srtp_err_status_cipher_fail;
+        }
+    }
+
+    /* if we're encrypting, exor keystream into the message */
+    if (stream->rtcp_services & sec_serv_conf) {
+        status = srtp_cipher_encrypt(session_keys->rtcp_cipher,
+                                     rtcp + enc_start, enc_octet_len,
+                                     srtcp + enc_start, &enc_octet_len);
+        if (status) {
+            return srtp_err_status_cipher_fail;
+        }
+    } else if (rtcp != srtcp) {
+        /* if no encryption and not-inplace then need to copy rest of packet */
+        memcpy(srtcp + enc_start, rtcp + enc_start, enc_octet_len);
+    }
+
+    /* initialize auth func context */
+    status = srtp_auth_start(session_keys->rtcp_auth);
+    if (status) {
+        return status;
+    }
+
+    /*
+     * run auth func over packet (including trailer), and write the
+     * result at auth_tag
+     */
+    status = srtp_auth_compute(session_keys->rtcp_auth, auth_start,
+                               rtcp_len + sizeof(srtcp_trailer_t), auth_tag);
+    debug_print(mod_srtp, "srtcp auth tag:    %s",
+                srtp_octet_string_hex_string(auth_tag, tag_len));
+    if (status) {
+        return srtp_err_status_auth_fail;
+    }
+
+    *srtcp_len = enc_start + enc_octet_len;
+
+    /* increase the packet length by the length of the auth tag and seq_num*/
+    *srtcp_len += (tag_len + sizeof(srtcp_trailer_t));
+
+    /* increase the packet by the mki_size */
+    *srtcp_len += stream->mki_size;
+
+    return srtp_err_status_ok;
+}
+
+/*
+ * srtp_unprotect_rtcp_stream() is srtp_unprotect_rtcp(), except that if
+ * known is not NULL it is the packet's stream, already looked up by the
+ * caller
+ */
+static srtp_err_status_t srtp_unprotect_rtcp_stream(srtp_t ctx,
+                                                    const uint8_t *srtcp,
+                                                    size_t srtcp_len,
+                                                    uint8_t *rtcp,
+                                                    size_t *rtcp_len,
+                                                    srtp_stream_ctx_t *known)
+{
+    const srtcp_hdr_t *hdr = (const srtcp_hdr_t *)srtcp;
+    size_t enc_start;               /* pointer to start of encrypted portion  */
+    const uint8_t *auth_start;      /* pointer to start of auth. portion      */
+    const uint8_t *trailer_p;       /* pointer to start of trailer            */
+    uint32_t trailer;               /* trailer value                          */
+    size_t enc_octet_len = 0;       /* number of octets in encrypted portion */
+    const uint8_t *auth_tag = NULL; /* location of auth_tag within packet     */
+    uint8_t tmp_tag[SRTP_MAX_TAG_LEN];
+    srtp_err_status_t status;
+    size_t auth_len;
+    size_t tag_len;
+    srtp_stream_ctx_t *stream;
+    size_t prefix_len;
+    uint32_t seq_num;
+    bool e_bit_in_packet;          /* E-bit was found in the packet */
+    bool sec_serv_confidentiality; /* whether confidentiality was requested */
+    srtp_session_keys_t *session_keys = NULL;
+    srtp_session_keys_call_t call;
+
+    /*
+     * check that the length value is sane; we'll check again once we
+     * know the tag length, but we at least want to know that it is
+     * a positive value
+     */
+    if (srtcp_len < octets_in_rtcp_header + sizeof(srtcp_trailer_t)) {
+        return srtp_err_status_bad_param;
+    }
+
+    /*
+     * look up ssrc in srtp_stream list, and process the packet with
+     * the appropriate stream.  if we haven't seen this stream before,
+     * there's only one key for this srtp_session, and the cipher
+     * supports key-sharing, then we assume that a new stream using
+     * that key has just started up
+     */
+    stream = known != NULL ? known : srtp_get_stream(ctx, hdr->ssrc);
+    if (stream == NULL) {
+        if (ctx->stream_template != NULL) {
+            stream = ctx->stream_template;
+
+            debug_print(mod_srtp,
+                        "srtcp using provisional stream (SSRC: 0x%08x)",
+                        ntohl(hdr->ssrc));
+        } else {
+            /* no template stream, so we return an error */
+            return srtp_err_status_no_ctx;
+        }
+    }
+
+    /*
+     * Determine if MKI is being used and what session keys should be used
+     */
+    status = srtp_get_session_keys_for_packet(stream, srtcp, srtcp_len,
+                                              &session_keys);
+    if (status) {
+        return status;
+    }
+    session_keys = srtp_start_session_keys_call(session_keys, true, &call);
+
+    /* get tag length from stream context */
+    tag_len = srtp_auth_get_tag_length(session_keys->rtcp_auth);
+
+    /* check the packet length - it must contain at least a full RTCP
+       header, an auth tag (if applicable), and the SRTCP encrypted flag
+       and 31-bit index value */
+    if (srtcp_len < octets_in_rtcp_header + sizeof(srtcp_trailer_t) +
+                        stream->mki_size + tag_len) {
         return srtp_err_status_bad_param;
     }
 
-    status = srtp_valid_policy(policy);
-    if (status != srtp_err_status_ok) {
-        return status;
+    /*
+     * Check if this is an AEAD stream (GCM mode).  If so, then dispatch
+     * the request to our AEAD handler.
+     */
+    if (session_keys->rtp_cipher->algorithm == SRTP_AES_GCM_128 ||
+        session_keys->rtp_cipher->algorithm == SRTP_AES_GCM_256) {
+        return srtp_unprotect_rtcp_aead(ctx, stream, srtcp, srtcp_len, rtcp,
+                                        rtcp_len, session_keys);
+    }
+
+    sec_serv_confidentiality = stream->rtcp_services == sec_serv_conf ||
+                               stream->rtcp_services == sec_serv_conf_and_auth;
+
+    /*
+     * set encryption start, encryption length, and trailer
+     */
+    enc_start = octets_in_rtcp_header;
+    enc_octet_len = srtcp_len - (octets_in_rtcp_header + tag_len +
+                                 stream->mki_size + sizeof(srtcp_trailer_t));
+    /*
+     *index & E (encryption) bit follow normal data. hdr->len is the number of
+     * words (32-bit) in the normal packet minus 1
+     */
+    /* This should point trailer to the word past the end of the normal data. */
+    /* This would need to be modified for optional mikey data */
+    trailer_p = srtcp + srtcp_len -
+                (tag_len + stream->mki_size + sizeof(srtcp_trailer_t));
+    memcpy(&trailer, trailer_p, sizeof(trailer));
+
+    e_bit_in_packet = (*trailer_p & SRTCP_E_BYTE_BIT) == SRTCP_E_BYTE_BIT;
+    if (e_bit_in_packet != sec_serv_confidentiality) {
+        return srtp_err_status_cant_check;
+    }
+
+    /*
+     * set the auth_start and auth_tag pointers to the proper locations
+     * (note that srtcp *always* uses authentication, unlike srtp)
+     */
+    auth_start = srtcp;
+
+    /*
+     * The location of the auth tag in the packet needs to know MKI
+     * could be present.  The data needed to calculate the Auth tag
+     * must not include the MKI
+     */
+    auth_len = srtcp_len - tag_len - stream->mki_size;
+    auth_tag = srtcp + auth_len + stream->mki_size;
+
+    /*
+     * check the sequence number for replays
+     */
+    /* this is easier than dealing with bitfield access */
+    seq_num = ntohl(trailer) & SRTCP_INDEX_MASK;
+    debug_print(mod_srtp, "srtcp index: %x", seq_num);
+    status = srtp_rdb_check(&stream->rtcp_rdb, seq_num);
+    if (status) {
+        return status;
+    }
+
+    /*
+     * if we're using aes counter mode, set nonce and seq
+     */
+    if (session_keys->rtcp_cipher->type->id == SRTP_AES_ICM_128 ||
+        session_keys->rtcp_cipher->type->id == SRTP_AES_ICM_192 ||
+        session_keys->rtcp_cipher->type->id == SRTP_AES_ICM_256) {
+        v128_t iv;
+
+        iv.v32[0] = 0;
+        iv.v32[1] = hdr->ssrc; /* still in network order! */
+        iv.v32[2] = htonl(seq_num >> 16);
+        iv.v32[3] = htonl(seq_num << 16);
+        status = srtp_cipher_set_iv(session_keys->rtcp_cipher, (uint8_t *)&iv,
+                                    srtp_direction_decrypt);
+
+    } else {
+        v128_t iv;
+
+        /* otherwise, just set the index to seq_num */
+        iv.v32[0] = 0;
+        iv.v32[1] = 0;
+        iv.v32[2] = 0;
+        iv.v32[3] = htonl(seq_num);
+        status = srtp_cipher_set_iv(session_keys->rtcp_cipher, (uint8_t *)&iv,
+                                    srtp_direction_decrypt);
+    }
+    if (status) {
+        return srtp_err_status_cipher_fail;
+    }
+
+    /*
+     * if we're authenticating using a universal hash, put the keystream
+     * prefix into the authentication tag
+     */
+    prefix_len = srtp_auth_get_prefix_length(session_keys->rtcp_auth);
+    if (prefix_len) {
+        status =
+            srtp_cipher_output(session_keys->rtcp_cipher, tmp_tag, &prefix_len);
+        debug_print(mod_srtp, "keystream prefix: %s",
+                    srtp_octet_string_hex_string(tmp_tag, prefix_len));
+        if (status) {
+            return srtp_err_status_cipher_fail;
+        }
+    }
+
+    /* initialize auth func context */
+    status = srtp_auth_start(session_keys->rtcp_auth);
+    if (status) {
+        return status;
+    }
+
+    /* run auth func over packet, put result into tmp_tag */
+    status = srtp_auth_compute(session_keys->rtcp_auth, auth_start, auth_len,
+                               tmp_tag);
+    debug_print(mod_srtp, "srtcp computed tag:       %s",
+                srtp_octet_string_hex_string(tmp_tag, tag_len));
+    if (status) {
+        return srtp_err_status_auth_fail;
+    }
+
+    /* compare the tag just computed with the one in the packet */
+    debug_print(mod_srtp, "srtcp tag from packet:    %s",
+                srtp_octet_string_hex_string(auth_tag, tag_len));
+    if (!srtp_octet_string_equal(tmp_tag, auth_tag, tag_len)) {
+        return srtp_err_status_auth_fail;
+    }
+
+    /* check output length */
+    if (*rtcp_len <
+        srtcp_len - sizeof(srtcp_trailer_t) - stream->mki_size - tag_len) {
+        return srtp_err_status_buffer_small;
     }
 
-    switch (policy->ssrc.type) {
-    case (ssrc_any_outbound):
-    case (ssrc_any_inbound):
-        status = update_template_streams(session, policy);
-        break;
-    case (ssrc_specific):
-        status = stream_update(session, policy);
-        break;
-    case (ssrc_undefined):
-    default:
-        return srtp_err_status_bad_param;
+    /* if not inplace need to copy rtcp header */
+    if (srtcp != rtcp) {
+        memcpy(rtcp, srtcp, enc_start);
     }
 
-    return status;
-}
-
-/*
- * The default policy - provides a convenient way for callers to use
- * the default security policy
- *
- * The default policy is defined in RFC 3711
- * (Section 5. Default and mandatory-to-implement Transforms)
- *
- */
+    /* if we're decrypting, exor keystream into the message */
+    if (sec_serv_confidentiality) {
+        status = srtp_cipher_decrypt(session_keys->rtcp_cipher,
+                                     srtcp + enc_start, enc_octet_len,
+                                     rtcp + enc_start, &enc_octet_len);
+        if (status) {
+            return srtp_err_status_cipher_fail;
+        }
+    } else if (srtcp != rtcp) {
+        /* if no encryption and not-inplace then need to copy rest of packet */
+        memcpy(rtcp + enc_start, srtcp + enc_start, enc_octet_len);
+    }
 
-/*
- * NOTE: cipher_key_len is really key len (128 bits) plus salt len
- *  (112 bits)
- */
-/* There are hard-coded 16's for base_key_len in the key generation code */
+    *rtcp_len = srtcp_len;
 
-void srtp_crypto_policy_set_rtp_default(srtp_crypto_policy_t *p)
-{
-    p->cipher_type = SRTP_AES_ICM_128;
-    p->cipher_key_len =
-        SRTP_AES_ICM_128_KEY_LEN_WSALT; /* default 128 bits per RFC 3711 */
-    p->auth_type = SRTP_HMAC_SHA1;
-    p->auth_key_len = 20; /* default 160 bits per RFC 3711 */
-    p->auth_tag_len = 10; /* default 80 bits per RFC 3711 */
-    p->sec_serv = sec_serv_conf_and_auth;
-}
+    /* decrease the packet length by the length of the auth tag and seq_num */
+    *rtcp_len -= (tag_len + sizeof(srtcp_trailer_t));
 
-void srtp_crypto_policy_set_rtcp_default(srtp_crypto_policy_t *p)
-{
-    p->cipher_type = SRTP_AES_ICM_128;
-    p->cipher_key_len =
-        SRTP_AES_ICM_128_KEY_LEN_WSALT; /* default 128 bits per RFC 3711 */
-    p->auth_type = SRTP_HMAC_SHA1;
-    p->auth_key_len = 20; /* default 160 bits per RFC 3711 */
-    p->auth_tag_len = 10; /* default 80 bits per RFC 3711 */
-    p->sec_serv = sec_serv_conf_and_auth;
-}
+    /* decrease the packet length by the length of the mki_size */
+    *rtcp_len -= stream->mki_size;
 
-void srtp_crypto_policy_set_aes_cm_128_hmac_sha1_32(srtp_crypto_policy_t *p)
-{
     /*
-     * corresponds to RFC 4568
+     * verify that stream is for received traffic - this check will
+     * detect SSRC collisions, since a stream that appears in both
+     * srtp_protect() and srtp_unprotect() will fail this test in one of
+     * those functions.
      *
-     * note that this crypto policy is intended for SRTP, but not SRTCP
+     * we do this check *after* the authentication check, so that the
+     * latter check will catch any attempts to fool us into thinking
+     * that we've got a collision
      */
+    if (stream->direction != dir_srtp_receiver) {
+        if (stream->direction == dir_unknown) {
+            stream->direction = dir_srtp_receiver;
+        } else {
+            srtp_handle_event(ctx, stream, event_ssrc_collision);
+        }
+    }
 
-    p->cipher_type = SRTP_AES_ICM_128;
-    p->cipher_key_len =
-        SRTP_AES_ICM_128_KEY_LEN_WSALT; /* 128 bit key, 112 bit salt */
-    p->auth_type = SRTP_HMAC_SHA1;
-    p->auth_key_len = 20; /* 160 bit key               */
-    p->auth_tag_len = 4;  /* 32 bit tag                */
-    p->sec_serv = sec_serv_conf_and_auth;
-}
-
-void srtp_crypto_policy_set_aes_cm_128_null_auth(srtp_crypto_policy_t *p)
-{
     /*
-     * corresponds to RFC 4568
-     *
-     * note that this crypto policy is intended for SRTP, but not SRTCP
+     * if the stream is a 'provisional' one, in which the template context
+     * is used, then we need to allocate a new stream at this point, since
+     * the authentication passed
      */
+    if (stream == ctx->stream_template) {
+        srtp_stream_ctx_t *new_stream;
 
-    p->cipher_type = SRTP_AES_ICM_128;
-    p->cipher_key_len =
-        SRTP_AES_ICM_128_KEY_LEN_WSALT; /* 128 bit key, 112 bit salt */
-    p->auth_type = SRTP_NULL_AUTH;
-    p->auth_key_len = 0;
-    p->auth_tag_len = 0;
-    p->sec_serv = sec_serv_conf;
-}
+        /*
+         * allocate and initialize a new stream
+         *
+         * note that we indicate failure if we can't allocate the new
+         * stream, and some implementations will want to not return
+         * failure here
+         */
+        status =
+            srtp_stream_clone(ctx->stream_template, hdr->ssrc, &new_stream);
+        if (status) {
+            return status;
+        }
 
-void srtp_crypto_policy_set_null_cipher_hmac_sha1_80(srtp_crypto_policy_t *p)
-{
-    /*
-     * corresponds to RFC 4568
-     */
+        /* add new stream to the list */
+        status = srtp_insert_or_dealloc_stream(ctx->stream_list, new_stream,
+                                               ctx->stream_template);
+        if (status) {
+            return status;
+        }
 
-    p->cipher_type = SRTP_NULL_CIPHER;
-    p->cipher_key_len =
-        SRTP_AES_ICM_128_KEY_LEN_WSALT; /* 128 bit key, 112 bit salt */
-    p->auth_type = SRTP_HMAC_SHA1;
-    p->auth_key_len = 20;
-    p->auth_tag_len = 10;
-    p->sec_serv = sec_serv_auth;
-}
+        /* set stream (the pointer used in this function) */
+        stream = new_stream;
+    }
 
-void srtp_crypto_policy_set_null_cipher_hmac_null(srtp_crypto_policy_t *p)
-{
-    /*
-     * Should only be used for testing
-     */
+    /* we've passed the authentication check, so add seq_num to the rdb */
+    srtp_rdb_add_index(&stream->rtcp_rdb, seq_num);
 
-    p->cipher_type = SRTP_NULL_CIPHER;
-    p->cipher_key_len =
-        SRTP_AES_ICM_128_KEY_LEN_WSALT; /* 128 bit key, 112 bit salt */
-    p->auth_type = SRTP_NULL_AUTH;
-    p->auth_key_len = 0;
-    p->auth_tag_len = 0;
-    p->sec_serv = sec_serv_none;
+    return srtp_err_status_ok;
 }
 
-void srtp_crypto_policy_set_aes_cm_256_hmac_sha1_80(srtp_crypto_policy_t *p)
+srtp_err_status_t srtp_unprotect_rtcp(srtp_t ctx,
+                                      const uint8_t *srtcp,
+                                      size_t srtcp_len,
+                                      uint8_t *rtcp,
+                                      size_t *rtcp_len)
 {
-    /*
-     * corresponds to RFC 6188
-     */
+    return srtp_unprotect_rtcp_stream(ctx, srtcp, srtcp_len, rtcp, rtcp_len,
+                                      NULL);
+}
 
-    p->cipher_type = SRTP_AES_ICM_256;
-    p->cipher_key_len = SRTP_AES_ICM_256_KEY_LEN_WSALT;
-    p->auth_type = SRTP_HMAC_SHA1;
-    p->auth_key_len = 20; /* default 160 bits per RFC 3711 */
-    p->auth_tag_len = 10; /* default 80 bits per RFC 3711 */
-    p->sec_serv = sec_serv_conf_and_auth;
+/*
+ * RFC 5761 section 4: RTCP packet types 192-223 occupy the second
+ * octet in the place of the RTP marker bit and payload types 64-95
+ */
+static bool srtp_framed_is_rtcp(const uint8_t *pkt, size_t len)
+{
+    return len >= 2 && pkt[1] >= 192 && pkt[1] <= 223;
 }
 
-void srtp_crypto_policy_set_aes_cm_256_hmac_sha1_32(srtp_crypto_policy_t *p)
+/*
+ * srtp_unprotect_mux_stream() unprotects a packet already classified as
+ * RTP or RTCP.  The stream is looked up once; if cache is not NULL it
+ * holds the stream of the previous packet, which is reused when the SSRC
+ * matches and updated otherwise.  If info is not NULL it is filled in
+ * from the unprotected packet.
+ */
+static srtp_err_status_t srtp_unprotect_mux_stream(srtp_t ctx,
+                                                   const uint8_t *srtp,
+                                                   size_t srtp_len,
+                                                   uint8_t *out,
+                                                   size_t *out_len,
+                                                   bool is_rtcp,
+                                                   srtp_stream_ctx_t **cache,
+                                                   srtp_packet_info_t *info)
 {
-    /*
-     * corresponds to RFC 6188
-     *
-     * note that this crypto policy is intended for SRTP, but not SRTCP
-     */
+    srtp_stream_ctx_t *stream;
+    srtp_err_status_t status;
+    uint32_t ssrc;
 
-    p->cipher_type = SRTP_AES_ICM_256;
-    p->cipher_key_len = SRTP_AES_ICM_256_KEY_LEN_WSALT;
-    p->auth_type = SRTP_HMAC_SHA1;
-    p->auth_key_len = 20; /* default 160 bits per RFC 3711 */
-    p->auth_tag_len = 4;  /* default 80 bits per RFC 3711 */
-    p->sec_serv = sec_serv_conf_and_auth;
+    /* the SSRC is read here, so the fixed header must be present */
+    if (srtp_len < (is_rtcp ? octets_in_rtcp_header : octets_in_rtp_header)) {
+        return srtp_err_status_bad_param;
+    }
+    if (is_rtcp) {
+        ssrc = ((const srtcp_hdr_t *)srtp)->ssrc;
+    } else {
+        ssrc = ((const srtp_hdr_t *)srtp)->ssrc;
+    }
+
+    if (cache != NULL && *cache != NULL && (*cache)->ssrc == ssrc) {
+        stream = *cache;
+    } else {
+        stream = srtp_get_stream(ctx, ssrc);
+        if (cache != NULL) {
+            *cache = stream;
+        }
+    }
+
+    if (is_rtcp) {
+        status = srtp_unprotect_rtcp_stream(ctx, srtp, srtp_len, out, out_len,
+                                            stream);
+    } else {
+        status = srtp_unprotect_rtp(ctx, srtp, srtp_len, out, out_len,
+                                    SIZE_MAX, NULL, stream);
+    }
+    if (status || info == NULL) {
+        return status;
+    }
+
+    info->is_rtcp = is_rtcp;
+    info->ssrc = ntohl(ssrc);
+    info->payload_type = is_rtcp ? out[1] : out[1] & 0x7f;
+    if (is_rtcp) {
+        info->seq = 0;
+        info->header_len = octets_in_rtcp_header;
+    } else {
+        const srtp_hdr_t *hdr = (const srtp_hdr_t *)out;
+        info->seq = ntohs(hdr->seq);
+        info->header_len = srtp_get_rtp_hdr_len(hdr);
+        if (hdr->x == 1) {
+            info->header_len += srtp_get_rtp_xtn_hdr_len(hdr, out);
+        }
+    }
+    info->payload_len = *out_len - info->header_len;
+
+    return srtp_err_status_ok;
 }
 
 /*
- * AES-256 with no authentication.
+ * srtp_unprotect_mux_in_place() unprotects a packet in place with
+ * srtp_unprotect_mux_stream().  The headers are read through the
+ * structures of srtp_priv.h, so a packet that is not 32-bit aligned is
+ * unprotected in a copy in *scratch, allocated on first use and freed by
+ * the caller, and copied back.
  */
-void srtp_crypto_policy_set_aes_cm_256_null_auth(srtp_crypto_policy_t *p)
+#define SRTP_MUX_SCRATCH_LEN 0x10000
+
+static srtp_err_status_t srtp_unprotect_mux_in_place(
+    srtp_t ctx,
+    uint8_t *pkt,
+    size_t len,
+    size_t *out_len,
+    bool is_rtcp,
+    srtp_stream_ctx_t **cache,
+    srtp_packet_info_t *info,
+    uint8_t **scratch)
 {
-    p->cipher_type = SRTP_AES_ICM_256;
-    p->cipher_key_len = SRTP_AES_ICM_256_KEY_LEN_WSALT;
-    p->auth_type = SRTP_NULL_AUTH;
-    p->auth_key_len = 0;
-    p->auth_tag_len = 0;
-    p->sec_serv = sec_serv_conf;
+    srtp_err_status_t status;
+
+    *out_len = len;
+    if (((uintptr_t)pkt & 3) == 0) {
+        return srtp_unprotect_mux_stream(ctx, pkt, len, pkt, out_len,
+                                         is_rtcp, cache, info);
+    }
+
+    if (len > SRTP_MUX_SCRATCH_LEN) {
+        return srtp_err_status_bad_param;
+    }
+    if (*scratch == NULL) {
+        *scratch = (uint8_t *)srtp_crypto_alloc(SRTP_MUX_SCRATCH_LEN);
+        if (*scratch == NULL) {
+            return srtp_err_status_alloc_fail;
+        }
+    }
+
+    memcpy(*scratch, pkt, len);
+    status = srtp_unprotect_mux_stream(ctx, *scratch, len, *scratch, out_len,
+                                       is_rtcp, cache, info);
+    if (status == srtp_err_status_ok) {
+        memcpy(pkt, *scratch, *out_len);
+    }
+
+    return status;
+}
+
+srtp_err_status_t srtp_unprotect_mux(srtp_t ctx,
+                                     const uint8_t *srtp,
+                                     size_t srtp_len,
+                                     uint8_t *out,
+                                     size_t *out_len,
+                                     srtp_packet_info_t *info)
+{
+    if (ctx == NULL || srtp == NULL || out == NULL || out_len == NULL) {
+        return srtp_err_status_bad_param;
+    }
+
+    return srtp_unprotect_mux_stream(ctx, srtp, srtp_len, out, out_len,
+                                     srtp_framed_is_rtcp(srtp, srtp_len),
+                                     NULL, info);
 }
 
-void srtp_crypto_policy_set_aes_cm_192_hmac_sha1_80(srtp_crypto_policy_t *p)
+srtp_err_status_t srtp_unprotect_mux_batch(srtp_t ctx,
+                                           srtp_mux_packet_t *packets,
+                                           size_t num_packets)
 {
-    /*
-     * corresponds to RFC 6188
-     */
+    srtp_stream_ctx_t *cache = NULL;
+    uint8_t *scratch = NULL;
 
-    p->cipher_type = SRTP_AES_ICM_192;
-    p->cipher_key_len = SRTP_AES_ICM_192_KEY_LEN_WSALT;
-    p->auth_type = SRTP_HMAC_SHA1;
-    p->auth_key_len = 20; /* default 160 bits per RFC 3711 */
-    p->auth_tag_len = 10; /* default 80 bits per RFC 3711 */
-    p->sec_serv = sec_serv_conf_and_auth;
-}
+    if (ctx == NULL || (packets == NULL && num_packets != 0)) {
+        return srtp_err_status_bad_param;
+    }
 
-void srtp_crypto_policy_set_aes_cm_192_hmac_sha1_32(srtp_crypto_policy_t *p)
-{
-    /*
-     * corresponds to RFC 6188
-     *
-     * note that this crypto policy is intended for SRTP, but not SRTCP
-     */
+    for (size_t i = 0; i < num_packets; i++) {
+        srtp_mux_packet_t *p = &packets[i];
 
-    p->cipher_type = SRTP_AES_ICM_192;
-    p->cipher_key_len = SRTP_AES_ICM_192_KEY_LEN_WSALT;
-    p->auth_type = SRTP_HMAC_SHA1;
-    p->auth_key_len = 20; /* default 160 bits per RFC 3711 */
-    p->auth_tag_len = 4;  /* default 80 bits per RFC 3711 */
-    p->sec_serv = sec_serv_conf_and_auth;
+        p->status = srtp_unprotect_mux_in_place(
+            ctx, p->data, p->len, &p->len,
+            srtp_framed_is_rtcp(p->data, p->len), &cache, &p->info, &scratch);
+        if (p->status) {
+            p->len = 0;
+        }
+    }
+
+    if (scratch != NULL) {
+        srtp_crypto_free(scratch);
+    }
+
+    return srtp_err_status_ok;
 }
 
-/*
- * AES-192 with no authentication.
- */
-void srtp_crypto_policy_set_aes_cm_192_null_auth(srtp_crypto_policy_t *p)
+srtp_err_status_t srtp_unprotect_framed(srtp_t ctx,
+                                        uint8_t *buf,
+                                        size_t buf_len,
+                                        size_t *consumed,
+                                        srtp_framed_packet_t *packets,
+                                        size_t *num_packets)
 {
-    p->cipher_type = SRTP_AES_ICM_192;
-    p->cipher_key_len = SRTP_AES_ICM_192_KEY_LEN_WSALT;
-    p->auth_type = SRTP_NULL_AUTH;
-    p->auth_key_len = 0;
-    p->auth_tag_len = 0;
-    p->sec_serv = sec_serv_conf;
+    size_t max_packets;
+    size_t count = 0;
+    size_t pos = 0;       /* start of the next frame             */
+    size_t free_from = 0; /* end of the last unprotected packet  */
+    srtp_stream_ctx_t *cache = NULL;
+    uint8_t *scratch = NULL; /* aligned copy for packets with no room */
+
+    if (ctx == NULL || buf == NULL || consumed == NULL || packets == NULL ||
+        num_packets == NULL) {
+        return srtp_err_status_bad_param;
+    }
+
+    max_packets = *num_packets;
+
+    while (count < max_packets && buf_len - pos >= 2) {
+        srtp_framed_packet_t *out = &packets[count];
+        size_t len = ((size_t)buf[pos] << 8) | buf[pos + 1];
+        size_t start = pos + 2;
+        size_t aligned;
+        uint8_t *pkt;
+
+        if (buf_len - start < len) {
+            break; /* incomplete frame, wait for more data */
+        }
+        pos = start + len;
+
+        /*
+         * move the packet down to the first 32-bit boundary after the
+         * previous output, if that is not past the packet's own start
+         */
+        aligned = free_from + ((4 - ((uintptr_t)(buf + free_from) & 3)) & 3);
+        if (aligned <= start) {
+            if (aligned != start) {
+                memmove(buf + aligned, buf + start, len);
+            }
+            start = aligned;
+        }
+        pkt = buf + start;
+
+        out->offset = start;
+        out->is_rtcp = srtp_framed_is_rtcp(pkt, len);
+        out->status =
+            srtp_unprotect_mux_in_place(ctx, pkt, len, &out->len,
+                                        out->is_rtcp, &cache, NULL, &scratch);
+
+        if (out->status == srtp_err_status_ok) {
+            free_from = start + out->len;
+        } else {
+            out->len = 0;
+            free_from = start;
+        }
+        count++;
+    }
+
+    if (scratch != NULL) {
+        srtp_crypto_free(scratch);
+    }
+
+    *consumed = pos;
+    *num_packets = count;
+
+    return srtp_err_status_ok;
 }
 
 /*
- * AES-128 GCM mode with 16 octet auth tag.
+ * the demultiplexer keeps one open-addressed table, with linear probing,
+ * of two kinds of entry: a session entry per context id, and a stream
+ * entry per (context id, SSRC) pair that has been seen.  A stream entry
+ * records the stream generation of its session when it was made, and is
+ * only trusted while the session is still at that generation, so that a
+ * stream removed or detached behind the demultiplexer's back is never
+ * used.  Entries are 40 octets, so a probe sequence usually stays within
+ * one or two cache lines.
  */
-void srtp_crypto_policy_set_aes_gcm_128_16_auth(srtp_crypto_policy_t *p)
+typedef enum {
+    srtp_demux_empty = 0,
+    srtp_demux_session = 1,
+    srtp_demux_stream = 2,
+    srtp_demux_deleted = 3
+} srtp_demux_kind_t;
+
+typedef struct srtp_demux_entry_t {
+    uint64_t context_id;
+    uint32_t ssrc; /* network byte order, zero for a session entry */
+    uint32_t kind;
+    srtp_t session;
+    srtp_stream_ctx_t *stream;
+    uint64_t gen; /* stream_gen of the session when the entry was made */
+} srtp_demux_entry_t;
+
+typedef struct srtp_demux_ctx_t_ {
+    srtp_demux_entry_t *entries;
+    size_t capacity; /* a power of two */
+    size_t used;     /* entries that are not empty, including deleted */
+    size_t live;     /* session and stream entries */
+} srtp_demux_ctx_t_;
+
+#define SRTP_DEMUX_MIN_CAPACITY 64
+
+static size_t srtp_demux_hash(const srtp_demux_ctx_t_ *demux,
+                              uint64_t context_id,
+                              uint32_t ssrc,
+                              uint32_t kind)
 {
-    p->cipher_type = SRTP_AES_GCM_128;
-    p->cipher_key_len = SRTP_AES_GCM_128_KEY_LEN_WSALT;
-    p->auth_type = SRTP_NULL_AUTH; /* GCM handles the auth for us */
-    p->auth_key_len = 0;
-    p->auth_tag_len = 16; /* 16 octet tag length */
-    p->sec_serv = sec_serv_conf_and_auth;
+    uint64_t h = (context_id ^ ((uint64_t)ssrc << 32) ^ kind) *
+                 0x9e3779b97f4a7c15ULL;
+
+    return (size_t)(h >> 32) & (demux->capacity - 1);
 }
 
-/*
- * AES-256 GCM mode with 16 octet auth tag.
- */
-void srtp_crypto_policy_set_aes_gcm_256_16_auth(srtp_crypto_policy_t *p)
+static srtp_demux_entry_t *srtp_demux_find(const srtp_demux_ctx_t_ *demux,
+                                           uint64_t context_id,
+                                           uint32_t ssrc,
+                                           uint32_t kind)
 {
-    p->cipher_type = SRTP_AES_GCM_256;
-    p->cipher_key_len = SRTP_AES_GCM_256_KEY_LEN_WSALT;
-    p->auth_type = SRTP_NULL_AUTH; /* GCM handles the auth for us */
-    p->auth_key_len = 0;
-    p->auth_tag_len = 16; /* 16 octet tag length */
-    p->sec_serv = sec_serv_conf_and_auth;
-}
+    size_t i = srtp_demux_hash(demux, context_id, ssrc, kind);
 
-/*
- * secure rtcp functions
- */
+    for (;;) {
+        srtp_demux_entry_t *e = &demux->entries[i];
 
-/*
- * AEAD uses a new IV formation method.  This function implements
- * section 9.1 (SRTCP IV Formation for AES-GCM) from RFC7714.
- * The calculation is defined as, where (+) is the xor operation:
- *
- *                0  1  2  3  4  5  6  7  8  9 10 11
- *               +--+--+--+--+--+--+--+--+--+--+--+--+
- *               |00|00|    SSRC   |00|00|0+SRTCP Idx|---+
- *               +--+--+--+--+--+--+--+--+--+--+--+--+   |
- *                                                       |
- *               +--+--+--+--+--+--+--+--+--+--+--+--+   |
- *               |         Encryption Salt           |->(+)
- *               +--+--+--+--+--+--+--+--+--+--+--+--+   |
- *                                                       |
- *               +--+--+--+--+--+--+--+--+--+--+--+--+   |
- *               |       Initialization Vector       |<--+
- *               +--+--+--+--+--+--+--+--+--+--+--+--+*
- *
- * Input:  *session_keys - pointer to SRTP stream context session keys,
- *                        used to retrieve the SALT
- *         *iv           - Pointer to recieve the calculated IV
- *         seq_num       - The SEQ value to use for the IV calculation.
- *         *hdr          - The RTP header, used to get the SSRC value
- *
- * Returns: srtp_err_status_ok if no error or srtp_err_status_bad_param
- *          if seq_num is invalid
- *
- */
-static srtp_err_status_t srtp_calc_aead_iv_srtcp(
-    srtp_session_keys_t *session_keys,
-    v128_t *iv,
-    uint32_t seq_num,
-    const srtcp_hdr_t *hdr)
+        if (e->kind == srtp_demux_empty) {
+            return NULL;
+        }
+        if (e->kind == kind && e->ssrc == ssrc &&
+            e->context_id == context_id) {
+            return e;
+        }
+        i = (i + 1) & (demux->capacity - 1);
+    }
+}
+
+static srtp_err_status_t srtp_demux_resize(srtp_demux_ctx_t_ *demux,
+                                           size_t capacity)
 {
-    v128_t in;
-    v128_t salt;
+    srtp_demux_entry_t *old = demux->entries;
+    size_t old_capacity = demux->capacity;
 
-    memset(&in, 0, sizeof(v128_t));
-    memset(&salt, 0, sizeof(v128_t));
+    demux->entries = (srtp_demux_entry_t *)srtp_crypto_alloc(
+        sizeof(srtp_demux_entry_t) * capacity);
+    if (demux->entries == NULL) {
+        demux->entries = old;
+        return srtp_err_status_alloc_fail;
+    }
+    demux->capacity = capacity;
+    demux->used = 0;
+    demux->live = 0;
 
-    in.v16[0] = 0;
-    memcpy(&in.v16[1], &hdr->ssrc, 4); /* still in network order! */
-    in.v16[3] = 0;
+    /* re-insert the live entries, dropping deleted ones */
+    for (size_t j = 0; j < old_capacity; j++) {
+        size_t i;
 
-    /*
-     *  The SRTCP index (seq_num) spans bits 0 through 30 inclusive.
-     *  The most significant bit should be zero.
-     */
-    if (seq_num & 0x80000000UL) {
-        return srtp_err_status_bad_param;
+        if (old[j].kind != srtp_demux_session &&
+            old[j].kind != srtp_demux_stream) {
+            continue;
+        }
+        i = srtp_demux_hash(demux, old[j].context_id, old[j].ssrc,
+                            old[j].kind);
+        while (demux->entries[i].kind != srtp_demux_empty) {
+            i = (i + 1) & (demux->capacity - 1);
+        }
+        demux->entries[i] = old[j];
+        demux->used++;
+        demux->live++;
     }
-    in.v32[2] = htonl(seq_num);
+    srtp_crypto_free(old);
 
-    debug_print(mod_srtp, "Pre-salted RTCP IV = %s\n", v128_hex_string(&in));
+    return srtp_err_status_ok;
+}
 
-    /*
-     * Get the SALT value from the context
-     */
-    memcpy(salt.v8, session_keys->c_salt, 12);
-    debug_print(mod_srtp, "RTCP SALT = %s\n", v128_hex_string(&salt));
+static srtp_err_status_t srtp_demux_insert(srtp_demux_ctx_t_ *demux,
+                                           uint64_t context_id,
+                                           uint32_t ssrc,
+                                           uint32_t kind,
+                                           srtp_t session,
+                                           srtp_stream_ctx_t *stream)
+{
+    srtp_demux_entry_t *e;
+    size_t i;
+
+    e = srtp_demux_find(demux, context_id, ssrc, kind);
+    if (e != NULL) {
+        e->session = session;
+        e->stream = stream;
+        e->gen = session->stream_gen;
+        return srtp_err_status_ok;
+    }
 
     /*
-     * Finally, apply the SALT to the input
+     * keep the load factor at or below one half; if most of the used
+     * slots are deleted entries, rehashing at the same size is enough
      */
-    v128_xor(iv, &in, &salt);
+    if (2 * (demux->used + 1) > demux->capacity) {
+        size_t capacity = demux->capacity;
+        srtp_err_status_t status;
+
+        if (4 * (demux->live + 1) > capacity) {
+            capacity *= 2;
+        }
+        status = srtp_demux_resize(demux, capacity);
+        if (status) {
+            return status;
+        }
+    }
+
+    i = srtp_demux_hash(demux, context_id, ssrc, kind);
+    while (demux->entries[i].kind != srtp_demux_empty) {
+        i = (i + 1) & (demux->capacity - 1);
+    }
+    e = &demux->entries[i];
+    e->context_id = context_id;
+    e->ssrc = ssrc;
+    e->kind = kind;
+    e->session = session;
+    e->stream = stream;
+    e->gen = session->stream_gen;
+    demux->used++;
+    demux->live++;
 
     return srtp_err_status_ok;
 }
 
-/*
- * This code handles AEAD ciphers for outgoing RTCP.  We currently support
- * AES-GCM mode with 128 or 256 bit keys.
- */
-static srtp_err_status_t srtp_protect_rtcp_aead(
-    srtp_stream_ctx_t *stream,
-    const uint8_t *rtcp,
-    size_t rtcp_len,
-    uint8_t *srtcp,
-    size_t *srtcp_len,
-    srtp_session_keys_t *session_keys)
+static void srtp_demux_delete(srtp_demux_ctx_t_ *demux, srtp_demux_entry_t *e)
 {
-    const srtcp_hdr_t *hdr = (const srtcp_hdr_t *)rtcp;
-    size_t enc_start;         /* pointer to start of encrypted portion  */
-    uint8_t *trailer_p;       /* pointer to start of trailer            */
-    uint32_t trailer;         /* trailer value                          */
-    size_t enc_octet_len = 0; /* number of octets in encrypted portion  */
-    uint8_t *auth_tag = NULL; /* location of auth_tag within packet     */
-    srtp_err_status_t status;
-    size_t tag_len;
-    uint32_t seq_num;
-    v128_t iv;
-
-    /* get tag length from stream context */
-    tag_len = srtp_auth_get_tag_length(session_keys->rtcp_auth);
+    e->kind = srtp_demux_deleted;
+    e->session = NULL;
+    e->stream = NULL;
+    demux->live--;
+}
 
-    /*
-     * set encryption start and encryption length - if we're not
-     * providing confidentiality, set enc_start to NULL
-     */
-    enc_start = octets_in_rtcp_header;
-    enc_octet_len = rtcp_len - enc_start;
+srtp_err_status_t srtp_demux_create(srtp_demux_t *demux)
+{
+    srtp_demux_ctx_t_ *d;
 
-    /* check output length */
-    if (*srtcp_len <
-        rtcp_len + sizeof(srtcp_trailer_t) + stream->mki_size + tag_len) {
-        return srtp_err_status_buffer_small;
+    if (demux == NULL) {
+        return srtp_err_status_bad_param;
     }
 
-    /* if not-inplace then need to copy full rtcp header */
-    if (rtcp != srtcp) {
-        memcpy(srtcp, rtcp, enc_start);
+    d = (srtp_demux_ctx_t_ *)srtp_crypto_alloc(sizeof(srtp_demux_ctx_t_));
+    if (d == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+    d->entries = (srtp_demux_entry_t *)srtp_crypto_alloc(
+        sizeof(srtp_demux_entry_t) * SRTP_DEMUX_MIN_CAPACITY);
+    if (d->entries == NULL) {
+        srtp_crypto_free(d);
+        return srtp_err_status_alloc_fail;
     }
+    d->capacity = SRTP_DEMUX_MIN_CAPACITY;
+    d->used = 0;
+    d->live = 0;
 
-    /* NOTE: hdr->length is not usable - it refers to only the first
-     * RTCP report in the compound packet!
-     */
-    trailer_p = srtcp + enc_start + enc_octet_len + tag_len;
+    *demux = d;
 
-    if (stream->rtcp_services & sec_serv_conf) {
-        trailer = htonl(SRTCP_E_BIT); /* set encrypt bit */
-    } else {
-        /* 0 is network-order independant */
-        trailer = 0x00000000; /* set encrypt bit */
-    }
+    return srtp_err_status_ok;
+}
 
-    if (stream->use_mki) {
-        srtp_inject_mki(srtcp + rtcp_len + tag_len + sizeof(srtcp_trailer_t),
-                        session_keys, stream->mki_size);
+srtp_err_status_t srtp_demux_dealloc(srtp_demux_t demux)
+{
+    if (demux == NULL) {
+        return srtp_err_status_bad_param;
     }
 
-    /*
-     * set the auth_tag pointer to the proper location, which is after
-     * the payload, but before the trailer
-     * (note that srtcp *always* provides authentication, unlike srtp)
-     */
-    /* Note: This would need to change for optional mikey data */
-    auth_tag = srtcp + rtcp_len;
+    srtp_crypto_free(demux->entries);
+    srtp_crypto_free(demux);
 
-    /*
-     * check sequence number for overruns, and copy it into the packet
-     * if its value isn't too big
-     */
-    status = srtp_rdb_increment(&stream->rtcp_rdb);
-    if (status) {
-        return status;
+    return srtp_err_status_ok;
+}
+
+struct srtp_demux_add_data {
+    srtp_demux_ctx_t_ *demux;
+    uint64_t context_id;
+    srtp_t session;
+    srtp_err_status_t status;
+};
+
+static bool srtp_demux_add_stream_cb(srtp_stream_t stream, void *data)
+{
+    struct srtp_demux_add_data *d = (struct srtp_demux_add_data *)data;
+
+    d->status = srtp_demux_insert(d->demux, d->context_id, stream->ssrc,
+                                  srtp_demux_stream, d->session, stream);
+
+    return d->status == srtp_err_status_ok;
+}
+
+srtp_err_status_t srtp_demux_add_session(srtp_demux_t demux,
+                                         uint64_t context_id,
+                                         srtp_t session)
+{
+    struct srtp_demux_add_data data;
+    srtp_err_status_t status;
+
+    if (demux == NULL || session == NULL) {
+        return srtp_err_status_bad_param;
     }
-    seq_num = srtp_rdb_get_value(&stream->rtcp_rdb);
-    trailer |= htonl(seq_num);
-    debug_print(mod_srtp, "srtcp index: %x", seq_num);
 
-    memcpy(trailer_p, &trailer, sizeof(trailer));
+    /* a context id maps to one session; replace any earlier one */
+    srtp_demux_remove_session(demux, context_id);
 
-    /*
-     * Calculate and set the IV
-     */
-    status = srtp_calc_aead_iv_srtcp(session_keys, &iv, seq_num, hdr);
+    status = srtp_demux_insert(demux, context_id, 0, srtp_demux_session,
+                               session, NULL);
     if (status) {
-        return srtp_err_status_cipher_fail;
+        return status;
     }
-    status = srtp_cipher_set_iv(session_keys->rtcp_cipher, (uint8_t *)&iv,
-                                srtp_direction_encrypt);
-    if (status) {
-        return srtp_err_status_cipher_fail;
+
+    data.demux = demux;
+    data.context_id = context_id;
+    data.session = session;
+    data.status = srtp_err_status_ok;
+    srtp_stream_list_for_each(session->stream_list, srtp_demux_add_stream_cb,
+                              &data);
+    if (data.status) {
+        srtp_demux_remove_session(demux, context_id);
+    }
+
+    return data.status;
+}
+
+srtp_err_status_t srtp_demux_remove_session(srtp_demux_t demux,
+                                            uint64_t context_id)
+{
+    bool found = false;
+
+    if (demux == NULL) {
+        return srtp_err_status_bad_param;
     }
 
     /*
-     * Set the AAD for GCM mode
+     * scan the whole table, so that entries for streams the session no
+     * longer has are dropped too
      */
-    if (stream->rtcp_services & sec_serv_conf) {
-        /*
-         * If payload encryption is enabled, then the AAD consist of
-         * the RTCP header and the seq# at the end of the packet
-         */
-        status = srtp_cipher_set_aad(session_keys->rtcp_cipher, rtcp,
-                                     octets_in_rtcp_header);
-        if (status) {
-            return srtp_err_status_cipher_fail;
-        }
-    } else {
-        /*
-         * Since payload encryption is not enabled, we must authenticate
-         * the entire packet as described in RFC 7714 (Section 9.3. Data
-         * Types in Unencrypted SRTCP Compound Packets)
-         */
-        status = srtp_cipher_set_aad(session_keys->rtcp_cipher, rtcp, rtcp_len);
-        if (status) {
-            return (srtp_err_status_cipher_fail);
+    for (size_t i = 0; i < demux->capacity; i++) {
+        srtp_demux_entry_t *e = &demux->entries[i];
+
+        if ((e->kind == srtp_demux_session || e->kind == srtp_demux_stream) &&
+            e->context_id == context_id) {
+            found = found || e->kind == srtp_demux_session;
+            srtp_demux_delete(demux, e);
         }
     }
-    /*
-     * Process the sequence# as AAD
-     */
-    status = srtp_cipher_set_aad(session_keys->rtcp_cipher, (uint8_t *)&trailer,
-                                 sizeof(trailer));
-    if (status) {
-        return (srtp_err_status_cipher_fail);
+
+    return found ? srtp_err_status_ok : srtp_err_status_no_ctx;
+}
+
+srtp_err_status_t srtp_demux_stream_remove(srtp_demux_t demux,
+                                           uint64_t context_id,
+                                           uint32_t ssrc)
+{
+    srtp_demux_entry_t *e;
+    srtp_t session;
+
+    if (demux == NULL) {
+        return srtp_err_status_bad_param;
     }
 
-    /* if we're encrypting, exor keystream into the message */
-    if (stream->rtcp_services & sec_serv_conf) {
-        size_t outlen = *srtcp_len - enc_start;
-        status =
-            srtp_cipher_encrypt(session_keys->rtcp_cipher, rtcp + enc_start,
-                                enc_octet_len, srtcp + enc_start, &outlen);
-        enc_octet_len = outlen;
-        if (status) {
-            return srtp_err_status_cipher_fail;
-        }
-        /*
-         * Get the tag and append that to the output
-         */
-        status =
-            srtp_cipher_get_tag(session_keys->rtcp_cipher, auth_tag, &tag_len);
-        if (status) {
-            return (srtp_err_status_cipher_fail);
-        }
-    } else {
-        /* if no encryption and not-inplace then need to copy rest of packet */
-        if (rtcp != srtcp) {
-            memcpy(srtcp + enc_start, rtcp + enc_start, enc_octet_len);
-        }
+    e = srtp_demux_find(demux, context_id, 0, srtp_demux_session);
+    if (e == NULL) {
+        return srtp_err_status_no_ctx;
+    }
+    session = e->session;
 
-        /*
-         * Even though we're not encrypting the payload, we need
-         * to run the cipher to get the auth tag.
-         */
-        size_t nolen = 0;
-        status = srtp_cipher_encrypt(session_keys->rtcp_cipher, NULL, 0, NULL,
-                                     &nolen);
-        if (status) {
-            return srtp_err_status_cipher_fail;
-        }
-        /*
-         * Get the tag and append that to the output
-         */
-        status =
-            srtp_cipher_get_tag(session_keys->rtcp_cipher, auth_tag, &tag_len);
-        if (status) {
-            return (srtp_err_status_cipher_fail);
-        }
+    /* forget the stream before it is freed */
+    e = srtp_demux_find(demux, context_id, htonl(ssrc), srtp_demux_stream);
+    if (e != NULL) {
+        srtp_demux_delete(demux, e);
     }
 
-    *srtcp_len = octets_in_rtcp_header + enc_octet_len;
+    return srtp_stream_remove(session, ssrc);
+}
 
-    /* increase the packet length by the length of the auth tag and seq_num*/
-    *srtcp_len += (tag_len + sizeof(srtcp_trailer_t));
+/*
+ * srtp_demux_lookup(demux, context_id, ssrc, session, stream) finds the
+ * session for context_id and, if it has been seen and is still in the
+ * session, the stream for ssrc (network order); ssrc is NULL if the
+ * packet is too short to hold one
+ */
+static srtp_err_status_t srtp_demux_lookup(srtp_demux_ctx_t_ *demux,
+                                           uint64_t context_id,
+                                           const uint32_t *ssrc,
+                                           srtp_t *session,
+                                           srtp_stream_ctx_t **stream)
+{
+    srtp_demux_entry_t *e;
+
+    *stream = NULL;
+    if (ssrc != NULL) {
+        e = srtp_demux_find(demux, context_id, *ssrc, srtp_demux_stream);
+        if (e != NULL && e->gen == e->session->stream_gen) {
+            *session = e->session;
+            *stream = e->stream;
+            return srtp_err_status_ok;
+        }
+        if (e != NULL) {
+            /* the session has dropped a stream since; look it up again */
+            srtp_demux_delete(demux, e);
+        }
+    }
 
-    /* increase the packet by the mki_size */
-    *srtcp_len += stream->mki_size;
+    e = srtp_demux_find(demux, context_id, 0, srtp_demux_session);
+    if (e == NULL) {
+        return srtp_err_status_no_ctx;
+    }
+    *session = e->session;
 
     return srtp_err_status_ok;
 }
 
 /*
- * This function handles incoming SRTCP packets while in AEAD mode,
- * which currently supports AES-GCM encryption.  Note, the auth tag is
- * at the end of the packet stream and is automatically checked by GCM
- * when decrypting the payload.
+ * srtp_demux_index(demux, context_id, session, ssrc) indexes the stream
+ * for ssrc after its first packet was unprotected through the
+ * demultiplexer, when it may have just been cloned from the template.
+ * Failing to do so only costs a slower lookup next time.
  */
-static srtp_err_status_t srtp_unprotect_rtcp_aead(
-    srtp_t ctx,
-    srtp_stream_ctx_t *stream,
-    const uint8_t *srtcp,
-    size_t srtcp_len,
-    uint8_t *rtcp,
-    size_t *rtcp_len,
-    srtp_session_keys_t *session_keys)
+static void srtp_demux_index(srtp_demux_ctx_t_ *demux,
+                             uint64_t context_id,
+                             srtp_t session,
+                             uint32_t ssrc)
 {
-    const srtcp_hdr_t *hdr = (const srtcp_hdr_t *)srtcp;
-    size_t enc_start;               /* pointer to start of encrypted portion  */
-    const uint8_t *trailer_p;       /* pointer to start of trailer            */
-    uint32_t trailer;               /* trailer value                          */
-    size_t enc_octet_len = 0;       /* number of octets in encrypted portion */
-    const uint8_t *auth_tag = NULL; /* location of auth_tag within packet     */
-    srtp_err_status_t status;
-    size_t tag_len;
-    size_t tmp_len;
-    uint32_t seq_num;
-    v128_t iv;
-
-    /* get tag length from stream context */
-    tag_len = srtp_auth_get_tag_length(session_keys->rtcp_auth);
+    srtp_stream_ctx_t *stream = srtp_get_stream(session, ssrc);
 
-    enc_start = octets_in_rtcp_header;
+    if (stream != NULL) {
+        srtp_demux_insert(demux, context_id, ssrc, srtp_demux_stream, session,
+                          stream);
+    }
+}
 
-    /*
-     * set encryption start, encryption length, and trailer
-     */
-    /* index & E (encryption) bit follow normal data. hdr->len is the number of
-     * words (32-bit) in the normal packet minus 1
-     */
-    /* This should point trailer to the word past the end of the normal data. */
-    /* This would need to be modified for optional mikey data */
-    trailer_p = srtcp + srtcp_len - sizeof(srtcp_trailer_t) - stream->mki_size;
-    memcpy(&trailer, trailer_p, sizeof(trailer));
+srtp_err_status_t srtp_demux_unprotect(srtp_demux_t demux,
+                                       uint64_t context_id,
+                                       const uint8_t *srtp,
+                                       size_t srtp_len,
+                                       uint8_t *rtp,
+                                       size_t *rtp_len)
+{
+    srtp_err_status_t status;
+    srtp_t session;
+    srtp_stream_ctx_t *stream;
+    uint32_t ssrc = 0;
 
-    /*
-     * We pass the tag down to the cipher when doing GCM mode
-     */
-    enc_octet_len = srtcp_len - (octets_in_rtcp_header +
-                                 sizeof(srtcp_trailer_t) + stream->mki_size);
-    auth_tag = srtcp + (srtcp_len - tag_len - stream->mki_size -
-                        sizeof(srtcp_trailer_t));
+    if (demux == NULL || srtp == NULL) {
+        return srtp_err_status_bad_param;
+    }
 
-    /*
-     * check the sequence number for replays
-     */
-    /* this is easier than dealing with bitfield access */
-    seq_num = ntohl(trailer) & SRTCP_INDEX_MASK;
-    debug_print(mod_srtp, "srtcp index: %x", seq_num);
-    status = srtp_rdb_check(&stream->rtcp_rdb, seq_num);
+    /* read the ssrc now, in case the packet is unprotected in place */
+    if (srtp_len >= octets_in_rtp_header) {
+        ssrc = ((const srtp_hdr_t *)srtp)->ssrc;
+    }
+    status = srtp_demux_lookup(demux, context_id,
+                               srtp_len >= octets_in_rtp_header ? &ssrc : NULL,
+                               &session, &stream);
     if (status) {
         return status;
     }
 
-    /*
-     * Calculate and set the IV
-     */
-    status = srtp_calc_aead_iv_srtcp(session_keys, &iv, seq_num, hdr);
-    if (status) {
-        return srtp_err_status_cipher_fail;
+    status = srtp_unprotect_rtp(session, srtp, srtp_len, rtp, rtp_len,
+                                SIZE_MAX, NULL, stream);
+    if (status == srtp_err_status_ok && stream == NULL) {
+        srtp_demux_index(demux, context_id, session, ssrc);
     }
-    status = srtp_cipher_set_iv(session_keys->rtcp_cipher, (uint8_t *)&iv,
-                                srtp_direction_decrypt);
+
+    return status;
+}
+
+srtp_err_status_t srtp_demux_unprotect_rtcp(srtp_demux_t demux,
+                                            uint64_t context_id,
+                                            const uint8_t *srtcp,
+                                            size_t srtcp_len,
+                                            uint8_t *rtcp,
+                                            size_t *rtcp_len)
+{
+    srtp_err_status_t status;
+    srtp_t session;
+    srtp_stream_ctx_t *stream;
+    uint32_t ssrc = 0;
+
+    if (demux == NULL || srtcp == NULL) {
+        return srtp_err_status_bad_param;
+    }
+
+    /* the stream found here is the one srtp_unprotect_rtcp() would use */
+    if (srtcp_len >= octets_in_rtcp_header) {
+        ssrc = ((const srtcp_hdr_t *)srtcp)->ssrc;
+    }
+    status = srtp_demux_lookup(
+        demux, context_id, srtcp_len >= octets_in_rtcp_header ? &ssrc : NULL,
+        &session, &stream);
     if (status) {
-        return srtp_err_status_cipher_fail;
+        return status;
     }
 
-    /* check output length */
-    if (*rtcp_len <
-        srtcp_len - sizeof(srtcp_trailer_t) - stream->mki_size - tag_len) {
-        return srtp_err_status_buffer_small;
+    status = srtp_unprotect_rtcp_stream(session, srtcp, srtcp_len, rtcp,
+                                        rtcp_len, stream);
+    if (status == srtp_err_status_ok && stream == NULL) {
+        srtp_demux_index(demux, context_id, session, ssrc);
     }
 
-    /* if not inplace need to copy rtcp header */
-    if (srtcp != rtcp) {
-        memcpy(rtcp, srtcp, enc_start);
+    return status;
+}
+
+srtp_err_status_t srtp_demux_unprotect_batch(srtp_demux_t demux,
+                                             srtp_demux_packet_t *packets,
+                                             size_t num_packets)
+{
+    if (demux == NULL || (packets == NULL && num_packets != 0)) {
+        return srtp_err_status_bad_param;
     }
 
-    /*
-     * Set the AAD for GCM mode
-     */
-    if (*trailer_p & SRTCP_E_BYTE_BIT) {
-        /*
-         * If payload encryption is enabled, then the AAD consist of
-         * the RTCP header and the seq# at the end of the packet
-         */
-        status = srtp_cipher_set_aad(session_keys->rtcp_cipher, srtcp,
-                                     octets_in_rtcp_header);
-        if (status) {
-            return srtp_err_status_cipher_fail;
+#if defined(__GNUC__)
+    /* start fetching the table slots before any packet is processed */
+    for (size_t i = 0; i < num_packets; i++) {
+        const srtp_demux_packet_t *p = &packets[i];
+
+        if (p->len >= octets_in_rtp_header && !p->is_rtcp) {
+            __builtin_prefetch(
+                &demux->entries[srtp_demux_hash(
+                    demux, p->context_id, ((const srtp_hdr_t *)p->data)->ssrc,
+                    srtp_demux_stream)]);
+        } else if (p->len >= octets_in_rtcp_header && p->is_rtcp) {
+            __builtin_prefetch(&demux->entries[srtp_demux_hash(
+                demux, p->context_id, ((const srtcp_hdr_t *)p->data)->ssrc,
+                srtp_demux_stream)]);
         }
-    } else {
-        /*
-         * Since payload encryption is not enabled, we must authenticate
-         * the entire packet as described in RFC 7714 (Section 9.3. Data
-         * Types in Unencrypted SRTCP Compound Packets)
-         */
-        status = srtp_cipher_set_aad(
-            session_keys->rtcp_cipher, srtcp,
-            (srtcp_len - tag_len - sizeof(srtcp_trailer_t) - stream->mki_size));
-        if (status) {
-            return (srtp_err_status_cipher_fail);
+    }
+#endif
+
+    for (size_t i = 0; i < num_packets; i++) {
+        srtp_demux_packet_t *p = &packets[i];
+
+        if (p->is_rtcp) {
+            p->status = srtp_demux_unprotect_rtcp(demux, p->context_id, p->data,
+                                                  p->len, p->data, &p->len);
+        } else {
+            p->status = srtp_demux_unprotect(demux, p->context_id, p->data,
+                                             p->len, p->data, &p->len);
+        }
+        if (p->status) {
+            p->len = 0;
         }
     }
 
-    /*
-     * Process the sequence# as AAD
-     */
-    status = srtp_cipher_set_aad(session_keys->rtcp_cipher, (uint8_t *)&trailer,
-                                 sizeof(trailer));
-    if (status) {
-        return (srtp_err_status_cipher_fail);
+    return srtp_err_status_ok;
+}
+
+static srtp_err_status_t srtp_process_ring_desc(srtp_t ctx,
+                                                uint8_t *region,
+                                                size_t region_len,
+                                                srtp_ring_desc_t *d,
+                                                srtp_ring_op_t op)
+{
+    uint8_t *pkt;
+    size_t out_len;
+    srtp_err_status_t status;
+
+    if (d->offset < d->headroom || d->offset > region_len ||
+        d->len > region_len - d->offset ||
+        d->tailroom > region_len - d->offset - d->len) {
+        return srtp_err_status_bad_param;
     }
 
-    /* if we're decrypting, exor keystream into the message */
-    if (*trailer_p & SRTCP_E_BYTE_BIT) {
-        status = srtp_cipher_decrypt(session_keys->rtcp_cipher,
-                                     srtcp + enc_start, enc_octet_len,
-                                     rtcp + enc_start, &enc_octet_len);
-        if (status) {
-            return status;
+    pkt = region + d->offset;
+    if (op == srtp_ring_protect) {
+        out_len = d->len + d->tailroom;
+        if (d->is_rtcp) {
+            status = srtp_protect_rtcp(ctx, pkt, d->len, pkt, &out_len,
+                                       d->mki_index);
+        } else {
+            status =
+                srtp_protect(ctx, pkt, d->len, pkt, &out_len, d->mki_index);
         }
     } else {
-        /* if no encryption and not-inplace then need to copy rest of packet */
-        if (rtcp != srtcp) {
-            memcpy(rtcp + enc_start, srtcp + enc_start, enc_octet_len);
-        }
-
-        /*
-         * Still need to run the cipher to check the tag
-         */
-        tmp_len = 0;
-        status = srtp_cipher_decrypt(session_keys->rtcp_cipher, auth_tag,
-                                     tag_len, NULL, &tmp_len);
-        if (status) {
-            return status;
+        out_len = d->len;
+        if (d->is_rtcp) {
+            status = srtp_unprotect_rtcp(ctx, pkt, d->len, pkt, &out_len);
+        } else {
+            status = srtp_unprotect(ctx, pkt, d->len, pkt, &out_len);
         }
     }
 
-    *rtcp_len = srtcp_len;
+    if (status == srtp_err_status_ok) {
+        /* the trailer moves the end of the packet into the tailroom */
+        d->tailroom = d->tailroom + d->len - out_len;
+        d->len = out_len;
+    }
 
-    /* decrease the packet length by the length of the auth tag and seq_num*/
-    *rtcp_len -= (tag_len + sizeof(srtcp_trailer_t) + stream->mki_size);
+    return status;
+}
 
-    /*
-     * verify that stream is for received traffic - this check will
-     * detect SSRC collisions, since a stream that appears in both
-     * srtp_protect() and srtp_unprotect() will fail this test in one of
-     * those functions.
-     *
-     * we do this check *after* the authentication check, so that the
-     * latter check will catch any attempts to fool us into thinking
-     * that we've got a collision
-     */
-    if (stream->direction != dir_srtp_receiver) {
-        if (stream->direction == dir_unknown) {
-            stream->direction = dir_srtp_receiver;
-        } else {
-            srtp_handle_event(ctx, stream, event_ssrc_collision);
-        }
+srtp_err_status_t srtp_process_ring(srtp_t ctx,
+                                    uint8_t *region,
+                                    size_t region_len,
+                                    srtp_ring_t *in,
+                                    srtp_ring_t *out,
+                                    srtp_ring_op_t op,
+                                    size_t budget,
+                                    size_t *processed)
+{
+    uint32_t in_prod, in_cons, out_prod;
+    size_t count = 0;
+
+    if (ctx == NULL || region == NULL || in == NULL || out == NULL ||
+        processed == NULL || in->desc == NULL || out->desc == NULL ||
+        in->size == 0 || (in->size & (in->size - 1)) != 0 ||
+        out->size == 0 || (out->size & (out->size - 1)) != 0 ||
+        (op != srtp_ring_protect && op != srtp_ring_unprotect)) {
+        return srtp_err_status_bad_param;
     }
 
-    /*
-     * if the stream is a 'provisional' one, in which the template context
-     * is used, then we need to allocate a new stream at this point, since
-     * the authentication passed
-     */
-    if (stream == ctx->stream_template) {
-        srtp_stream_ctx_t *new_stream;
+    in_prod = in->producer;
+    in_cons = in->consumer;
+    out_prod = out->producer;
 
-        /*
-         * allocate and initialize a new stream
-         *
-         * note that we indicate failure if we can't allocate the new
-         * stream, and some implementations will want to not return
-         * failure here
-         */
-        status =
-            srtp_stream_clone(ctx->stream_template, hdr->ssrc, &new_stream);
-        if (status) {
-            return status;
-        }
+    while (in_cons != in_prod && out_prod - out->consumer < out->size &&
+           (budget == 0 || count < budget)) {
+        srtp_ring_desc_t *d = &out->desc[out_prod & (out->size - 1)];
 
-        /* add new stream to the list */
-        status = srtp_insert_or_dealloc_stream(ctx->stream_list, new_stream,
-                                               ctx->stream_template);
-        if (status) {
-            return status;
-        }
+        *d = in->desc[in_cons & (in->size - 1)];
+        d->status = srtp_process_ring_desc(ctx, region, region_len, d, op);
 
-        /* set stream (the pointer used in this function) */
-        stream = new_stream;
+        in_cons++;
+        out_prod++;
+        count++;
     }
 
-    /* we've passed the authentication check, so add seq_num to the rdb */
-    srtp_rdb_add_index(&stream->rtcp_rdb, seq_num);
+    in->consumer = in_cons;
+    out->producer = out_prod;
+    *processed = count;
 
     return srtp_err_status_ok;
 }
 
-srtp_err_status_t srtp_protect_rtcp(srtp_t ctx,
-                                    const uint8_t *rtcp,
-                                    size_t rtcp_len,
-                                    uint8_t *srtcp,
-                                    size_t *srtcp_len,
-                                    size_t mki_index)
+/*
+ * srtp_segment_trailer_length() checks the header of an RTP packet and
+ * finds the trailer srtp_protect() will add to it, from the stream of its
+ * SSRC or else the template
+ */
+static srtp_err_status_t srtp_segment_trailer_length(srtp_t ctx,
+                                                     const uint8_t *pkt,
+                                                     size_t pkt_len,
+                                                     size_t mki_index,
+                                                     size_t *length)
 {
-    const srtcp_hdr_t *hdr = (const srtcp_hdr_t *)rtcp;
-    size_t enc_start;         /* pointer to start of encrypted portion  */
-    uint8_t *auth_start;      /* pointer to start of auth. portion      */
-    uint8_t *trailer_p;       /* pointer to start of trailer            */
-    uint32_t trailer;         /* trailer value                          */
-    size_t enc_octet_len = 0; /* number of octets in encrypted portion */
-    uint8_t *auth_tag = NULL; /* location of auth_tag within packet     */
-    srtp_err_status_t status;
-    size_t tag_len;
+    const srtp_hdr_t *hdr = (const srtp_hdr_t *)pkt;
     srtp_stream_ctx_t *stream;
-    size_t prefix_len;
-    uint32_t seq_num;
-    srtp_session_keys_t *session_keys = NULL;
+    srtp_err_status_t status;
 
-    /* check the packet length - it must at least contain a full header */
-    if (rtcp_len < octets_in_rtcp_header) {
-        return srtp_err_status_bad_param;
+    status = srtp_validate_rtp_header(pkt, pkt_len);
+    if (status) {
+        return status;
     }
 
-    /*
-     * look up ssrc in srtp_stream list, and process the packet with
-     * the appropriate stream.  if we haven't seen this stream before,
-     * there's only one key for this srtp_session, and the cipher
-     * supports key-sharing, then we assume that a new stream using
-     * that key has just started up
-     */
     stream = srtp_get_stream(ctx, hdr->ssrc);
     if (stream == NULL) {
-        if (ctx->stream_template != NULL) {
-            srtp_stream_ctx_t *new_stream;
-
-            /* allocate and initialize a new stream */
-            status =
-                srtp_stream_clone(ctx->stream_template, hdr->ssrc, &new_stream);
-            if (status) {
-                return status;
-            }
+        stream = ctx->stream_template;
+    }
+    if (stream == NULL) {
+        return srtp_err_status_no_ctx;
+    }
 
-            /* add new stream to the list */
-            status = srtp_insert_or_dealloc_stream(ctx->stream_list, new_stream,
-                                                   ctx->stream_template);
-            if (status) {
-                return status;
-            }
+    return stream_get_protect_trailer_length(stream, true, mki_index, length);
+}
 
-            /* set stream (the pointer used in this function) */
-            stream = new_stream;
-        } else {
-            /* no template stream, so we return an error */
-            return srtp_err_status_no_ctx;
-        }
+srtp_err_status_t srtp_protect_segments(srtp_t ctx,
+                                        uint8_t *buf,
+                                        size_t buf_size,
+                                        size_t len,
+                                        size_t stride,
+                                        size_t mki_index,
+                                        size_t *out_len,
+                                        size_t *out_stride)
+{
+    srtp_err_status_t status;
+    size_t num_segments;
+    size_t last_len;
+    size_t trailer_len = 0;
+    size_t new_stride;
+
+    /* the packets are protected at their own, aligned, offsets */
+    if (ctx == NULL || buf == NULL || out_len == NULL ||
+        out_stride == NULL || len == 0 || stride == 0 || len > buf_size ||
+        ((uintptr_t)buf & 3) != 0 || (stride & 3) != 0) {
+        return srtp_err_status_bad_param;
     }
 
+    num_segments = (len + stride - 1) / stride;
+    last_len = len - (num_segments - 1) * stride;
+
     /*
-     * verify that stream is for sending traffic - this check will
-     * detect SSRC collisions, since a stream that appears in both
-     * srtp_protect() and srtp_unprotect() will fail this test in one of
-     * those functions.
+     * check every packet before anything is moved; they must all get the
+     * same trailer, or the protected segments would not all have the same
+     * length
      */
-    if (stream->direction != dir_srtp_sender) {
-        if (stream->direction == dir_unknown) {
-            stream->direction = dir_srtp_sender;
-        } else {
-            srtp_handle_event(ctx, stream, event_ssrc_collision);
+    for (size_t i = 0; i < num_segments; i++) {
+        size_t seg_len = i + 1 < num_segments ? stride : last_len;
+        size_t length;
+
+        status = srtp_segment_trailer_length(ctx, buf + i * stride, seg_len,
+                                             mki_index, &length);
+        if (status) {
+            return status;
+        }
+        if (i == 0) {
+            trailer_len = length;
+        } else if (length != trailer_len) {
+            return srtp_err_status_bad_param;
         }
     }
 
-    status = srtp_get_session_keys(stream, mki_index, &session_keys);
-    if (status) {
-        return status;
+    new_stride = stride + trailer_len;
+    if (buf_size - len < num_segments * trailer_len) {
+        return srtp_err_status_buffer_small;
     }
 
     /*
-     * Check if this is an AEAD stream (GCM mode).  If so, then dispatch
-     * the request to our AEAD handler.
+     * protect the packets last one first, each where it is, so that it
+     * stays 32-bit aligned, and then move it to the new stride.  The
+     * trailer of packet i overwrites the start of packet i + 1, which has
+     * already been moved further out by (i + 1) * trailer_len octets.
      */
-    if (session_keys->rtp_cipher->algorithm == SRTP_AES_GCM_128 ||
-        session_keys->rtp_cipher->algorithm == SRTP_AES_GCM_256) {
-        return srtp_protect_rtcp_aead(stream, rtcp, rtcp_len, srtcp, srtcp_len,
-                                      session_keys);
+    for (size_t i = num_segments; i-- > 0;) {
+        uint8_t *pkt = buf + i * stride;
+        size_t seg_len = i + 1 < num_segments ? stride : last_len;
+        size_t pkt_len = seg_len + trailer_len;
+
+        status = srtp_protect(ctx, pkt, seg_len, pkt, &pkt_len, mki_index);
+        if (status) {
+            return status;
+        }
+        if (pkt_len != seg_len + trailer_len) {
+            return srtp_err_status_algo_fail;
+        }
+        if (i != 0) {
+            memmove(buf + i * new_stride, pkt, pkt_len);
+        }
     }
 
-    /* get tag length from stream context */
-    tag_len = srtp_auth_get_tag_length(session_keys->rtcp_auth);
+    *out_len = len + num_segments * trailer_len;
+    *out_stride = new_stride;
 
-    /*
-     * set encryption start and encryption length
-     */
-    enc_start = octets_in_rtcp_header;
-    enc_octet_len = rtcp_len - enc_start;
+    return srtp_err_status_ok;
+}
 
-    /* check output length */
-    if (*srtcp_len <
-        rtcp_len + sizeof(srtcp_trailer_t) + stream->mki_size + tag_len) {
+srtp_err_status_t srtp_unprotect_segments(srtp_t ctx,
+                                          uint8_t *buf,
+                                          size_t len,
+                                          size_t stride,
+                                          srtp_mux_packet_t *packets,
+                                          size_t *num_packets)
+{
+    size_t num_segments;
+
+    if (ctx == NULL || buf == NULL || packets == NULL ||
+        num_packets == NULL || len == 0 || stride == 0) {
+        return srtp_err_status_bad_param;
+    }
+
+    num_segments = (len + stride - 1) / stride;
+    if (num_segments > *num_packets) {
         return srtp_err_status_buffer_small;
     }
 
-    /* if not in place then need to copy rtcp header */
-    if (rtcp != srtcp) {
-        memcpy(srtcp, rtcp, enc_start);
+    for (size_t i = 0; i < num_segments; i++) {
+        packets[i].data = buf + i * stride;
+        packets[i].len = i + 1 < num_segments ? stride : len - i * stride;
     }
+    *num_packets = num_segments;
 
-    /* all of the packet, except the header, gets encrypted */
-    /*
-     * NOTE: hdr->length is not usable - it refers to only the first RTCP report
-     * in the compound packet!
-     */
-    trailer_p = srtcp + enc_start + enc_octet_len;
+    return srtp_unprotect_mux_batch(ctx, packets, num_segments);
+}
+
+/*
+ * relocatable session images
+ *
+ * An image is a pointer-free copy of an srtp_t written into a caller
+ * provided region.  Records refer to each other by octet offsets from the
+ * start of the region, so the region can be copied, shared with or mapped
+ * at a different address by another process.  The derived session keys
+ * are stored in the image, so srtp_session_import() rebuilds the cipher
+ * and auth contexts without running the KDF.  Integers are stored in host
+ * byte order; an image is only meaningful to the same build of libSRTP on
+ * the same architecture.
+ */
+
+#define SRTP_IMAGE_MAGIC 0x53525450 /* "SRTP" */
+#define SRTP_IMAGE_VERSION 2
+#define SRTP_IMAGE_ALIGN 8
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;            /* octets used by the image              */
+    uint64_t stream_template; /* offset of the template record, or 0   */
+    uint64_t streams;         /* offset of the first stream record     */
+    uint64_t num_streams;     /* number of records in the stream list  */
+} srtp_image_header_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t key_len;
+    uint32_t tag_len;
+    uint32_t present;
+    uint8_t key[SRTP_MAX_SESSION_KEY_LEN];
+} srtp_image_crypto_t;
+
+typedef struct {
+    srtp_image_crypto_t rtp_cipher;
+    srtp_image_crypto_t rtp_xtn_hdr_cipher;
+    srtp_image_crypto_t rtp_auth;
+    srtp_image_crypto_t rtcp_cipher;
+    srtp_image_crypto_t rtcp_auth;
+    uint64_t limit_num_left;
+    uint32_t limit_state;
+    uint8_t salt[SRTP_AEAD_SALT_LEN];
+    uint8_t c_salt[SRTP_AEAD_SALT_LEN];
+    uint8_t mki_id[SRTP_MAX_MKI_LEN];
+} srtp_image_keys_t;
+
+typedef struct {
+    uint64_t next;        /* offset of the next stream record, or 0     */
+    uint64_t keys;        /* offset of the key records, or 0 if shared  */
+    uint64_t rtp_bitmask; /* offset of the replay window words          */
+    uint64_t enc_xtn_hdr; /* offset of the header ids, or 0 if shared   */
+    uint64_t rtp_index;
+    uint64_t rtcp_bitmask[2];
+    uint32_t rtcp_window_start;
+    uint32_t ssrc;
+    uint32_t window_size;
+    uint32_t direction;
+    uint32_t rtp_services;
+    uint32_t rtcp_services;
+    uint32_t pending_roc;
+    uint32_t num_master_keys;
+    uint32_t mki_size;
+    uint32_t enc_xtn_hdr_count;
+    uint32_t use_mki;
+    uint32_t allow_repeat_tx;
+    uint32_t window_min;
+    uint32_t window_max;
+} srtp_image_stream_t;
+
+typedef struct {
+    uint8_t *region;
+    size_t region_len;
+    size_t pos;
+    const srtp_stream_ctx_t *stream_template;
+    size_t prev_stream;
+    size_t first_stream;
+    size_t num_streams;
+    srtp_err_status_t status;
+} srtp_image_writer_t;
+
+/*
+ * srtp_image_put() reserves len octets at the current position of the
+ * writer and copies data there if the region is large enough; the
+ * position keeps advancing when it is not, so that the required size
+ * can be reported
+ */
+static size_t srtp_image_put(srtp_image_writer_t *w,
+                             const void *data,
+                             size_t len)
+{
+    size_t off = w->pos;
+
+    if (w->region != NULL && off <= w->region_len &&
+        len <= w->region_len - off) {
+        memcpy(w->region + off, data, len);
+    }
+    w->pos += (len + SRTP_IMAGE_ALIGN - 1) & ~(size_t)(SRTP_IMAGE_ALIGN - 1);
+
+    return off;
+}
+
+/* srtp_image_get() copies len octets at offset off out of the region */
+static bool srtp_image_get(const uint8_t *region,
+                           size_t region_len,
+                           uint64_t off,
+                           void *data,
+                           size_t len)
+{
+    if (off > region_len || len > region_len - off) {
+        return false;
+    }
+    memcpy(data, region + off, len);
+    return true;
+}
+
+static void srtp_image_set_cipher(srtp_image_crypto_t *rec,
+                                  const srtp_cipher_t *c,
+                                  const uint8_t *key,
+                                  size_t tag_len)
+{
+    rec->present = c != NULL;
+    if (c == NULL) {
+        return;
+    }
+    rec->id = c->type->id;
+    rec->key_len = (uint32_t)c->key_len;
+    rec->tag_len = (uint32_t)tag_len;
+    memcpy(rec->key, key, SRTP_MAX_SESSION_KEY_LEN);
+}
+
+static void srtp_image_set_auth(srtp_image_crypto_t *rec,
+                                const srtp_auth_t *a,
+                                const uint8_t *key)
+{
+    rec->present = 1;
+    rec->id = a->type->id;
+    rec->key_len = (uint32_t)a->key_len;
+    rec->tag_len = (uint32_t)a->out_len;
+    memcpy(rec->key, key, SRTP_MAX_SESSION_KEY_LEN);
+}
+
+static srtp_err_status_t srtp_image_put_keys(srtp_image_writer_t *w,
+                                             const srtp_stream_ctx_t *stream,
+                                             uint64_t *off)
+{
+    srtp_image_keys_t rec;
+
+    *off = w->pos;
+    for (size_t i = 0; i < stream->num_master_keys; i++) {
+        const srtp_session_keys_t *keys = &stream->session_keys[i];
+        const srtp_retained_keys_t *r = keys->retained;
+
+        if (r == NULL) {
+            return srtp_err_status_bad_param;
+        }
+
+        memset(&rec, 0, sizeof(rec));
+        srtp_image_set_cipher(&rec.rtp_cipher, keys->rtp_cipher,
+                              r->rtp_cipher_key,
+                              srtp_auth_get_tag_length(keys->rtp_auth));
+        srtp_image_set_cipher(&rec.rtp_xtn_hdr_cipher,
+                              keys->rtp_xtn_hdr_cipher,
+                              r->rtp_xtn_hdr_cipher_key, 0);
+        srtp_image_set_auth(&rec.rtp_auth, keys->rtp_auth, r->rtp_auth_key);
+        srtp_image_set_cipher(&rec.rtcp_cipher, keys->rtcp_cipher,
+                              r->rtcp_cipher_key,
+                              srtp_auth_get_tag_length(keys->rtcp_auth));
+        srtp_image_set_auth(&rec.rtcp_auth, keys->rtcp_auth,
+                            r->rtcp_auth_key);
+        rec.limit_num_left = keys->limit->num_left;
+        rec.limit_state = (uint32_t)keys->limit->state;
+        memcpy(rec.salt, keys->salt, SRTP_AEAD_SALT_LEN);
+        memcpy(rec.c_salt, keys->c_salt, SRTP_AEAD_SALT_LEN);
+        if (keys->mki_id != NULL) {
+            memcpy(rec.mki_id, keys->mki_id, stream->mki_size);
+        }
+        srtp_image_put(w, &rec, sizeof(rec));
+    }
+    octet_string_set_to_zero(&rec, sizeof(rec));
+
+    return srtp_err_status_ok;
+}
+
+static srtp_err_status_t srtp_image_put_stream(srtp_image_writer_t *w,
+                                               const srtp_stream_ctx_t *stream,
+                                               const srtp_stream_ctx_t *tmpl,
+                                               size_t *stream_off)
+{
+    srtp_err_status_t status;
+    srtp_image_stream_t rec;
+    size_t ws = srtp_rdbx_get_window_size(&stream->rtp_rdbx);
+    size_t min_ws, max_ws;
+
+    srtp_rdbx_get_window_bounds(&stream->rtp_rdbx, &min_ws, &max_ws);
+
+    memset(&rec, 0, sizeof(rec));
+    rec.rtp_index = stream->rtp_rdbx.index;
+    memcpy(rec.rtcp_bitmask, &stream->rtcp_rdb.bitmask,
+           sizeof(rec.rtcp_bitmask));
+    rec.rtcp_window_start = stream->rtcp_rdb.window_start;
+    rec.ssrc = stream->ssrc;
+    rec.window_size = (uint32_t)ws;
+    rec.window_min = (uint32_t)min_ws;
+    rec.window_max = (uint32_t)max_ws;
+    rec.direction = (uint32_t)stream->direction;
+    rec.rtp_services = (uint32_t)stream->rtp_services;
+    rec.rtcp_services = (uint32_t)stream->rtcp_services;
+    rec.pending_roc = stream->pending_roc;
+    rec.num_master_keys = (uint32_t)stream->num_master_keys;
+    rec.mki_size = (uint32_t)stream->mki_size;
+    rec.enc_xtn_hdr_count = (uint32_t)stream->enc_xtn_hdr_count;
+    rec.use_mki = stream->use_mki;
+    rec.allow_repeat_tx = stream->allow_repeat_tx;
+
+    /* the record is written first, then the data it refers to */
+    *stream_off = srtp_image_put(w, &rec, sizeof(rec));
+
+    rec.rtp_bitmask = srtp_image_put(w, stream->rtp_rdbx.bitmask.word,
+                                     ws / bits_per_word * bytes_per_word);
+
+    if (tmpl != NULL &&
+        stream->num_master_keys == tmpl->num_master_keys &&
+        stream->session_keys[0].rtp_cipher ==
+            tmpl->session_keys[0].rtp_cipher) {
+        rec.keys = 0;
+    } else {
+        status = srtp_image_put_keys(w, stream, &rec.keys);
+        if (status) {
+            return status;
+        }
+    }
 
-    if (stream->rtcp_services & sec_serv_conf) {
-        trailer = htonl(SRTCP_E_BIT); /* set encrypt bit */
+    if (stream->enc_xtn_hdr_count == 0 ||
+        (tmpl != NULL && stream->enc_xtn_hdr == tmpl->enc_xtn_hdr)) {
+        rec.enc_xtn_hdr = 0;
     } else {
-        /* 0 is network-order independant */
-        trailer = 0x00000000; /* set encrypt bit */
+        rec.enc_xtn_hdr =
+            srtp_image_put(w, stream->enc_xtn_hdr, stream->enc_xtn_hdr_count);
     }
 
-    if (stream->use_mki) {
-        srtp_inject_mki(srtcp + rtcp_len + sizeof(srtcp_trailer_t),
-                        session_keys, stream->mki_size);
+    /* rewrite the record now that the offsets are known */
+    if (w->region != NULL && *stream_off + sizeof(rec) <= w->region_len) {
+        memcpy(w->region + *stream_off, &rec, sizeof(rec));
     }
 
-    /*
-     * set the auth_start and auth_tag pointers to the proper locations
-     * (note that srtpc *always* provides authentication, unlike srtp)
-     */
-    /* Note: This would need to change for optional mikey data */
-    auth_start = srtcp;
-    auth_tag = srtcp + rtcp_len + sizeof(srtcp_trailer_t) + stream->mki_size;
+    return srtp_err_status_ok;
+}
 
-    /*
-     * check sequence number for overruns, and copy it into the packet
-     * if its value isn't too big
-     */
-    status = srtp_rdb_increment(&stream->rtcp_rdb);
-    if (status) {
-        return status;
-    }
-    seq_num = srtp_rdb_get_value(&stream->rtcp_rdb);
-    trailer |= htonl(seq_num);
-    debug_print(mod_srtp, "srtcp index: %x", seq_num);
+static bool srtp_image_put_list_stream(srtp_stream_t stream, void *data)
+{
+    srtp_image_writer_t *w = (srtp_image_writer_t *)data;
+    size_t off;
+    uint64_t next;
 
-    memcpy(trailer_p, &trailer, sizeof(trailer));
+    w->status = srtp_image_put_stream(w, stream, w->stream_template, &off);
+    if (w->status) {
+        return false;
+    }
 
-    /*
-     * if we're using rindael counter mode, set nonce and seq
-     */
-    if (session_keys->rtcp_cipher->type->id == SRTP_AES_ICM_128 ||
-        session_keys->rtcp_cipher->type->id == SRTP_AES_ICM_192 ||
-        session_keys->rtcp_cipher->type->id == SRTP_AES_ICM_256) {
-        v128_t iv;
+    /* link the previous record to this one */
+    if (w->num_streams == 0) {
+        w->first_stream = off;
+    } else if (w->region != NULL &&
+               w->prev_stream + sizeof(srtp_image_stream_t) <= w->region_len) {
+        next = off;
+        memcpy(w->region + w->prev_stream +
+                   offsetof(srtp_image_stream_t, next),
+               &next, sizeof(next));
+    }
+    w->prev_stream = off;
+    w->num_streams++;
 
-        iv.v32[0] = 0;
-        iv.v32[1] = hdr->ssrc; /* still in network order! */
-        iv.v32[2] = htonl(seq_num >> 16);
-        iv.v32[3] = htonl(seq_num << 16);
-        status = srtp_cipher_set_iv(session_keys->rtcp_cipher, (uint8_t *)&iv,
-                                    srtp_direction_encrypt);
+    return true;
+}
 
-    } else {
-        v128_t iv;
+static bool srtp_image_flush_stream(srtp_stream_t stream, void *data)
+{
+    (void)data;
 
-        /* otherwise, just set the index to seq_num */
-        iv.v32[0] = 0;
-        iv.v32[1] = 0;
-        iv.v32[2] = 0;
-        iv.v32[3] = htonl(seq_num);
-        status = srtp_cipher_set_iv(session_keys->rtcp_cipher, (uint8_t *)&iv,
-                                    srtp_direction_encrypt);
+    for (size_t i = 0; i < stream->num_master_keys; i++) {
+        srtp_key_limit_flush(stream->session_keys[i].limit);
     }
-    if (status) {
-        return srtp_err_status_cipher_fail;
+
+    return true;
+}
+
+static bool srtp_image_mark_stream(srtp_stream_t stream, void *data)
+{
+    (void)data;
+
+    stream->exported = true;
+
+    return true;
+}
+
+srtp_err_status_t srtp_session_export(srtp_t session,
+                                      uint8_t *region,
+                                      size_t region_len,
+                                      size_t *image_len)
+{
+    srtp_err_status_t status;
+    srtp_image_writer_t w;
+    srtp_image_header_t hdr;
+    size_t off;
+
+    if (session == NULL || image_len == NULL) {
+        return srtp_err_status_bad_param;
     }
 
-    /*
-     * if we're authenticating using a universal hash, put the keystream
-     * prefix into the authentication tag
-     */
+    w.region = region;
+    w.region_len = region != NULL ? region_len : 0;
+    w.pos = 0;
+    w.stream_template = session->stream_template;
+    w.prev_stream = 0;
+    w.first_stream = 0;
+    w.num_streams = 0;
+    w.status = srtp_err_status_ok;
 
-    /* if auth_start is non-null, then put keystream into tag  */
-    if (auth_start) {
-        /* put keystream prefix into auth_tag */
-        prefix_len = srtp_auth_get_prefix_length(session_keys->rtcp_auth);
-        status = srtp_cipher_output(session_keys->rtcp_cipher, auth_tag,
-                                    &prefix_len);
+    /* the template's key usage must include what its streams hold back */
+    srtp_stream_list_for_each(session->stream_list, srtp_image_flush_stream,
+                              NULL);
 
-        debug_print(mod_srtp, "keystream prefix: %s",
-                    srtp_octet_string_hex_string(auth_tag, prefix_len));
+    memset(&hdr, 0, sizeof(hdr));
+    srtp_image_put(&w, &hdr, sizeof(hdr));
 
+    if (session->stream_template != NULL) {
+        status = srtp_image_put_stream(&w, session->stream_template, NULL,
+                                       &off);
         if (status) {
-            return srtp_err_status_cipher_fail;
+            return status;
         }
+        hdr.stream_template = off;
     }
 
-    /* if we're encrypting, exor keystream into the message */
-    if (stream->rtcp_services & sec_serv_conf) {
-        status = srtp_cipher_encrypt(session_keys->rtcp_cipher,
-                                     rtcp + enc_start, enc_octet_len,
-                                     srtcp + enc_start, &enc_octet_len);
-        if (status) {
-            return srtp_err_status_cipher_fail;
-        }
-    } else if (rtcp != srtcp) {
-        /* if no encryption and not-inplace then need to copy rest of packet */
-        memcpy(srtcp + enc_start, rtcp + enc_start, enc_octet_len);
+    srtp_stream_list_for_each(session->stream_list, srtp_image_put_list_stream,
+                              &w);
+    if (w.status) {
+        return w.status;
     }
 
-    /* initialize auth func context */
-    status = srtp_auth_start(session_keys->rtcp_auth);
-    if (status) {
-        return status;
+    *image_len = w.pos;
+    if (region == NULL || w.pos > region_len) {
+        return srtp_err_status_buffer_small;
     }
 
+    hdr.magic = SRTP_IMAGE_MAGIC;
+    hdr.version = SRTP_IMAGE_VERSION;
+    hdr.size = w.pos;
+    hdr.streams = w.first_stream;
+    hdr.num_streams = w.num_streams;
+    memcpy(region, &hdr, sizeof(hdr));
+
     /*
-     * run auth func over packet (including trailer), and write the
-     * result at auth_tag
+     * the importer continues from the indices in the image, so sending
+     * here as well would reuse its keystream
      */
-    status = srtp_auth_compute(session_keys->rtcp_auth, auth_start,
-                               rtcp_len + sizeof(srtcp_trailer_t), auth_tag);
-    debug_print(mod_srtp, "srtcp auth tag:    %s",
-                srtp_octet_string_hex_string(auth_tag, tag_len));
-    if (status) {
-        return srtp_err_status_auth_fail;
+    if (session->stream_template != NULL) {
+        session->stream_template->exported = true;
     }
-
-    *srtcp_len = enc_start + enc_octet_len;
-
-    /* increase the packet length by the length of the auth tag and seq_num*/
-    *srtcp_len += (tag_len + sizeof(srtcp_trailer_t));
-
-    /* increase the packet by the mki_size */
-    *srtcp_len += stream->mki_size;
+    srtp_stream_list_for_each(session->stream_list, srtp_image_mark_stream,
+                              NULL);
 
     return srtp_err_status_ok;
 }
 
-srtp_err_status_t srtp_unprotect_rtcp(srtp_t ctx,
-                                      const uint8_t *srtcp,
-                                      size_t srtcp_len,
-                                      uint8_t *rtcp,
-                                      size_t *rtcp_len)
+static srtp_err_status_t srtp_image_get_cipher(const srtp_image_crypto_t *rec,
+                                               srtp_cipher_t **c,
+                                               uint8_t *key)
 {
-    const srtcp_hdr_t *hdr = (const srtcp_hdr_t *)srtcp;
-    size_t enc_start;               /* pointer to start of encrypted portion  */
-    const uint8_t *auth_start;      /* pointer to start of auth. portion      */
-    const uint8_t *trailer_p;       /* pointer to start of trailer            */
-    uint32_t trailer;               /* trailer value                          */
-    size_t enc_octet_len = 0;       /* number of octets in encrypted portion */
-    const uint8_t *auth_tag = NULL; /* location of auth_tag within packet     */
-    uint8_t tmp_tag[SRTP_MAX_TAG_LEN];
     srtp_err_status_t status;
-    size_t auth_len;
-    size_t tag_len;
-    srtp_stream_ctx_t *stream;
-    size_t prefix_len;
-    uint32_t seq_num;
-    bool e_bit_in_packet;          /* E-bit was found in the packet */
-    bool sec_serv_confidentiality; /* whether confidentiality was requested */
-    srtp_session_keys_t *session_keys = NULL;
 
-    /*
-     * check that the length value is sane; we'll check again once we
-     * know the tag length, but we at least want to know that it is
-     * a positive value
-     */
-    if (srtcp_len < octets_in_rtcp_header + sizeof(srtcp_trailer_t)) {
+    if (rec->key_len > SRTP_MAX_SESSION_KEY_LEN) {
         return srtp_err_status_bad_param;
     }
-
-    /*
-     * look up ssrc in srtp_stream list, and process the packet with
-     * the appropriate stream.  if we haven't seen this stream before,
-     * there's only one key for this srtp_session, and the cipher
-     * supports key-sharing, then we assume that a new stream using
-     * that key has just started up
-     */
-    stream = srtp_get_stream(ctx, hdr->ssrc);
-    if (stream == NULL) {
-        if (ctx->stream_template != NULL) {
-            stream = ctx->stream_template;
-
-            debug_print(mod_srtp,
-                        "srtcp using provisional stream (SSRC: 0x%08x)",
-                        ntohl(hdr->ssrc));
-        } else {
-            /* no template stream, so we return an error */
-            return srtp_err_status_no_ctx;
-        }
-    }
-
-    /*
-     * Determine if MKI is being used and what session keys should be used
-     */
-    status = srtp_get_session_keys_for_packet(stream, srtcp, srtcp_len,
-                                              &session_keys);
+    status = srtp_crypto_kernel_alloc_cipher(rec->id, c, rec->key_len,
+                                             rec->tag_len);
     if (status) {
         return status;
     }
+    memcpy(key, rec->key, SRTP_MAX_SESSION_KEY_LEN);
 
-    /* get tag length from stream context */
-    tag_len = srtp_auth_get_tag_length(session_keys->rtcp_auth);
+    return srtp_cipher_init(*c, key);
+}
 
-    /* check the packet length - it must contain at least a full RTCP
-       header, an auth tag (if applicable), and the SRTCP encrypted flag
-       and 31-bit index value */
-    if (srtcp_len < octets_in_rtcp_header + sizeof(srtcp_trailer_t) +
-                        stream->mki_size + tag_len) {
+static srtp_err_status_t srtp_image_get_auth(const srtp_image_crypto_t *rec,
+                                             srtp_auth_t **a,
+                                             uint8_t *key)
+{
+    srtp_err_status_t status;
+
+    if (rec->key_len > SRTP_MAX_SESSION_KEY_LEN) {
         return srtp_err_status_bad_param;
     }
-
-    /*
-     * Check if this is an AEAD stream (GCM mode).  If so, then dispatch
-     * the request to our AEAD handler.
-     */
-    if (session_keys->rtp_cipher->algorithm == SRTP_AES_GCM_128 ||
-        session_keys->rtp_cipher->algorithm == SRTP_AES_GCM_256) {
-        return srtp_unprotect_rtcp_aead(ctx, stream, srtcp, srtcp_len, rtcp,
-                                        rtcp_len, session_keys);
+    status = srtp_crypto_kernel_alloc_auth(rec->id, a, rec->key_len,
+                                           rec->tag_len);
+    if (status) {
+        return status;
     }
+    memcpy(key, rec->key, SRTP_MAX_SESSION_KEY_LEN);
 
-    sec_serv_confidentiality = stream->rtcp_services == sec_serv_conf ||
-                               stream->rtcp_services == sec_serv_conf_and_auth;
+    return srtp_auth_init(*a, key);
+}
 
-    /*
-     * set encryption start, encryption length, and trailer
-     */
-    enc_start = octets_in_rtcp_header;
-    enc_octet_len = srtcp_len - (octets_in_rtcp_header + tag_len +
-                                 stream->mki_size + sizeof(srtcp_trailer_t));
-    /*
-     *index & E (encryption) bit follow normal data. hdr->len is the number of
-     * words (32-bit) in the normal packet minus 1
-     */
-    /* This should point trailer to the word past the end of the normal data. */
-    /* This would need to be modified for optional mikey data */
-    trailer_p = srtcp + srtcp_len -
-                (tag_len + stream->mki_size + sizeof(srtcp_trailer_t));
-    memcpy(&trailer, trailer_p, sizeof(trailer));
+static srtp_err_status_t srtp_image_get_keys(const uint8_t *region,
+                                             size_t region_len,
+                                             uint64_t off,
+                                             srtp_stream_ctx_t *str)
+{
+    srtp_err_status_t status = srtp_err_status_ok;
+    srtp_image_keys_t rec;
 
-    e_bit_in_packet = (*trailer_p & SRTCP_E_BYTE_BIT) == SRTCP_E_BYTE_BIT;
-    if (e_bit_in_packet != sec_serv_confidentiality) {
-        return srtp_err_status_cant_check;
-    }
+    for (size_t i = 0; i < str->num_master_keys; i++) {
+        srtp_session_keys_t *keys = &str->session_keys[i];
+        srtp_retained_keys_t *r;
 
-    /*
-     * set the auth_start and auth_tag pointers to the proper locations
-     * (note that srtcp *always* uses authentication, unlike srtp)
-     */
-    auth_start = srtcp;
+        if (!srtp_image_get(region, region_len,
+                            off + i * sizeof(srtp_image_keys_t), &rec,
+                            sizeof(rec))) {
+            status = srtp_err_status_bad_param;
+            break;
+        }
 
-    /*
-     * The location of the auth tag in the packet needs to know MKI
-     * could be present.  The data needed to calculate the Auth tag
-     * must not include the MKI
-     */
-    auth_len = srtcp_len - tag_len - stream->mki_size;
-    auth_tag = srtcp + auth_len + stream->mki_size;
+        /* an imported session can be exported again */
+        status = srtp_alloc_retained_keys(keys);
+        if (status) {
+            break;
+        }
+        r = keys->retained;
+
+        status = srtp_image_get_cipher(&rec.rtp_cipher, &keys->rtp_cipher,
+                                       r->rtp_cipher_key);
+        if (!status && rec.rtp_xtn_hdr_cipher.present) {
+            status = srtp_image_get_cipher(&rec.rtp_xtn_hdr_cipher,
+                                           &keys->rtp_xtn_hdr_cipher,
+                                           r->rtp_xtn_hdr_cipher_key);
+        }
+        if (!status) {
+            status = srtp_image_get_auth(&rec.rtp_auth, &keys->rtp_auth,
+                                         r->rtp_auth_key);
+        }
+        if (!status) {
+            status = srtp_image_get_cipher(&rec.rtcp_cipher,
+                                           &keys->rtcp_cipher,
+                                           r->rtcp_cipher_key);
+        }
+        if (!status) {
+            status = srtp_image_get_auth(&rec.rtcp_auth, &keys->rtcp_auth,
+                                         r->rtcp_auth_key);
+        }
+        if (status) {
+            break;
+        }
 
-    /*
-     * check the sequence number for replays
-     */
-    /* this is easier than dealing with bitfield access */
-    seq_num = ntohl(trailer) & SRTCP_INDEX_MASK;
-    debug_print(mod_srtp, "srtcp index: %x", seq_num);
-    status = srtp_rdb_check(&stream->rtcp_rdb, seq_num);
-    if (status) {
-        return status;
+        keys->limit = (srtp_key_limit_ctx_t *)srtp_crypto_alloc(
+            sizeof(srtp_key_limit_ctx_t));
+        if (keys->limit == NULL) {
+            status = srtp_err_status_alloc_fail;
+            break;
+        }
+        keys->limit->num_left = rec.limit_num_left;
+        keys->limit->state = (srtp_key_state_t)rec.limit_state;
+
+        memcpy(keys->salt, rec.salt, SRTP_AEAD_SALT_LEN);
+        memcpy(keys->c_salt, rec.c_salt, SRTP_AEAD_SALT_LEN);
+        if (str->mki_size != 0) {
+            keys->mki_id = srtp_crypto_alloc(str->mki_size);
+            if (keys->mki_id == NULL) {
+                status = srtp_err_status_alloc_fail;
+                break;
+            }
+            memcpy(keys->mki_id, rec.mki_id, str->mki_size);
+        }
     }
+    octet_string_set_to_zero(&rec, sizeof(rec));
 
-    /*
-     * if we're using aes counter mode, set nonce and seq
-     */
-    if (session_keys->rtcp_cipher->type->id == SRTP_AES_ICM_128 ||
-        session_keys->rtcp_cipher->type->id == SRTP_AES_ICM_192 ||
-        session_keys->rtcp_cipher->type->id == SRTP_AES_ICM_256) {
-        v128_t iv;
+    return status;
+}
 
-        iv.v32[0] = 0;
-        iv.v32[1] = hdr->ssrc; /* still in network order! */
-        iv.v32[2] = htonl(seq_num >> 16);
-        iv.v32[3] = htonl(seq_num << 16);
-        status = srtp_cipher_set_iv(session_keys->rtcp_cipher, (uint8_t *)&iv,
-                                    srtp_direction_decrypt);
+static srtp_err_status_t srtp_image_share_keys(
+    srtp_stream_ctx_t *str,
+    const srtp_stream_ctx_t *stream_template)
+{
+    srtp_err_status_t status;
 
-    } else {
-        v128_t iv;
+    for (size_t i = 0; i < str->num_master_keys; i++) {
+        srtp_session_keys_t *keys = &str->session_keys[i];
+        const srtp_session_keys_t *template_keys =
+            &stream_template->session_keys[i];
+
+        keys->rtp_cipher = template_keys->rtp_cipher;
+        keys->rtp_xtn_hdr_cipher = template_keys->rtp_xtn_hdr_cipher;
+        keys->rtp_auth = template_keys->rtp_auth;
+        keys->rtcp_cipher = template_keys->rtcp_cipher;
+        keys->rtcp_auth = template_keys->rtcp_auth;
+        status = srtp_key_limit_clone(template_keys->limit, &keys->limit);
+        if (status) {
+            return status;
+        }
+        memcpy(keys->salt, template_keys->salt, SRTP_AEAD_SALT_LEN);
+        memcpy(keys->c_salt, template_keys->c_salt, SRTP_AEAD_SALT_LEN);
+        if (str->mki_size != 0) {
+            keys->mki_id = srtp_crypto_alloc(str->mki_size);
+            if (keys->mki_id == NULL) {
+                return srtp_err_status_alloc_fail;
+            }
+            memcpy(keys->mki_id, template_keys->mki_id, str->mki_size);
+        }
+    }
 
-        /* otherwise, just set the index to seq_num */
-        iv.v32[0] = 0;
-        iv.v32[1] = 0;
-        iv.v32[2] = 0;
-        iv.v32[3] = htonl(seq_num);
-        status = srtp_cipher_set_iv(session_keys->rtcp_cipher, (uint8_t *)&iv,
-                                    srtp_direction_decrypt);
+    return srtp_err_status_ok;
+}
+
+static srtp_err_status_t srtp_image_get_stream(
+    const uint8_t *region,
+    size_t region_len,
+    uint64_t off,
+    const srtp_stream_ctx_t *stream_template,
+    srtp_stream_ctx_t **str_ptr,
+    uint64_t *next)
+{
+    srtp_err_status_t status;
+    srtp_image_stream_t rec;
+    srtp_stream_ctx_t *str;
+
+    *str_ptr = NULL;
+    if (!srtp_image_get(region, region_len, off, &rec, sizeof(rec))) {
+        return srtp_err_status_bad_param;
     }
-    if (status) {
-        return srtp_err_status_cipher_fail;
+    if (rec.num_master_keys == 0 ||
+        rec.num_master_keys > SRTP_MAX_NUM_MASTER_KEYS ||
+        rec.mki_size > SRTP_MAX_MKI_LEN) {
+        return srtp_err_status_bad_param;
+    }
+    if (rec.keys == 0 &&
+        (stream_template == NULL ||
+         rec.num_master_keys != stream_template->num_master_keys ||
+         rec.mki_size != stream_template->mki_size)) {
+        return srtp_err_status_bad_param;
+    }
+    if (rec.enc_xtn_hdr == 0 && rec.enc_xtn_hdr_count != 0 &&
+        (stream_template == NULL ||
+         rec.enc_xtn_hdr_count != stream_template->enc_xtn_hdr_count)) {
+        return srtp_err_status_bad_param;
     }
+    *next = rec.next;
 
-    /*
-     * if we're authenticating using a universal hash, put the keystream
-     * prefix into the authentication tag
-     */
-    prefix_len = srtp_auth_get_prefix_length(session_keys->rtcp_auth);
-    if (prefix_len) {
-        status =
-            srtp_cipher_output(session_keys->rtcp_cipher, tmp_tag, &prefix_len);
-        debug_print(mod_srtp, "keystream prefix: %s",
-                    srtp_octet_string_hex_string(tmp_tag, prefix_len));
-        if (status) {
-            return srtp_err_status_cipher_fail;
-        }
+    str = (srtp_stream_ctx_t *)srtp_crypto_alloc(sizeof(srtp_stream_ctx_t));
+    if (str == NULL) {
+        return srtp_err_status_alloc_fail;
     }
+    *str_ptr = str;
 
-    /* initialize auth func context */
-    status = srtp_auth_start(session_keys->rtcp_auth);
-    if (status) {
-        return status;
+    str->ssrc = rec.ssrc;
+    str->num_master_keys = rec.num_master_keys;
+    str->use_mki = rec.use_mki != 0;
+    str->mki_size = rec.mki_size;
+    str->rtp_services = (srtp_sec_serv_t)rec.rtp_services;
+    str->rtcp_services = (srtp_sec_serv_t)rec.rtcp_services;
+    str->direction = (direction_t)rec.direction;
+    str->allow_repeat_tx = rec.allow_repeat_tx != 0;
+    str->pending_roc = rec.pending_roc;
+
+    str->session_keys = (srtp_session_keys_t *)srtp_crypto_alloc(
+        sizeof(srtp_session_keys_t) * str->num_master_keys);
+    if (str->session_keys == NULL) {
+        return srtp_err_status_alloc_fail;
     }
 
-    /* run auth func over packet, put result into tmp_tag */
-    status = srtp_auth_compute(session_keys->rtcp_auth, auth_start, auth_len,
-                               tmp_tag);
-    debug_print(mod_srtp, "srtcp computed tag:       %s",
-                srtp_octet_string_hex_string(tmp_tag, tag_len));
+    if (rec.keys == 0) {
+        str->is_clone = true;
+        status = srtp_image_share_keys(str, stream_template);
+    } else {
+        status = srtp_image_get_keys(region, region_len, rec.keys, str);
+    }
     if (status) {
-        return srtp_err_status_auth_fail;
+        return status;
     }
 
-    /* compare the tag just computed with the one in the packet */
-    debug_print(mod_srtp, "srtcp tag from packet:    %s",
-                srtp_octet_string_hex_string(auth_tag, tag_len));
-    if (!srtp_octet_string_equal(tmp_tag, auth_tag, tag_len)) {
-        return srtp_err_status_auth_fail;
+    /* replay databases */
+    status = srtp_rdbx_init(&str->rtp_rdbx, rec.window_size);
+    if (status) {
+        return status;
     }
-
-    /* check output length */
-    if (*rtcp_len <
-        srtcp_len - sizeof(srtcp_trailer_t) - stream->mki_size - tag_len) {
-        return srtp_err_status_buffer_small;
+    status = srtp_rdbx_set_window_bounds(&str->rtp_rdbx, rec.window_min,
+                                         rec.window_max);
+    if (status) {
+        return status;
     }
-
-    /* if not inplace need to copy rtcp header */
-    if (srtcp != rtcp) {
-        memcpy(rtcp, srtcp, enc_start);
+    if (!srtp_image_get(region, region_len, rec.rtp_bitmask,
+                        str->rtp_rdbx.bitmask.word,
+                        rec.window_size / bits_per_word * bytes_per_word)) {
+        return srtp_err_status_bad_param;
     }
+    str->rtp_rdbx.index = rec.rtp_index;
+    str->rtcp_rdb.window_start = rec.rtcp_window_start;
+    memcpy(&str->rtcp_rdb.bitmask, rec.rtcp_bitmask,
+           sizeof(rec.rtcp_bitmask));
 
-    /* if we're decrypting, exor keystream into the message */
-    if (sec_serv_confidentiality) {
-        status = srtp_cipher_decrypt(session_keys->rtcp_cipher,
-                                     srtcp + enc_start, enc_octet_len,
-                                     rtcp + enc_start, &enc_octet_len);
-        if (status) {
-            return srtp_err_status_cipher_fail;
+    /* extensions header encryption */
+    str->enc_xtn_hdr_count = rec.enc_xtn_hdr_count;
+    if (rec.enc_xtn_hdr_count == 0) {
+        str->enc_xtn_hdr = NULL;
+    } else if (rec.enc_xtn_hdr == 0) {
+        str->enc_xtn_hdr = stream_template->enc_xtn_hdr;
+    } else {
+        str->enc_xtn_hdr = (uint8_t *)srtp_crypto_alloc(rec.enc_xtn_hdr_count);
+        if (str->enc_xtn_hdr == NULL) {
+            return srtp_err_status_alloc_fail;
+        }
+        if (!srtp_image_get(region, region_len, rec.enc_xtn_hdr,
+                            str->enc_xtn_hdr, rec.enc_xtn_hdr_count)) {
+            return srtp_err_status_bad_param;
         }
-    } else if (srtcp != rtcp) {
-        /* if no encryption and not-inplace then need to copy rest of packet */
-        memcpy(rtcp + enc_start, srtcp + enc_start, enc_octet_len);
     }
 
-    *rtcp_len = srtcp_len;
-
-    /* decrease the packet length by the length of the auth tag and seq_num */
-    *rtcp_len -= (tag_len + sizeof(srtcp_trailer_t));
+    return srtp_err_status_ok;
+}
 
-    /* decrease the packet length by the length of the mki_size */
-    *rtcp_len -= stream->mki_size;
+srtp_err_status_t srtp_session_import(srtp_t *session,
+                                      const uint8_t *region,
+                                      size_t region_len)
+{
+    srtp_err_status_t status;
+    srtp_image_header_t hdr;
+    srtp_stream_ctx_t *str;
+    uint64_t off, next;
 
-    /*
-     * verify that stream is for received traffic - this check will
-     * detect SSRC collisions, since a stream that appears in both
-     * srtp_protect() and srtp_unprotect() will fail this test in one of
-     * those functions.
-     *
-     * we do this check *after* the authentication check, so that the
-     * latter check will catch any attempts to fool us into thinking
-     * that we've got a collision
-     */
-    if (stream->direction != dir_srtp_receiver) {
-        if (stream->direction == dir_unknown) {
-            stream->direction = dir_srtp_receiver;
-        } else {
-            srtp_handle_event(ctx, stream, event_ssrc_collision);
-        }
+    if (session == NULL || region == NULL) {
+        return srtp_err_status_bad_param;
+    }
+    if (!srtp_image_get(region, region_len, 0, &hdr, sizeof(hdr)) ||
+        hdr.magic != SRTP_IMAGE_MAGIC || hdr.version != SRTP_IMAGE_VERSION ||
+        hdr.size > region_len) {
+        return srtp_err_status_bad_param;
     }
 
-    /*
-     * if the stream is a 'provisional' one, in which the template context
-     * is used, then we need to allocate a new stream at this point, since
-     * the authentication passed
-     */
-    if (stream == ctx->stream_template) {
-        srtp_stream_ctx_t *new_stream;
+    status = srtp_create(session, NULL);
+    if (status) {
+        return status;
+    }
 
-        /*
-         * allocate and initialize a new stream
-         *
-         * note that we indicate failure if we can't allocate the new
-         * stream, and some implementations will want to not return
-         * failure here
-         */
-        status =
-            srtp_stream_clone(ctx->stream_template, hdr->ssrc, &new_stream);
+    if (hdr.stream_template != 0) {
+        status = srtp_image_get_stream(region, region_len, hdr.stream_template,
+                                       NULL, &str, &next);
         if (status) {
+            if (str != NULL) {
+                srtp_stream_dealloc(str, NULL);
+            }
+            srtp_dealloc(*session);
+            *session = NULL;
             return status;
         }
-
-        /* add new stream to the list */
-        status = srtp_insert_or_dealloc_stream(ctx->stream_list, new_stream,
-                                               ctx->stream_template);
+        (*session)->stream_template = str;
+    }
+
+    off = hdr.streams;
+    for (uint64_t i = 0; i < hdr.num_streams; i++) {
+        status = srtp_image_get_stream(region, region_len, off,
+                                       (*session)->stream_template, &str,
+                                       &next);
+        if (!status) {
+            status = srtp_insert_or_dealloc_stream(
+                (*session)->stream_list, str, (*session)->stream_template);
+        } else if (str != NULL) {
+            srtp_stream_dealloc(str, (*session)->stream_template);
+        }
         if (status) {
+            srtp_dealloc(*session);
+            *session = NULL;
             return status;
         }
-
-        /* set stream (the pointer used in this function) */
-        stream = new_stream;
+        off = next;
     }
 
-    /* we've passed the authentication check, so add seq_num to the rdb */
-    srtp_rdb_add_index(&stream->rtcp_rdb, seq_num);
-
     return srtp_err_status_ok;
 }
 
@@ -4567,6 +8392,13 @@ srtp_err_status_t srtp_crypto_policy_set_from_profile_for_rtp(
     case srtp_profile_aead_aes_256_gcm:
         srtp_crypto_policy_set_aes_gcm_256_16_auth(policy);
         break;
+    /* each half of a double profile, see srtp_protect_double() */
+    case srtp_profile_double_aead_aes_128_gcm_aead_aes_128_gcm:
+        srtp_crypto_policy_set_aes_gcm_128_16_auth(policy);
+        break;
+    case srtp_profile_double_aead_aes_256_gcm_aead_aes_256_gcm:
+        srtp_crypto_policy_set_aes_gcm_256_16_auth(policy);
+        break;
 #endif
     /* the following profiles are not (yet) supported */
     case srtp_profile_null_sha1_32:
@@ -4601,6 +8433,13 @@ srtp_err_status_t srtp_crypto_policy_set_from_profile_for_rtcp(
     case srtp_profile_aead_aes_256_gcm:
         srtp_crypto_policy_set_aes_gcm_256_16_auth(policy);
         break;
+    /* each half of a double profile, see srtp_protect_double() */
+    case srtp_profile_double_aead_aes_128_gcm_aead_aes_128_gcm:
+        srtp_crypto_policy_set_aes_gcm_128_16_auth(policy);
+        break;
+    case srtp_profile_double_aead_aes_256_gcm_aead_aes_256_gcm:
+        srtp_crypto_policy_set_aes_gcm_256_16_auth(policy);
+        break;
 #endif
     /* the following profiles are not (yet) supported */
     case srtp_profile_null_sha1_32:
@@ -4637,6 +8476,12 @@ size_t srtp_profile_get_master_key_length(srtp_profile_t profile)
     case srtp_profile_aead_aes_256_gcm:
         return SRTP_AES_256_KEY_LEN;
         break;
+    case srtp_profile_double_aead_aes_128_gcm_aead_aes_128_gcm:
+        return 2 * SRTP_AES_128_KEY_LEN;
+        break;
+    case srtp_profile_double_aead_aes_256_gcm_aead_aes_256_gcm:
+        return 2 * SRTP_AES_256_KEY_LEN;
+        break;
     /* the following profiles are not (yet) supported */
     case srtp_profile_null_sha1_32:
     default:
@@ -4662,6 +8507,10 @@ size_t srtp_profile_get_master_salt_length(srtp_profile_t profile)
     case srtp_profile_aead_aes_256_gcm:
         return SRTP_AEAD_SALT_LEN;
         break;
+    case srtp_profile_double_aead_aes_128_gcm_aead_aes_128_gcm:
+    case srtp_profile_double_aead_aes_256_gcm_aead_aes_256_gcm:
+        return 2 * SRTP_AEAD_SALT_LEN;
+        break;
     /* the following profiles are not (yet) supported */
     case srtp_profile_null_sha1_32:
     default:
@@ -4814,6 +8663,31 @@ static void srtp_err_handler(srtp_err_reporting_level_t level, const char *msg)
     }
 }
 
+srtp_err_status_t srtp_set_log_level(srtp_log_level_t level)
+{
+    srtp_err_reporting_level_t err_level = srtp_err_level_debug;
+
+    switch (level) {
+    case srtp_log_level_error:
+        err_level = srtp_err_level_error;
+        break;
+    case srtp_log_level_warning:
+        err_level = srtp_err_level_warning;
+        break;
+    case srtp_log_level_info:
+        err_level = srtp_err_level_info;
+        break;
+    case srtp_log_level_debug:
+        err_level = srtp_err_level_debug;
+        break;
+    default:
+        return srtp_err_status_bad_param;
+    }
+
+    srtp_err_set_level(err_level);
+    return srtp_err_status_ok;
+}
+
 srtp_err_status_t srtp_install_log_handler(srtp_log_handler_func_t func,
                                            void *data)
 {
@@ -4866,6 +8740,122 @@ srtp_err_status_t srtp_stream_get_roc(srtp_t session,
     return srtp_err_status_ok;
 }
 
+srtp_err_status_t srtp_checkpoint_open(srtp_t session,
+                                       const char *path,
+                                       size_t max_streams)
+{
+#ifdef HAVE_SYS_MMAN_H
+    srtp_checkpoint_t *cp;
+    srtp_checkpoint_hdr_t *hdr;
+    struct stat st;
+    size_t len;
+    void *map;
+    int fd;
+
+    if (session == NULL || path == NULL || session->checkpoint != NULL ||
+        max_streams == 0 || max_streams > UINT32_MAX) {
+        return srtp_err_status_bad_param;
+    }
+
+    fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        return srtp_err_status_read_fail;
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return srtp_err_status_read_fail;
+    }
+
+    /* an empty file is new; an existing one keeps its own capacity */
+    if (st.st_size == 0) {
+        len = sizeof(srtp_checkpoint_hdr_t) +
+              max_streams * sizeof(srtp_checkpoint_slot_t);
+        if (ftruncate(fd, (off_t)len) != 0) {
+            close(fd);
+            return srtp_err_status_write_fail;
+        }
+    } else if ((size_t)st.st_size < sizeof(srtp_checkpoint_hdr_t)) {
+        close(fd);
+        return srtp_err_status_parse_err;
+    } else {
+        len = (size_t)st.st_size;
+    }
+
+    map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return srtp_err_status_read_fail;
+    }
+    hdr = (srtp_checkpoint_hdr_t *)map;
+
+    if (st.st_size == 0) {
+        hdr->magic = SRTP_CHECKPOINT_MAGIC;
+        hdr->version = SRTP_CHECKPOINT_VERSION;
+        hdr->num_slots = (uint32_t)max_streams;
+        hdr->num_used = 0;
+    } else if (hdr->magic != SRTP_CHECKPOINT_MAGIC ||
+               hdr->version != SRTP_CHECKPOINT_VERSION ||
+               hdr->num_used > hdr->num_slots ||
+               hdr->num_slots > (len - sizeof(srtp_checkpoint_hdr_t)) /
+                                    sizeof(srtp_checkpoint_slot_t)) {
+        munmap(map, len);
+        return srtp_err_status_parse_err;
+    }
+
+    cp = (srtp_checkpoint_t *)srtp_crypto_alloc(sizeof(srtp_checkpoint_t));
+    if (cp == NULL) {
+        munmap(map, len);
+        return srtp_err_status_alloc_fail;
+    }
+    cp->hdr = hdr;
+    cp->slots = (srtp_checkpoint_slot_t *)(hdr + 1);
+    cp->map_len = len;
+
+    if (st.st_size == 0 && srtp_checkpoint_flush(cp, true)) {
+        srtp_checkpoint_close(cp);
+        return srtp_err_status_write_fail;
+    }
+
+    session->checkpoint = cp;
+
+    return srtp_err_status_ok;
+#else
+    (void)session;
+    (void)path;
+    (void)max_streams;
+    return srtp_err_status_no_such_op;
+#endif
+}
+
+srtp_err_status_t srtp_checkpoint_sync(srtp_t session)
+{
+    if (session == NULL || session->checkpoint == NULL) {
+        return srtp_err_status_bad_param;
+    }
+
+    return srtp_checkpoint_flush(session->checkpoint, true);
+}
+
+srtp_err_status_t srtp_checkpoint_get_resume_index(srtp_t session,
+                                                   uint32_t ssrc,
+                                                   uint64_t *index)
+{
+    const srtp_checkpoint_slot_t *slot;
+
+    if (session == NULL || session->checkpoint == NULL || index == NULL) {
+        return srtp_err_status_bad_param;
+    }
+
+    slot = srtp_checkpoint_find(session->checkpoint, htonl(ssrc));
+    if (slot == NULL) {
+        return srtp_err_status_bad_param;
+    }
+
+    *index = slot->rtp_high_water;
+
+    return srtp_err_status_ok;
+}
+
 #ifndef SRTP_NO_STREAM_LIST
 
 #define INITIAL_STREAM_INDEX_SIZE 2
@@ -4965,9 +8955,11 @@ srtp_err_status_t srtp_stream_list_insert(srtp_stream_list_t list,
 }
 
 /*
- * removing an entry from the list performs a memory move of the following
- * entries one position back in order to keep all the entries in the buffer
- * contiguous.
+ * removing an entry from the list moves the last entry into the freed slot,
+ * which keeps the buffer contiguous without shifting the following entries.
+ * the moved entry takes the place of the current one, so
+ * srtp_stream_list_for_each() still visits it, and removing every stream
+ * while iterating (as srtp_dealloc() does) stays linear in the list size.
  */
 void srtp_stream_list_remove(srtp_stream_list_t list,
                              srtp_stream_t stream_to_remove)
@@ -4976,9 +8968,7 @@ void srtp_stream_list_remove(srtp_stream_list_t list,
 
     for (size_t i = 0; i < end; i++) {
         if (list->entries[i].ssrc == stream_to_remove->ssrc) {
-            size_t entries_to_move = list->size - i - 1;
-            memmove(&list->entries[i], &list->entries[i + 1],
-                    sizeof(list_entry) * entries_to_move);
+            list->entries[i] = list->entries[end - 1];
             list->size--;
 
             break;
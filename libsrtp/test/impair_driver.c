@@ -0,0 +1,814 @@
+/*
+ * impair_driver.c
+ *
+ * drives srtp_unprotect() over many streams through an impaired
+ * network path and measures replay database cost, index estimation
+ * and false rejections for different replay window sizes
+ */
+/*
+ *
+ * Copyright (c) 2001-2017 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "getopt_s.h" /* for local getopt()    */
+#include "srtp.h"
+#include "rdbx.h"
+#include "ut_sim.h"
+
+#include <stdio.h>  /* for printf()          */
+#include <stdlib.h> /* for malloc(), atoi()  */
+#include <time.h>   /* for clock()           */
+
+#define RTP_HEADER_LEN 12
+#define MAX_PAYLOAD_LEN 1200
+#define MAX_PKT_LEN (RTP_HEADER_LEN + MAX_PAYLOAD_LEN + SRTP_MAX_TRAILER_LEN)
+#define MAX_WINDOWS 16
+#define BATCH_SIZE 64
+#define SSRC_BASE 0x10000000
+
+/*
+ * a protected packet waiting in the sender's ring until the impaired
+ * connection delivers it (or a duplicate of it)
+ */
+typedef struct {
+    size_t len;
+    uint8_t data[MAX_PKT_LEN];
+} stored_packet_t;
+
+typedef struct {
+    uint32_t ssrc;
+    ut_impaired_connection conn;
+    stored_packet_t *ring;
+    size_t ring_mask;
+    uint8_t *accepted; /* one bit per sent position */
+    uint64_t last_index;
+    bool done;
+} sim_stream_t;
+
+typedef struct {
+    srtp_t sender;
+    size_t payload_len;
+    sim_stream_t *stream;
+} send_ctx_t;
+
+/* one delivered packet, replayed later against a bare srtp_rdbx_t */
+typedef struct {
+    uint64_t index;
+    uint32_t stream;
+    uint16_t seq;
+} delivery_t;
+
+typedef struct {
+    uint64_t delivered;
+    uint64_t accepted;
+    uint64_t dup_rejected;
+    uint64_t false_rejected;
+    uint64_t auth_failed;
+    uint64_t replay_accepted; /* must stay zero */
+    uint64_t misestimated;
+    uint64_t model_mismatch; /* must stay zero */
+    uint64_t lost;
+    uint64_t reordered;
+    uint64_t duplicated;
+    uint64_t jumps;
+    uint64_t roc_wraps;
+    double unprotect_ns;
+    double rdbx_ns;
+} impair_result_t;
+
+typedef struct {
+    size_t num_streams;
+    size_t num_packets;
+    size_t payload_len;
+    size_t window_size;
+    ut_impairment_t imp;
+} impair_config_t;
+
+static uint8_t test_key[46] = {
+    0xe1, 0xf9, 0x7a, 0x0d, 0x3e, 0x01, 0x8b, 0xe0, 0xd6, 0x4f, 0xa3, 0x2c,
+    0x06, 0xde, 0x41, 0x39, 0x0e, 0xc6, 0x75, 0xad, 0x49, 0x8a, 0xfe, 0xeb,
+    0xb6, 0x96, 0x0b, 0x3a, 0xab, 0xe6, 0xc1, 0x73, 0xc3, 0x17, 0xf2, 0xda,
+    0xbe, 0x35, 0x77, 0x93, 0xb6, 0x96, 0x0b, 0x3a
+};
+
+static void write_rtp_header(uint8_t *buf, uint32_t ssrc, uint64_t index)
+{
+    uint32_t ts = (uint32_t)index * 160;
+
+    buf[0] = 0x80;
+    buf[1] = 0x00;
+    buf[2] = (uint8_t)(index >> 8);
+    buf[3] = (uint8_t)index;
+    buf[4] = (uint8_t)(ts >> 24);
+    buf[5] = (uint8_t)(ts >> 16);
+    buf[6] = (uint8_t)(ts >> 8);
+    buf[7] = (uint8_t)ts;
+    buf[8] = (uint8_t)(ssrc >> 24);
+    buf[9] = (uint8_t)(ssrc >> 16);
+    buf[10] = (uint8_t)(ssrc >> 8);
+    buf[11] = (uint8_t)ssrc;
+}
+
+/*
+ * protects the packet the connection is about to send; a forward jump
+ * of half the sequence space or more cannot be estimated by the sender
+ * itself, so the ROC is handed to it out of band, as an application
+ * restarting a stream would
+ */
+static void protect_sent_packet(void *arg, const ut_packet_t *pkt)
+{
+    send_ctx_t *ctx = (send_ctx_t *)arg;
+    sim_stream_t *s = ctx->stream;
+    stored_packet_t *slot = &s->ring[pkt->sent & s->ring_mask];
+    srtp_err_status_t status;
+
+    if (pkt->sent != 0 && pkt->index - s->last_index >= 0x8000) {
+        srtp_stream_set_roc(ctx->sender, s->ssrc, (uint32_t)(pkt->index >> 16));
+    }
+    s->last_index = pkt->index;
+
+    write_rtp_header(slot->data, s->ssrc, pkt->index);
+    memset(slot->data + RTP_HEADER_LEN, 0xab, ctx->payload_len);
+    slot->len = sizeof(slot->data);
+    status = srtp_protect(ctx->sender, slot->data,
+                          RTP_HEADER_LEN + ctx->payload_len, slot->data,
+                          &slot->len, 0);
+    if (status) {
+        printf("srtp_protect() failed with error code %d at index %llu\n",
+               status, (unsigned long long)pkt->index);
+        exit(1);
+    }
+}
+
+static size_t ring_size_for(uint32_t reorder_max)
+{
+    size_t size = 1;
+
+    /* a delivered copy is at most 2 * reorder_max packets old */
+    while (size < 2 * (size_t)reorder_max + 2) {
+        size <<= 1;
+    }
+    return size;
+}
+
+static bool test_and_set(uint8_t *bits, uint64_t pos)
+{
+    uint8_t mask = (uint8_t)(1 << (pos & 7));
+    bool was_set = (bits[pos >> 3] & mask) != 0;
+
+    bits[pos >> 3] |= mask;
+    return was_set;
+}
+
+static bool is_set(const uint8_t *bits, uint64_t pos)
+{
+    return (bits[pos >> 3] & (1 << (pos & 7))) != 0;
+}
+
+/*
+ * replays the delivered sequence numbers against one bare srtp_rdbx_t
+ * per stream, exactly as srtp_unprotect() consults it: estimate the
+ * index, check it, and add it unless the estimate was wrong (in which
+ * case authentication would have failed); returns the number of
+ * misestimated indices and the elapsed time in *seconds
+ */
+static srtp_err_status_t replay_rdbx(const delivery_t *log,
+                                     size_t log_len,
+                                     size_t num_streams,
+                                     size_t window_size,
+                                     uint64_t *misestimated,
+                                     uint64_t *mismatched,
+                                     const srtp_err_status_t *outcome,
+                                     double *seconds)
+{
+    srtp_rdbx_t *rdbx;
+    srtp_xtd_seq_num_t est;
+    ssize_t delta;
+    srtp_err_status_t status;
+    clock_t timer;
+    size_t i;
+    uint64_t wrong = 0;
+    uint64_t mismatch = 0;
+
+    rdbx = calloc(num_streams, sizeof(srtp_rdbx_t));
+    if (rdbx == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+    for (i = 0; i < num_streams; i++) {
+        status = srtp_rdbx_init(&rdbx[i], window_size);
+        if (status) {
+            free(rdbx);
+            return status;
+        }
+    }
+
+    timer = clock();
+    for (i = 0; i < log_len; i++) {
+        srtp_rdbx_t *r = &rdbx[log[i].stream];
+        delta = srtp_rdbx_estimate_index(r, &est, log[i].seq);
+        if (srtp_rdbx_check(r, delta) != srtp_err_status_ok) {
+            status = srtp_err_status_replay_fail;
+        } else if (est != log[i].index) {
+            wrong++;
+            status = srtp_err_status_auth_fail;
+        } else {
+            srtp_rdbx_add_index(r, delta);
+            status = srtp_err_status_ok;
+        }
+        if (outcome != NULL) {
+            /* replay_old and replay_fail are both rejections */
+            bool rejected = outcome[i] == srtp_err_status_replay_old ||
+                            outcome[i] == srtp_err_status_replay_fail;
+            if ((status == srtp_err_status_replay_fail) != rejected ||
+                (status == srtp_err_status_auth_fail) !=
+                    (outcome[i] == srtp_err_status_auth_fail)) {
+                mismatch++;
+            }
+        }
+    }
+    timer = clock() - timer;
+
+    for (i = 0; i < num_streams; i++) {
+        srtp_rdbx_dealloc(&rdbx[i]);
+    }
+    free(rdbx);
+
+    *misestimated = wrong;
+    *mismatched = mismatch;
+    *seconds = (double)timer / CLOCKS_PER_SEC;
+    return srtp_err_status_ok;
+}
+
+static srtp_err_status_t run_impaired(const impair_config_t *cfg,
+                                      impair_result_t *res)
+{
+    srtp_policy_t policy;
+    srtp_t sender = NULL;
+    srtp_t receiver = NULL;
+    sim_stream_t *streams = NULL;
+    send_ctx_t send_ctx;
+    uint8_t(*batch)[MAX_PKT_LEN] = NULL;
+    size_t batch_len[BATCH_SIZE];
+    delivery_t batch_info[BATCH_SIZE];
+    uint64_t batch_sent[BATCH_SIZE];
+    srtp_err_status_t batch_status[BATCH_SIZE];
+    delivery_t *log = NULL;
+    srtp_err_status_t *outcome = NULL;
+    size_t log_len = 0;
+    size_t log_size = 0;
+    size_t ring_size = ring_size_for(cfg->imp.reorder_max);
+    size_t active = cfg->num_streams;
+    size_t next_stream = 0;
+    clock_t unprotect_time = 0;
+    srtp_err_status_t status;
+    double rdbx_seconds;
+    size_t i;
+
+    memset(res, 0, sizeof(*res));
+
+    memset(&policy, 0, sizeof(policy));
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.key = test_key;
+    policy.window_size = cfg->window_size;
+
+    status = srtp_create(&sender, NULL);
+    if (status) {
+        return status;
+    }
+    policy.ssrc.type = ssrc_any_inbound;
+    status = srtp_create(&receiver, &policy);
+    if (status) {
+        goto out;
+    }
+
+    streams = calloc(cfg->num_streams, sizeof(sim_stream_t));
+    batch = malloc(BATCH_SIZE * sizeof(*batch));
+    if (streams == NULL || batch == NULL) {
+        status = srtp_err_status_alloc_fail;
+        goto out;
+    }
+
+    send_ctx.sender = sender;
+    send_ctx.payload_len = cfg->payload_len;
+    policy.ssrc.type = ssrc_specific;
+    for (i = 0; i < cfg->num_streams; i++) {
+        sim_stream_t *s = &streams[i];
+        ut_impairment_t imp = cfg->imp;
+
+        /* every window size sees the same schedule for a given stream */
+        imp.seed = cfg->imp.seed + i + 1;
+        s->ssrc = SSRC_BASE + (uint32_t)i;
+        s->ring = malloc(ring_size * sizeof(stored_packet_t));
+        s->ring_mask = ring_size - 1;
+        s->accepted = calloc((cfg->num_packets + 7) / 8, 1);
+        if (s->ring == NULL || s->accepted == NULL) {
+            status = srtp_err_status_alloc_fail;
+            goto out;
+        }
+        status = ut_impaired_init(&s->conn, &imp, cfg->num_packets,
+                                  protect_sent_packet, &send_ctx);
+        if (status) {
+            goto out;
+        }
+        policy.ssrc.value = s->ssrc;
+        status = srtp_stream_add(sender, &policy);
+        if (status) {
+            goto out;
+        }
+    }
+
+    while (active != 0) {
+        size_t n = 0;
+        clock_t timer;
+
+        /* gather a batch round-robin across the streams */
+        while (n < BATCH_SIZE && active != 0) {
+            sim_stream_t *s = &streams[next_stream];
+            ut_packet_t pkt;
+
+            send_ctx.stream = s;
+            if (!s->done && ut_impaired_next(&s->conn, &pkt)) {
+                const stored_packet_t *slot =
+                    &s->ring[pkt.sent & s->ring_mask];
+                memcpy(batch[n], slot->data, slot->len);
+                batch_len[n] = slot->len;
+                batch_info[n].index = pkt.index;
+                batch_info[n].stream = (uint32_t)next_stream;
+                batch_info[n].seq = (uint16_t)pkt.index;
+                batch_sent[n] = pkt.sent;
+                n++;
+            } else if (!s->done) {
+                s->done = true;
+                active--;
+            }
+            next_stream = (next_stream + 1) % cfg->num_streams;
+        }
+
+        timer = clock();
+        for (i = 0; i < n; i++) {
+            batch_status[i] =
+                srtp_unprotect(receiver, batch[i], batch_len[i], batch[i],
+                               &batch_len[i]);
+        }
+        unprotect_time += clock() - timer;
+
+        if (log_len + n > log_size) {
+            void *p;
+            log_size = log_size ? 2 * log_size : 4096;
+            p = realloc(log, log_size * sizeof(delivery_t));
+            if (p == NULL) {
+                status = srtp_err_status_alloc_fail;
+                goto out;
+            }
+            log = p;
+            p = realloc(outcome, log_size * sizeof(srtp_err_status_t));
+            if (p == NULL) {
+                status = srtp_err_status_alloc_fail;
+                goto out;
+            }
+            outcome = p;
+        }
+
+        for (i = 0; i < n; i++) {
+            sim_stream_t *s = &streams[batch_info[i].stream];
+            switch (batch_status[i]) {
+            case srtp_err_status_ok:
+                res->accepted++;
+                if (test_and_set(s->accepted, batch_sent[i])) {
+                    res->replay_accepted++;
+                }
+                break;
+            case srtp_err_status_replay_old:
+            case srtp_err_status_replay_fail:
+                if (is_set(s->accepted, batch_sent[i])) {
+                    res->dup_rejected++;
+                } else {
+                    res->false_rejected++;
+                }
+                break;
+            case srtp_err_status_auth_fail:
+                res->auth_failed++;
+                break;
+            default:
+                printf("srtp_unprotect() failed with error code %d\n",
+                       batch_status[i]);
+                status = batch_status[i];
+                goto out;
+            }
+            log[log_len] = batch_info[i];
+            outcome[log_len] = batch_status[i];
+            log_len++;
+        }
+        res->delivered += n;
+    }
+
+    for (i = 0; i < cfg->num_streams; i++) {
+        const ut_impaired_connection *c = &streams[i].conn;
+        res->lost += c->lost;
+        res->reordered += c->reordered;
+        res->duplicated += c->duplicated;
+        res->jumps += c->jumps;
+        res->roc_wraps += (c->next_index - 1) >> 16;
+    }
+
+    status = replay_rdbx(log, log_len, cfg->num_streams, cfg->window_size,
+                         &res->misestimated, &res->model_mismatch, outcome,
+                         &rdbx_seconds);
+    if (status) {
+        goto out;
+    }
+
+    if (res->delivered != 0) {
+        res->unprotect_ns = (double)unprotect_time * 1e9 / CLOCKS_PER_SEC /
+                            (double)res->delivered;
+        res->rdbx_ns = rdbx_seconds * 1e9 / (double)res->delivered;
+    }
+
+out:
+    if (streams != NULL) {
+        for (i = 0; i < cfg->num_streams; i++) {
+            ut_impaired_dealloc(&streams[i].conn);
+            free(streams[i].ring);
+            free(streams[i].accepted);
+        }
+        free(streams);
+    }
+    free(batch);
+    free(log);
+    free(outcome);
+    if (receiver != NULL) {
+        srtp_dealloc(receiver);
+    }
+    srtp_dealloc(sender);
+
+    return status;
+}
+
+static void print_result_header(void)
+{
+    printf("%8s %10s %10s %10s %10s %8s %10s %10s %10s\n", "window",
+           "delivered", "accepted", "dup-rej", "false-rej", "rate%",
+           "auth-fail", "ns/unprot", "ns/rdbx");
+}
+
+static void print_result(size_t window_size, const impair_result_t *res)
+{
+    double rate = 0;
+
+    if (res->delivered != 0) {
+        rate = 100.0 * (double)res->false_rejected / (double)res->delivered;
+    }
+    printf("%8zu %10llu %10llu %10llu %10llu %8.4f %10llu %10.1f %10.1f\n",
+           window_size, (unsigned long long)res->delivered,
+           (unsigned long long)res->accepted,
+           (unsigned long long)res->dup_rejected,
+           (unsigned long long)res->false_rejected, rate,
+           (unsigned long long)res->auth_failed, res->unprotect_ns,
+           res->rdbx_ns);
+}
+
+static void print_impairment_stats(const impair_result_t *res)
+{
+    printf("impairments: lost %llu, reordered %llu, duplicated %llu, "
+           "jumps %llu, roc wraps %llu\n",
+           (unsigned long long)res->lost, (unsigned long long)res->reordered,
+           (unsigned long long)res->duplicated,
+           (unsigned long long)res->jumps,
+           (unsigned long long)res->roc_wraps);
+}
+
+/*
+ * checks the invariants that hold for every impairment: no packet is
+ * accepted twice, and the bare srtp_rdbx_t model predicts every
+ * srtp_unprotect() decision
+ */
+static bool check_invariants(const impair_result_t *res)
+{
+    if (res->replay_accepted != 0) {
+        printf("%llu replayed packets were accepted\n",
+               (unsigned long long)res->replay_accepted);
+        return false;
+    }
+    if (res->model_mismatch != 0) {
+        printf("%llu srtp_unprotect() results differ from the rdbx model\n",
+               (unsigned long long)res->model_mismatch);
+        return false;
+    }
+    if (res->misestimated != res->auth_failed) {
+        printf("%llu misestimated indices but %llu auth failures\n",
+               (unsigned long long)res->misestimated,
+               (unsigned long long)res->auth_failed);
+        return false;
+    }
+    return true;
+}
+
+static uint32_t percent_to_rate(const char *arg)
+{
+    double pct = atof(arg);
+
+    if (pct <= 0) {
+        return 0;
+    }
+    if (pct >= 100) {
+        return UT_RATE_ONE;
+    }
+    return (uint32_t)(pct * UT_RATE_ONE / 100);
+}
+
+static size_t parse_windows(const char *arg, size_t *windows)
+{
+    size_t n = 0;
+    char *end;
+
+    while (*arg != '\0' && n < MAX_WINDOWS) {
+        windows[n++] = (size_t)strtoul(arg, &end, 10);
+        if (end == arg) {
+            return 0;
+        }
+        arg = (*end == ',') ? end + 1 : end;
+    }
+    return n;
+}
+
+static srtp_err_status_t validate(void)
+{
+    impair_config_t cfg;
+    impair_result_t res;
+    srtp_err_status_t status;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.num_streams = 16;
+    cfg.num_packets = 2048;
+    cfg.payload_len = 32;
+    cfg.imp.loss_rate = UT_RATE_ONE / 50;
+    cfg.imp.loss_burst_max = 8;
+    cfg.imp.reorder_rate = UT_RATE_ONE / 10;
+    cfg.imp.reorder_max = 32;
+    cfg.imp.dup_rate = UT_RATE_ONE / 20;
+    cfg.imp.start_seq = 0xfc00;
+    cfg.imp.seed = 1;
+
+    /*
+     * without sequence jumps nothing is ever delayed beyond the window,
+     * and the stream crosses a ROC wrap without losing authentication
+     */
+    printf("testing reorder, loss and duplication across a ROC wrap...");
+    cfg.window_size = 128;
+    status = run_impaired(&cfg, &res);
+    if (status) {
+        printf("failed with error code %d\n", status);
+        return status;
+    }
+    if (!check_invariants(&res) || res.false_rejected != 0 ||
+        res.auth_failed != 0 || res.dup_rejected == 0 ||
+        res.roc_wraps != cfg.num_streams) {
+        printf("failed\n");
+        print_result_header();
+        print_result(cfg.window_size, &res);
+        print_impairment_stats(&res);
+        return srtp_err_status_algo_fail;
+    }
+    printf("passed\n");
+
+    /*
+     * jumps below half the sequence space can push late packets out of
+     * a small window, but must never confuse the index estimate
+     */
+    printf("testing sequence jumps...");
+    cfg.imp.jump_rate = UT_RATE_ONE / 100;
+    cfg.imp.jump_max = 0x4000;
+    cfg.window_size = 64;
+    status = run_impaired(&cfg, &res);
+    if (status) {
+        printf("failed with error code %d\n", status);
+        return status;
+    }
+    if (!check_invariants(&res) || res.auth_failed != 0 || res.jumps == 0) {
+        printf("failed\n");
+        print_result_header();
+        print_result(cfg.window_size, &res);
+        print_impairment_stats(&res);
+        return srtp_err_status_algo_fail;
+    }
+    printf("passed\n");
+
+    /*
+     * jumps beyond half the sequence space are misestimated by the
+     * receiver; they have to show up as authentication failures, never
+     * as accepted packets
+     */
+    printf("testing sequence jumps beyond the estimation range...");
+    cfg.imp.jump_rate = UT_RATE_ONE / 500;
+    cfg.imp.jump_max = 0x20000;
+    status = run_impaired(&cfg, &res);
+    if (status) {
+        printf("failed with error code %d\n", status);
+        return status;
+    }
+    if (!check_invariants(&res)) {
+        printf("failed\n");
+        return srtp_err_status_algo_fail;
+    }
+    printf("passed\n");
+
+    return srtp_err_status_ok;
+}
+
+static void usage(char *prog_name)
+{
+    printf("usage: %s [ -t | -v ] [ -n streams ] [ -p packets ] "
+           "[ -w window[,window...] ]\n"
+           "       [ -l loss%% ] [ -b burst ] [ -r reorder%% ] [ -d depth ] "
+           "[ -u dup%% ]\n"
+           "       [ -j jump%% ] [ -J jump ] [ -s seq ] [ -z payload ]\n"
+           "where -t  runs the benchmark over each window size\n"
+           "      -v  runs the validation tests\n"
+           "      -n  number of streams (default 128)\n"
+           "      -p  packets sent per stream (default 2048)\n"
+           "      -w  replay window sizes (default 64,128,256,1024,4096)\n"
+           "      -l  chance of a loss burst, -b longest burst\n"
+           "      -r  chance of delaying a packet, -d longest delay\n"
+           "      -u  chance of duplicating a packet\n"
+           "      -j  chance of a sequence jump, -J largest jump\n"
+           "      -s  first sequence number (default 65000, crosses a ROC "
+           "wrap)\n"
+           "      -z  payload length (default 160)\n",
+           prog_name);
+    exit(255);
+}
+
+int main(int argc, char *argv[])
+{
+    impair_config_t cfg;
+    impair_result_t res;
+    size_t windows[MAX_WINDOWS] = { 64, 128, 256, 1024, 4096 };
+    size_t num_windows = 5;
+    srtp_err_status_t status;
+    bool do_timing_test = false;
+    bool do_validation = false;
+    size_t i;
+    int q;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.num_streams = 128;
+    cfg.num_packets = 2048;
+    cfg.payload_len = 160;
+    cfg.imp.loss_rate = UT_RATE_ONE / 100;
+    cfg.imp.loss_burst_max = 4;
+    cfg.imp.reorder_rate = UT_RATE_ONE / 20;
+    cfg.imp.reorder_max = 100;
+    cfg.imp.dup_rate = UT_RATE_ONE / 100;
+    cfg.imp.jump_rate = UT_RATE_ONE / 1000;
+    cfg.imp.jump_max = 1000;
+    cfg.imp.start_seq = 65000;
+    cfg.imp.seed = 1;
+
+    /* process input arguments */
+    while (1) {
+        q = getopt_s(argc, argv, "tvn:p:w:l:b:r:d:u:j:J:s:z:");
+        if (q == -1) {
+            break;
+        }
+        switch (q) {
+        case 't':
+            do_timing_test = true;
+            break;
+        case 'v':
+            do_validation = true;
+            break;
+        case 'n':
+            cfg.num_streams = (size_t)atoi(optarg_s);
+            break;
+        case 'p':
+            cfg.num_packets = (size_t)atoi(optarg_s);
+            break;
+        case 'w':
+            num_windows = parse_windows(optarg_s, windows);
+            if (num_windows == 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'l':
+            cfg.imp.loss_rate = percent_to_rate(optarg_s);
+            break;
+        case 'b':
+            cfg.imp.loss_burst_max = (uint32_t)atoi(optarg_s);
+            break;
+        case 'r':
+            cfg.imp.reorder_rate = percent_to_rate(optarg_s);
+            break;
+        case 'd':
+            cfg.imp.reorder_max = (uint32_t)atoi(optarg_s);
+            break;
+        case 'u':
+            cfg.imp.dup_rate = percent_to_rate(optarg_s);
+            break;
+        case 'j':
+            cfg.imp.jump_rate = percent_to_rate(optarg_s);
+            break;
+        case 'J':
+            cfg.imp.jump_max = (uint32_t)atoi(optarg_s);
+            break;
+        case 's':
+            cfg.imp.start_seq = (uint16_t)atoi(optarg_s);
+            break;
+        case 'z':
+            cfg.payload_len = (size_t)atoi(optarg_s);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (!do_validation && !do_timing_test) {
+        usage(argv[0]);
+    }
+    if (cfg.num_streams == 0 || cfg.num_packets == 0 ||
+        cfg.payload_len > MAX_PAYLOAD_LEN ||
+        cfg.imp.reorder_max > UT_MAX_DELAY) {
+        usage(argv[0]);
+    }
+
+    printf("impaired connection test driver\n");
+
+    status = srtp_init();
+    if (status) {
+        printf("error: srtp initialization failed with error code %d\n",
+               status);
+        exit(1);
+    }
+
+    if (do_validation) {
+        status = validate();
+        if (status) {
+            exit(1);
+        }
+    }
+
+    if (do_timing_test) {
+        printf("%zu streams x %zu packets, reorder depth %u, "
+               "start seq %u\n",
+               cfg.num_streams, cfg.num_packets, cfg.imp.reorder_max,
+               cfg.imp.start_seq);
+        print_result_header();
+        for (i = 0; i < num_windows; i++) {
+            cfg.window_size = windows[i];
+            status = run_impaired(&cfg, &res);
+            if (status) {
+                printf("error: window size %zu failed with error code %d\n",
+                       windows[i], status);
+                exit(1);
+            }
+            print_result(windows[i], &res);
+            if (!check_invariants(&res)) {
+                exit(1);
+            }
+        }
+        print_impairment_stats(&res);
+    }
+
+    status = srtp_shutdown();
+    if (status) {
+        printf("error: srtp shutdown failed with error code %d\n", status);
+        exit(1);
+    }
+
+    return 0;
+}
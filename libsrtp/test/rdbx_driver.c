@@ -61,6 +61,8 @@
 
 srtp_err_status_t test_replay_dbx(size_t num_trials, size_t ws);
 
+srtp_err_status_t test_adaptive_rdbx(size_t num_trials);
+
 double rdbx_check_adds_per_second(size_t num_trials, size_t ws);
 
 void usage(char *prog_name)
@@ -121,6 +123,15 @@ int main(int argc, char *argv[])
             exit(1);
         }
         printf("passed\n");
+
+        printf("testing adaptive srtp_rdbx_t (ws=64..1024)...\n");
+
+        status = test_adaptive_rdbx(1 << 12);
+        if (status) {
+            printf("failed\n");
+            exit(1);
+        }
+        printf("passed\n");
     }
 
     if (do_timing_test) {
@@ -324,6 +335,169 @@ srtp_err_status_t test_replay_dbx(size_t num_trials, size_t ws)
     return srtp_err_status_ok;
 }
 
+static srtp_err_status_t expect_window_size(const srtp_rdbx_t *rdbx,
+                                            size_t ws)
+{
+    if (srtp_rdbx_get_window_size(rdbx) != ws) {
+        printf("window size is %zu, expected %zu\n",
+               srtp_rdbx_get_window_size(rdbx), ws);
+        return srtp_err_status_algo_fail;
+    }
+    return srtp_err_status_ok;
+}
+
+srtp_err_status_t test_adaptive_rdbx(size_t num_trials)
+{
+    srtp_rdbx_t rdbx;
+    ut_connection utc;
+    uint8_t *seen;
+    uint32_t idx, ircvd;
+    srtp_err_status_t status;
+
+    if (srtp_rdbx_init(&rdbx, 64) != srtp_err_status_ok) {
+        printf("replay_init failed\n");
+        return srtp_err_status_init_fail;
+    }
+
+    printf("\ttesting window bounds...");
+    if (srtp_rdbx_set_window_bounds(&rdbx, 128, 1024) !=
+            srtp_err_status_bad_param ||
+        srtp_rdbx_set_window_bounds(&rdbx, 32, 48) !=
+            srtp_err_status_bad_param ||
+        srtp_rdbx_set_window_bounds(&rdbx, 64, 1024) != srtp_err_status_ok) {
+        return srtp_err_status_algo_fail;
+    }
+    printf("passed\n");
+
+    /* in-order traffic leaves the window at its minimum */
+    printf("\ttesting growth on reordering...");
+    for (idx = 1; idx <= 2000; idx++) {
+        status = rdbx_check_add(&rdbx, idx);
+        if (status) {
+            return status;
+        }
+    }
+    status = expect_window_size(&rdbx, 64);
+    if (status) {
+        return status;
+    }
+
+    /* an index 60 behind the highest one doubles the window */
+    status = rdbx_check_add(&rdbx, 2100);
+    if (!status) {
+        status = rdbx_check_add(&rdbx, 2040);
+    }
+    if (!status) {
+        status = expect_window_size(&rdbx, 128);
+    }
+    if (status) {
+        return status;
+    }
+
+    /*
+     * indices that had already left the 64 bit window are covered again,
+     * whether or not they were received, and must stay rejected
+     */
+    for (idx = 2100 - 127; idx < 2100 - 63; idx++) {
+        status = rdbx_check_expect_failure(&rdbx, idx);
+        if (status) {
+            return status;
+        }
+    }
+
+    /* once the window has moved on, it accepts the deeper reordering */
+    status = rdbx_check_add(&rdbx, 2300);
+    if (!status) {
+        status = rdbx_check_add(&rdbx, 2200);
+    }
+    if (!status) {
+        status = rdbx_check_expect_failure(&rdbx, 2200);
+    }
+    if (!status) {
+        status = expect_window_size(&rdbx, 256);
+    }
+    if (status) {
+        return status;
+    }
+    printf("passed\n");
+
+    /* each quiet period halves the window, down to its minimum */
+    printf("\ttesting shrinking after quiet periods...");
+    for (idx = 2301; idx <= 2300 + 3 * SRTP_RDBX_ADAPT_PERIOD; idx++) {
+        status = rdbx_check_add(&rdbx, idx);
+        if (status) {
+            return status;
+        }
+    }
+    status = expect_window_size(&rdbx, 64);
+    if (!status) {
+        status = rdbx_check_expect_failure(&rdbx, idx - 64);
+    }
+    if (status) {
+        return status;
+    }
+    printf("passed\n");
+
+    srtp_rdbx_dealloc(&rdbx);
+
+    /*
+     * reordered traffic: every index is accepted at most once.  Indices
+     * that come back into a grown window are reported as replays, so
+     * unlike rdbx_check_add_unordered() both rejections are tolerated
+     */
+    seen = calloc(num_trials + UT_BUF, 1);
+    if (seen == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+    if (srtp_rdbx_init(&rdbx, 64) != srtp_err_status_ok ||
+        srtp_rdbx_set_window_bounds(&rdbx, 64, 1024) != srtp_err_status_ok) {
+        free(seen);
+        printf("replay_init failed\n");
+        return srtp_err_status_init_fail;
+    }
+    ut_init(&utc);
+
+    printf("\ttesting non-sequential insertion...");
+    for (size_t i = 0; i < num_trials; i++) {
+        ssize_t delta;
+        srtp_xtd_seq_num_t est;
+
+        ircvd = ut_next_index(&utc);
+        delta = srtp_index_guess(&rdbx.index, &est,
+                                 (srtp_sequence_number_t)ircvd);
+        if (srtp_rdbx_check(&rdbx, delta) == srtp_err_status_ok) {
+            if (seen[ircvd]) {
+                printf("index %u accepted twice\n", ircvd);
+                free(seen);
+                return srtp_err_status_algo_fail;
+            }
+            srtp_rdbx_add_index(&rdbx, delta);
+            seen[ircvd] = 1;
+        }
+        if (rdbx_check_expect_failure(&rdbx, ircvd)) {
+            free(seen);
+            return srtp_err_status_algo_fail;
+        }
+    }
+    for (ircvd = 0; ircvd < num_trials + UT_BUF; ircvd++) {
+        if (seen[ircvd] && rdbx_check_expect_failure(&rdbx, ircvd)) {
+            free(seen);
+            return srtp_err_status_algo_fail;
+        }
+    }
+    if (srtp_rdbx_get_window_size(&rdbx) <= 64) {
+        printf("window did not grow\n");
+        free(seen);
+        return srtp_err_status_algo_fail;
+    }
+    printf("passed\n");
+
+    free(seen);
+    srtp_rdbx_dealloc(&rdbx);
+
+    return srtp_err_status_ok;
+}
+
 #include <time.h> /* for clock()  */
 
 double rdbx_check_adds_per_second(size_t num_trials, size_t ws)
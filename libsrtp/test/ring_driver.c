@@ -0,0 +1,441 @@
+/*
+ * ring_driver.c
+ *
+ * test driver for srtp_process_ring(), using a user-space stand-in
+ * for a packet ring device
+ */
+/*
+ *
+ * Copyright (c) 2001-2017 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "getopt_s.h" /* for local getopt()    */
+#include "srtp.h"
+
+#include <stdio.h>  /* for printf()          */
+#include <stdlib.h> /* for malloc()          */
+#include <string.h>
+#include <stdint.h>
+
+/*
+ * ring_sim_t stands in for an AF_XDP socket: one UMEM region cut into
+ * fixed size frames, a transmit ring the application posts to, a
+ * completion ring, a receive ring the "device" fills and a ring the
+ * application receives on.  Transmitted frames are looped back to the
+ * receive ring without copying, as a device in loopback mode would.
+ */
+
+#define FRAME_SIZE 2048
+#define FRAME_HEADROOM 256
+#define NUM_FRAMES 64
+#define RING_SIZE 16
+
+typedef struct {
+    uint8_t *umem;
+    size_t umem_len;
+    srtp_ring_desc_t desc[4][RING_SIZE];
+    srtp_ring_t tx;
+    srtp_ring_t tx_done;
+    srtp_ring_t rx;
+    srtp_ring_t app;
+} ring_sim_t;
+
+static uint8_t test_key[30] = {
+    0xe1, 0xf9, 0x7a, 0x0d, 0x3e, 0x01, 0x8b, 0xe0, 0xd6, 0x4f,
+    0xa3, 0x2c, 0x06, 0xde, 0x41, 0x39, 0x0e, 0xc6, 0x75, 0xad,
+    0x49, 0x8a, 0xfe, 0xeb, 0xb6, 0x96, 0x0b, 0x3a, 0xab, 0xe6
+};
+
+static void ring_init(srtp_ring_t *ring, srtp_ring_desc_t *desc, uint32_t size)
+{
+    ring->desc = desc;
+    ring->size = size;
+    ring->producer = 0;
+    ring->consumer = 0;
+}
+
+static bool ring_full(const srtp_ring_t *ring)
+{
+    return ring->producer - ring->consumer == ring->size;
+}
+
+static bool ring_post(srtp_ring_t *ring, const srtp_ring_desc_t *d)
+{
+    if (ring_full(ring)) {
+        return false;
+    }
+    ring->desc[ring->producer++ & (ring->size - 1)] = *d;
+    return true;
+}
+
+static bool ring_take(srtp_ring_t *ring, srtp_ring_desc_t *d)
+{
+    if (ring->producer == ring->consumer) {
+        return false;
+    }
+    *d = ring->desc[ring->consumer++ & (ring->size - 1)];
+    return true;
+}
+
+static srtp_err_status_t ring_sim_init(ring_sim_t *sim)
+{
+    sim->umem_len = (size_t)NUM_FRAMES * FRAME_SIZE;
+    sim->umem = malloc(sim->umem_len);
+    if (sim->umem == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+    ring_init(&sim->tx, sim->desc[0], RING_SIZE);
+    ring_init(&sim->tx_done, sim->desc[1], RING_SIZE);
+    ring_init(&sim->rx, sim->desc[2], RING_SIZE);
+    ring_init(&sim->app, sim->desc[3], RING_SIZE);
+    return srtp_err_status_ok;
+}
+
+/* the device: completed transmissions arrive on the receive ring */
+static void ring_sim_loopback(ring_sim_t *sim)
+{
+    srtp_ring_desc_t d;
+
+    while (!ring_full(&sim->rx) && ring_take(&sim->tx_done, &d)) {
+        ring_post(&sim->rx, &d);
+    }
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+/*
+ * writes packet number n into its frame; every fifth packet is RTCP,
+ * the payload length varies so that the trailers land at every
+ * alignment
+ */
+static size_t write_packet(uint8_t *pkt, uint32_t n, bool *is_rtcp)
+{
+    size_t payload_len = 20 + (n * 7) % 300;
+    size_t hdr_len;
+    size_t i;
+
+    *is_rtcp = (n % 5) == 4;
+    pkt[0] = 0x80;
+    if (*is_rtcp) {
+        payload_len -= payload_len % 4;
+        hdr_len = 8;
+        pkt[1] = 200; /* sender report */
+        pkt[2] = 0;
+        pkt[3] = (uint8_t)((hdr_len + payload_len) / 4 - 1);
+        put_u32(pkt + 4, 0xcafebabe);
+    } else {
+        hdr_len = 12;
+        pkt[1] = 0x0f;
+        pkt[2] = (uint8_t)(n >> 8);
+        pkt[3] = (uint8_t)n;
+        put_u32(pkt + 4, n * 160);
+        put_u32(pkt + 8, 0xcafebabe);
+    }
+
+    for (i = 0; i < payload_len; i++) {
+        pkt[hdr_len + i] = (uint8_t)(n + i);
+    }
+
+    return hdr_len + payload_len;
+}
+
+static srtp_err_status_t create_sessions(srtp_t *sender, srtp_t *receiver)
+{
+    srtp_policy_t policy;
+    srtp_err_status_t status;
+
+    memset(&policy, 0, sizeof(policy));
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.key = test_key;
+    policy.ssrc.type = ssrc_any_outbound;
+    status = srtp_create(sender, &policy);
+    if (status) {
+        return status;
+    }
+    policy.ssrc.type = ssrc_any_inbound;
+    return srtp_create(receiver, &policy);
+}
+
+/*
+ * sends num_packets through protect, the loopback device and
+ * unprotect, processing at most budget packets per ring call, and
+ * checks that each arrives intact in its own frame
+ */
+static srtp_err_status_t test_loopback(uint32_t num_packets, size_t budget)
+{
+    ring_sim_t sim;
+    srtp_t sender, receiver;
+    uint8_t expected[FRAME_SIZE];
+    uint32_t sent = 0;
+    uint32_t received = 0;
+    srtp_err_status_t status;
+
+    status = ring_sim_init(&sim);
+    if (status) {
+        return status;
+    }
+    status = create_sessions(&sender, &receiver);
+    if (status) {
+        return status;
+    }
+
+    while (received < num_packets) {
+        srtp_ring_desc_t d;
+        size_t n;
+
+        /* the application queues new packets for transmission */
+        while (sent < num_packets && !ring_full(&sim.tx)) {
+            size_t frame = (size_t)(sent % NUM_FRAMES) * FRAME_SIZE;
+
+            memset(&d, 0, sizeof(d));
+            d.offset = frame + FRAME_HEADROOM;
+            d.headroom = FRAME_HEADROOM;
+            d.len = write_packet(sim.umem + d.offset, sent, &d.is_rtcp);
+            d.tailroom = FRAME_SIZE - FRAME_HEADROOM - d.len;
+            d.user_data = (void *)(uintptr_t)sent;
+            ring_post(&sim.tx, &d);
+            sent++;
+        }
+
+        status = srtp_process_ring(sender, sim.umem, sim.umem_len, &sim.tx,
+                                   &sim.tx_done, srtp_ring_protect, budget, &n);
+        if (status) {
+            return status;
+        }
+        ring_sim_loopback(&sim);
+        status = srtp_process_ring(receiver, sim.umem, sim.umem_len, &sim.rx,
+                                   &sim.app, srtp_ring_unprotect, budget, &n);
+        if (status) {
+            return status;
+        }
+
+        while (ring_take(&sim.app, &d)) {
+            uint32_t num = (uint32_t)(uintptr_t)d.user_data;
+            bool is_rtcp;
+            size_t len = write_packet(expected, num, &is_rtcp);
+
+            if (num != received || d.status != srtp_err_status_ok ||
+                d.is_rtcp != is_rtcp || d.len != len ||
+                d.offset != (num % NUM_FRAMES) * FRAME_SIZE + FRAME_HEADROOM ||
+                d.headroom != FRAME_HEADROOM ||
+                d.tailroom != FRAME_SIZE - FRAME_HEADROOM - len ||
+                memcmp(sim.umem + d.offset, expected, len) != 0) {
+                printf("packet %u did not survive the loopback\n", num);
+                return srtp_err_status_algo_fail;
+            }
+            received++;
+        }
+    }
+
+    srtp_dealloc(sender);
+    srtp_dealloc(receiver);
+    free(sim.umem);
+
+    return srtp_err_status_ok;
+}
+
+/*
+ * checks that bad descriptors and packets complete with an error
+ * without holding up the others, and that a full output ring stops
+ * processing
+ */
+static srtp_err_status_t test_errors(void)
+{
+    ring_sim_t sim;
+    srtp_t sender, receiver;
+    srtp_ring_desc_t d;
+    srtp_ring_desc_t small_desc[4];
+    srtp_ring_t small;
+    srtp_err_status_t expect[5];
+    size_t n, i;
+    srtp_err_status_t status;
+
+    status = ring_sim_init(&sim);
+    if (status) {
+        return status;
+    }
+    status = create_sessions(&sender, &receiver);
+    if (status) {
+        return status;
+    }
+
+    for (i = 0; i < 5; i++) {
+        memset(&d, 0, sizeof(d));
+        d.offset = i * FRAME_SIZE + FRAME_HEADROOM;
+        d.headroom = FRAME_HEADROOM;
+        d.len = write_packet(sim.umem + d.offset, (uint32_t)i, &d.is_rtcp);
+        d.tailroom = FRAME_SIZE - FRAME_HEADROOM - d.len;
+        expect[i] = srtp_err_status_ok;
+        if (i == 1) {
+            d.tailroom = 4; /* no room for the tag */
+            expect[i] = srtp_err_status_buffer_small;
+        } else if (i == 2) {
+            d.headroom = FRAME_HEADROOM + 1; /* reaches before the region */
+            d.offset = FRAME_HEADROOM;
+            expect[i] = srtp_err_status_bad_param;
+        } else if (i == 3) {
+            d.tailroom = sim.umem_len; /* reaches past the region */
+            expect[i] = srtp_err_status_bad_param;
+        }
+        ring_post(&sim.tx, &d);
+    }
+
+    status = srtp_process_ring(sender, sim.umem, sim.umem_len, &sim.tx,
+                               &sim.tx_done, srtp_ring_protect, 0, &n);
+    if (status || n != 5) {
+        return srtp_err_status_algo_fail;
+    }
+    for (i = 0; i < 5; i++) {
+        if (!ring_take(&sim.tx_done, &d) || d.status != expect[i]) {
+            return srtp_err_status_algo_fail;
+        }
+        if (d.status == srtp_err_status_ok) {
+            /* corrupt the first packet, the last must still pass */
+            if (i == 0) {
+                sim.umem[d.offset + d.len - 1] ^= 1;
+            }
+            ring_post(&sim.rx, &d);
+        }
+    }
+
+    /* an output ring with room for one completion */
+    ring_init(&small, small_desc, 4);
+    small.producer = 3;
+    status = srtp_process_ring(receiver, sim.umem, sim.umem_len, &sim.rx,
+                               &small, srtp_ring_unprotect, 0, &n);
+    if (status || n != 1 || sim.rx.producer - sim.rx.consumer != 1 ||
+        small_desc[3].status != srtp_err_status_auth_fail) {
+        return srtp_err_status_algo_fail;
+    }
+    small.consumer = 4;
+    status = srtp_process_ring(receiver, sim.umem, sim.umem_len, &sim.rx,
+                               &small, srtp_ring_unprotect, 0, &n);
+    if (status || n != 1 || small_desc[0].status != srtp_err_status_ok) {
+        return srtp_err_status_algo_fail;
+    }
+
+    /* a ring size that is not a power of two is refused */
+    small.size = 3;
+    if (srtp_process_ring(receiver, sim.umem, sim.umem_len, &sim.rx, &small,
+                          srtp_ring_unprotect, 0, &n) !=
+        srtp_err_status_bad_param) {
+        return srtp_err_status_algo_fail;
+    }
+
+    srtp_dealloc(sender);
+    srtp_dealloc(receiver);
+    free(sim.umem);
+
+    return srtp_err_status_ok;
+}
+
+static void usage(char *prog_name)
+{
+    printf("usage: %s -v\n", prog_name);
+    exit(255);
+}
+
+int main(int argc, char *argv[])
+{
+    srtp_err_status_t status;
+    bool do_validation = false;
+    int q;
+
+    while (1) {
+        q = getopt_s(argc, argv, "v");
+        if (q == -1) {
+            break;
+        }
+        switch (q) {
+        case 'v':
+            do_validation = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (!do_validation) {
+        usage(argv[0]);
+    }
+
+    status = srtp_init();
+    if (status) {
+        printf("error: srtp init failed with error code %d\n", status);
+        exit(1);
+    }
+
+    printf("testing srtp_process_ring() loopback...");
+    status = test_loopback(1000, 0);
+    if (status) {
+        printf("failed\n");
+        exit(1);
+    }
+    printf("passed\n");
+
+    printf("testing srtp_process_ring() loopback with a budget...");
+    status = test_loopback(1000, 3);
+    if (status) {
+        printf("failed\n");
+        exit(1);
+    }
+    printf("passed\n");
+
+    printf("testing srtp_process_ring() errors...");
+    status = test_errors();
+    if (status) {
+        printf("failed\n");
+        exit(1);
+    }
+    printf("passed\n");
+
+    status = srtp_shutdown();
+    if (status) {
+        printf("error: srtp shutdown failed with error code %d\n", status);
+        exit(1);
+    }
+
+    return 0;
+}
@@ -23,6 +23,13 @@
  *
  * $ extractaudio -A ./marseillaise-rtp.pcap ./marseillaise-out.wav
  *
+ * Large captures with many flows can be decoded offline, in parallel,
+ * using a key file that lists the key of every flow (see
+ * rtp_decoder_offline.c for its format):
+ *
+ * $ ./test/rtp_decoder -p capture.pcapng -F keys.txt -w decrypted.pcap \
+ *     -m rtcp-mux -j 8
+ *
  * Bernardo Torres <bernardo@torresautomacao.com.br>
  *
  * Some structure and code from https://github.com/gteissier/srtp-decrypt
@@ -186,6 +193,12 @@ int main(int argc, char *argv[])
     int len;
     int expected_len;
     int do_list_mods = 0;
+    const char *key_file = NULL;
+    const char *out_file = NULL;
+    const char *keylog_file = NULL;
+    uint8_t *keylog = NULL;
+    size_t keylog_len = 0;
+    size_t num_workers = 0;
 
     fprintf(stderr, "Using %s [0x%x]\n", srtp_get_version_string(),
             srtp_get_version());
@@ -207,7 +220,7 @@ int main(int argc, char *argv[])
 
     /* check args */
     while (1) {
-        c = getopt_s(argc, argv, "b:k:gt:ae:ld:f:c:m:p:o:s:r:");
+        c = getopt_s(argc, argv, "b:k:gt:ae:ld:f:c:m:p:o:s:r:F:w:j:K:");
         if (c == -1) {
             break;
         }
@@ -309,6 +322,18 @@ int main(int argc, char *argv[])
         case 'r':
             roc = atoi(optarg_s);
             break;
+        case 'F':
+            key_file = optarg_s;
+            break;
+        case 'w':
+            out_file = optarg_s;
+            break;
+        case 'j':
+            num_workers = strtoul(optarg_s, NULL, 0);
+            break;
+        case 'K':
+            keylog_file = optarg_s;
+            break;
         default:
             usage(argv[0]);
         }
@@ -342,10 +367,36 @@ int main(int argc, char *argv[])
         return 0;
     }
 
-    if ((sec_servs && !input_key) || (!sec_servs && input_key)) {
+    if (key_file != NULL) {
+        if (strcmp(pcap_file, "-") == 0) {
+            fprintf(stderr, "error: offline decoding (-F) requires a pcap "
+                            "file (-p)\n");
+            exit(1);
+        }
+        status = rtp_decoder_offline(pcap_file, key_file, out_file, mode,
+                                     num_workers);
+        if (status) {
+            fprintf(stderr, "error: offline decoding failed with error code "
+                            "%d\n",
+                    status);
+        }
+        srtp_shutdown();
+        return status ? 1 : 0;
+    }
+
+    if (keylog_file != NULL) {
+        keylog = rtp_decoder_read_keylog(keylog_file, &keylog_len);
+        if (keylog == NULL) {
+            fprintf(stderr, "error: could not read key log %s\n", keylog_file);
+            exit(1);
+        }
+    }
+
+    if (keylog == NULL &&
+        ((sec_servs && !input_key) || (!sec_servs && input_key))) {
         /*
          * a key must be provided if and only if security services have
-         * been requested
+         * been requested, unless they all come from a key log
          */
         if (input_key == NULL) {
             fprintf(stderr, "key not provided\n");
@@ -358,20 +409,26 @@ int main(int argc, char *argv[])
     }
 
     /* report security services selected on the command line */
-    fprintf(stderr, "security services: ");
-    if (sec_servs & sec_serv_conf) {
-        fprintf(stderr, "confidentiality ");
-    }
-    if (sec_servs & sec_serv_auth) {
-        fprintf(stderr, "message authentication");
-    }
-    if (sec_servs == sec_serv_none) {
-        fprintf(stderr, "none");
+    if (keylog != NULL) {
+        fprintf(stderr, "security services: from key log %s\n", keylog_file);
+    } else {
+        fprintf(stderr, "security services: ");
+        if (sec_servs & sec_serv_conf) {
+            fprintf(stderr, "confidentiality ");
+        }
+        if (sec_servs & sec_serv_auth) {
+            fprintf(stderr, "message authentication");
+        }
+        if (sec_servs == sec_serv_none) {
+            fprintf(stderr, "none");
+        }
+        fprintf(stderr, "\n");
     }
-    fprintf(stderr, "\n");
 
     /* set up the srtp policy and master key */
-    if (sec_servs) {
+    if (keylog != NULL) {
+        /* the streams are set up from the key log as they turn up */
+    } else if (sec_servs) {
         /*
          * create policy structure, using the default mechanisms but
          * with only the security services requested on the command line,
@@ -601,7 +658,13 @@ int main(int argc, char *argv[])
         exit(1);
     }
     fprintf(stderr, "Starting decoder\n");
-    if (rtp_decoder_init(dec, policy, mode, rtp_packet_offset, roc)) {
+    if (keylog != NULL) {
+        status = rtp_decoder_init_keylog(dec, keylog, keylog_len, mode,
+                                         rtp_packet_offset);
+    } else {
+        status = rtp_decoder_init(dec, policy, mode, rtp_packet_offset, roc);
+    }
+    if (status) {
         fprintf(stderr, "error: init failed\n");
         exit(1);
     }
@@ -618,6 +681,7 @@ int main(int argc, char *argv[])
 
     rtp_decoder_deinit(dec);
     rtp_decoder_dealloc(dec);
+    free(keylog);
 
     status = srtp_shutdown();
     if (status) {
@@ -635,6 +699,9 @@ void usage(char *string)
         stderr,
         "usage: %s [-d <debug>]* [[-k][-b] <key>] [-a][-t][-e] [-c "
         "<srtp-crypto-suite>] [-m <mode>] [-s <ssrc> [-r <roc>]]\n"
+        "or     %s -p <pcap file> -F <key file> [-w <out file>] [-j <n>] "
+        "[-m <mode>]\n"
+        "or     %s -K <key log> [-p <pcap file>] [-m <mode>]\n"
         "or     %s -l\n"
         "where  -a use message authentication\n"
         "       -e <key size> use encryption (use 128 or 256 for key size)\n"
@@ -653,8 +720,18 @@ void usage(char *string)
         "       -s <ssrc> restrict decrypting to the given SSRC (in host byte "
         "order)\n"
         "       -r <roc> initial rollover counter, requires -s <ssrc> "
-        "(defaults to 0)\n",
-        string, string);
+        "(defaults to 0)\n"
+        "       -F <key file> decode the whole capture offline using the "
+        "per-flow\n"
+        "          keys of the key file\n"
+        "       -w <out file> write the decrypted packets to a pcap file\n"
+        "       -j <n> number of worker threads for offline decoding "
+        "(defaults to\n"
+        "          the number of CPUs)\n"
+        "       -K <key log> take the keys of each SSRC from a key log "
+        "written\n"
+        "          with srtp_keylog_open() instead of -k/-b\n",
+        string, string, string, string);
     exit(1);
 }
 
@@ -692,6 +769,8 @@ srtp_err_status_t rtp_decoder_init(rtp_decoder_t dcdr,
     dcdr->rtcp_cnt = 0;
     dcdr->mode = mode;
     dcdr->policy = policy;
+    dcdr->keylog = NULL;
+    dcdr->keylog_len = 0;
 
     srtp_err_status_t result = srtp_create(&dcdr->srtp_ctx, &dcdr->policy);
     if (result != srtp_err_status_ok) {
@@ -707,6 +786,139 @@ srtp_err_status_t rtp_decoder_init(rtp_decoder_t dcdr,
     return srtp_err_status_ok;
 }
 
+srtp_err_status_t rtp_decoder_init_keylog(rtp_decoder_t dcdr,
+                                          const uint8_t *keylog,
+                                          size_t keylog_len,
+                                          rtp_decoder_mode_t mode,
+                                          size_t rtp_packet_offset)
+{
+    dcdr->rtp_offset = rtp_packet_offset;
+    dcdr->srtp_ctx = NULL;
+    dcdr->start_tv.tv_usec = 0;
+    dcdr->start_tv.tv_sec = 0;
+    dcdr->frame_nr = -1;
+    dcdr->error_cnt = 0;
+    dcdr->rtp_cnt = 0;
+    dcdr->rtcp_cnt = 0;
+    dcdr->mode = mode;
+    memset(&dcdr->policy, 0, sizeof(dcdr->policy));
+    dcdr->keylog = keylog;
+    dcdr->keylog_len = keylog_len;
+
+    /* the session starts out empty, see rtp_decoder_add_keylog_stream() */
+    return srtp_create(&dcdr->srtp_ctx, NULL);
+}
+
+srtp_err_status_t rtp_decoder_add_keylog_stream(rtp_decoder_t dcdr,
+                                                uint32_t ssrc,
+                                                size_t skip)
+{
+    srtp_keylog_entry_t entries[SRTP_MAX_NUM_MASTER_KEYS];
+    srtp_master_key_t keys[SRTP_MAX_NUM_MASTER_KEYS];
+    srtp_master_key_t *key_ptrs[SRTP_MAX_NUM_MASTER_KEYS];
+    srtp_policy_t policy;
+    srtp_err_status_t status;
+    size_t num_keys;
+
+    if (dcdr->keylog == NULL) {
+        return srtp_err_status_no_ctx;
+    }
+
+    status = srtp_keylog_find(dcdr->keylog, dcdr->keylog_len, ssrc, skip,
+                              entries, SRTP_MAX_NUM_MASTER_KEYS, &num_keys);
+    if (status) {
+        return status;
+    }
+
+    memset(&policy, 0, sizeof(policy));
+    policy.ssrc.type = ssrc_specific;
+    policy.ssrc.value = ssrc;
+    policy.rtp = entries[0].rtp;
+    policy.rtcp = entries[0].rtcp;
+    policy.window_size = 128;
+    if (num_keys == 1 && entries[0].mki_len == 0) {
+        policy.key = entries[0].key;
+    } else {
+        for (size_t i = 0; i < num_keys; i++) {
+            keys[i].key = entries[i].key;
+            keys[i].mki_id = entries[i].mki;
+            key_ptrs[i] = &keys[i];
+        }
+        policy.keys = key_ptrs;
+        policy.num_master_keys = num_keys;
+        policy.use_mki = entries[0].mki_len != 0;
+        policy.mki_size = entries[0].mki_len;
+    }
+
+    fprintf(stderr, "SSRC 0x%08x: using the keys of session %lu\n", ssrc,
+            (unsigned long)entries[0].session_id);
+
+    return srtp_stream_add(dcdr->srtp_ctx, &policy);
+}
+
+/*
+ * unprotects the first packet of an SSRC that has no stream yet, trying
+ * the candidates the key log has for it in turn until one authenticates
+ */
+static srtp_err_status_t rtp_decoder_unprotect_keylog(rtp_decoder_t dcdr,
+                                                      uint8_t *pkt,
+                                                      size_t *len,
+                                                      bool rtp,
+                                                      uint32_t ssrc)
+{
+    rtp_msg_t copy;
+    srtp_err_status_t status;
+    size_t out_len;
+
+    for (size_t skip = 0;; skip++) {
+        status = rtp_decoder_add_keylog_stream(dcdr, ssrc, skip);
+        if (status) {
+            return status;
+        }
+
+        memcpy(&copy, pkt, *len);
+        out_len = *len;
+        if (rtp) {
+            status = srtp_unprotect(dcdr->srtp_ctx, (uint8_t *)&copy, *len,
+                                    (uint8_t *)&copy, &out_len);
+        } else {
+            status = srtp_unprotect_rtcp(dcdr->srtp_ctx, (uint8_t *)&copy,
+                                         *len, (uint8_t *)&copy, &out_len);
+        }
+        if (status == srtp_err_status_ok) {
+            memcpy(pkt, &copy, out_len);
+            *len = out_len;
+            return status;
+        }
+
+        srtp_stream_remove(dcdr->srtp_ctx, ssrc);
+    }
+}
+
+uint8_t *rtp_decoder_read_keylog(const char *path, size_t *len)
+{
+    FILE *f;
+    long size;
+    uint8_t *buf = NULL;
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+    if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) > 0 &&
+        fseek(f, 0, SEEK_SET) == 0) {
+        buf = malloc((size_t)size);
+        if (buf != NULL && fread(buf, 1, (size_t)size, f) != (size_t)size) {
+            free(buf);
+            buf = NULL;
+        }
+        *len = (size_t)size;
+    }
+    fclose(f);
+
+    return buf;
+}
+
 /*
  * decodes key as base64
  */
@@ -778,6 +990,11 @@ void rtp_decoder_handle_pkt(u_char *arg,
         status =
             srtp_unprotect(dcdr->srtp_ctx, (uint8_t *)&message, octets_recvd,
                            (uint8_t *)&message, &octets_recvd);
+        if (status == srtp_err_status_no_ctx && dcdr->keylog != NULL) {
+            status = rtp_decoder_unprotect_keylog(
+                dcdr, (uint8_t *)&message, &octets_recvd, true,
+                ntohl(message.header.ssrc));
+        }
         if (status) {
             dcdr->error_cnt++;
             return;
@@ -787,6 +1004,14 @@ void rtp_decoder_handle_pkt(u_char *arg,
         status = srtp_unprotect_rtcp(dcdr->srtp_ctx, (uint8_t *)&message,
                                      octets_recvd, (uint8_t *)&message,
                                      &octets_recvd);
+        if (status == srtp_err_status_no_ctx && dcdr->keylog != NULL &&
+            octets_recvd >= 8) {
+            uint32_t ssrc;
+            memcpy(&ssrc, (uint8_t *)&message + 4, sizeof(ssrc));
+            status = rtp_decoder_unprotect_keylog(dcdr, (uint8_t *)&message,
+                                                  &octets_recvd, false,
+                                                  ntohl(ssrc));
+        }
         if (status) {
             dcdr->error_cnt++;
             return;
@@ -68,6 +68,8 @@ typedef struct rtp_decoder_ctx_t {
     size_t error_cnt;
     size_t rtp_cnt;
     size_t rtcp_cnt;
+    const uint8_t *keylog; /* contents of a key log, or NULL */
+    size_t keylog_len;
 } rtp_decoder_ctx_t;
 
 typedef struct rtp_decoder_ctx_t *rtp_decoder_t;
@@ -105,8 +107,44 @@ srtp_err_status_t rtp_decoder_init(rtp_decoder_t dcdr,
                                    size_t rtp_packet_offset,
                                    uint32_t roc);
 
+/*
+ * like rtp_decoder_init(), but the streams are set up from the key log
+ * in keylog as their SSRCs turn up, see srtp_keylog_open()
+ */
+srtp_err_status_t rtp_decoder_init_keylog(rtp_decoder_t dcdr,
+                                          const uint8_t *keylog,
+                                          size_t keylog_len,
+                                          rtp_decoder_mode_t mode,
+                                          size_t rtp_packet_offset);
+
+/*
+ * reads the whole key log at path into memory, which malloc() aligns
+ * well enough for srtp_keylog_find(); returns NULL on failure
+ */
+uint8_t *rtp_decoder_read_keylog(const char *path, size_t *len);
+
+/*
+ * adds a stream for ssrc with the keys of the candidate after the first
+ * skip that the key log of dcdr has for it, see srtp_keylog_find();
+ * returns srtp_err_status_no_ctx if there are no more
+ */
+srtp_err_status_t rtp_decoder_add_keylog_stream(rtp_decoder_t dcdr,
+                                                uint32_t ssrc,
+                                                size_t skip);
+
 srtp_err_status_t rtp_decoder_deinit(rtp_decoder_t decoder);
 
+/*
+ * decodes a whole pcap or pcapng file using the per-flow keys found in
+ * key_file, on num_workers threads (0 selects one per online CPU), and
+ * writes the decrypted packets to out_file as pcap unless it is NULL
+ */
+srtp_err_status_t rtp_decoder_offline(const char *pcap_file,
+                                      const char *key_file,
+                                      const char *out_file,
+                                      rtp_decoder_mode_t mode,
+                                      size_t num_workers);
+
 void rtp_decoder_srtp_log_handler(srtp_log_level_t level,
                                   const char *msg,
                                   void *data);
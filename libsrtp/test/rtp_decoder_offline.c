@@ -0,0 +1,1233 @@
+/*
+ * rtp_decoder_offline.c
+ *
+ * offline, multi-flow decoder for SRTP capture files
+ *
+ * The capture file (pcap or pcapng) is memory mapped privately and
+ * indexed in a single pass.  Every UDP datagram is matched by its
+ * 5-tuple against the flows listed in a key file; each flow owns one
+ * SRTP session, so the SSRCs found inside a flow are demultiplexed by
+ * libsrtp itself.  Flows are then distributed over a pool of worker
+ * threads, every flow being handled by exactly one worker so that the
+ * packets of a flow are unprotected in capture order.  Packets are
+ * decrypted in place inside the mapping and written out as a classic
+ * pcap file straight from the mapping with writev(), so no packet data
+ * is copied in user space.
+ *
+ * The key file contains one line per key:
+ *
+ *   <src-addr> <src-port> <dst-addr> <dst-port> <ssrc|*> <suite> <key>
+ *
+ * where <suite> is an RFC 4568 crypto suite name and <key> the base64
+ * encoded master key and salt (as in an SDES inline key parameter).
+ * Several lines for the same 5-tuple with different SSRCs add streams
+ * to the same session, '*' matches any SSRC.  Empty lines and lines
+ * starting with '#' are ignored.
+ */
+/*
+ *
+ * Copyright (c) 2001-2017 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include <pcap.h>
+#include "rtp_decoder.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define OFFLINE_MAX_KEY_LEN 96
+#define OFFLINE_MAX_LINE 512
+#define OFFLINE_MAX_WORKERS 256
+#define OFFLINE_IOV_BATCH 512 /* records per writev(), stays below IOV_MAX */
+
+/*
+ * captures frequently contain reordered packets, use a replay window
+ * that is much larger than the default one
+ */
+#define OFFLINE_WINDOW_SIZE 1024
+
+/* link types, see https://www.tcpdump.org/linktypes.html */
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4 228
+#define LINKTYPE_IPV6 229
+
+#define PCAP_MAGIC_USEC 0xa1b2c3d4
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+#define PCAPNG_BLOCK_SHB 0x0a0d0d0a
+#define PCAPNG_BLOCK_IDB 0x00000001
+#define PCAPNG_BLOCK_SPB 0x00000003
+#define PCAPNG_BLOCK_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4d
+#define PCAPNG_OPT_IF_TSRESOL 9
+
+typedef struct {
+    uint8_t src[16];
+    uint8_t dst[16];
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint8_t family; /* 4 or 6 */
+} offline_flow_key_t;
+
+typedef struct offline_key_t {
+    srtp_policy_t policy;
+    uint8_t key[OFFLINE_MAX_KEY_LEN];
+    offline_flow_key_t flow;
+    struct offline_key_t *next;
+} offline_key_t;
+
+typedef struct {
+    offline_flow_key_t key;
+    srtp_policy_t *policy; /* list of policies, linked through next */
+    srtp_t session;
+    size_t worker;
+    size_t num_pkts;
+    bool used;
+    bool failed;
+} offline_flow_t;
+
+typedef struct {
+    uint32_t hdr[4]; /* pcap record header written to the output */
+    uint8_t *frame;  /* start of the frame inside the mapping */
+    uint32_t flow;
+    uint16_t l3_off;
+    uint16_t l4_off;
+    uint32_t payload_len; /* protected length, then decrypted length */
+    srtp_err_status_t status;
+} offline_pkt_t;
+
+typedef struct {
+    uint32_t resolution_div; /* timestamp units per second */
+} offline_if_t;
+
+struct offline_ctx_t;
+
+typedef struct {
+    struct offline_ctx_t *ctx;
+    pthread_t thread;
+    uint32_t *pkts;
+    size_t num_pkts;
+    size_t load;
+    size_t rtp_cnt;
+    size_t rtcp_cnt;
+    size_t error_cnt;
+    size_t octets;
+} offline_worker_t;
+
+typedef struct offline_ctx_t {
+    rtp_decoder_mode_t mode;
+    uint8_t *map;
+    size_t map_len;
+    uint32_t linktype;
+    bool have_linktype;
+    offline_if_t *ifs;
+    size_t num_ifs;
+    offline_pkt_t *pkts;
+    size_t num_pkts;
+    size_t max_pkts;
+    size_t unmatched_cnt;
+    offline_key_t *keys;
+    offline_flow_t *flows;
+    size_t flow_mask;
+    size_t num_flows;
+    offline_worker_t *workers;
+    size_t num_workers;
+} offline_ctx_t;
+
+typedef void (*offline_policy_setter_t)(srtp_crypto_policy_t *p);
+
+static void offline_set_aes_cm_128_hmac_sha1_80(srtp_crypto_policy_t *p)
+{
+    srtp_crypto_policy_set_aes_cm_128_hmac_sha1_80(p);
+}
+
+static const struct {
+    const char *name;
+    offline_policy_setter_t rtp;
+    offline_policy_setter_t rtcp;
+} offline_suites[] = {
+    { "AES_CM_128_HMAC_SHA1_80", offline_set_aes_cm_128_hmac_sha1_80,
+      offline_set_aes_cm_128_hmac_sha1_80 },
+    { "AES_CM_128_HMAC_SHA1_32", srtp_crypto_policy_set_aes_cm_128_hmac_sha1_32,
+      offline_set_aes_cm_128_hmac_sha1_80 },
+    { "AES_192_CM_HMAC_SHA1_80", srtp_crypto_policy_set_aes_cm_192_hmac_sha1_80,
+      srtp_crypto_policy_set_aes_cm_192_hmac_sha1_80 },
+    { "AES_192_CM_HMAC_SHA1_32", srtp_crypto_policy_set_aes_cm_192_hmac_sha1_32,
+      srtp_crypto_policy_set_aes_cm_192_hmac_sha1_80 },
+    { "AES_256_CM_HMAC_SHA1_80", srtp_crypto_policy_set_aes_cm_256_hmac_sha1_80,
+      srtp_crypto_policy_set_aes_cm_256_hmac_sha1_80 },
+    { "AES_256_CM_HMAC_SHA1_32", srtp_crypto_policy_set_aes_cm_256_hmac_sha1_32,
+      srtp_crypto_policy_set_aes_cm_256_hmac_sha1_80 },
+    { "AEAD_AES_128_GCM", srtp_crypto_policy_set_aes_gcm_128_16_auth,
+      srtp_crypto_policy_set_aes_gcm_128_16_auth },
+    { "AEAD_AES_256_GCM", srtp_crypto_policy_set_aes_gcm_256_16_auth,
+      srtp_crypto_policy_set_aes_gcm_256_16_auth },
+    { NULL, NULL, NULL }
+};
+
+static uint16_t rd16(const uint8_t *p, bool swap)
+{
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return swap ? (uint16_t)((v >> 8) | (v << 8)) : v;
+}
+
+static uint32_t rd32(const uint8_t *p, bool swap)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    if (swap) {
+        v = (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+    }
+    return v;
+}
+
+static uint16_t be16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static void wr_be16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+static size_t offline_flow_hash(const offline_flow_key_t *key)
+{
+    /* FNV-1a */
+    const uint8_t *p = (const uint8_t *)key;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < sizeof(*key); i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static offline_flow_t *offline_flow_find(offline_ctx_t *ctx,
+                                         const offline_flow_key_t *key,
+                                         bool insert)
+{
+    size_t i = offline_flow_hash(key) & ctx->flow_mask;
+
+    while (ctx->flows[i].used) {
+        if (memcmp(&ctx->flows[i].key, key, sizeof(*key)) == 0) {
+            return &ctx->flows[i];
+        }
+        i = (i + 1) & ctx->flow_mask;
+    }
+
+    if (!insert) {
+        return NULL;
+    }
+
+    ctx->flows[i].used = true;
+    ctx->flows[i].key = *key;
+    ctx->num_flows++;
+    return &ctx->flows[i];
+}
+
+static bool offline_parse_addr(const char *s, uint8_t *addr, uint8_t *family)
+{
+    if (inet_pton(AF_INET, s, addr) == 1) {
+        *family = 4;
+        return true;
+    }
+    if (inet_pton(AF_INET6, s, addr) == 1) {
+        *family = 6;
+        return true;
+    }
+    return false;
+}
+
+static srtp_err_status_t offline_parse_key_line(char *line,
+                                                offline_key_t *k,
+                                                const char *file,
+                                                size_t line_nr)
+{
+    char *tok[7];
+    char *save = NULL;
+    size_t n = 0;
+    uint8_t src_family, dst_family;
+    size_t i;
+
+    for (char *t = strtok_r(line, " \t\r\n", &save); t != NULL && n < 7;
+         t = strtok_r(NULL, " \t\r\n", &save)) {
+        tok[n++] = t;
+    }
+    if (n != 7) {
+        fprintf(stderr, "%s:%zu: expected 7 fields\n", file, line_nr);
+        return srtp_err_status_parse_err;
+    }
+
+    memset(k, 0, sizeof(*k));
+    if (!offline_parse_addr(tok[0], k->flow.src, &src_family) ||
+        !offline_parse_addr(tok[2], k->flow.dst, &dst_family) ||
+        src_family != dst_family) {
+        fprintf(stderr, "%s:%zu: bad address pair %s %s\n", file, line_nr,
+                tok[0], tok[2]);
+        return srtp_err_status_parse_err;
+    }
+    k->flow.family = src_family;
+    k->flow.src_port = (uint16_t)strtoul(tok[1], NULL, 0);
+    k->flow.dst_port = (uint16_t)strtoul(tok[3], NULL, 0);
+
+    if (strcmp(tok[4], "*") == 0) {
+        k->policy.ssrc.type = ssrc_any_inbound;
+    } else {
+        k->policy.ssrc.type = ssrc_specific;
+        k->policy.ssrc.value = (uint32_t)strtoul(tok[4], NULL, 0);
+    }
+
+    for (i = 0; offline_suites[i].name != NULL; i++) {
+        if (strcasecmp(offline_suites[i].name, tok[5]) == 0) {
+            break;
+        }
+    }
+    if (offline_suites[i].name == NULL) {
+        fprintf(stderr, "%s:%zu: unknown crypto suite %s\n", file, line_nr,
+                tok[5]);
+        return srtp_err_status_parse_err;
+    }
+    offline_suites[i].rtp(&k->policy.rtp);
+    offline_suites[i].rtcp(&k->policy.rtcp);
+
+    size_t b64_len = strlen(tok[6]);
+    int pad = 0;
+    if (b64_len > OFFLINE_MAX_KEY_LEN * 4 / 3 ||
+        base64_string_to_octet_string(k->key, &pad, tok[6], b64_len) !=
+            b64_len ||
+        b64_len / 4 * 3 - (size_t)pad < k->policy.rtp.cipher_key_len) {
+        fprintf(stderr,
+                "%s:%zu: key must be base64 encoded and at least %zu octets\n",
+                file, line_nr, k->policy.rtp.cipher_key_len);
+        return srtp_err_status_parse_err;
+    }
+
+    k->policy.key = k->key;
+    k->policy.window_size = OFFLINE_WINDOW_SIZE;
+    k->policy.allow_repeat_tx = false;
+    k->policy.next = NULL;
+
+    return srtp_err_status_ok;
+}
+
+static srtp_err_status_t offline_load_keys(offline_ctx_t *ctx,
+                                           const char *key_file)
+{
+    char line[OFFLINE_MAX_LINE];
+    size_t line_nr = 0;
+    size_t num_keys = 0;
+    size_t size = 16;
+    FILE *f;
+
+    f = fopen(key_file, "r");
+    if (f == NULL) {
+        fprintf(stderr, "error: could not open key file %s\n", key_file);
+        return srtp_err_status_read_fail;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char *p = line;
+        line_nr++;
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0') {
+            continue;
+        }
+
+        offline_key_t *k = (offline_key_t *)malloc(sizeof(offline_key_t));
+        if (k == NULL) {
+            fclose(f);
+            return srtp_err_status_alloc_fail;
+        }
+        srtp_err_status_t status =
+            offline_parse_key_line(p, k, key_file, line_nr);
+        if (status) {
+            free(k);
+            fclose(f);
+            return status;
+        }
+        k->next = ctx->keys;
+        ctx->keys = k;
+        num_keys++;
+    }
+    fclose(f);
+
+    if (num_keys == 0) {
+        fprintf(stderr, "error: no keys found in %s\n", key_file);
+        return srtp_err_status_parse_err;
+    }
+
+    /* keep the open addressed flow table at most half full */
+    while (size < num_keys * 2) {
+        size *= 2;
+    }
+    ctx->flows = (offline_flow_t *)calloc(size, sizeof(offline_flow_t));
+    if (ctx->flows == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+    ctx->flow_mask = size - 1;
+
+    for (offline_key_t *k = ctx->keys; k != NULL; k = k->next) {
+        offline_flow_t *flow = offline_flow_find(ctx, &k->flow, true);
+        k->policy.next = flow->policy;
+        flow->policy = &k->policy;
+    }
+
+    return srtp_err_status_ok;
+}
+
+/*
+ * locates the UDP payload of a captured frame and fills in the flow key,
+ * returns false for anything that is not a complete, unfragmented UDP
+ * datagram
+ */
+static bool offline_locate_udp(uint32_t linktype,
+                               const uint8_t *frame,
+                               uint32_t caplen,
+                               offline_flow_key_t *key,
+                               offline_pkt_t *pkt)
+{
+    size_t off;
+    size_t l4;
+    size_t ip_end;
+    uint16_t ethertype;
+
+    switch (linktype) {
+    case LINKTYPE_ETHERNET:
+        if (caplen < 14) {
+            return false;
+        }
+        ethertype = be16(frame + 12);
+        off = 14;
+        /* 802.1Q and 802.1ad tags */
+        while ((ethertype == 0x8100 || ethertype == 0x88a8) &&
+               caplen >= off + 4) {
+            ethertype = be16(frame + off + 2);
+            off += 4;
+        }
+        break;
+    case LINKTYPE_LINUX_SLL:
+        if (caplen < 16) {
+            return false;
+        }
+        ethertype = be16(frame + 14);
+        off = 16;
+        break;
+    case LINKTYPE_RAW:
+    case LINKTYPE_IPV4:
+    case LINKTYPE_IPV6:
+        if (caplen < 1) {
+            return false;
+        }
+        ethertype = (frame[0] >> 4) == 4 ? 0x0800 : 0x86dd;
+        off = 0;
+        break;
+    default:
+        return false;
+    }
+
+    memset(key, 0, sizeof(*key));
+
+    if (ethertype == 0x0800) {
+        size_t ihl;
+        if (caplen < off + 20 || (frame[off] >> 4) != 4) {
+            return false;
+        }
+        ihl = (size_t)(frame[off] & 0x0f) * 4;
+        if (ihl < 20 || frame[off + 9] != 17 ||
+            (be16(frame + off + 6) & 0x3fff) != 0) {
+            return false;
+        }
+        ip_end = off + be16(frame + off + 2);
+        memcpy(key->src, frame + off + 12, 4);
+        memcpy(key->dst, frame + off + 16, 4);
+        key->family = 4;
+        l4 = off + ihl;
+    } else if (ethertype == 0x86dd) {
+        uint8_t nh;
+        if (caplen < off + 40 || (frame[off] >> 4) != 6) {
+            return false;
+        }
+        nh = frame[off + 6];
+        ip_end = off + 40 + be16(frame + off + 4);
+        memcpy(key->src, frame + off + 8, 16);
+        memcpy(key->dst, frame + off + 24, 16);
+        key->family = 6;
+        l4 = off + 40;
+        /* hop-by-hop, routing and destination options headers */
+        while ((nh == 0 || nh == 43 || nh == 60) && l4 + 2 <= caplen) {
+            nh = frame[l4];
+            l4 += ((size_t)frame[l4 + 1] + 1) * 8;
+        }
+        if (nh != 17) {
+            return false;
+        }
+    } else {
+        return false;
+    }
+
+    /* truncated captures can not be authenticated */
+    if (ip_end > caplen || l4 + 8 > ip_end) {
+        return false;
+    }
+
+    size_t udp_len = be16(frame + l4 + 4);
+    if (udp_len < 8 || l4 + udp_len > ip_end) {
+        return false;
+    }
+
+    key->src_port = be16(frame + l4);
+    key->dst_port = be16(frame + l4 + 2);
+
+    pkt->l3_off = (uint16_t)off;
+    pkt->l4_off = (uint16_t)l4;
+    pkt->payload_len = (uint32_t)(udp_len - 8);
+
+    return true;
+}
+
+static srtp_err_status_t offline_add_pkt(offline_ctx_t *ctx,
+                                         uint8_t *frame,
+                                         uint32_t caplen,
+                                         uint32_t origlen,
+                                         uint32_t ts_sec,
+                                         uint32_t ts_usec)
+{
+    offline_flow_key_t key;
+    offline_flow_t *flow;
+    offline_pkt_t *pkt;
+
+    if (ctx->num_pkts == ctx->max_pkts) {
+        size_t n = ctx->max_pkts ? ctx->max_pkts * 2 : 4096;
+        offline_pkt_t *p =
+            (offline_pkt_t *)realloc(ctx->pkts, n * sizeof(offline_pkt_t));
+        if (p == NULL) {
+            return srtp_err_status_alloc_fail;
+        }
+        ctx->pkts = p;
+        ctx->max_pkts = n;
+    }
+
+    pkt = &ctx->pkts[ctx->num_pkts];
+    if (caplen > 0xffff ||
+        !offline_locate_udp(ctx->linktype, frame, caplen, &key, pkt)) {
+        ctx->unmatched_cnt++;
+        return srtp_err_status_ok;
+    }
+
+    flow = offline_flow_find(ctx, &key, false);
+    if (flow == NULL) {
+        ctx->unmatched_cnt++;
+        return srtp_err_status_ok;
+    }
+
+    pkt->hdr[0] = ts_sec;
+    pkt->hdr[1] = ts_usec;
+    pkt->hdr[2] = caplen;
+    pkt->hdr[3] = origlen;
+    pkt->frame = frame;
+    pkt->flow = (uint32_t)(flow - ctx->flows);
+    pkt->status = srtp_err_status_fail;
+    flow->num_pkts++;
+    ctx->num_pkts++;
+
+    return srtp_err_status_ok;
+}
+
+static srtp_err_status_t offline_set_linktype(offline_ctx_t *ctx,
+                                              uint32_t linktype)
+{
+    if (ctx->have_linktype && ctx->linktype != linktype) {
+        fprintf(stderr, "error: captures with mixed link types (%u and %u) "
+                        "are not supported\n",
+                ctx->linktype, linktype);
+        return srtp_err_status_parse_err;
+    }
+    ctx->linktype = linktype;
+    ctx->have_linktype = true;
+    return srtp_err_status_ok;
+}
+
+static srtp_err_status_t offline_scan_pcap(offline_ctx_t *ctx)
+{
+    uint8_t *p = ctx->map;
+    uint8_t *end = ctx->map + ctx->map_len;
+    uint32_t magic = rd32(p, false);
+    bool swap;
+    bool nsec;
+    srtp_err_status_t status;
+
+    if (magic == PCAP_MAGIC_USEC || magic == PCAP_MAGIC_NSEC) {
+        swap = false;
+    } else {
+        swap = true;
+        magic = rd32(p, true);
+    }
+    nsec = magic == PCAP_MAGIC_NSEC;
+
+    if (ctx->map_len < 24) {
+        return srtp_err_status_parse_err;
+    }
+    status = offline_set_linktype(ctx, rd32(p + 20, swap) & 0xffff);
+    if (status) {
+        return status;
+    }
+
+    for (p += 24; end - p >= 16;) {
+        uint32_t ts_sec = rd32(p, swap);
+        uint32_t ts_frac = rd32(p + 4, swap);
+        uint32_t caplen = rd32(p + 8, swap);
+        uint32_t origlen = rd32(p + 12, swap);
+        p += 16;
+        if (caplen > (size_t)(end - p)) {
+            fprintf(stderr, "warning: capture file is truncated\n");
+            break;
+        }
+        status = offline_add_pkt(ctx, p, caplen, origlen, ts_sec,
+                                  nsec ? ts_frac / 1000 : ts_frac);
+        if (status) {
+            return status;
+        }
+        p += caplen;
+    }
+
+    return srtp_err_status_ok;
+}
+
+static srtp_err_status_t offline_add_if(offline_ctx_t *ctx,
+                                        const uint8_t *block,
+                                        uint32_t block_len,
+                                        bool swap)
+{
+    uint32_t div = 1000000;
+    const uint8_t *opt = block + 16;
+    const uint8_t *end = block + block_len - 4;
+    offline_if_t *ifs;
+
+    while (end - opt >= 4) {
+        uint16_t code = rd16(opt, swap);
+        uint16_t len = rd16(opt + 2, swap);
+        if (code == 0 || len > end - opt - 4) {
+            break;
+        }
+        if (code == PCAPNG_OPT_IF_TSRESOL && len == 1) {
+            uint8_t r = opt[4];
+            /* keep the divisor in 32 bits, finer resolutions are rare */
+            if (r & 0x80) {
+                div = (r & 0x7f) < 32 ? (uint32_t)1 << (r & 0x7f) : 0;
+            } else {
+                div = 1;
+                while (r-- > 0 && div <= 100000000) {
+                    div *= 10;
+                }
+            }
+            if (div == 0) {
+                return srtp_err_status_parse_err;
+            }
+        }
+        opt += 4 + ((len + 3u) & ~3u);
+    }
+
+    ifs = (offline_if_t *)realloc(ctx->ifs,
+                                  (ctx->num_ifs + 1) * sizeof(offline_if_t));
+    if (ifs == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+    ctx->ifs = ifs;
+    ctx->ifs[ctx->num_ifs++].resolution_div = div;
+
+    return offline_set_linktype(ctx, rd16(block + 8, swap));
+}
+
+static srtp_err_status_t offline_scan_pcapng(offline_ctx_t *ctx)
+{
+    uint8_t *p = ctx->map;
+    uint8_t *end = ctx->map + ctx->map_len;
+    bool swap = false;
+    srtp_err_status_t status;
+
+    while (end - p >= 12) {
+        uint32_t type = rd32(p, swap);
+        uint32_t block_len;
+
+        if (type == PCAPNG_BLOCK_SHB) {
+            uint32_t bom = rd32(p + 8, false);
+            if (bom == PCAPNG_BYTE_ORDER_MAGIC) {
+                swap = false;
+            } else if (rd32(p + 8, true) == PCAPNG_BYTE_ORDER_MAGIC) {
+                swap = true;
+            } else {
+                return srtp_err_status_parse_err;
+            }
+            /* interface ids are scoped to a section */
+            ctx->num_ifs = 0;
+        }
+
+        block_len = rd32(p + 4, swap);
+        if (block_len < 12 || (block_len & 3) != 0 ||
+            block_len > (size_t)(end - p)) {
+            fprintf(stderr, "warning: capture file is truncated\n");
+            break;
+        }
+
+        if (type == PCAPNG_BLOCK_IDB && block_len >= 20) {
+            status = offline_add_if(ctx, p, block_len, swap);
+            if (status) {
+                return status;
+            }
+        } else if (type == PCAPNG_BLOCK_EPB && block_len >= 32) {
+            uint32_t if_id = rd32(p + 8, swap);
+            uint64_t ts = ((uint64_t)rd32(p + 12, swap) << 32) |
+                          rd32(p + 16, swap);
+            uint32_t caplen = rd32(p + 20, swap);
+            uint32_t origlen = rd32(p + 24, swap);
+            uint32_t div;
+            uint64_t frac;
+
+            if (if_id >= ctx->num_ifs || caplen > block_len - 32) {
+                return srtp_err_status_parse_err;
+            }
+            div = ctx->ifs[if_id].resolution_div;
+            frac = ts % div;
+            frac = div >= 1000000 ? frac / (div / 1000000)
+                                  : frac * 1000000 / div;
+            status = offline_add_pkt(ctx, p + 28, caplen, origlen,
+                                     (uint32_t)(ts / div), (uint32_t)frac);
+            if (status) {
+                return status;
+            }
+        } else if (type == PCAPNG_BLOCK_SPB && block_len >= 16) {
+            uint32_t origlen = rd32(p + 8, swap);
+            uint32_t caplen = origlen < block_len - 16 ? origlen
+                                                       : block_len - 16;
+            if (ctx->num_ifs == 0) {
+                return srtp_err_status_parse_err;
+            }
+            status = offline_add_pkt(ctx, p + 12, caplen, origlen, 0, 0);
+            if (status) {
+                return status;
+            }
+        }
+
+        p += block_len;
+    }
+
+    return srtp_err_status_ok;
+}
+
+static uint32_t offline_csum_add(uint32_t sum, const uint8_t *p, size_t len)
+{
+    while (len > 1) {
+        sum += be16(p);
+        p += 2;
+        len -= 2;
+    }
+    if (len) {
+        sum += (uint32_t)p[0] << 8;
+    }
+    return sum;
+}
+
+static uint16_t offline_csum_fold(uint32_t sum)
+{
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+/*
+ * after decryption the datagram is shorter, fix up the lengths and
+ * checksums of the IP and UDP headers as well as the record header
+ */
+static void offline_fixup_headers(offline_pkt_t *pkt, uint32_t protected_len)
+{
+    uint8_t *ip = pkt->frame + pkt->l3_off;
+    uint8_t *udp = pkt->frame + pkt->l4_off;
+    uint32_t shrink = protected_len - pkt->payload_len;
+    uint16_t udp_len = (uint16_t)(pkt->payload_len + 8);
+    uint32_t sum;
+    uint8_t pseudo[4];
+
+    wr_be16(udp + 4, udp_len);
+    wr_be16(udp + 6, 0);
+
+    if ((ip[0] >> 4) == 4) {
+        size_t ihl = (size_t)(ip[0] & 0x0f) * 4;
+        wr_be16(ip + 2, (uint16_t)(be16(ip + 2) - shrink));
+        wr_be16(ip + 10, 0);
+        wr_be16(ip + 10, offline_csum_fold(offline_csum_add(0, ip, ihl)));
+        sum = offline_csum_add(0, ip + 12, 8);
+    } else {
+        wr_be16(ip + 4, (uint16_t)(be16(ip + 4) - shrink));
+        sum = offline_csum_add(0, ip + 8, 32);
+    }
+
+    pseudo[0] = 0;
+    pseudo[1] = 17;
+    wr_be16(pseudo + 2, udp_len);
+    sum = offline_csum_add(sum, pseudo, 4);
+    sum = offline_csum_add(sum, udp, udp_len);
+    uint16_t csum = offline_csum_fold(sum);
+    wr_be16(udp + 6, csum == 0 ? 0xffff : csum);
+
+    /* trailing link layer padding is dropped as well */
+    pkt->hdr[2] = pkt->l4_off + (uint32_t)udp_len;
+    pkt->hdr[3] = pkt->hdr[3] > pkt->hdr[2] + shrink ? pkt->hdr[3] - shrink
+                                                     : pkt->hdr[2];
+}
+
+static void offline_decode_pkt(offline_worker_t *w, offline_pkt_t *pkt)
+{
+    offline_flow_t *flow = &w->ctx->flows[pkt->flow];
+    uint8_t *msg = pkt->frame + pkt->l4_off + 8;
+    uint32_t protected_len = pkt->payload_len;
+    size_t len = protected_len;
+    bool rtp;
+
+    if (flow->failed) {
+        pkt->status = srtp_err_status_no_ctx;
+        w->error_cnt++;
+        return;
+    }
+
+    if (flow->session == NULL) {
+        /* sessions are created by the owning worker, in parallel */
+        srtp_err_status_t status = srtp_create(&flow->session, flow->policy);
+        if (status) {
+            fprintf(stderr, "error: srtp_create() failed for flow %u (%d)\n",
+                    pkt->flow, status);
+            flow->session = NULL;
+            flow->failed = true;
+            pkt->status = status;
+            w->error_cnt++;
+            return;
+        }
+    }
+
+    if (w->ctx->mode == mode_rtp) {
+        rtp = true;
+    } else if (w->ctx->mode == mode_rtcp) {
+        rtp = false;
+    } else {
+        rtp = true;
+        if (len >= 2) {
+            /* rfc5761 */
+            uint8_t payload_type = msg[1] & 0x7f;
+            rtp = payload_type < 64 || payload_type > 95;
+        }
+    }
+
+    if (rtp) {
+        if (len < 1 || (msg[0] >> 6) != 2) {
+            pkt->status = srtp_err_status_bad_param;
+        } else {
+            pkt->status = srtp_unprotect(flow->session, msg, len, msg, &len);
+        }
+    } else {
+        pkt->status = srtp_unprotect_rtcp(flow->session, msg, len, msg, &len);
+    }
+
+    if (pkt->status) {
+        w->error_cnt++;
+        return;
+    }
+
+    if (rtp) {
+        w->rtp_cnt++;
+    } else {
+        w->rtcp_cnt++;
+    }
+    w->octets += protected_len;
+    pkt->payload_len = (uint32_t)len;
+    offline_fixup_headers(pkt, protected_len);
+}
+
+static void *offline_worker_run(void *arg)
+{
+    offline_worker_t *w = (offline_worker_t *)arg;
+
+    for (size_t i = 0; i < w->num_pkts; i++) {
+        offline_decode_pkt(w, &w->ctx->pkts[w->pkts[i]]);
+    }
+
+    return NULL;
+}
+
+static int offline_cmp_flow_load(const void *a, const void *b)
+{
+    const offline_flow_t *fa = *(const offline_flow_t *const *)a;
+    const offline_flow_t *fb = *(const offline_flow_t *const *)b;
+
+    if (fa->num_pkts != fb->num_pkts) {
+        return fa->num_pkts < fb->num_pkts ? 1 : -1;
+    }
+    return 0;
+}
+
+/*
+ * assigns every flow to a worker, largest flows first to the least
+ * loaded worker, and builds the per worker packet lists in capture order
+ */
+static srtp_err_status_t offline_assign_workers(offline_ctx_t *ctx,
+                                                uint32_t **pkt_lists)
+{
+    offline_flow_t **order;
+    size_t n = 0;
+    uint32_t *lists;
+
+    order = (offline_flow_t **)malloc((ctx->flow_mask + 1) *
+                                      sizeof(offline_flow_t *));
+    if (order == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+    for (size_t i = 0; i <= ctx->flow_mask; i++) {
+        if (ctx->flows[i].used && ctx->flows[i].num_pkts > 0) {
+            order[n++] = &ctx->flows[i];
+        }
+    }
+    qsort(order, n, sizeof(offline_flow_t *), offline_cmp_flow_load);
+
+    for (size_t i = 0; i < n; i++) {
+        size_t best = 0;
+        for (size_t j = 1; j < ctx->num_workers; j++) {
+            if (ctx->workers[j].load < ctx->workers[best].load) {
+                best = j;
+            }
+        }
+        order[i]->worker = best;
+        ctx->workers[best].load += order[i]->num_pkts;
+    }
+    free(order);
+
+    lists = (uint32_t *)malloc((ctx->num_pkts + 1) * sizeof(uint32_t));
+    if (lists == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+    *pkt_lists = lists;
+
+    for (size_t j = 0; j < ctx->num_workers; j++) {
+        ctx->workers[j].pkts = lists;
+        lists += ctx->workers[j].load;
+    }
+    for (size_t i = 0; i < ctx->num_pkts; i++) {
+        size_t worker = ctx->flows[ctx->pkts[i].flow].worker;
+        offline_worker_t *w = &ctx->workers[worker];
+        w->pkts[w->num_pkts++] = (uint32_t)i;
+    }
+
+    return srtp_err_status_ok;
+}
+
+static srtp_err_status_t offline_writev_all(int fd,
+                                            struct iovec *iov,
+                                            int iovcnt)
+{
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return srtp_err_status_write_fail;
+        }
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return srtp_err_status_ok;
+}
+
+static srtp_err_status_t offline_write_pcap(offline_ctx_t *ctx,
+                                            const char *out_file,
+                                            size_t *written)
+{
+    struct iovec iov[2 * OFFLINE_IOV_BATCH];
+    struct {
+        uint32_t magic;
+        uint16_t version_major;
+        uint16_t version_minor;
+        int32_t thiszone;
+        uint32_t sigfigs;
+        uint32_t snaplen;
+        uint32_t linktype;
+    } file_hdr = { PCAP_MAGIC_USEC, 2, 4, 0, 0, 0xffff, ctx->linktype };
+    int cnt = 0;
+    int fd;
+    srtp_err_status_t status = srtp_err_status_ok;
+
+    fd = open(out_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "error: could not open %s for writing\n", out_file);
+        return srtp_err_status_write_fail;
+    }
+
+    /* the output is a classic pcap file in host byte order */
+    iov[cnt].iov_base = &file_hdr;
+    iov[cnt++].iov_len = sizeof(file_hdr);
+
+    *written = 0;
+    for (size_t i = 0; i < ctx->num_pkts && status == srtp_err_status_ok;
+         i++) {
+        offline_pkt_t *pkt = &ctx->pkts[i];
+        if (pkt->status != srtp_err_status_ok) {
+            continue;
+        }
+        if (cnt + 2 > 2 * OFFLINE_IOV_BATCH) {
+            status = offline_writev_all(fd, iov, cnt);
+            cnt = 0;
+        }
+        iov[cnt].iov_base = pkt->hdr;
+        iov[cnt++].iov_len = sizeof(pkt->hdr);
+        iov[cnt].iov_base = pkt->frame;
+        iov[cnt++].iov_len = pkt->hdr[2];
+        (*written)++;
+    }
+    if (status == srtp_err_status_ok && cnt > 0) {
+        status = offline_writev_all(fd, iov, cnt);
+    }
+
+    if (close(fd) != 0 && status == srtp_err_status_ok) {
+        status = srtp_err_status_write_fail;
+    }
+    if (status) {
+        fprintf(stderr, "error: writing %s failed\n", out_file);
+    }
+    return status;
+}
+
+static void offline_cleanup(offline_ctx_t *ctx)
+{
+    if (ctx->flows != NULL) {
+        for (size_t i = 0; i <= ctx->flow_mask; i++) {
+            if (ctx->flows[i].session != NULL) {
+                srtp_dealloc(ctx->flows[i].session);
+            }
+        }
+        free(ctx->flows);
+    }
+    while (ctx->keys != NULL) {
+        offline_key_t *next = ctx->keys->next;
+        octet_string_set_to_zero(ctx->keys->key, sizeof(ctx->keys->key));
+        free(ctx->keys);
+        ctx->keys = next;
+    }
+    if (ctx->map != NULL) {
+        munmap(ctx->map, ctx->map_len);
+    }
+    free(ctx->workers);
+    free(ctx->pkts);
+    free(ctx->ifs);
+}
+
+srtp_err_status_t rtp_decoder_offline(const char *pcap_file,
+                                      const char *key_file,
+                                      const char *out_file,
+                                      rtp_decoder_mode_t mode,
+                                      size_t num_workers)
+{
+    offline_ctx_t ctx;
+    uint32_t *pkt_lists = NULL;
+    struct stat st;
+    struct timeval start, stop;
+    size_t rtp_cnt = 0, rtcp_cnt = 0, error_cnt = 0, octets = 0;
+    size_t written = 0;
+    size_t started = 0;
+    srtp_err_status_t status;
+    int fd;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.mode = mode;
+
+    status = offline_load_keys(&ctx, key_file);
+    if (status) {
+        offline_cleanup(&ctx);
+        return status;
+    }
+
+    fd = open(pcap_file, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < 24) {
+        fprintf(stderr, "error: could not open capture file %s\n", pcap_file);
+        if (fd >= 0) {
+            close(fd);
+        }
+        offline_cleanup(&ctx);
+        return srtp_err_status_read_fail;
+    }
+
+    /*
+     * a private writable mapping lets the packets be decrypted in place
+     * without ever modifying the capture file
+     */
+    ctx.map_len = (size_t)st.st_size;
+    ctx.map = (uint8_t *)mmap(NULL, ctx.map_len, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (ctx.map == MAP_FAILED) {
+        ctx.map = NULL;
+        fprintf(stderr, "error: could not map capture file %s\n", pcap_file);
+        offline_cleanup(&ctx);
+        return srtp_err_status_read_fail;
+    }
+    madvise(ctx.map, ctx.map_len, MADV_SEQUENTIAL);
+
+    if (rd32(ctx.map, false) == PCAPNG_BLOCK_SHB) {
+        status = offline_scan_pcapng(&ctx);
+    } else {
+        status = offline_scan_pcap(&ctx);
+    }
+    if (status) {
+        fprintf(stderr, "error: could not parse capture file %s\n", pcap_file);
+        offline_cleanup(&ctx);
+        return status;
+    }
+    madvise(ctx.map, ctx.map_len, MADV_RANDOM);
+
+    if (num_workers == 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        num_workers = n > 0 ? (size_t)n : 1;
+    }
+    if (num_workers > OFFLINE_MAX_WORKERS) {
+        num_workers = OFFLINE_MAX_WORKERS;
+    }
+    if (num_workers > ctx.num_flows) {
+        num_workers = ctx.num_flows;
+    }
+    ctx.num_workers = num_workers;
+    ctx.workers =
+        (offline_worker_t *)calloc(num_workers, sizeof(offline_worker_t));
+    if (ctx.workers == NULL) {
+        offline_cleanup(&ctx);
+        return srtp_err_status_alloc_fail;
+    }
+    for (size_t i = 0; i < num_workers; i++) {
+        ctx.workers[i].ctx = &ctx;
+    }
+
+    status = offline_assign_workers(&ctx, &pkt_lists);
+    if (status) {
+        free(pkt_lists);
+        offline_cleanup(&ctx);
+        return status;
+    }
+
+    fprintf(stderr, "Decoding %zu packets of %zu flows with %zu workers\n",
+            ctx.num_pkts, ctx.num_flows, num_workers);
+
+    gettimeofday(&start, NULL);
+    for (started = 0; started < num_workers; started++) {
+        if (pthread_create(&ctx.workers[started].thread, NULL,
+                           offline_worker_run, &ctx.workers[started]) != 0) {
+            fprintf(stderr, "error: could not start worker thread\n");
+            status = srtp_err_status_fail;
+            break;
+        }
+    }
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(ctx.workers[i].thread, NULL);
+        rtp_cnt += ctx.workers[i].rtp_cnt;
+        rtcp_cnt += ctx.workers[i].rtcp_cnt;
+        error_cnt += ctx.workers[i].error_cnt;
+        octets += ctx.workers[i].octets;
+    }
+    gettimeofday(&stop, NULL);
+    free(pkt_lists);
+
+    if (status == srtp_err_status_ok && out_file != NULL) {
+        status = offline_write_pcap(&ctx, out_file, &written);
+    }
+
+    double secs = (double)(stop.tv_sec - start.tv_sec) +
+                  (double)(stop.tv_usec - start.tv_usec) / 1e6;
+    fprintf(stderr, "RTP packets decoded: %zu\n", rtp_cnt);
+    fprintf(stderr, "RTCP packets decoded: %zu\n", rtcp_cnt);
+    fprintf(stderr, "Packet decode errors: %zu\n", error_cnt);
+    fprintf(stderr, "Packets without a key: %zu\n", ctx.unmatched_cnt);
+    if (out_file != NULL) {
+        fprintf(stderr, "Packets written: %zu\n", written);
+    }
+    if (secs > 0) {
+        fprintf(stderr, "Decode rate: %.1f kpps, %.1f Mbit/s\n",
+                (double)(rtp_cnt + rtcp_cnt) / secs / 1e3,
+                (double)octets * 8 / secs / 1e6);
+    }
+
+    offline_cleanup(&ctx);
+    return status;
+}
+
+#else /* _WIN32 */
+
+srtp_err_status_t rtp_decoder_offline(const char *pcap_file,
+                                      const char *key_file,
+                                      const char *out_file,
+                                      rtp_decoder_mode_t mode,
+                                      size_t num_workers)
+{
+    (void)pcap_file;
+    (void)key_file;
+    (void)out_file;
+    (void)mode;
+    (void)num_workers;
+    fprintf(stderr, "error: offline decoding is not supported on this "
+                    "platform\n");
+    return srtp_err_status_no_such_op;
+}
+
+#endif /* _WIN32 */
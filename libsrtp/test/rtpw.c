@@ -86,6 +86,7 @@
 
 #include "srtp.h"
 #include "rtp.h"
+#include "rtpw_load.h"
 #include "util.h"
 
 #define DICT_FILE "words.txt"
@@ -131,7 +132,13 @@ volatile int interrupted = 0;
  * program_type distinguishes the [s]rtp sender and receiver cases
  */
 
-typedef enum { sender, receiver, unknown } program_type;
+typedef enum { sender, receiver, load, unknown } program_type;
+
+/*
+ * parse_size_list(...) parses a comma separated list of sizes into
+ * list, returns the number of entries or 0 on error
+ */
+size_t parse_size_list(char *arg, size_t *list, size_t max);
 
 int main(int argc, char *argv[])
 {
@@ -164,6 +171,8 @@ int main(int argc, char *argv[])
     size_t expected_len;
     bool do_list_mods = false;
     uint32_t ssrc = 0xdeadbeef; /* ssrc value hardcoded for now */
+    rtpw_load_cfg_t load_cfg;
+    size_t cpus[2];
 #ifdef RTPW_USE_WINSOCK2
     WORD wVersionRequested = MAKEWORD(2, 0);
     WSADATA wsaData;
@@ -177,6 +186,17 @@ int main(int argc, char *argv[])
 
     memset(&policy, 0x0, sizeof(srtp_policy_t));
 
+    memset(&load_cfg, 0, sizeof(load_cfg));
+    load_cfg.num_streams = 100;
+    load_cfg.sizes[0] = 160;
+    load_cfg.num_sizes = 1;
+    load_cfg.pps = 50000;
+    load_cfg.duration = 10;
+    load_cfg.send_cpu = -1;
+    load_cfg.recv_cpu = -1;
+    load_cfg.ssrc_base = ssrc;
+    load_cfg.interrupted = &interrupted;
+
     printf("Using %s [0x%x]\n", srtp_get_version_string(), srtp_get_version());
 
     if (setup_signal_handler(argv[0]) != 0) {
@@ -193,7 +213,7 @@ int main(int argc, char *argv[])
 
     /* check args */
     while (1) {
-        c = getopt_s(argc, argv, "b:k:rsgt:ae:ld:w:");
+        c = getopt_s(argc, argv, "b:k:rsgt:ae:ld:w:Ln:z:p:T:c:");
         if (c == -1) {
             break;
         }
@@ -246,6 +266,39 @@ int main(int argc, char *argv[])
         case 'w':
             dictfile = optarg_s;
             break;
+        case 'L':
+            prog_type = load;
+            break;
+        case 'n':
+            load_cfg.num_streams = strtoul(optarg_s, NULL, 0);
+            break;
+        case 'z':
+            load_cfg.num_sizes =
+                parse_size_list(optarg_s, load_cfg.sizes, RTPW_LOAD_MAX_SIZES);
+            if (load_cfg.num_sizes == 0) {
+                printf("error: bad payload size list %s\n", optarg_s);
+                exit(1);
+            }
+            break;
+        case 'p':
+            load_cfg.pps = strtoull(optarg_s, NULL, 0);
+            break;
+        case 'T':
+            load_cfg.duration = (unsigned int)strtoul(optarg_s, NULL, 0);
+            break;
+        case 'c':
+            switch (parse_size_list(optarg_s, cpus, 2)) {
+            case 2:
+                load_cfg.recv_cpu = (int)cpus[1];
+            /* fall thru */
+            case 1:
+                load_cfg.send_cpu = (int)cpus[0];
+                break;
+            default:
+                printf("error: bad cpu list %s\n", optarg_s);
+                exit(1);
+            }
+            break;
         default:
             usage(argv[0]);
         }
@@ -332,7 +385,7 @@ int main(int argc, char *argv[])
     name.sin_family = PF_INET;
     name.sin_port = htons(port);
 
-    if (ADDR_IS_MULTICAST(rcvr_addr.s_addr)) {
+    if (prog_type != load && ADDR_IS_MULTICAST(rcvr_addr.s_addr)) {
         if (prog_type == sender) {
             ret = setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl,
                              sizeof(ttl));
@@ -525,7 +578,16 @@ int main(int argc, char *argv[])
         policy.next = NULL;
     }
 
-    if (prog_type == sender) {
+    if (prog_type == load) {
+        ret = rtpw_load_run(&load_cfg, &policy, name);
+        close(sock);
+        status = srtp_shutdown();
+        if (status) {
+            printf("error: srtp shutdown failed with error code %d\n", status);
+            exit(1);
+        }
+        return ret;
+    } else if (prog_type == sender) {
 #if BEW
         /* bind to local socket (to match crypto policy, if need be) */
         memset(&local, 0, sizeof(struct sockaddr_in));
@@ -649,6 +711,8 @@ void usage(char *string)
 {
     printf("usage: %s [-d <debug>]* [-k <key> [-a][-e]] "
            "[-s | -r] dest_ip dest_port\n"
+           "or     %s [-d <debug>]* [-k <key> [-a][-e]] -L [-n <streams>] "
+           "[-z <sizes>] [-p <pps>] [-T <secs>] [-c <cpus>] dest_ip dest_port\n"
            "or     %s -l\n"
            "where  -a use message authentication\n"
            "       -e <key size> use encryption (use 128 or 256 for key size)\n"
@@ -660,11 +724,36 @@ void usage(char *string)
            "       -r act as rtp receiver\n"
            "       -l list debug modules\n"
            "       -d <debug> turn on debugging for module <debug>\n"
-           "       -w <wordsfile> use <wordsfile> for input, rather than %s\n",
-           string, string, DICT_FILE);
+           "       -w <wordsfile> use <wordsfile> for input, rather than %s\n"
+           "       -L run a sender and a receiver thread as load generator\n"
+           "       -n <streams> number of simulated streams (default 100)\n"
+           "       -z <sizes> comma separated RTP payload sizes, used in turn "
+           "(default 160)\n"
+           "       -p <pps> target packet rate of all streams (default 50000)\n"
+           "       -T <secs> duration of the load run (default 10)\n"
+           "       -c <cpu>[,<cpu>] pin the sender [and receiver] thread\n",
+           string, string, string, DICT_FILE);
     exit(1);
 }
 
+size_t parse_size_list(char *arg, size_t *list, size_t max)
+{
+    size_t n = 0;
+    char *end;
+
+    while (*arg != '\0') {
+        if (n == max) {
+            return 0;
+        }
+        list[n++] = strtoul(arg, &end, 0);
+        if (end == arg || (*end != ',' && *end != '\0')) {
+            return 0;
+        }
+        arg = *end == ',' ? end + 1 : end;
+    }
+    return n;
+}
+
 void leave_group(int sock, struct ip_mreq mreq, char *name)
 {
     int ret;
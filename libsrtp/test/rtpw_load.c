@@ -0,0 +1,599 @@
+/*
+ * rtpw_load.c
+ *
+ * load generator mode for rtpw
+ *
+ * A sender thread protects packets of many simulated streams at a
+ * target packet rate and sends them in batches, a receiver thread
+ * receives them in batches and unprotects them.  The sender embeds its
+ * send time (CLOCK_MONOTONIC) right after the RTP header, so the
+ * receiver can measure the protect to unprotect latency, which is
+ * collected in a log-linear histogram.  On Linux batching uses
+ * sendmmsg()/recvmmsg() and the threads can be pinned to cores.
+ */
+/*
+ *
+ * Copyright (c) 2001-2017 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* for sendmmsg(), recvmmsg() and CPU affinity */
+#endif
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "rtpw_load.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#define RTPW_LOAD_BATCH 32
+#define RTPW_LOAD_MAX_PAYLOAD 1400
+#define RTPW_LOAD_MIN_PAYLOAD 8 /* room for the send timestamp */
+#define RTPW_LOAD_BUF_LEN                                                      \
+    (RTP_HEADER_LEN + RTPW_LOAD_MAX_PAYLOAD + SRTP_MAX_TRAILER_LEN)
+#define RTPW_LOAD_SOCK_BUF (4 * 1024 * 1024)
+#define RTPW_LOAD_DRAIN_NS 200000000ull /* wait for stragglers */
+
+/*
+ * latency histogram: values below 16ns get their own bucket, above
+ * that every power of two is split into 16 linear sub-buckets, which
+ * bounds the relative error of a percentile to about 6%
+ */
+#define LAT_SUB_BITS 4
+#define LAT_SUB (1u << LAT_SUB_BITS)
+#define LAT_BUCKETS (64 * LAT_SUB)
+
+typedef struct {
+    const rtpw_load_cfg_t *cfg;
+    srtp_t srtp;
+    int sock;
+    int cpu;
+    pthread_t thread;
+    uint64_t packets;
+    uint64_t octets;
+    uint64_t errors;
+    uint64_t elapsed_ns;
+    uint64_t *hist;
+} rtpw_load_thread_t;
+
+static pthread_mutex_t rtpw_load_lock = PTHREAD_MUTEX_INITIALIZER;
+static int rtpw_load_sender_done = 0;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_ns(uint64_t ns)
+{
+    struct timespec ts;
+    ts.tv_sec = (time_t)(ns / 1000000000ull);
+    ts.tv_nsec = (long)(ns % 1000000000ull);
+    nanosleep(&ts, NULL);
+}
+
+static void put_be64(uint8_t *p, uint64_t v)
+{
+    for (int i = 7; i >= 0; i--) {
+        p[i] = (uint8_t)v;
+        v >>= 8;
+    }
+}
+
+static uint64_t get_be64(const uint8_t *p)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+static size_t lat_bucket(uint64_t ns)
+{
+    unsigned int msb = LAT_SUB_BITS;
+
+    if (ns < LAT_SUB) {
+        return (size_t)ns;
+    }
+    while (msb < 63 && (ns >> (msb + 1)) != 0) {
+        msb++;
+    }
+    return (msb - LAT_SUB_BITS + 1) * LAT_SUB +
+           (size_t)((ns >> (msb - LAT_SUB_BITS)) & (LAT_SUB - 1));
+}
+
+static uint64_t lat_bucket_value(size_t bucket)
+{
+    size_t shift;
+
+    if (bucket < LAT_SUB) {
+        return bucket;
+    }
+    shift = bucket / LAT_SUB - 1;
+    return (uint64_t)(LAT_SUB + bucket % LAT_SUB) << shift;
+}
+
+static uint64_t lat_percentile(const uint64_t *hist, uint64_t total, double p)
+{
+    uint64_t target = (uint64_t)((double)total * p / 100.0);
+    uint64_t sum = 0;
+
+    if (target == 0) {
+        target = 1;
+    }
+    for (size_t i = 0; i < LAT_BUCKETS; i++) {
+        sum += hist[i];
+        if (sum >= target) {
+            return lat_bucket_value(i);
+        }
+    }
+    return 0;
+}
+
+static void pin_thread(int cpu, const char *name)
+{
+    if (cpu < 0) {
+        return;
+    }
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        fprintf(stderr, "warning: could not pin %s to cpu %d\n", name, cpu);
+    }
+#else
+    fprintf(stderr, "warning: cpu pinning of %s not supported\n", name);
+#endif
+}
+
+static int send_batch(int sock, uint8_t bufs[][RTPW_LOAD_BUF_LEN],
+                      const size_t *lens, size_t n)
+{
+#ifdef __linux__
+    struct mmsghdr msgs[RTPW_LOAD_BATCH];
+    struct iovec iov[RTPW_LOAD_BATCH];
+    size_t done = 0;
+
+    memset(msgs, 0, sizeof(msgs));
+    for (size_t i = 0; i < n; i++) {
+        iov[i].iov_base = bufs[i];
+        iov[i].iov_len = lens[i];
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    while (done < n) {
+        int ret = sendmmsg(sock, msgs + done, (unsigned int)(n - done), 0);
+        if (ret < 0) {
+            if (errno == EINTR || errno == ENOBUFS) {
+                continue;
+            }
+            return -1;
+        }
+        done += (size_t)ret;
+    }
+#else
+    for (size_t i = 0; i < n; i++) {
+        if (send(sock, bufs[i], lens[i], 0) < 0 && errno != ENOBUFS) {
+            return -1;
+        }
+    }
+#endif
+    return 0;
+}
+
+static bool recv_timed_out(int err)
+{
+#if EWOULDBLOCK != EAGAIN
+    if (err == EWOULDBLOCK) {
+        return true;
+    }
+#endif
+    return err == EAGAIN || err == EINTR;
+}
+
+/* returns the number of datagrams received, 0 on timeout, -1 on error */
+static int recv_batch(int sock, uint8_t bufs[][RTPW_LOAD_BUF_LEN],
+                      size_t *lens)
+{
+#ifdef __linux__
+    struct mmsghdr msgs[RTPW_LOAD_BATCH];
+    struct iovec iov[RTPW_LOAD_BATCH];
+    int ret;
+
+    memset(msgs, 0, sizeof(msgs));
+    for (size_t i = 0; i < RTPW_LOAD_BATCH; i++) {
+        iov[i].iov_base = bufs[i];
+        iov[i].iov_len = RTPW_LOAD_BUF_LEN;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    ret = recvmmsg(sock, msgs, RTPW_LOAD_BATCH, MSG_WAITFORONE, NULL);
+    if (ret < 0) {
+        return recv_timed_out(errno) ? 0 : -1;
+    }
+    for (int i = 0; i < ret; i++) {
+        lens[i] = msgs[i].msg_len;
+    }
+    return ret;
+#else
+    ssize_t ret = recv(sock, bufs[0], RTPW_LOAD_BUF_LEN, 0);
+    if (ret < 0) {
+        return recv_timed_out(errno) ? 0 : -1;
+    }
+    lens[0] = (size_t)ret;
+    return 1;
+#endif
+}
+
+static void *sender_run(void *arg)
+{
+    rtpw_load_thread_t *t = (rtpw_load_thread_t *)arg;
+    const rtpw_load_cfg_t *cfg = t->cfg;
+    static uint8_t bufs[RTPW_LOAD_BATCH][RTPW_LOAD_BUF_LEN];
+    size_t lens[RTPW_LOAD_BATCH];
+    uint16_t *seq;
+    uint64_t start, end, sent = 0;
+
+    pin_thread(t->cpu, "sender");
+
+    seq = (uint16_t *)calloc(cfg->num_streams, sizeof(uint16_t));
+    if (seq == NULL) {
+        t->errors++;
+        goto done;
+    }
+    memset(bufs, 0x55, sizeof(bufs));
+
+    start = now_ns();
+    end = start + (uint64_t)cfg->duration * 1000000000ull;
+    while (!*cfg->interrupted) {
+        uint64_t now = now_ns();
+        uint64_t due;
+        size_t n;
+
+        if (now >= end) {
+            break;
+        }
+
+        /* number of packets that should have been sent by now */
+        due = (now - start) / 1000 * cfg->pps / 1000000 + 1;
+        if (due <= sent) {
+            uint64_t next = start + (sent * 1000000000ull) / cfg->pps;
+            if (next > now + 50000) {
+                sleep_ns(next - now - 20000);
+            }
+            continue;
+        }
+        n = (size_t)(due - sent);
+        if (n > RTPW_LOAD_BATCH) {
+            n = RTPW_LOAD_BATCH;
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            uint64_t pkt = sent + i;
+            size_t stream = (size_t)(pkt % cfg->num_streams);
+            size_t payload = cfg->sizes[pkt % cfg->num_sizes];
+            uint32_t ssrc = cfg->ssrc_base + (uint32_t)stream;
+            uint32_t ts = (uint32_t)(seq[stream] * 160u);
+            uint8_t *b = bufs[i];
+            srtp_err_status_t status;
+
+            b[0] = 0x80;
+            b[1] = 96;
+            b[2] = (uint8_t)(seq[stream] >> 8);
+            b[3] = (uint8_t)seq[stream];
+            b[4] = (uint8_t)(ts >> 24);
+            b[5] = (uint8_t)(ts >> 16);
+            b[6] = (uint8_t)(ts >> 8);
+            b[7] = (uint8_t)ts;
+            b[8] = (uint8_t)(ssrc >> 24);
+            b[9] = (uint8_t)(ssrc >> 16);
+            b[10] = (uint8_t)(ssrc >> 8);
+            b[11] = (uint8_t)ssrc;
+            seq[stream]++;
+
+            put_be64(b + RTP_HEADER_LEN, now_ns());
+            lens[i] = RTPW_LOAD_BUF_LEN;
+            status = srtp_protect(t->srtp, b, RTP_HEADER_LEN + payload, b,
+                                  &lens[i], 0);
+            if (status) {
+                fprintf(stderr, "error: srtp_protect() failed with code %d\n",
+                        status);
+                t->errors++;
+                goto done;
+            }
+            t->octets += lens[i];
+        }
+
+        if (send_batch(t->sock, bufs, lens, n) != 0) {
+            perror("error: send failed");
+            t->errors++;
+            break;
+        }
+        sent += n;
+    }
+    t->elapsed_ns = now_ns() - start;
+
+done:
+    t->packets = sent;
+    free(seq);
+
+    pthread_mutex_lock(&rtpw_load_lock);
+    rtpw_load_sender_done = 1;
+    pthread_mutex_unlock(&rtpw_load_lock);
+
+    return NULL;
+}
+
+static void *receiver_run(void *arg)
+{
+    rtpw_load_thread_t *t = (rtpw_load_thread_t *)arg;
+    static uint8_t bufs[RTPW_LOAD_BATCH][RTPW_LOAD_BUF_LEN];
+    size_t lens[RTPW_LOAD_BATCH];
+    uint64_t first = 0, last = 0;
+    uint64_t done_at = 0;
+
+    pin_thread(t->cpu, "receiver");
+
+    while (1) {
+        int n = recv_batch(t->sock, bufs, lens);
+        uint64_t now;
+
+        if (n < 0) {
+            perror("error: receive failed");
+            t->errors++;
+            break;
+        }
+
+        now = now_ns();
+        for (int i = 0; i < n; i++) {
+            size_t len = lens[i];
+            srtp_err_status_t status =
+                srtp_unprotect(t->srtp, bufs[i], lens[i], bufs[i], &len);
+            if (status || len < RTP_HEADER_LEN + RTPW_LOAD_MIN_PAYLOAD) {
+                t->errors++;
+                continue;
+            }
+            uint64_t sent_at = get_be64(bufs[i] + RTP_HEADER_LEN);
+            t->hist[lat_bucket(now > sent_at ? now - sent_at : 0)]++;
+            t->packets++;
+            t->octets += lens[i];
+        }
+        if (n > 0) {
+            if (first == 0) {
+                first = now;
+            }
+            last = now;
+            continue;
+        }
+
+        /* timed out, stop once the sender is done and the queue drained */
+        pthread_mutex_lock(&rtpw_load_lock);
+        int sender_done = rtpw_load_sender_done;
+        pthread_mutex_unlock(&rtpw_load_lock);
+        if (sender_done) {
+            if (done_at == 0) {
+                done_at = now;
+            } else if (now - done_at > RTPW_LOAD_DRAIN_NS) {
+                break;
+            }
+        }
+    }
+    t->elapsed_ns = last - first;
+
+    return NULL;
+}
+
+static int open_socket(int rcv_timeout_ms)
+{
+    int sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    int size = RTPW_LOAD_SOCK_BUF;
+    struct timeval tv;
+
+    if (sock < 0) {
+        return -1;
+    }
+    /* best effort, the kernel may clamp these */
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    if (rcv_timeout_ms > 0) {
+        tv.tv_sec = 0;
+        tv.tv_usec = rcv_timeout_ms * 1000;
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+    return sock;
+}
+
+int rtpw_load_run(const rtpw_load_cfg_t *cfg,
+                  const srtp_policy_t *policy,
+                  struct sockaddr_in addr)
+{
+    rtpw_load_thread_t snd, rcv;
+    srtp_policy_t snd_policy = *policy;
+    srtp_policy_t rcv_policy = *policy;
+    srtp_err_status_t status;
+    uint64_t *hist;
+    int ret = 1;
+
+    if (cfg->num_streams == 0 || cfg->num_sizes == 0 || cfg->pps == 0) {
+        fprintf(stderr, "error: bad load configuration\n");
+        return 1;
+    }
+    for (size_t i = 0; i < cfg->num_sizes; i++) {
+        if (cfg->sizes[i] < RTPW_LOAD_MIN_PAYLOAD ||
+            cfg->sizes[i] > RTPW_LOAD_MAX_PAYLOAD) {
+            fprintf(stderr, "error: payload sizes must be between %d and %d\n",
+                    RTPW_LOAD_MIN_PAYLOAD, RTPW_LOAD_MAX_PAYLOAD);
+            return 1;
+        }
+    }
+
+    memset(&snd, 0, sizeof(snd));
+    memset(&rcv, 0, sizeof(rcv));
+    snd.cfg = rcv.cfg = cfg;
+    snd.cpu = cfg->send_cpu;
+    rcv.cpu = cfg->recv_cpu;
+    snd.sock = rcv.sock = -1;
+    rtpw_load_sender_done = 0;
+
+    hist = (uint64_t *)calloc(LAT_BUCKETS, sizeof(uint64_t));
+    if (hist == NULL) {
+        fprintf(stderr, "error: malloc() failed\n");
+        return 1;
+    }
+    rcv.hist = hist;
+
+    /* one session per side, every simulated stream is a separate ssrc */
+    snd_policy.ssrc.type = ssrc_any_outbound;
+    rcv_policy.ssrc.type = ssrc_any_inbound;
+    snd_policy.next = rcv_policy.next = NULL;
+    status = srtp_create(&snd.srtp, &snd_policy);
+    if (status == srtp_err_status_ok) {
+        status = srtp_create(&rcv.srtp, &rcv_policy);
+    }
+    if (status) {
+        fprintf(stderr, "error: srtp_create() failed with code %d\n", status);
+        goto cleanup;
+    }
+
+    rcv.sock = open_socket(50);
+    snd.sock = open_socket(0);
+    if (rcv.sock < 0 || snd.sock < 0 ||
+        bind(rcv.sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        connect(snd.sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        perror("error: socket setup failed");
+        goto cleanup;
+    }
+
+    printf("load: %zu streams, %llu pps, %u s, payload sizes", cfg->num_streams,
+           (unsigned long long)cfg->pps, cfg->duration);
+    for (size_t i = 0; i < cfg->num_sizes; i++) {
+        printf(" %zu", cfg->sizes[i]);
+    }
+    printf("\n");
+
+    if (pthread_create(&rcv.thread, NULL, receiver_run, &rcv) != 0) {
+        fprintf(stderr, "error: could not start receiver thread\n");
+        goto cleanup;
+    }
+    if (pthread_create(&snd.thread, NULL, sender_run, &snd) != 0) {
+        fprintf(stderr, "error: could not start sender thread\n");
+        pthread_mutex_lock(&rtpw_load_lock);
+        rtpw_load_sender_done = 1;
+        pthread_mutex_unlock(&rtpw_load_lock);
+        pthread_join(rcv.thread, NULL);
+        goto cleanup;
+    }
+    pthread_join(snd.thread, NULL);
+    pthread_join(rcv.thread, NULL);
+
+    double snd_secs = (double)snd.elapsed_ns / 1e9;
+    double rcv_secs = (double)rcv.elapsed_ns / 1e9;
+    printf("sent:      %llu packets, %.0f pps, %.1f Mbit/s\n",
+           (unsigned long long)snd.packets,
+           snd_secs > 0 ? (double)snd.packets / snd_secs : 0.0,
+           snd_secs > 0 ? (double)snd.octets * 8 / snd_secs / 1e6 : 0.0);
+    printf("received:  %llu packets, %.0f pps, %.1f Mbit/s\n",
+           (unsigned long long)rcv.packets,
+           rcv_secs > 0 ? (double)rcv.packets / rcv_secs : 0.0,
+           rcv_secs > 0 ? (double)rcv.octets * 8 / rcv_secs / 1e6 : 0.0);
+    printf("lost:      %llu packets\n",
+           (unsigned long long)(snd.packets > rcv.packets + rcv.errors
+                                    ? snd.packets - rcv.packets - rcv.errors
+                                    : 0));
+    printf("errors:    %llu send, %llu unprotect\n",
+           (unsigned long long)snd.errors, (unsigned long long)rcv.errors);
+    if (rcv.packets > 0) {
+        printf("latency:   p50 %.1f us, p90 %.1f us, p99 %.1f us, "
+               "p99.9 %.1f us, max %.1f us\n",
+               (double)lat_percentile(hist, rcv.packets, 50.0) / 1e3,
+               (double)lat_percentile(hist, rcv.packets, 90.0) / 1e3,
+               (double)lat_percentile(hist, rcv.packets, 99.0) / 1e3,
+               (double)lat_percentile(hist, rcv.packets, 99.9) / 1e3,
+               (double)lat_percentile(hist, rcv.packets, 100.0) / 1e3);
+    }
+
+    ret = (snd.errors == 0 && rcv.errors == 0 && rcv.packets > 0) ? 0 : 1;
+
+cleanup:
+    if (snd.sock >= 0) {
+        close(snd.sock);
+    }
+    if (rcv.sock >= 0) {
+        close(rcv.sock);
+    }
+    if (snd.srtp != NULL) {
+        srtp_dealloc(snd.srtp);
+    }
+    if (rcv.srtp != NULL) {
+        srtp_dealloc(rcv.srtp);
+    }
+    free(hist);
+    return ret;
+}
+
+#else /* _WIN32 */
+
+int rtpw_load_run(const rtpw_load_cfg_t *cfg,
+                  const srtp_policy_t *policy,
+                  struct sockaddr_in addr)
+{
+    (void)cfg;
+    (void)policy;
+    (void)addr;
+    fprintf(stderr, "error: load mode is not supported on this platform\n");
+    return 1;
+}
+
+#endif /* _WIN32 */
@@ -0,0 +1,82 @@
+/*
+ * rtpw_load.h
+ *
+ * load generator mode for rtpw: many simulated streams sent over
+ * loopback with batched socket I/O, measuring protect to unprotect
+ * latency
+ */
+/*
+ *
+ * Copyright (c) 2001-2017 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef RTPW_LOAD_H
+#define RTPW_LOAD_H
+
+#include "rtp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RTPW_LOAD_MAX_SIZES 16
+
+typedef struct {
+    size_t num_streams;                /* number of simulated streams  */
+    size_t sizes[RTPW_LOAD_MAX_SIZES]; /* RTP payload sizes, cycled    */
+    size_t num_sizes;
+    uint64_t pps;          /* target packet rate, all streams     */
+    unsigned int duration; /* seconds to send for                 */
+    int send_cpu;          /* core for the sender, -1 for any     */
+    int recv_cpu;          /* core for the receiver, -1 for any   */
+    uint32_t ssrc_base;    /* ssrc of the first stream            */
+    volatile int *interrupted;
+} rtpw_load_cfg_t;
+
+/*
+ * rtpw_load_run(cfg, policy, addr) runs a sender and a receiver thread,
+ * the receiver bound to addr, for cfg->duration seconds and prints the
+ * achieved rate and latency percentiles.  The ssrc of the policy is
+ * ignored, every simulated stream gets its own ssrc.  Returns 0 if every
+ * received packet could be unprotected.
+ */
+int rtpw_load_run(const rtpw_load_cfg_t *cfg,
+                  const srtp_policy_t *policy,
+                  struct sockaddr_in addr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RTPW_LOAD_H */
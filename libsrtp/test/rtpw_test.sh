@@ -169,6 +169,16 @@ kill $sender_pid
 wait $receiver_pid 2>/dev/null
 wait $sender_pid 2>/dev/null
 
+
+echo  $0 ": starting rtpw load generator..."
+
+$RTPW $* $ARGS -L -n 64 -z 160,1200 -p 5000 -T 1 127.0.0.1 $DEST_PORT
+retval=$?
+if [ $retval != 0 ]; then
+    echo $0 ": error"
+    exit 253
+fi
+
 echo $0 ": done (test passed)"
 
 else 
@@ -58,6 +58,16 @@
 #include <winsock2.h>
 #endif
 
+#ifdef HAVE_UNISTD_H
+#include <unistd.h> /* for getpid() */
+#endif
+
+#if defined(__linux__) && defined(HAVE_SYS_SOCKET_H) && defined(HAVE_UNISTD_H)
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/udp.h> /* for UDP_SEGMENT and UDP_GRO */
+#endif
+
 #define PRINT_REFERENCE_PACKET 1
 
 srtp_err_status_t srtp_validate(void);
@@ -106,6 +116,41 @@ srtp_err_status_t srtp_test_set_receiver_roc(void);
 
 srtp_err_status_t srtp_test_set_sender_roc(void);
 
+srtp_err_status_t srtp_test_unprotect_framed(void);
+
+srtp_err_status_t srtp_test_session_export(void);
+
+srtp_err_status_t srtp_test_double(void);
+
+srtp_err_status_t srtp_test_shared_template(void);
+
+srtp_err_status_t srtp_test_key_limit_shards(void);
+
+srtp_err_status_t srtp_test_detached_stream(void);
+
+srtp_err_status_t srtp_test_unprotect_partial(void);
+
+srtp_err_status_t srtp_test_protect_reserve(void);
+
+srtp_err_status_t srtp_test_demux(void);
+
+srtp_err_status_t srtp_test_adaptive_window(void);
+
+srtp_err_status_t srtp_test_log_level(void);
+
+srtp_err_status_t srtp_test_unprotect_mux(void);
+
+srtp_err_status_t srtp_test_checkpoint(void);
+
+srtp_err_status_t srtp_test_keylog(void);
+
+#if defined(GCM) && !defined(OPENSSL) && !defined(WOLFSSL) &&                 \
+    !defined(MBEDTLS) && !defined(NSS)
+srtp_err_status_t srtp_test_aead_reject_no_write(void);
+#endif
+
+srtp_err_status_t srtp_test_segments(void);
+
 double srtp_bits_per_second(size_t msg_len_octets, const srtp_policy_t *policy);
 
 double srtp_rejections_per_second(size_t msg_len_octets,
@@ -115,6 +160,10 @@ void srtp_do_timing(const srtp_policy_t *policy);
 
 void srtp_do_rejection_timing(const srtp_policy_t *policy);
 
+double srtp_teardown_seconds(size_t num_streams);
+
+void srtp_do_teardown_timing(void);
+
 srtp_err_status_t srtp_test(const srtp_policy_t *policy,
                             bool test_extension_headers,
                             bool use_mki,
@@ -317,9 +366,10 @@ srtp_err_status_t call_srtp_unprotect_rtcp(srtp_ctx_t *ctx,
 void usage(char *prog_name)
 {
     printf("usage: %s [ -t ][ -c ][ -v ][ -s ][ -o ][-d <debug_module> ]* [ -l "
-           "][ -n ]\n"
+           "][ -n ][ -u ]\n"
            "  -t         run timing test\n"
            "  -r         run rejection timing test\n"
+           "  -u         run session teardown timing test\n"
            "  -c         run codec timing test\n"
            "  -v         run validation tests\n"
            "  -s         run stream list tests only\n"
@@ -364,6 +414,10 @@ extern const srtp_policy_t *invalid_policy_array[];
 
 extern const srtp_policy_t wildcard_policy;
 
+/* the default_policy is declared below; it has two master keys with MKIs */
+
+extern const srtp_policy_t default_policy;
+
 /*
  * mod_driver debug module - debugging module for this test driver
  *
@@ -381,6 +435,7 @@ int main(int argc, char *argv[])
     int q;
     bool do_timing_test = false;
     bool do_rejection_test = false;
+    bool do_teardown_timing = false;
     bool do_codec_timing = false;
     bool do_validation = false;
     bool do_stream_list = false;
@@ -418,7 +473,7 @@ int main(int argc, char *argv[])
 
     /* process input arguments */
     while (1) {
-        q = getopt_s(argc, argv, "trcvsold:n");
+        q = getopt_s(argc, argv, "trucvsold:n");
         if (q == -1) {
             break;
         }
@@ -429,6 +484,9 @@ int main(int argc, char *argv[])
         case 'r':
             do_rejection_test = true;
             break;
+        case 'u':
+            do_teardown_timing = true;
+            break;
         case 'c':
             do_codec_timing = true;
             break;
@@ -462,7 +520,8 @@ int main(int argc, char *argv[])
     }
 
     if (!do_validation && !do_timing_test && !do_codec_timing &&
-        !do_list_mods && !do_rejection_test && !do_stream_list) {
+        !do_list_mods && !do_rejection_test && !do_stream_list &&
+        !do_teardown_timing) {
         usage(argv[0]);
     }
 
@@ -848,6 +907,140 @@ int main(int argc, char *argv[])
             printf("failed\n");
             exit(1);
         }
+
+        printf("testing srtp_unprotect_framed()...");
+        if (srtp_test_unprotect_framed() == srtp_err_status_ok) {
+            printf("passed\n");
+        } else {
+            printf("failed\n");
+            exit(1);
+        }
+
+        printf("testing srtp_session_export()/srtp_session_import()...");
+        if (srtp_test_session_export() == srtp_err_status_ok) {
+            printf("passed\n");
+        } else {
+            printf("failed\n");
+            exit(1);
+        }
+
+        printf("testing srtp_protect_double()/srtp_unprotect_double()...");
+        if (srtp_test_double() == srtp_err_status_ok) {
+            printf("passed\n");
+        } else {
+            printf("failed\n");
+            exit(1);
+        }
+
+        printf("testing that streams leave their template unchanged...");
+        if (srtp_test_shared_template() == srtp_err_status_ok) {
+            printf("passed\n");
+        } else {
+            printf("failed\n");
+            exit(1);
+        }
+
+        printf("testing key usage limits shared by cloned streams...");
+        if (srtp_test_key_limit_shards() == srtp_err_status_ok) {
+            printf("passed\n");
+        } else {
+            printf("failed\n");
+            exit(1);
+        }
+
+        printf("testing streams created apart from their session...");
+        if (srtp_test_detached_stream() == srtp_err_status_ok) {
+            printf("passed\n");
+        } else {
+            printf("failed\n");
+            exit(1);
+        }
+
+        printf("testing srtp_unprotect_partial()...");
+        if (srtp_test_unprotect_partial() == srtp_err_status_ok) {
+            printf("passed\n");
+        } else {
+            printf("failed\n");
+            exit(1);
+        }
+
+        printf("testing srtp_protect_reserve()...");
+        if (srtp_test_protect_reserve() == srtp_err_status_ok) {
+            printf("passed\n");
+        } else {
+            printf("failed\n");
+            exit(1);
+        }
+
+        printf("testing srtp_demux_t...");
+        if (srtp_test_demux() == srtp_err_status_ok) {
+            printf("passed\n");
+        } else {
+            printf("failed\n");
+            exit(1);
+        }
+
+        printf("testing adaptive replay window...");
+        if (srtp_test_adaptive_window() == srtp_err_status_ok) {
+            printf("passed\n");
+        } else {
+            printf("failed\n");
+            exit(1);
+        }
+
+        printf("testing log level filtering...");
+        if (srtp_test_log_level() == srtp_err_status_ok) {
+            printf("passed\n");
+        } else {
+            printf("failed\n");
+            exit(1);
+        }
+
+        printf("testing srtp_unprotect_mux()...");
+        if (srtp_test_unprotect_mux() == srtp_err_status_ok) {
+            printf("passed\n");
+        } else {
+            printf("failed\n");
+            exit(1);
+        }
+
+        printf("testing index checkpointing...");
+        if (srtp_test_checkpoint() == srtp_err_status_ok) {
+            printf("passed\n");
+        } else {
+            printf("failed\n");
+            exit(1);
+        }
+
+        printf("testing key log...");
+        if (srtp_test_keylog() == srtp_err_status_ok) {
+            printf("passed\n");
+        } else {
+            printf("failed\n");
+            exit(1);
+        }
+
+        printf("testing packed segment buffers...");
+        if (srtp_test_segments() == srtp_err_status_ok) {
+            printf("passed\n");
+        } else {
+            printf("failed\n");
+            exit(1);
+        }
+
+#if defined(GCM) && !defined(OPENSSL) && !defined(WOLFSSL) &&                 \
+    !defined(MBEDTLS) && !defined(NSS)
+        printf("testing rejected AEAD packets leave the output unwritten...");
+        if (srtp_test_aead_reject_no_write() == srtp_err_status_ok) {
+            printf("passed\n");
+        } else {
+            printf("failed\n");
+            exit(1);
+        }
+#endif
+        if (do_log_stdout) {
+            srtp_install_log_handler(log_handler, NULL);
+        }
     }
 
     if (do_stream_list) {
@@ -882,6 +1075,10 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (do_teardown_timing) {
+        srtp_do_teardown_timing();
+    }
+
     if (do_codec_timing) {
         srtp_policy_t policy;
         size_t ignore;
@@ -1094,6 +1291,92 @@ void srtp_do_rejection_timing(const srtp_policy_t *policy)
     printf("\r\n\r\n");
 }
 
+void srtp_do_teardown_timing(void)
+{
+    size_t num_streams;
+
+    /*
+     * note: the output of this function is formatted so that it
+     * can be used in gnuplot.  '#' indicates a comment, and "\r\n"
+     * terminates a record
+     */
+
+    printf("# testing srtp session teardown:\r\n");
+    printf("# number of streams\tteardown time (microseconds)"
+           "\tper stream (nanoseconds)\r\n");
+
+    for (num_streams = 1; num_streams <= 100000; num_streams *= 10) {
+        double seconds = srtp_teardown_seconds(num_streams);
+        printf("%zu\t\t\t%f\t\t%f\r\n", num_streams, seconds * 1.0E6,
+               seconds * 1.0E9 / (double)num_streams);
+    }
+
+    /* these extra linefeeds let gnuplot know that a dataset is done */
+    printf("\r\n\r\n");
+}
+
+/*
+ * srtp_teardown_seconds(num_streams) builds a session whose template has
+ * been cloned into num_streams streams, one per ssrc, and returns the time
+ * srtp_dealloc() takes to tear it down
+ */
+double srtp_teardown_seconds(size_t num_streams)
+{
+    srtp_t srtp;
+    srtp_policy_t policy;
+    uint8_t *mesg, *packet;
+    size_t input_len, len;
+    clock_t timer;
+    srtp_err_status_t status;
+
+    memset(&policy, 0, sizeof(policy));
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.ssrc.type = ssrc_any_outbound;
+    policy.key = test_key;
+    policy.window_size = 128;
+
+    status = srtp_create(&srtp, &policy);
+    if (status) {
+        printf("error: srtp_create() failed with error code %d\n", status);
+        exit(1);
+    }
+
+    mesg = create_rtp_test_packet(64, 0, 1, 1, false, &input_len, NULL);
+    packet = create_rtp_test_packet(64, 0, 1, 1, false, &input_len, NULL);
+    if (mesg == NULL || packet == NULL) {
+        free(mesg);
+        free(packet);
+        return 0.0; /* indicate failure by returning zero */
+    }
+
+    /* protecting one packet per ssrc clones a stream from the template */
+    for (size_t i = 0; i < num_streams; i++) {
+        memcpy(packet, mesg, input_len);
+        ((srtp_hdr_t *)packet)->ssrc = htonl((uint32_t)i + 1);
+        len = input_len;
+        status = call_srtp_protect(srtp, packet, &len, 0);
+        if (status) {
+            printf("error: srtp_protect() failed with error code %d\n",
+                   status);
+            exit(1);
+        }
+    }
+
+    free(mesg);
+    free(packet);
+
+    timer = clock();
+    status = srtp_dealloc(srtp);
+    timer = clock() - timer;
+    if (status) {
+        printf("error: srtp_dealloc() failed with error code %d\n", status);
+        exit(1);
+    }
+
+    return (double)timer / CLOCKS_PER_SEC;
+}
+
 #define MAX_MSG_LEN 1024
 
 double srtp_bits_per_second(size_t msg_len_octets, const srtp_policy_t *policy)
@@ -4671,59 +4954,2542 @@ srtp_err_status_t srtp_test_set_sender_roc(void)
 }
 
 /*
- * srtp policy definitions - these definitions are used above
+ * frames a mix of protected RTP and RTCP packets as an RFC 4571 stream
+ * starting buf_offset octets past a 32-bit boundary, with an incomplete
+ * frame at the end, and checks that srtp_unprotect_framed() recovers
+ * every packet at the offset it reports, in one or in several calls
  */
+static srtp_err_status_t test_unprotect_framed(
+    void (*set_rtp)(srtp_crypto_policy_t *),
+    size_t buf_offset,
+    size_t first_batch,
+    bool expect_aligned)
+{
+    const size_t num_pkts = 7;
+    uint8_t *plain[7];
+    size_t plain_len[7];
+    bool is_rtcp[7];
+    srtp_framed_packet_t results[8];
+    srtp_policy_t policy;
+    srtp_t sender, receiver;
+    uint8_t *storage, *buf;
+    size_t buf_len = 0;
+    size_t consumed, total_consumed = 0;
+    size_t num_results, done = 0;
+    srtp_err_status_t status;
+    size_t i;
 
-// clang-format off
-uint8_t test_key[46] = {
-    0xe1, 0xf9, 0x7a, 0x0d, 0x3e, 0x01, 0x8b, 0xe0,
-    0xd6, 0x4f, 0xa3, 0x2c, 0x06, 0xde, 0x41, 0x39,
-    0x0e, 0xc6, 0x75, 0xad, 0x49, 0x8a, 0xfe, 0xeb,
-    0xb6, 0x96, 0x0b, 0x3a, 0xab, 0xe6, 0xc1, 0x73,
-    0xc3, 0x17, 0xf2, 0xda, 0xbe, 0x35, 0x77, 0x93,
-    0xb6, 0x96, 0x0b, 0x3a, 0xab, 0xe6
-};
+    memset(&policy, 0, sizeof(policy));
+    set_rtp(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.key = test_key;
+    policy.ssrc.type = ssrc_any_outbound;
+    status = srtp_create(&sender, &policy);
+    if (status) {
+        return status;
+    }
+    policy.ssrc.type = ssrc_any_inbound;
+    status = srtp_create(&receiver, &policy);
+    if (status) {
+        return status;
+    }
 
-uint8_t test_key_2[46] = {
-    0xf0, 0xf0, 0x49, 0x14, 0xb5, 0x13, 0xf2, 0x76,
-    0x3a, 0x1b, 0x1f, 0xa1, 0x30, 0xf1, 0x0e, 0x29,
-    0x98, 0xf6, 0xf6, 0xe4, 0x3e, 0x43, 0x09, 0xd1,
-    0xe6, 0x22, 0xa0, 0xe3, 0x32, 0xb9, 0xf1, 0xb6,
-    0xc3, 0x17, 0xf2, 0xda, 0xbe, 0x35, 0x77, 0x93,
-    0xb6, 0x96, 0x0b, 0x3a, 0xab, 0xe6
-};
+    storage = malloc(num_pkts * (2 + 64 + SRTP_MAX_SRTCP_TRAILER_LEN) + 16);
+    if (storage == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+    buf = storage + buf_offset;
 
-uint8_t test_key_gcm[28] = {
-    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
-    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
-    0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
-    0xa8, 0xa9, 0xaa, 0xab
-};
+    for (i = 0; i < num_pkts; i++) {
+        uint8_t *pkt;
+        size_t len;
 
-uint8_t test_mki_id[TEST_MKI_ID_SIZE] = {
-    0xe1, 0xf9, 0x7a, 0x0d
-};
+        is_rtcp[i] = (i % 3) == 2;
+        if (is_rtcp[i]) {
+            pkt = create_rtcp_test_packet(8 + i, 0xcafebabe, &len, NULL);
+        } else {
+            pkt = create_rtp_test_packet(13 + 5 * i, 0xcafebabe, (uint16_t)i,
+                                         (uint32_t)i, false, &len, NULL);
+        }
+        plain[i] = malloc(len);
+        if (plain[i] == NULL) {
+            return srtp_err_status_alloc_fail;
+        }
+        memcpy(plain[i], pkt, len);
+        plain_len[i] = len;
 
-uint8_t test_mki_id_2[TEST_MKI_ID_SIZE] = {
-    0xf3, 0xa1, 0x46, 0x71
-};
-// clang-format on
+        if (is_rtcp[i]) {
+            status = call_srtp_protect_rtcp(sender, pkt, &len, 0);
+        } else {
+            status = call_srtp_protect(sender, pkt, &len, 0);
+        }
+        if (status) {
+            return status;
+        }
 
-const srtp_policy_t default_policy = {
-    { ssrc_any_outbound, 0 }, /* SSRC */
-    {
-        /* SRTP policy */
-        SRTP_AES_ICM_128,               /* cipher type                 */
-        SRTP_AES_ICM_128_KEY_LEN_WSALT, /* cipher key length in octets */
-        SRTP_HMAC_SHA1,                 /* authentication func type    */
-        16,                             /* auth key length in octets   */
-        10,                             /* auth tag length in octets   */
-        sec_serv_conf_and_auth          /* security services flag      */
-    },
-    {
-        /* SRTCP policy */
-        SRTP_AES_ICM_128,               /* cipher type                 */
-        SRTP_AES_ICM_128_KEY_LEN_WSALT, /* cipher key length in octets */
+        buf[buf_len++] = (uint8_t)(len >> 8);
+        buf[buf_len++] = (uint8_t)len;
+        memcpy(buf + buf_len, pkt, len);
+        buf_len += len;
+        free(pkt);
+    }
+
+    /* an incomplete frame that must be left alone */
+    buf[buf_len++] = 0;
+    buf[buf_len++] = 40;
+    memset(buf + buf_len, 0x55, 5);
+    buf_len += 5;
+
+    while (done < num_pkts) {
+        num_results = done == 0 ? first_batch : 8;
+        status = srtp_unprotect_framed(receiver, buf + total_consumed,
+                                       buf_len - total_consumed, &consumed,
+                                       results, &num_results);
+        if (status) {
+            return status;
+        }
+        if (num_results == 0) {
+            return srtp_err_status_fail;
+        }
+
+        for (i = 0; i < num_results; i++) {
+            const srtp_framed_packet_t *r = &results[i];
+            const uint8_t *pkt = buf + total_consumed + r->offset;
+
+            if (r->status != srtp_err_status_ok ||
+                r->is_rtcp != is_rtcp[done] || r->len != plain_len[done] ||
+                memcmp(pkt, plain[done], r->len) != 0) {
+                return srtp_err_status_fail;
+            }
+            /*
+             * with a tag there is always room to align a packet, except
+             * for the first one if buf is an octet past a boundary
+             */
+            if (expect_aligned && ((uintptr_t)pkt & 3) != 0 &&
+                !(done == 0 && buf_offset == 1)) {
+                return srtp_err_status_fail;
+            }
+            done++;
+        }
+        total_consumed += consumed;
+    }
+
+    if (buf_len - total_consumed != 7 || buf[total_consumed + 1] != 40) {
+        return srtp_err_status_fail;
+    }
+
+    for (i = 0; i < num_pkts; i++) {
+        free(plain[i]);
+    }
+    free(storage);
+    srtp_dealloc(sender);
+    srtp_dealloc(receiver);
+
+    return srtp_err_status_ok;
+}
+
+srtp_err_status_t srtp_test_unprotect_framed(void)
+{
+    srtp_err_status_t status;
+
+    status =
+        test_unprotect_framed(srtp_crypto_policy_set_rtp_default, 3, 8, true);
+    if (status) {
+        return status;
+    }
+
+    status =
+        test_unprotect_framed(srtp_crypto_policy_set_rtp_default, 1, 2, true);
+    if (status) {
+        return status;
+    }
+
+    /* without a tag the room in front of a packet may be too small */
+    status = test_unprotect_framed(
+        srtp_crypto_policy_set_null_cipher_hmac_null, 2, 8, false);
+    if (status) {
+        return status;
+    }
+
+    return srtp_err_status_ok;
+}
+
+/*
+ * test_export_send() protects a packet on the sender and unprotects a copy
+ * of it on the receiver; the protected packet is returned in sent if that
+ * is not NULL
+ */
+static srtp_err_status_t test_export_send(srtp_t sender,
+                                          srtp_t receiver,
+                                          uint32_t ssrc,
+                                          uint16_t seq,
+                                          uint8_t **sent,
+                                          size_t *sent_len)
+{
+    srtp_err_status_t status;
+    uint8_t *pkt;
+    size_t len;
+
+    pkt = create_rtp_test_packet(32, ssrc, seq, seq, false, &len, NULL);
+    if (pkt == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+    status = call_srtp_protect(sender, pkt, &len, 0);
+    if (status) {
+        free(pkt);
+        return status;
+    }
+
+    if (sent != NULL) {
+        *sent = malloc(len);
+        if (*sent == NULL) {
+            free(pkt);
+            return srtp_err_status_alloc_fail;
+        }
+        memcpy(*sent, pkt, len);
+        *sent_len = len;
+    }
+
+    status = call_srtp_unprotect(receiver, pkt, &len);
+    free(pkt);
+
+    return status;
+}
+
+srtp_err_status_t srtp_test_session_export(void)
+{
+    const uint32_t ssrcs[] = { 0xcafebabe, 0xdecafbad };
+    srtp_err_status_t status;
+    srtp_policy_t sender_policy[2];
+    srtp_policy_t receiver_policy[2];
+    srtp_t sender_session;
+    srtp_t receiver_session;
+    uint8_t *region;
+    uint8_t *moved;
+    size_t region_len;
+    size_t image_len;
+    uint8_t *replay_pkt = NULL;
+    size_t replay_len = 0;
+    uint32_t roc;
+    uint16_t seq;
+
+    /*
+     * the first SSRC uses a stream cloned from the template, the second a
+     * stream of its own with a different key
+     */
+    memset(sender_policy, 0, sizeof(sender_policy));
+    srtp_crypto_policy_set_rtp_default(&sender_policy[0].rtp);
+    srtp_crypto_policy_set_rtcp_default(&sender_policy[0].rtcp);
+    sender_policy[0].ssrc.type = ssrc_any_outbound;
+    sender_policy[0].key = test_key;
+    sender_policy[0].window_size = 128;
+    sender_policy[0].next = &sender_policy[1];
+    sender_policy[1] = sender_policy[0];
+    sender_policy[1].ssrc.type = ssrc_specific;
+    sender_policy[1].ssrc.value = ssrcs[1];
+    sender_policy[1].key = test_key_2;
+    sender_policy[1].next = NULL;
+
+    /* only the receiver keeps the derived keys an export needs */
+    memcpy(receiver_policy, sender_policy, sizeof(receiver_policy));
+    receiver_policy[0].ssrc.type = ssrc_any_inbound;
+    receiver_policy[0].next = &receiver_policy[1];
+    receiver_policy[0].exportable = true;
+    receiver_policy[1].exportable = true;
+
+    status = srtp_create(&sender_session, sender_policy);
+    if (status) {
+        return status;
+    }
+    status = srtp_create(&receiver_session, receiver_policy);
+    if (status) {
+        return status;
+    }
+
+    /* run up to just before the rollover */
+    for (seq = 65530; seq != 0; seq++) {
+        for (size_t i = 0; i < 2; i++) {
+            status = test_export_send(
+                sender_session, receiver_session, ssrcs[i], seq,
+                (i == 0 && seq == 65533) ? &replay_pkt : NULL, &replay_len);
+            if (status) {
+                return status;
+            }
+        }
+    }
+
+    if (srtp_session_export(sender_session, NULL, 0, &region_len) !=
+        srtp_err_status_bad_param) {
+        return srtp_err_status_fail;
+    }
+
+    /* a NULL region queries the size */
+    status = srtp_session_export(receiver_session, NULL, 0, &region_len);
+    if (status != srtp_err_status_buffer_small || region_len == 0) {
+        return srtp_err_status_fail;
+    }
+
+    region = malloc(region_len);
+    if (region == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+    status = srtp_session_export(receiver_session, region, region_len - 1,
+                                 &image_len);
+    if (status != srtp_err_status_buffer_small || image_len != region_len) {
+        return srtp_err_status_fail;
+    }
+    status = srtp_session_export(receiver_session, region, region_len,
+                                 &image_len);
+    if (status) {
+        return status;
+    }
+
+    /* an exported session must not send with the importer's keystream */
+    for (size_t i = 0; i < 3; i++) {
+        uint8_t *pkt;
+        size_t len;
+
+        pkt = create_rtp_test_packet(32, i < 2 ? ssrcs[i] : 0x12345678, 1, 1,
+                                     false, &len, NULL);
+        if (pkt == NULL) {
+            return srtp_err_status_alloc_fail;
+        }
+        status = call_srtp_protect(receiver_session, pkt, &len, 0);
+        free(pkt);
+        if (status != srtp_err_status_key_expired) {
+            return srtp_err_status_fail;
+        }
+    }
+
+    /* the image must not depend on where it lives */
+    moved = malloc(region_len);
+    if (moved == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+    memcpy(moved, region, region_len);
+    memset(region, 0, region_len);
+    free(region);
+
+    status = srtp_dealloc(receiver_session);
+    if (status) {
+        return status;
+    }
+
+    /* a damaged image is rejected */
+    moved[0] ^= 0xff;
+    if (srtp_session_import(&receiver_session, moved, region_len) !=
+        srtp_err_status_bad_param) {
+        return srtp_err_status_fail;
+    }
+    moved[0] ^= 0xff;
+    if (srtp_session_import(&receiver_session, moved, region_len / 2) !=
+        srtp_err_status_bad_param) {
+        return srtp_err_status_fail;
+    }
+
+    status = srtp_session_import(&receiver_session, moved, region_len);
+    memset(moved, 0, region_len);
+    free(moved);
+    if (status) {
+        return status;
+    }
+
+    /* the replay windows survived */
+    if (call_srtp_unprotect(receiver_session, replay_pkt, &replay_len) !=
+        srtp_err_status_replay_fail) {
+        return srtp_err_status_fail;
+    }
+
+    /* the rollover counters continue across the rollover */
+    for (seq = 0; seq < 4; seq++) {
+        for (size_t i = 0; i < 2; i++) {
+            status = test_export_send(sender_session, receiver_session,
+                                      ssrcs[i], seq, NULL, NULL);
+            if (status) {
+                return status;
+            }
+        }
+    }
+    for (size_t i = 0; i < 2; i++) {
+        status = srtp_stream_get_roc(receiver_session, ssrcs[i], &roc);
+        if (status) {
+            return status;
+        }
+        if (roc != 1) {
+            return srtp_err_status_fail;
+        }
+    }
+
+    /* the imported template still clones new streams */
+    status = test_export_send(sender_session, receiver_session, 0x12345678, 1,
+                              NULL, NULL);
+    if (status) {
+        return status;
+    }
+
+    free(replay_pkt);
+
+    status = srtp_dealloc(sender_session);
+    if (status) {
+        return status;
+    }
+
+    return srtp_dealloc(receiver_session);
+}
+
+/*
+ * test_double_session() creates a session holding only a template stream
+ * with the default policy, or AES-128 GCM with a 16 octet tag if gcm is
+ * set
+ */
+static srtp_t test_double_session(uint8_t *key,
+                                  srtp_ssrc_type_t type,
+                                  bool gcm)
+{
+    srtp_policy_t policy;
+    srtp_t session;
+
+    memset(&policy, 0, sizeof(policy));
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+#ifdef GCM
+    if (gcm) {
+        srtp_crypto_policy_set_aes_gcm_128_16_auth(&policy.rtp);
+        srtp_crypto_policy_set_aes_gcm_128_16_auth(&policy.rtcp);
+    }
+#else
+    if (gcm) {
+        return NULL;
+    }
+#endif
+    policy.ssrc.type = type;
+    policy.key = key;
+    policy.window_size = 128;
+
+    if (srtp_create(&session, &policy)) {
+        return NULL;
+    }
+    return session;
+}
+
+#define TEST_DOUBLE_PAYLOAD_LEN 600
+#define TEST_DOUBLE_NUM_SESSIONS 13
+
+/*
+ * test_double(inner_gcm, outer_gcm) runs the double encryption tests with
+ * GCM or the default policy in each layer; the outer and hop-by-hop
+ * layers share a suite
+ */
+static srtp_err_status_t test_double(bool inner_gcm, bool outer_gcm)
+{
+    // clang-format off
+    uint8_t hop_key[30] = {
+        0x3a, 0x1b, 0x1f, 0xa1, 0x30, 0xf1, 0x0e, 0x29,
+        0x98, 0xf6, 0xf6, 0xe4, 0x3e, 0x43, 0x09, 0xd1,
+        0xe6, 0x22, 0xa0, 0xe3, 0x32, 0xb9, 0xf1, 0xb6,
+        0xc3, 0x17, 0xf2, 0xda, 0xbe, 0x35
+    };
+    // clang-format on
+    srtp_t sessions[TEST_DOUBLE_NUM_SESSIONS];
+    srtp_t *s = sessions;
+    srtp_t sender_inner, sender_outer;
+    srtp_t recv_inner, recv_outer;
+    srtp_t ref_inner, ref_outer;
+    srtp_t md_in, md_out;
+    srtp_t hop_inner, hop_outer;
+    srtp_t mark_out, mark_inner, mark_outer;
+    const uint32_t ssrc = 0xcafebabe;
+    const size_t in_tag_len = inner_gcm ? 16 : 10;
+    const size_t out_tag_len = outer_gcm ? 16 : 10;
+    const size_t trailer_len = in_tag_len + 1 + out_tag_len;
+    srtp_err_status_t status;
+    uint8_t inner_pkt[12 + TEST_DOUBLE_PAYLOAD_LEN + SRTP_MAX_TRAILER_LEN];
+    uint8_t *pkt, *orig, *ref, *md;
+    size_t len, buf_len, srtp_len, out_len, enc_start, mark_len;
+    uint8_t marker;
+
+    *s++ = sender_inner =
+        test_double_session(test_key, ssrc_any_outbound, inner_gcm);
+    *s++ = sender_outer =
+        test_double_session(test_key_2, ssrc_any_outbound, outer_gcm);
+    *s++ = recv_inner =
+        test_double_session(test_key, ssrc_any_inbound, inner_gcm);
+    *s++ = recv_outer =
+        test_double_session(test_key_2, ssrc_any_inbound, outer_gcm);
+    *s++ = ref_inner =
+        test_double_session(test_key, ssrc_any_inbound, inner_gcm);
+    *s++ = ref_outer =
+        test_double_session(test_key_2, ssrc_any_inbound, outer_gcm);
+    *s++ = md_in = test_double_session(test_key_2, ssrc_any_inbound, outer_gcm);
+    *s++ = md_out = test_double_session(hop_key, ssrc_any_outbound, outer_gcm);
+    *s++ = hop_inner =
+        test_double_session(test_key, ssrc_any_inbound, inner_gcm);
+    *s++ = hop_outer =
+        test_double_session(hop_key, ssrc_any_inbound, outer_gcm);
+    *s++ = mark_out =
+        test_double_session(hop_key, ssrc_any_outbound, outer_gcm);
+    *s++ = mark_inner =
+        test_double_session(test_key, ssrc_any_inbound, inner_gcm);
+    *s++ = mark_outer =
+        test_double_session(hop_key, ssrc_any_inbound, outer_gcm);
+    for (size_t i = 0; i < TEST_DOUBLE_NUM_SESSIONS; i++) {
+        if (sessions[i] == NULL) {
+            return srtp_err_status_init_fail;
+        }
+    }
+
+    /* both sessions must be given, and be different */
+    srtp_len = 0;
+    if (srtp_protect_double(sender_inner, sender_inner, inner_pkt, 0,
+                            inner_pkt, &srtp_len) !=
+        srtp_err_status_bad_param) {
+        return srtp_err_status_fail;
+    }
+
+    for (uint16_t seq = 0; seq < 4; seq++) {
+        pkt = create_rtp_test_packet(TEST_DOUBLE_PAYLOAD_LEN, ssrc, seq, seq,
+                                     seq & 1, &len, &buf_len);
+        orig = malloc(buf_len);
+        ref = malloc(buf_len);
+        md = malloc(buf_len);
+        if (orig == NULL || ref == NULL || md == NULL) {
+            return srtp_err_status_alloc_fail;
+        }
+        marker = (uint8_t)((seq >> 1) & 1);
+        ((srtp_hdr_t *)pkt)->m = marker;
+        memcpy(orig, pkt, len);
+        enc_start = len - TEST_DOUBLE_PAYLOAD_LEN;
+
+        srtp_len = buf_len;
+        status = srtp_protect_double(sender_inner, sender_outer, pkt, len, pkt,
+                                     &srtp_len);
+        if (status) {
+            return status;
+        }
+        if (srtp_len != len + trailer_len) {
+            return srtp_err_status_fail;
+        }
+        memcpy(ref, pkt, srtp_len);
+        memcpy(md, pkt, srtp_len);
+
+        /* the receiving endpoint gets the original packet back */
+        out_len = srtp_len;
+        status = srtp_unprotect_double(recv_inner, recv_outer, pkt, srtp_len,
+                                       pkt, &out_len);
+        if (status) {
+            return status;
+        }
+        if (out_len != len || memcmp(pkt, orig, len) != 0) {
+            return srtp_err_status_fail;
+        }
+
+        /* the outer layer is plain SRTP over the whole packet ... */
+        out_len = srtp_len;
+        status = srtp_unprotect(ref_outer, ref, srtp_len, ref, &out_len);
+        if (status) {
+            return status;
+        }
+        if (out_len != len + in_tag_len + 1 || ref[out_len - 1] != 0) {
+            return srtp_err_status_fail;
+        }
+
+        /* ... and the inner layer plain SRTP without the extension */
+        memcpy(inner_pkt, ref, 12);
+        ((srtp_hdr_t *)inner_pkt)->x = 0;
+        memcpy(inner_pkt + 12, ref + enc_start,
+               TEST_DOUBLE_PAYLOAD_LEN + in_tag_len);
+        out_len = sizeof(inner_pkt);
+        status = srtp_unprotect(ref_inner, inner_pkt,
+                                12 + TEST_DOUBLE_PAYLOAD_LEN + in_tag_len,
+                                inner_pkt, &out_len);
+        if (status) {
+            return status;
+        }
+        if (out_len != 12 + TEST_DOUBLE_PAYLOAD_LEN ||
+            memcmp(inner_pkt + 12, orig + enc_start,
+                   TEST_DOUBLE_PAYLOAD_LEN) != 0) {
+            return srtp_err_status_fail;
+        }
+
+        /*
+         * a distributor that flips the marker records the original in
+         * the OHB, config M (0x04, present) and B (0x08, value)
+         */
+        mark_len = len + in_tag_len + 1;
+        ((srtp_hdr_t *)ref)->m = !marker;
+        ref[mark_len - 1] = (uint8_t)(0x04 | (marker ? 0x08 : 0));
+        out_len = buf_len;
+        status = srtp_protect(mark_out, ref, mark_len, ref, &out_len, 0);
+        if (status) {
+            return status;
+        }
+        status = srtp_unprotect_double(mark_inner, mark_outer, ref, out_len,
+                                       ref, &out_len);
+        if (status) {
+            return status;
+        }
+        if (out_len != len || memcmp(ref, orig, len) != 0) {
+            return srtp_err_status_fail;
+        }
+
+        /* a media distributor replaces the hop-by-hop layer */
+        out_len = buf_len;
+        status =
+            srtp_reprotect_outer(md_in, md_out, md, srtp_len, md, &out_len);
+        if (status) {
+            return status;
+        }
+        if (out_len != srtp_len) {
+            return srtp_err_status_fail;
+        }
+        status = srtp_unprotect_double(hop_inner, hop_outer, md, out_len, md,
+                                       &out_len);
+        if (status) {
+            return status;
+        }
+        if (out_len != len || memcmp(md, orig, len) != 0) {
+            return srtp_err_status_fail;
+        }
+
+        free(pkt);
+        free(orig);
+        free(ref);
+        free(md);
+    }
+
+    /* a modified payload, a replay and the wrong inner key are rejected */
+    pkt = create_rtp_test_packet(TEST_DOUBLE_PAYLOAD_LEN, ssrc, 10, 10, false,
+                                 &len, &buf_len);
+    orig = malloc(buf_len);
+    if (orig == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+    srtp_len = buf_len;
+    status = srtp_protect_double(sender_inner, sender_outer, pkt, len, pkt,
+                                 &srtp_len);
+    if (status) {
+        return status;
+    }
+    memcpy(orig, pkt, srtp_len);
+
+    pkt[len / 2] ^= 1;
+    out_len = srtp_len;
+    if (srtp_unprotect_double(recv_inner, recv_outer, pkt, srtp_len, pkt,
+                              &out_len) != srtp_err_status_auth_fail) {
+        return srtp_err_status_fail;
+    }
+
+    memcpy(pkt, orig, srtp_len);
+    out_len = srtp_len;
+    if (srtp_unprotect_double(md_out, recv_outer, pkt, srtp_len, pkt,
+                              &out_len) != srtp_err_status_auth_fail) {
+        return srtp_err_status_fail;
+    }
+
+    memcpy(pkt, orig, srtp_len);
+    out_len = srtp_len;
+    status = srtp_unprotect_double(recv_inner, recv_outer, pkt, srtp_len, pkt,
+                                   &out_len);
+    if (status) {
+        return status;
+    }
+    out_len = srtp_len;
+    if (srtp_unprotect_double(recv_inner, recv_outer, orig, srtp_len, orig,
+                              &out_len) != srtp_err_status_replay_fail) {
+        return srtp_err_status_fail;
+    }
+
+    free(pkt);
+    free(orig);
+
+    for (size_t i = 0; i < TEST_DOUBLE_NUM_SESSIONS; i++) {
+        status = srtp_dealloc(sessions[i]);
+        if (status) {
+            return status;
+        }
+    }
+
+    return srtp_err_status_ok;
+}
+
+srtp_err_status_t srtp_test_double(void)
+{
+    srtp_err_status_t status;
+
+    status = test_double(false, false);
+#ifdef GCM
+    /* each AEAD layer must be encrypted in one call, alone or mixed */
+    if (status == srtp_err_status_ok) {
+        status = test_double(true, true);
+    }
+    if (status == srtp_err_status_ok) {
+        status = test_double(true, false);
+    }
+    if (status == srtp_err_status_ok) {
+        status = test_double(false, true);
+    }
+#endif
+
+    return status;
+}
+
+/*
+ * template_state_t is a copy of the per-packet state of the RTP cipher and
+ * auth function of a stream template
+ */
+typedef struct {
+    uint8_t cipher[SRTP_MAX_CIPHER_CALL_STATE_LEN];
+    uint8_t auth[SRTP_MAX_AUTH_CALL_STATE_LEN];
+    size_t cipher_len;
+    size_t auth_len;
+} template_state_t;
+
+static void get_template_state(srtp_t session, template_state_t *ts)
+{
+    const srtp_session_keys_t *keys =
+        &session->stream_template->session_keys[0];
+
+    ts->cipher_len = 0;
+    if (keys->rtp_cipher->type->start_call != NULL) {
+        ts->cipher_len = keys->rtp_cipher->type->call_state_len;
+        memcpy(ts->cipher, keys->rtp_cipher->state, ts->cipher_len);
+    }
+    ts->auth_len = 0;
+    if (keys->rtp_auth->type->start_call != NULL) {
+        ts->auth_len = keys->rtp_auth->type->call_state_len;
+        memcpy(ts->auth, keys->rtp_auth->state, ts->auth_len);
+    }
+}
+
+/*
+ * test_shared_template(rtp, rtcp) checks that streams cloned from a
+ * template using the given crypto policies keep their per-packet state to
+ * themselves, so that the contexts shared with the template are not
+ * written while packets are processed
+ */
+static srtp_err_status_t test_shared_template(const srtp_crypto_policy_t *rtp,
+                                              const srtp_crypto_policy_t *rtcp)
+{
+    srtp_policy_t policy;
+    srtp_t sender, receiver;
+    template_state_t before, after;
+    srtp_err_status_t status;
+
+    memset(&policy, 0, sizeof(policy));
+    policy.rtp = *rtp;
+    policy.rtcp = *rtcp;
+    policy.ssrc.type = ssrc_any_outbound;
+    policy.key = test_key;
+    policy.window_size = 128;
+
+    status = srtp_create(&sender, &policy);
+    if (status) {
+        return status;
+    }
+    policy.ssrc.type = ssrc_any_inbound;
+    status = srtp_create(&receiver, &policy);
+    if (status) {
+        srtp_dealloc(sender);
+        return status;
+    }
+
+    get_template_state(sender, &before);
+    get_template_state(receiver, &after);
+
+    /* interleave two streams cloned from each template */
+    for (uint16_t seq = 0; seq < 8 && status == srtp_err_status_ok; seq++) {
+        status = test_export_send(sender, receiver, 0xa1a1a1a1, seq, NULL,
+                                  NULL);
+        if (status == srtp_err_status_ok) {
+            status = test_export_send(sender, receiver, 0xb2b2b2b2,
+                                      (uint16_t)(seq + 1000), NULL, NULL);
+        }
+    }
+
+    if (status == srtp_err_status_ok) {
+        template_state_t now;
+
+        get_template_state(sender, &now);
+        if (memcmp(before.cipher, now.cipher, before.cipher_len) ||
+            memcmp(before.auth, now.auth, before.auth_len)) {
+            status = srtp_err_status_algo_fail;
+        }
+        get_template_state(receiver, &now);
+        if (memcmp(after.cipher, now.cipher, after.cipher_len) ||
+            memcmp(after.auth, now.auth, after.auth_len)) {
+            status = srtp_err_status_algo_fail;
+        }
+    }
+
+    srtp_dealloc(sender);
+    srtp_dealloc(receiver);
+
+    return status;
+}
+
+srtp_err_status_t srtp_test_shared_template(void)
+{
+    srtp_crypto_policy_t rtp, rtcp;
+    srtp_err_status_t status;
+
+    srtp_crypto_policy_set_rtp_default(&rtp);
+    srtp_crypto_policy_set_rtcp_default(&rtcp);
+    status = test_shared_template(&rtp, &rtcp);
+#ifdef GCM
+    if (status == srtp_err_status_ok) {
+        srtp_crypto_policy_set_aes_gcm_128_16_auth(&rtp);
+        srtp_crypto_policy_set_aes_gcm_128_16_auth(&rtcp);
+        status = test_shared_template(&rtp, &rtcp);
+    }
+#endif
+
+    return status;
+}
+
+static size_t key_limit_soft_events;
+static size_t key_limit_hard_events;
+
+static void key_limit_event_handler(srtp_event_data_t *data)
+{
+    if (data->event == event_key_soft_limit) {
+        key_limit_soft_events++;
+    } else if (data->event == event_key_hard_limit) {
+        key_limit_hard_events++;
+    }
+}
+
+/*
+ * streams cloned from one template keep their own usage shards; check
+ * that the limits are signalled within the bound the batching allows and
+ * that the hard limit is never exceeded
+ */
+srtp_err_status_t srtp_test_key_limit_shards(void)
+{
+    const uint32_t ssrcs[4] = { 0x11111111, 0x22222222, 0x33333333,
+                                0x44444444 };
+    const size_t num_streams = sizeof(ssrcs) / sizeof(ssrcs[0]);
+    const srtp_xtd_seq_num_t soft = 0x10000; /* as in crypto/kernel/key.c */
+    const srtp_xtd_seq_num_t margin = 3000;
+    srtp_policy_t policy;
+    srtp_t srtp;
+    srtp_err_status_t status;
+    size_t sent = 0;
+    size_t soft_at = 0;
+    size_t hard_at = 0;
+    size_t slack;
+
+    memset(&policy, 0, sizeof(policy));
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.ssrc.type = ssrc_any_outbound;
+    policy.key = test_key;
+    policy.window_size = 128;
+
+    status = srtp_create(&srtp, &policy);
+    if (status) {
+        return status;
+    }
+    status = srtp_key_limit_set(srtp->stream_template->session_keys[0].limit,
+                                soft + margin);
+    if (status) {
+        srtp_dealloc(srtp);
+        return status;
+    }
+
+    key_limit_soft_events = 0;
+    key_limit_hard_events = 0;
+    srtp_install_event_handler(key_limit_event_handler);
+
+    while (hard_at == 0) {
+        uint8_t *pkt;
+        size_t len;
+        uint32_t ssrc = ssrcs[sent % num_streams];
+        uint16_t seq = (uint16_t)(sent / num_streams);
+
+        pkt = create_rtp_test_packet(16, ssrc, seq, 0, false, &len, NULL);
+        status = call_srtp_protect(srtp, pkt, &len, 0);
+        free(pkt);
+        sent++;
+
+        if (soft_at == 0 && key_limit_soft_events != 0) {
+            soft_at = sent;
+        }
+        if (status == srtp_err_status_key_expired) {
+            hard_at = sent;
+        } else if (status) {
+            break;
+        }
+    }
+
+    srtp_install_event_handler(NULL);
+    srtp_dealloc(srtp);
+
+    if (hard_at == 0 || key_limit_hard_events != 1) {
+        return srtp_err_status_algo_fail;
+    }
+    /* every other stream may have leased fewer than a batch of uses */
+    slack = (num_streams - 1) * (SRTP_KEY_LIMIT_BATCH - 1);
+    if (soft_at > margin + 1 || soft_at + slack <= margin) {
+        return srtp_err_status_algo_fail;
+    }
+    if (hard_at > soft + margin || hard_at + slack < soft + margin) {
+        return srtp_err_status_algo_fail;
+    }
+
+    return srtp_err_status_ok;
+}
+
+srtp_err_status_t srtp_test_detached_stream(void)
+{
+    const uint32_t ssrc = 0x5eed5eed;
+    srtp_policy_t policy;
+    srtp_t sender, receiver;
+    srtp_stream_t stream = NULL;
+    srtp_err_status_t status;
+
+    memset(&policy, 0, sizeof(policy));
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.ssrc.type = ssrc_any_inbound;
+    policy.key = test_key;
+    policy.window_size = 128;
+
+    /* templates belong to their session */
+    if (srtp_stream_create(&stream, &policy) != srtp_err_status_bad_param) {
+        return srtp_err_status_fail;
+    }
+
+    policy.ssrc.type = ssrc_specific;
+    policy.ssrc.value = ssrc;
+    status = srtp_create(&sender, &policy);
+    if (status) {
+        return status;
+    }
+    status = srtp_create(&receiver, NULL);
+    if (status) {
+        srtp_dealloc(sender);
+        return status;
+    }
+
+    status = srtp_stream_create(&stream, &policy);
+    if (status == srtp_err_status_ok) {
+        status = srtp_stream_attach(receiver, stream);
+        if (status) {
+            srtp_stream_destroy(stream);
+        }
+    }
+
+    /* a second stream for the same ssrc is refused and stays the caller's */
+    if (status == srtp_err_status_ok) {
+        status = srtp_stream_create(&stream, &policy);
+    }
+    if (status == srtp_err_status_ok) {
+        if (srtp_stream_attach(receiver, stream) !=
+            srtp_err_status_bad_param) {
+            status = srtp_err_status_fail;
+        }
+        srtp_stream_destroy(stream);
+    }
+
+    for (uint16_t seq = 0; seq < 4 && status == srtp_err_status_ok; seq++) {
+        status = test_export_send(sender, receiver, ssrc, seq, NULL, NULL);
+    }
+
+    /* once detached, the session no longer knows the ssrc */
+    if (status == srtp_err_status_ok) {
+        status = srtp_stream_detach(receiver, ssrc, &stream);
+    }
+    if (status == srtp_err_status_ok) {
+        if (stream == NULL) {
+            status = srtp_err_status_fail;
+        } else {
+            status = srtp_stream_destroy(stream);
+        }
+    }
+    if (status == srtp_err_status_ok &&
+        test_export_send(sender, receiver, ssrc, 4, NULL, NULL) !=
+            srtp_err_status_no_ctx) {
+        status = srtp_err_status_fail;
+    }
+    if (status == srtp_err_status_ok &&
+        srtp_stream_detach(receiver, ssrc, &stream) != srtp_err_status_no_ctx) {
+        status = srtp_err_status_fail;
+    }
+    srtp_dealloc(receiver);
+
+    /*
+     * a stream cloned from a template is freed by detach, also after the
+     * template was replaced
+     */
+    if (status == srtp_err_status_ok) {
+        policy.ssrc.type = ssrc_any_inbound;
+        status = srtp_create(&receiver, &policy);
+        if (status == srtp_err_status_ok) {
+            status = test_export_send(sender, receiver, ssrc, 5, NULL, NULL);
+            if (status == srtp_err_status_ok) {
+                status = srtp_update(receiver, &policy);
+            }
+            if (status == srtp_err_status_ok) {
+                status = srtp_stream_detach(receiver, ssrc, &stream);
+            }
+            if (status == srtp_err_status_ok && stream != NULL) {
+                status = srtp_err_status_fail;
+            }
+            srtp_dealloc(receiver);
+        }
+    }
+
+    srtp_dealloc(sender);
+
+    return status;
+}
+
+srtp_err_status_t srtp_test_unprotect_partial(void)
+{
+    const uint32_t ssrc = 0x0badcafe;
+    const size_t hdr_len = 12;
+    const size_t payload_len = 100;
+    const size_t prefix = 5;
+    srtp_policy_t policy;
+    srtp_t sender, receiver;
+    srtp_unprotect_resume_t resume;
+    srtp_err_status_t status;
+    uint8_t *plain, *pkt;
+    uint8_t out[256];
+    size_t plain_len, len, out_len;
+
+    memset(&policy, 0, sizeof(policy));
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.ssrc.type = ssrc_any_outbound;
+    policy.key = test_key;
+    policy.window_size = 128;
+
+    status = srtp_create(&sender, &policy);
+    if (status) {
+        return status;
+    }
+    policy.ssrc.type = ssrc_any_inbound;
+    status = srtp_create(&receiver, &policy);
+    if (status) {
+        srtp_dealloc(sender);
+        return status;
+    }
+
+    plain = create_rtp_test_packet(payload_len, ssrc, 1, 1, false, &plain_len,
+                                   NULL);
+
+    for (uint16_t seq = 1; seq <= 3 && status == srtp_err_status_ok; seq++) {
+        pkt = create_rtp_test_packet(payload_len, ssrc, seq, 1, false, &len,
+                                     NULL);
+        ((srtp_hdr_t *)plain)->seq = htons(seq);
+        status = call_srtp_protect(sender, pkt, &len, 0);
+
+        /* only the header and the first few payload octets are clear */
+        out_len = sizeof(out);
+        if (status == srtp_err_status_ok) {
+            status = srtp_unprotect_partial(receiver, pkt, len, out, &out_len,
+                                            prefix, &resume);
+        }
+        if (status == srtp_err_status_ok &&
+            (out_len != plain_len ||
+             memcmp(out, plain, hdr_len + prefix) != 0 ||
+             memcmp(out, plain, plain_len) == 0)) {
+            status = srtp_err_status_algo_fail;
+        }
+
+        /* the second packet is dropped without being finished */
+        if (status == srtp_err_status_ok && seq != 2) {
+            status = srtp_unprotect_finish(receiver, out, out_len, &resume);
+            if (status == srtp_err_status_ok &&
+                memcmp(out, plain, plain_len) != 0) {
+                status = srtp_err_status_algo_fail;
+            }
+        }
+
+        /* the replay database saw the packet */
+        if (status == srtp_err_status_ok) {
+            out_len = sizeof(out);
+            if (srtp_unprotect_partial(receiver, pkt, len, out, &out_len,
+                                       prefix, &resume) !=
+                srtp_err_status_replay_fail) {
+                status = srtp_err_status_algo_fail;
+            }
+        }
+        free(pkt);
+    }
+
+    /* a tampered packet is rejected before anything is decrypted */
+    if (status == srtp_err_status_ok) {
+        pkt = create_rtp_test_packet(payload_len, ssrc, 4, 1, false, &len,
+                                     NULL);
+        status = call_srtp_protect(sender, pkt, &len, 0);
+        if (status == srtp_err_status_ok) {
+            pkt[hdr_len + prefix + 10] ^= 1;
+            out_len = sizeof(out);
+            if (srtp_unprotect_partial(receiver, pkt, len, out, &out_len,
+                                       prefix, &resume) !=
+                srtp_err_status_auth_fail) {
+                status = srtp_err_status_algo_fail;
+            }
+        }
+        free(pkt);
+    }
+
+    free(plain);
+    srtp_dealloc(sender);
+    srtp_dealloc(receiver);
+
+    return status;
+}
+
+/*
+ * reserve indexes for a run of packets, complete them out of order as
+ * worker threads would, and check the output matches srtp_protect()
+ */
+srtp_err_status_t srtp_test_protect_reserve(void)
+{
+#define RESERVE_TEST_PACKETS 8
+    const uint32_t ssrc = 0x7e57ab1e;
+    const srtp_session_keys_t *keys;
+    srtp_policy_t policy;
+    srtp_t sender, reference, receiver;
+    srtp_protect_ticket_t tickets[RESERVE_TEST_PACKETS];
+    uint8_t *pkts[RESERVE_TEST_PACKETS];
+    size_t lens[RESERVE_TEST_PACKETS];
+    srtp_err_status_t status;
+    uint8_t *ref;
+    size_t ref_len, len;
+    size_t n = 0;
+
+    memset(&policy, 0, sizeof(policy));
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.ssrc.type = ssrc_any_outbound;
+    policy.key = test_key;
+    policy.window_size = 128;
+
+    status = srtp_create(&sender, &policy);
+    if (status) {
+        return status;
+    }
+    status = srtp_create(&reference, &policy);
+    if (status) {
+        srtp_dealloc(sender);
+        return status;
+    }
+    policy.ssrc.type = ssrc_any_inbound;
+    status = srtp_create(&receiver, &policy);
+    if (status) {
+        srtp_dealloc(sender);
+        srtp_dealloc(reference);
+        return status;
+    }
+
+    /* transforms that keep per-packet state in the stream are refused */
+    keys = &sender->stream_template->session_keys[0];
+    if (keys->rtp_cipher->type->start_call == NULL ||
+        keys->rtp_auth->type->start_call == NULL) {
+        pkts[0] = create_rtp_test_packet(64, ssrc, 1, 0, false, &lens[0],
+                                         NULL);
+        if (srtp_protect_reserve(sender, pkts[0], lens[0],
+                                 lens[0] + SRTP_MAX_TRAILER_LEN, 0,
+                                 &tickets[0]) != srtp_err_status_no_such_op) {
+            status = srtp_err_status_algo_fail;
+        }
+        free(pkts[0]);
+        srtp_dealloc(sender);
+        srtp_dealloc(reference);
+        srtp_dealloc(receiver);
+        return status;
+    }
+
+    /* the serial step, in packet order */
+    for (; n < RESERVE_TEST_PACKETS && status == srtp_err_status_ok; n++) {
+        pkts[n] = create_rtp_test_packet(64, ssrc, (uint16_t)(n + 1),
+                                         (uint32_t)n, false, &lens[n], NULL);
+
+        /* a packet that will not fit its output buffer uses no index */
+        if (srtp_protect_reserve(sender, pkts[n], lens[n], lens[n], 0,
+                                 &tickets[n]) != srtp_err_status_buffer_small) {
+            status = srtp_err_status_algo_fail;
+            n++;
+            break;
+        }
+        status = srtp_protect_reserve(sender, pkts[n], lens[n],
+                                      lens[n] + SRTP_MAX_TRAILER_LEN, 0,
+                                      &tickets[n]);
+    }
+
+    /* a ticket only fits the packet it was issued for */
+    if (status == srtp_err_status_ok) {
+        len = lens[0] + SRTP_MAX_TRAILER_LEN;
+        if (srtp_protect_complete(&tickets[1], pkts[0], lens[0], pkts[0],
+                                  &len) != srtp_err_status_bad_param) {
+            status = srtp_err_status_algo_fail;
+        }
+    }
+
+    /* the crypto step, in any order */
+    for (size_t i = RESERVE_TEST_PACKETS; i > 0 && status == srtp_err_status_ok;
+         i--) {
+        len = lens[i - 1] + SRTP_MAX_TRAILER_LEN;
+        status = srtp_protect_complete(&tickets[i - 1], pkts[i - 1],
+                                       lens[i - 1], pkts[i - 1], &len);
+        lens[i - 1] = len;
+    }
+
+    for (size_t i = 0; i < RESERVE_TEST_PACKETS && status == srtp_err_status_ok;
+         i++) {
+        ref = create_rtp_test_packet(64, ssrc, (uint16_t)(i + 1), (uint32_t)i,
+                                     false, &ref_len, NULL);
+        status = call_srtp_protect(reference, ref, &ref_len, 0);
+        if (status == srtp_err_status_ok &&
+            (ref_len != lens[i] || memcmp(ref, pkts[i], ref_len) != 0)) {
+            status = srtp_err_status_algo_fail;
+        }
+        free(ref);
+        if (status == srtp_err_status_ok) {
+            status = call_srtp_unprotect(receiver, pkts[i], &lens[i]);
+        }
+    }
+
+    /* the index stays reserved, so the packet cannot be sent twice */
+    if (status == srtp_err_status_ok) {
+        ref = create_rtp_test_packet(64, ssrc, 1, 0, false, &ref_len, NULL);
+        if (srtp_protect_reserve(sender, ref, ref_len,
+                                 ref_len + SRTP_MAX_TRAILER_LEN, 0,
+                                 &tickets[0]) != srtp_err_status_replay_fail) {
+            status = srtp_err_status_algo_fail;
+        }
+        free(ref);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        free(pkts[i]);
+    }
+    srtp_dealloc(sender);
+    srtp_dealloc(reference);
+    srtp_dealloc(receiver);
+
+    return status;
+#undef RESERVE_TEST_PACKETS
+}
+
+srtp_err_status_t srtp_test_demux(void)
+{
+#define DEMUX_TEST_PACKETS 6
+    const uint32_t ssrc_a = 0xaaaa0001;
+    const uint32_t ssrc_b = 0xbbbb0002;
+    srtp_policy_t policy;
+    srtp_t sender_a, sender_b, receiver_a, receiver_b;
+    srtp_demux_t demux;
+    srtp_demux_packet_t batch[DEMUX_TEST_PACKETS];
+    uint8_t *plain[DEMUX_TEST_PACKETS];
+    size_t plain_len[DEMUX_TEST_PACKETS];
+    srtp_err_status_t status;
+    uint8_t *pkt;
+    size_t len;
+
+    memset(&policy, 0, sizeof(policy));
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.window_size = 128;
+
+    /* session a uses a template, session b a specific stream */
+    policy.ssrc.type = ssrc_any_outbound;
+    policy.key = test_key;
+    status = srtp_create(&sender_a, &policy);
+    if (status) {
+        return status;
+    }
+    policy.ssrc.type = ssrc_any_inbound;
+    status = srtp_create(&receiver_a, &policy);
+    if (status) {
+        return status;
+    }
+    policy.ssrc.type = ssrc_specific;
+    policy.ssrc.value = ssrc_b;
+    policy.key = test_key_2;
+    status = srtp_create(&sender_b, &policy);
+    if (status) {
+        return status;
+    }
+    status = srtp_create(&receiver_b, &policy);
+    if (status) {
+        return status;
+    }
+
+    status = srtp_demux_create(&demux);
+    if (status == srtp_err_status_ok) {
+        status = srtp_demux_add_session(demux, 1, receiver_a);
+    }
+    if (status == srtp_err_status_ok) {
+        status = srtp_demux_add_session(demux, 2, receiver_b);
+    }
+
+    /* extra contexts make the table grow */
+    for (uint64_t id = 100; id < 200 && status == srtp_err_status_ok; id++) {
+        status = srtp_demux_add_session(demux, id, receiver_b);
+    }
+    for (uint64_t id = 100; id < 200 && status == srtp_err_status_ok; id++) {
+        status = srtp_demux_remove_session(demux, id);
+    }
+    if (status) {
+        return status;
+    }
+
+    /* a batch mixing both sessions, twice over */
+    for (size_t round = 0; round < 2 && status == srtp_err_status_ok;
+         round++) {
+        for (size_t i = 0; i < DEMUX_TEST_PACKETS; i++) {
+            bool is_a = (i % 2) == 0;
+            uint16_t seq = (uint16_t)(round * DEMUX_TEST_PACKETS + i);
+
+            plain[i] = create_rtp_test_packet(40, is_a ? ssrc_a : ssrc_b, seq,
+                                              seq, false, &plain_len[i], NULL);
+            pkt = create_rtp_test_packet(40, is_a ? ssrc_a : ssrc_b, seq, seq,
+                                         false, &len, NULL);
+            if (status == srtp_err_status_ok) {
+                status = call_srtp_protect(is_a ? sender_a : sender_b, pkt,
+                                           &len, 0);
+            }
+            batch[i].context_id = is_a ? 1 : 2;
+            batch[i].data = pkt;
+            batch[i].len = len;
+            batch[i].is_rtcp = false;
+        }
+        if (status == srtp_err_status_ok) {
+            status = srtp_demux_unprotect_batch(demux, batch,
+                                                DEMUX_TEST_PACKETS);
+        }
+        for (size_t i = 0; i < DEMUX_TEST_PACKETS; i++) {
+            if (status == srtp_err_status_ok) {
+                status = batch[i].status;
+            }
+            if (status == srtp_err_status_ok &&
+                (batch[i].len != plain_len[i] ||
+                 memcmp(batch[i].data, plain[i], plain_len[i]) != 0)) {
+                status = srtp_err_status_algo_fail;
+            }
+            free(batch[i].data);
+            free(plain[i]);
+        }
+    }
+
+    /* the wrong context does not authenticate, an unknown one is absent */
+    if (status == srtp_err_status_ok) {
+        pkt = create_rtp_test_packet(40, ssrc_b, 100, 100, false, &len, NULL);
+        status = call_srtp_protect(sender_b, pkt, &len, 0);
+        if (status == srtp_err_status_ok &&
+            (srtp_demux_unprotect(demux, 1, pkt, len, pkt, &len) !=
+                 srtp_err_status_auth_fail ||
+             srtp_demux_unprotect(demux, 3, pkt, len, pkt, &len) !=
+                 srtp_err_status_no_ctx)) {
+            status = srtp_err_status_algo_fail;
+        }
+        free(pkt);
+    }
+
+    /*
+     * a stream removed from the session directly is not used from the
+     * table; the template clones a new one
+     */
+    if (status == srtp_err_status_ok) {
+        status = srtp_stream_remove(receiver_a, ssrc_a);
+    }
+    if (status == srtp_err_status_ok) {
+        pkt = create_rtp_test_packet(40, ssrc_a, 200, 200, false, &len, NULL);
+        status = call_srtp_protect(sender_a, pkt, &len, 0);
+        if (status == srtp_err_status_ok) {
+            status = srtp_demux_unprotect(demux, 1, pkt, len, pkt, &len);
+        }
+        free(pkt);
+    }
+
+    /* SRTCP uses the stream found in the table */
+    if (status == srtp_err_status_ok) {
+        pkt = create_rtcp_test_packet(24, ssrc_a, &len, NULL);
+        status = call_srtp_protect_rtcp(sender_a, pkt, &len, 0);
+        if (status == srtp_err_status_ok) {
+            status = srtp_demux_unprotect_rtcp(demux, 1, pkt, len, pkt, &len);
+        }
+        free(pkt);
+    }
+
+    /* a stream removed through the demultiplexer is gone */
+    if (status == srtp_err_status_ok) {
+        status = srtp_demux_stream_remove(demux, 2, ssrc_b);
+    }
+    if (status == srtp_err_status_ok) {
+        pkt = create_rtp_test_packet(40, ssrc_b, 101, 101, false, &len, NULL);
+        status = call_srtp_protect(sender_b, pkt, &len, 0);
+        if (status == srtp_err_status_ok &&
+            srtp_demux_unprotect(demux, 2, pkt, len, pkt, &len) !=
+                srtp_err_status_no_ctx) {
+            status = srtp_err_status_algo_fail;
+        }
+        free(pkt);
+    }
+
+    srtp_demux_dealloc(demux);
+    srtp_dealloc(sender_a);
+    srtp_dealloc(sender_b);
+    srtp_dealloc(receiver_a);
+    srtp_dealloc(receiver_b);
+
+    return status;
+#undef DEMUX_TEST_PACKETS
+}
+
+/*
+ * a receiver whose policy sets window_size_max grows the window of a
+ * cloned stream when packets arrive reordered by nearly its size, and
+ * keeps rejecting indices that had already left the smaller window
+ */
+srtp_err_status_t srtp_test_adaptive_window(void)
+{
+#define ADAPTIVE_TEST_PACKETS 100
+    srtp_policy_t policy;
+    srtp_t sender, receiver;
+    uint8_t *pkt[ADAPTIVE_TEST_PACKETS + 1];
+    size_t pkt_len[ADAPTIVE_TEST_PACKETS + 1];
+    const uint32_t ssrc = 0xcafebabe;
+    srtp_stream_t stream;
+    srtp_err_status_t status;
+    size_t len;
+    /* sequence numbers in delivery order, and the expected outcome */
+    const struct {
+        uint16_t seq;
+        srtp_err_status_t status;
+    } steps[] = {
+        { 100, srtp_err_status_ok },         /* jump ahead               */
+        { 50, srtp_err_status_ok },          /* 50 behind: window grows  */
+        { 50, srtp_err_status_replay_fail }, /* plain replay             */
+        { 40, srtp_err_status_ok },          /* inside the old window    */
+        { 20, srtp_err_status_replay_fail }, /* accepted before growing  */
+        { 35, srtp_err_status_replay_fail }, /* had left the old window  */
+    };
+
+    memset(&policy, 0, sizeof(policy));
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.key = test_key;
+    policy.window_size = 64;
+
+    /* the upper bound may not be below the window size */
+    policy.ssrc.type = ssrc_any_inbound;
+    policy.window_size_max = 32;
+    if (srtp_create(&receiver, &policy) != srtp_err_status_bad_param) {
+        return srtp_err_status_algo_fail;
+    }
+
+    policy.window_size_max = 512;
+    status = srtp_create(&receiver, &policy);
+    if (status) {
+        return status;
+    }
+    policy.ssrc.type = ssrc_any_outbound;
+    policy.window_size_max = 0;
+    status = srtp_create(&sender, &policy);
+    if (status) {
+        srtp_dealloc(receiver);
+        return status;
+    }
+
+    for (uint16_t seq = 1; seq <= ADAPTIVE_TEST_PACKETS; seq++) {
+        pkt[seq] = create_rtp_test_packet(40, ssrc, seq, seq, false,
+                                          &pkt_len[seq], NULL);
+        if (status == srtp_err_status_ok) {
+            status = call_srtp_protect(sender, pkt[seq], &pkt_len[seq], 0);
+        }
+    }
+
+    /* in-order delivery up to 30 leaves the window at its minimum */
+    for (uint16_t seq = 1; seq <= 30 && status == srtp_err_status_ok; seq++) {
+        uint8_t copy[128];
+        len = pkt_len[seq];
+        memcpy(copy, pkt[seq], len);
+        status = call_srtp_unprotect(receiver, copy, &len);
+    }
+    stream = srtp_get_stream(receiver, htonl(ssrc));
+    if (status == srtp_err_status_ok &&
+        (stream == NULL ||
+         srtp_rdbx_get_window_size(&stream->rtp_rdbx) != 64)) {
+        status = srtp_err_status_algo_fail;
+    }
+
+    for (size_t i = 0;
+         i < sizeof(steps) / sizeof(steps[0]) && status == srtp_err_status_ok;
+         i++) {
+        uint8_t copy[128];
+        len = pkt_len[steps[i].seq];
+        memcpy(copy, pkt[steps[i].seq], len);
+        if (call_srtp_unprotect(receiver, copy, &len) != steps[i].status) {
+            status = srtp_err_status_algo_fail;
+        }
+    }
+    if (status == srtp_err_status_ok &&
+        srtp_rdbx_get_window_size(&stream->rtp_rdbx) != 128) {
+        status = srtp_err_status_algo_fail;
+    }
+
+    for (uint16_t seq = 1; seq <= ADAPTIVE_TEST_PACKETS; seq++) {
+        free(pkt[seq]);
+    }
+    srtp_dealloc(sender);
+    srtp_dealloc(receiver);
+
+    return status;
+#undef ADAPTIVE_TEST_PACKETS
+}
+
+struct log_level_test_data {
+    size_t count;
+    bool collision;
+};
+
+static void log_level_test_handler(srtp_log_level_t level,
+                                   const char *msg,
+                                   void *data)
+{
+    struct log_level_test_data *d = (struct log_level_test_data *)data;
+    (void)level;
+    d->count++;
+    if (strstr(msg, "SSRC collision") != NULL) {
+        d->collision = true;
+    }
+}
+
+static srtp_debug_module_t mod_log_test = {
+    false,     /* debugging is off by default */
+    "log test" /* printable name for module   */
+};
+
+/*
+ * a module that is switched off is filtered at every level, and switching
+ * one module leaves the others as they are
+ */
+static srtp_err_status_t srtp_test_log_modules(void)
+{
+    struct log_level_test_data data = { 0, false };
+    bool driver_on = mod_driver.on;
+    srtp_err_status_t status;
+
+    status = srtp_crypto_kernel_load_debug_module(&mod_log_test);
+    if (status) {
+        return status;
+    }
+    srtp_install_log_handler(log_level_test_handler, &data);
+
+    srtp_set_debug_module(mod_log_test.name, false);
+    srtp_set_debug_module(mod_driver.name, false);
+    if (srtp_err_report_enabled(srtp_err_level_error, &mod_driver) ||
+        srtp_err_report_enabled(srtp_err_level_warning, &mod_log_test) ||
+        !srtp_err_report_enabled(srtp_err_level_error, NULL)) {
+        status = srtp_err_status_algo_fail;
+    }
+
+    srtp_set_debug_module(mod_driver.name, true);
+    if (!srtp_err_report_enabled(srtp_err_level_warning, &mod_driver) ||
+        srtp_err_report_enabled(srtp_err_level_warning, &mod_log_test)) {
+        status = srtp_err_status_algo_fail;
+    }
+
+    srtp_set_debug_module(mod_log_test.name, true);
+    srtp_set_debug_module(mod_driver.name, false);
+    if (srtp_err_report_enabled(srtp_err_level_debug, &mod_driver) ||
+        !srtp_err_report_enabled(srtp_err_level_debug, &mod_log_test)) {
+        status = srtp_err_status_algo_fail;
+    }
+
+    srtp_set_debug_module(mod_driver.name, driver_on);
+    srtp_install_log_handler(NULL, NULL);
+
+    return status;
+}
+
+/*
+ * a stream that is protected after it has received raises an SSRC
+ * collision, which the default event handler reports as a warning only
+ * while warnings pass the log level
+ */
+srtp_err_status_t srtp_test_log_level(void)
+{
+    srtp_policy_t policy;
+    srtp_t sender, receiver;
+    struct log_level_test_data data = { 0, false };
+    const uint32_t ssrc = 0xc011c0de;
+    srtp_err_status_t status;
+    uint8_t *pkt;
+    size_t len;
+
+    if (srtp_set_log_level((srtp_log_level_t)42) !=
+        srtp_err_status_bad_param) {
+        return srtp_err_status_algo_fail;
+    }
+
+    status = srtp_test_log_modules();
+    if (status) {
+        return status;
+    }
+
+    memset(&policy, 0, sizeof(policy));
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.ssrc.type = ssrc_specific;
+    policy.ssrc.value = ssrc;
+    policy.key = test_key;
+    policy.window_size = 128;
+    status = srtp_create(&sender, &policy);
+    if (status) {
+        return status;
+    }
+    status = srtp_create(&receiver, &policy);
+    if (status) {
+        srtp_dealloc(sender);
+        return status;
+    }
+
+    /* filtered out: nothing reaches the handler */
+    status = srtp_set_log_level(srtp_log_level_error);
+    srtp_install_log_handler(log_level_test_handler, &data);
+    srtp_install_event_handler(srtp_event_reporter);
+
+    /* the receiving stream now has a direction */
+    pkt = create_rtp_test_packet(40, ssrc, 1, 1, false, &len, NULL);
+    if (status == srtp_err_status_ok) {
+        status = call_srtp_protect(sender, pkt, &len, 0);
+    }
+    if (status == srtp_err_status_ok) {
+        status = call_srtp_unprotect(receiver, pkt, &len);
+    }
+    free(pkt);
+
+    if (status == srtp_err_status_ok) {
+        pkt = create_rtp_test_packet(40, ssrc, 2, 2, false, &len, NULL);
+        status = call_srtp_protect(receiver, pkt, &len, 0);
+        free(pkt);
+    }
+    if (status == srtp_err_status_ok && data.count != 0) {
+        status = srtp_err_status_algo_fail;
+    }
+
+    /* let through: the collision is reported in a single message */
+    if (status == srtp_err_status_ok) {
+        status = srtp_set_log_level(srtp_log_level_warning);
+    }
+    if (status == srtp_err_status_ok) {
+        pkt = create_rtp_test_packet(40, ssrc, 3, 3, false, &len, NULL);
+        status = call_srtp_protect(receiver, pkt, &len, 0);
+        free(pkt);
+    }
+    if (status == srtp_err_status_ok && (data.count != 1 || !data.collision)) {
+        status = srtp_err_status_algo_fail;
+    }
+
+    srtp_set_log_level(srtp_log_level_debug);
+    srtp_install_log_handler(NULL, NULL);
+    srtp_dealloc(sender);
+    srtp_dealloc(receiver);
+
+    return status;
+}
+
+static bool mux_info_is(const srtp_packet_info_t *info,
+                        bool is_rtcp,
+                        uint8_t payload_type,
+                        uint16_t seq,
+                        size_t header_len,
+                        size_t payload_len)
+{
+    return info->is_rtcp == is_rtcp && info->payload_type == payload_type &&
+           info->seq == seq && info->ssrc == 0xabad1dea &&
+           info->header_len == header_len && info->payload_len == payload_len;
+}
+
+/*
+ * RTP and RTCP packets of one stream, sharing a transport, go through a
+ * single entry point that classifies them and describes their headers
+ */
+srtp_err_status_t srtp_test_unprotect_mux(void)
+{
+    srtp_policy_t policy;
+    srtp_t sender, receiver;
+    srtp_mux_packet_t batch[5];
+    srtp_packet_info_t info;
+    const uint32_t ssrc = 0xabad1dea;
+    uint8_t runt[4] = { 0x80, 0xc8, 0x00, 0x00 };
+    uint8_t *replay;
+    srtp_err_status_t status;
+    size_t len;
+
+    memset(&policy, 0, sizeof(policy));
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.key = test_key;
+    policy.window_size = 128;
+    policy.ssrc.type = ssrc_any_outbound;
+    status = srtp_create(&sender, &policy);
+    if (status) {
+        return status;
+    }
+    policy.ssrc.type = ssrc_any_inbound;
+    status = srtp_create(&receiver, &policy);
+    if (status) {
+        srtp_dealloc(sender);
+        return status;
+    }
+
+    memset(batch, 0, sizeof(batch));
+    batch[0].data = create_rtp_test_packet(40, ssrc, 1, 1, true,
+                                           &batch[0].len, NULL);
+    status = call_srtp_protect(sender, batch[0].data, &batch[0].len, 0);
+    replay = malloc(batch[0].len);
+    if (replay == NULL) {
+        status = srtp_err_status_alloc_fail;
+    } else {
+        memcpy(replay, batch[0].data, batch[0].len);
+    }
+    batch[1].data = create_rtcp_test_packet(24, ssrc, &batch[1].len, NULL);
+    if (status == srtp_err_status_ok) {
+        status =
+            call_srtp_protect_rtcp(sender, batch[1].data, &batch[1].len, 0);
+    }
+    batch[2].data = create_rtp_test_packet(40, ssrc, 2, 2, false,
+                                           &batch[2].len, NULL);
+    if (status == srtp_err_status_ok) {
+        status = call_srtp_protect(sender, batch[2].data, &batch[2].len, 0);
+    }
+    batch[3].data = replay;
+    batch[3].len = batch[0].len;
+    batch[4].data = runt;
+    batch[4].len = sizeof(runt);
+
+    if (status == srtp_err_status_ok) {
+        status = srtp_unprotect_mux_batch(receiver, batch, 5);
+    }
+    if (status == srtp_err_status_ok &&
+        (batch[0].status != srtp_err_status_ok ||
+         !mux_info_is(&batch[0].info, false, 0xf, 1, 24, 40) ||
+         batch[1].status != srtp_err_status_ok ||
+         !mux_info_is(&batch[1].info, true, 200, 0, 8, 24) ||
+         batch[2].status != srtp_err_status_ok ||
+         !mux_info_is(&batch[2].info, false, 0xf, 2, 12, 40) ||
+         batch[3].status != srtp_err_status_replay_fail || batch[3].len != 0 ||
+         batch[4].status != srtp_err_status_bad_param)) {
+        status = srtp_err_status_algo_fail;
+    }
+
+    /* the single packet form */
+    free(batch[0].data);
+    batch[0].data = create_rtp_test_packet(40, ssrc, 3, 3, false, &len, NULL);
+    if (status == srtp_err_status_ok) {
+        status = call_srtp_protect(sender, batch[0].data, &len, 0);
+    }
+    if (status == srtp_err_status_ok) {
+        status = srtp_unprotect_mux(receiver, batch[0].data, len,
+                                    batch[0].data, &len, &info);
+    }
+    if (status == srtp_err_status_ok &&
+        (!mux_info_is(&info, false, 0xf, 3, 12, 40) || len != 52)) {
+        status = srtp_err_status_algo_fail;
+    }
+    if (status == srtp_err_status_ok &&
+        srtp_unprotect_mux(NULL, batch[0].data, len, batch[0].data, &len,
+                           &info) != srtp_err_status_bad_param) {
+        status = srtp_err_status_algo_fail;
+    }
+
+    free(batch[0].data);
+    free(batch[1].data);
+    free(batch[2].data);
+    free(replay);
+    srtp_dealloc(sender);
+    srtp_dealloc(receiver);
+
+    return status;
+}
+
+/*
+ * checkpoint_protect(session, ssrc, seq, rtcp, index) protects one RTP
+ * packet, or one RTCP packet if rtcp is set, and for RTCP returns the
+ * SRTCP index that was sent in *index
+ */
+static srtp_err_status_t checkpoint_protect(srtp_t session,
+                                            uint32_t ssrc,
+                                            uint16_t seq,
+                                            bool rtcp,
+                                            uint32_t *index)
+{
+    srtp_err_status_t status;
+    uint8_t *pkt;
+    uint32_t trailer;
+    size_t len;
+
+    if (rtcp) {
+        pkt = create_rtcp_test_packet(28, ssrc, &len, NULL);
+    } else {
+        pkt = create_rtp_test_packet(28, ssrc, seq, 0, false, &len, NULL);
+    }
+    if (pkt == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+
+    if (rtcp) {
+        status = call_srtp_protect_rtcp(session, pkt, &len, 0);
+        if (status == srtp_err_status_ok) {
+            /* the trailer sits in front of the 10 octet HMAC-SHA1-80 tag */
+            memcpy(&trailer, pkt + len - 10 - sizeof(trailer),
+                   sizeof(trailer));
+            *index = ntohl(trailer) & SRTCP_INDEX_MASK;
+        }
+    } else {
+        status = call_srtp_protect(session, pkt, &len, 0);
+    }
+
+    free(pkt);
+
+    return status;
+}
+
+/*
+ * test_tmp_path(path, len, name) names a scratch file after name and the
+ * process, since ctest may run several drivers in one directory at once
+ */
+static void test_tmp_path(char *path, size_t len, const char *name)
+{
+#ifdef HAVE_UNISTD_H
+    snprintf(path, len, "%s.%ld.tmp", name, (long)getpid());
+#else
+    snprintf(path, len, "%s.tmp", name);
+#endif
+}
+
+srtp_err_status_t srtp_test_checkpoint(void)
+{
+    char path[64];
+    srtp_policy_t policy;
+    srtp_t session;
+    srtp_err_status_t status;
+    uint64_t resume;
+    uint32_t rtcp_index = 0;
+
+    memset(&policy, 0, sizeof(policy));
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.key = test_key;
+    policy.window_size = 128;
+    policy.ssrc.type = ssrc_any_outbound;
+
+    test_tmp_path(path, sizeof(path), "srtp_driver_checkpoint");
+    remove(path);
+
+    /* a first run sends a few packets and stops without any cleanup */
+    status = srtp_create(&session, &policy);
+    if (status) {
+        return status;
+    }
+    status = srtp_checkpoint_open(session, path, 1);
+    if (status == srtp_err_status_no_such_op) {
+        /* no memory mapped files on this platform */
+        srtp_dealloc(session);
+        remove(path);
+        return srtp_err_status_ok;
+    }
+    for (uint16_t seq = 1; status == srtp_err_status_ok && seq <= 10; seq++) {
+        status = checkpoint_protect(session, 0xcafebabe, seq, false, NULL);
+    }
+    if (status == srtp_err_status_ok) {
+        status = checkpoint_protect(session, 0xcafebabe, 0, true, &rtcp_index);
+    }
+    if (status == srtp_err_status_ok &&
+        (srtp_checkpoint_get_resume_index(session, 0xcafebabe, &resume) ||
+         resume < 10 || rtcp_index != 1)) {
+        status = srtp_err_status_algo_fail;
+    }
+    srtp_dealloc(session);
+    if (status) {
+        remove(path);
+        return status;
+    }
+
+    /* the restarted sender must not go back to any reserved index */
+    status = srtp_create(&session, &policy);
+    if (status) {
+        remove(path);
+        return status;
+    }
+    status = srtp_checkpoint_open(session, path, 1);
+    if (status == srtp_err_status_ok &&
+        srtp_checkpoint_open(session, path, 1) != srtp_err_status_bad_param) {
+        status = srtp_err_status_algo_fail;
+    }
+    if (status == srtp_err_status_ok &&
+        checkpoint_protect(session, 0xcafebabe, 11, false, NULL) ==
+            srtp_err_status_ok) {
+        status = srtp_err_status_algo_fail;
+    }
+    if (status == srtp_err_status_ok) {
+        status = checkpoint_protect(session, 0xcafebabe,
+                                    (uint16_t)(resume + 1), false, NULL);
+    }
+    if (status == srtp_err_status_ok) {
+        status = checkpoint_protect(session, 0xcafebabe, 0, true, &rtcp_index);
+    }
+    if (status == srtp_err_status_ok && rtcp_index <= 4096) {
+        status = srtp_err_status_algo_fail;
+    }
+
+    /* the file was created with room for a single SSRC */
+    if (status == srtp_err_status_ok &&
+        checkpoint_protect(session, 0xdecafbad, 1, false, NULL) !=
+            srtp_err_status_alloc_fail) {
+        status = srtp_err_status_algo_fail;
+    }
+    if (status == srtp_err_status_ok) {
+        status = srtp_checkpoint_sync(session);
+    }
+
+    srtp_dealloc(session);
+    remove(path);
+
+    return status;
+}
+
+/*
+ * keylog_read(path, len) reads a whole key log into memory
+ */
+static uint8_t *keylog_read(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    uint8_t *buf = NULL;
+    long size;
+
+    if (f == NULL) {
+        return NULL;
+    }
+    if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) > 0 &&
+        fseek(f, 0, SEEK_SET) == 0) {
+        buf = malloc((size_t)size);
+        if (buf != NULL && fread(buf, 1, (size_t)size, f) != (size_t)size) {
+            free(buf);
+            buf = NULL;
+        }
+        *len = (size_t)size;
+    }
+    fclose(f);
+
+    return buf;
+}
+
+srtp_err_status_t srtp_test_keylog(void)
+{
+    char path[64];
+    srtp_keylog_entry_t entries[SRTP_MAX_NUM_MASTER_KEYS];
+    srtp_master_key_t keys[SRTP_MAX_NUM_MASTER_KEYS];
+    srtp_master_key_t *key_ptrs[SRTP_MAX_NUM_MASTER_KEYS];
+    srtp_policy_t policy;
+    srtp_t sender, sender_2, receiver;
+    srtp_stream_t stream;
+    srtp_err_status_t status;
+    uint8_t *log = NULL;
+    uint8_t *pkt;
+    uint64_t template_id, update_id;
+    size_t log_len = 0;
+    size_t num_keys;
+    size_t len;
+
+    test_tmp_path(path, sizeof(path), "srtp_driver_keylog");
+    remove(path);
+    status = srtp_keylog_open(path, 8);
+    if (status == srtp_err_status_no_such_op) {
+        /* no memory mapped files on this platform */
+        remove(path);
+        return srtp_err_status_ok;
+    }
+    if (status) {
+        remove(path);
+        return status;
+    }
+
+    /* an older session with a template of its own */
+    policy = default_policy;
+    policy.key = test_key;
+    policy.keys = NULL;
+    policy.num_master_keys = 0;
+    policy.use_mki = false;
+    policy.mki_size = 0;
+    status = srtp_create(&sender, &policy);
+    if (status) {
+        srtp_keylog_close();
+        remove(path);
+        return status;
+    }
+    srtp_dealloc(sender);
+
+    /* a template with two MKIs, and a stream that gets rekeyed */
+    policy = default_policy;
+    status = srtp_create(&sender, &policy);
+    if (status) {
+        srtp_keylog_close();
+        remove(path);
+        return status;
+    }
+    policy.ssrc.type = ssrc_specific;
+    policy.ssrc.value = 0xcafebabe;
+    policy.key = test_key_2;
+    policy.keys = NULL;
+    policy.num_master_keys = 0;
+    policy.use_mki = false;
+    policy.mki_size = 0;
+    status = srtp_create(&sender_2, &policy);
+    if (status == srtp_err_status_ok) {
+        policy.key = test_key;
+        status = srtp_update(sender_2, &policy);
+        srtp_dealloc(sender_2);
+    }
+
+    /*
+     * a stream built apart is logged as it joins the template's session;
+     * one that never joins a session is not logged
+     */
+    policy.ssrc.value = 0xfeedface;
+    policy.key = test_key_2;
+    if (status == srtp_err_status_ok) {
+        status = srtp_stream_create(&stream, &policy);
+    }
+    if (status == srtp_err_status_ok) {
+        status = srtp_stream_attach(sender, stream);
+        if (status) {
+            srtp_stream_destroy(stream);
+        }
+    }
+    policy.ssrc.value = 0xdecafbad;
+    if (status == srtp_err_status_ok) {
+        status = srtp_stream_create(&stream, &policy);
+    }
+    if (status == srtp_err_status_ok) {
+        status = srtp_stream_destroy(stream);
+    }
+
+    pkt = create_rtp_test_packet(28, 0xdeadbeef, 1, 1, false, &len, NULL);
+    if (status == srtp_err_status_ok) {
+        status = call_srtp_protect(sender, pkt, &len, 1);
+    }
+    srtp_dealloc(sender);
+    if (srtp_keylog_close() != srtp_err_status_ok && !status) {
+        status = srtp_err_status_write_fail;
+    }
+    if (status == srtp_err_status_ok) {
+        log = keylog_read(path, &log_len);
+        if (log == NULL) {
+            status = srtp_err_status_read_fail;
+        }
+    }
+
+    /* an unknown SSRC gets the keys of the template */
+    if (status == srtp_err_status_ok) {
+        status = srtp_keylog_find(log, log_len, 0xdeadbeef, 0, entries,
+                                  SRTP_MAX_NUM_MASTER_KEYS, &num_keys);
+    }
+    if (status == srtp_err_status_ok &&
+        (num_keys != 2 || entries[0].ssrc.type != ssrc_any_outbound ||
+         entries[1].key_len < SRTP_AES_ICM_128_KEY_LEN_WSALT ||
+         memcmp(entries[1].key, test_key_2, SRTP_AES_ICM_128_KEY_LEN_WSALT) ||
+         entries[1].mki_len != TEST_MKI_ID_SIZE ||
+         memcmp(entries[1].mki, test_mki_id_2, TEST_MKI_ID_SIZE))) {
+        status = srtp_err_status_algo_fail;
+    }
+    template_id = entries[0].session_id;
+
+    /* which is enough to set up a receiver for the captured packet */
+    if (status == srtp_err_status_ok) {
+        memset(&policy, 0, sizeof(policy));
+        policy.ssrc.type = ssrc_specific;
+        policy.ssrc.value = 0xdeadbeef;
+        policy.rtp = entries[0].rtp;
+        policy.rtcp = entries[0].rtcp;
+        for (size_t i = 0; i < num_keys; i++) {
+            keys[i].key = entries[i].key;
+            keys[i].mki_id = entries[i].mki;
+            key_ptrs[i] = &keys[i];
+        }
+        policy.keys = key_ptrs;
+        policy.num_master_keys = num_keys;
+        policy.use_mki = true;
+        policy.mki_size = entries[0].mki_len;
+        policy.window_size = 128;
+        status = srtp_create(&receiver, &policy);
+        if (status == srtp_err_status_ok) {
+            status = call_srtp_unprotect(receiver, pkt, &len);
+            srtp_dealloc(receiver);
+        }
+    }
+
+    /* a known SSRC gets the keys it was last updated with */
+    if (status == srtp_err_status_ok) {
+        status = srtp_keylog_find(log, log_len, 0xcafebabe, 0, entries,
+                                  SRTP_MAX_NUM_MASTER_KEYS, &num_keys);
+    }
+    if (status == srtp_err_status_ok &&
+        (num_keys != 1 || entries[0].ssrc.type != ssrc_specific ||
+         entries[0].ssrc.value != 0xcafebabe || entries[0].mki_len != 0 ||
+         entries[0].session_id == template_id ||
+         memcmp(entries[0].key, test_key, SRTP_AES_ICM_128_KEY_LEN_WSALT))) {
+        status = srtp_err_status_algo_fail;
+    }
+    update_id = entries[0].session_id;
+
+    /*
+     * the keys it had before the update, then the templates of every
+     * session, are the next candidates
+     */
+    if (status == srtp_err_status_ok) {
+        status = srtp_keylog_find(log, log_len, 0xcafebabe, 1, entries,
+                                  SRTP_MAX_NUM_MASTER_KEYS, &num_keys);
+    }
+    if (status == srtp_err_status_ok &&
+        (num_keys != 1 || entries[0].ssrc.type != ssrc_specific ||
+         entries[0].session_id != update_id ||
+         memcmp(entries[0].key, test_key_2, SRTP_AES_ICM_128_KEY_LEN_WSALT))) {
+        status = srtp_err_status_algo_fail;
+    }
+    if (status == srtp_err_status_ok) {
+        status = srtp_keylog_find(log, log_len, 0xcafebabe, 2, entries,
+                                  SRTP_MAX_NUM_MASTER_KEYS, &num_keys);
+    }
+    if (status == srtp_err_status_ok &&
+        (num_keys != 2 || entries[0].ssrc.type != ssrc_any_outbound ||
+         entries[0].session_id != template_id)) {
+        status = srtp_err_status_algo_fail;
+    }
+    if (status == srtp_err_status_ok) {
+        status = srtp_keylog_find(log, log_len, 0xcafebabe, 3, entries,
+                                  SRTP_MAX_NUM_MASTER_KEYS, &num_keys);
+    }
+    if (status == srtp_err_status_ok &&
+        (num_keys != 1 || entries[0].ssrc.type != ssrc_any_outbound ||
+         entries[0].session_id == template_id ||
+         entries[0].session_id == update_id ||
+         memcmp(entries[0].key, test_key, SRTP_AES_ICM_128_KEY_LEN_WSALT))) {
+        status = srtp_err_status_algo_fail;
+    }
+    if (status == srtp_err_status_ok &&
+        srtp_keylog_find(log, log_len, 0xcafebabe, 4, entries,
+                         SRTP_MAX_NUM_MASTER_KEYS,
+                         &num_keys) != srtp_err_status_no_ctx) {
+        status = srtp_err_status_algo_fail;
+    }
+
+    /* an attached stream shares the session id of its session */
+    if (status == srtp_err_status_ok) {
+        status = srtp_keylog_find(log, log_len, 0xfeedface, 0, entries,
+                                  SRTP_MAX_NUM_MASTER_KEYS, &num_keys);
+    }
+    if (status == srtp_err_status_ok &&
+        (num_keys != 1 || entries[0].ssrc.type != ssrc_specific ||
+         entries[0].ssrc.value != 0xfeedface ||
+         entries[0].session_id != template_id ||
+         memcmp(entries[0].key, test_key_2, SRTP_AES_ICM_128_KEY_LEN_WSALT))) {
+        status = srtp_err_status_algo_fail;
+    }
+    if (status == srtp_err_status_ok) {
+        status = srtp_keylog_find(log, log_len, 0xdecafbad, 0, entries,
+                                  SRTP_MAX_NUM_MASTER_KEYS, &num_keys);
+    }
+    if (status == srtp_err_status_ok &&
+        entries[0].ssrc.type != ssrc_any_outbound) {
+        status = srtp_err_status_algo_fail;
+    }
+
+    if (status == srtp_err_status_ok &&
+        srtp_keylog_find(log, log_len, 0xcafebabe, 0, entries, 0,
+                         &num_keys) != srtp_err_status_buffer_small) {
+        status = srtp_err_status_algo_fail;
+    }
+    if (status == srtp_err_status_ok &&
+        srtp_keylog_find(log, 16, 0xcafebabe, 0, entries,
+                         SRTP_MAX_NUM_MASTER_KEYS,
+                         &num_keys) != srtp_err_status_parse_err) {
+        status = srtp_err_status_algo_fail;
+    }
+
+    free(pkt);
+    free(log);
+    remove(path);
+
+    return status;
+}
+
+#if defined(UDP_SEGMENT) && defined(UDP_GRO)
+/*
+ * segments_loopback() sends a protected packed buffer to itself over
+ * loopback with UDP_SEGMENT, receives it with UDP_GRO enabled, and
+ * unprotects whatever buffers arrive; *num_ok counts the packets that
+ * unprotected, or is SIZE_MAX if the kernel does not offer the options
+ */
+static srtp_err_status_t segments_loopback(srtp_t receiver,
+                                           const uint8_t *buf,
+                                           size_t len,
+                                           size_t stride,
+                                           size_t *num_ok)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    struct timeval tv = { 1, 0 };
+    uint8_t rx[2048];
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    srtp_mux_packet_t packets[16];
+    int gso_size = (int)stride;
+    size_t expected = (len + stride - 1) / stride;
+    srtp_err_status_t status = srtp_err_status_ok;
+    int one = 1;
+    int tx_fd, rx_fd;
+
+    *num_ok = 0;
+    tx_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    rx_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(0x7f000001);
+    if (tx_fd < 0 || rx_fd < 0 ||
+        bind(rx_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        getsockname(rx_fd, (struct sockaddr *)&addr, &addr_len) ||
+        setsockopt(rx_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) ||
+        setsockopt(rx_fd, IPPROTO_UDP, UDP_GRO, &one, sizeof(one)) ||
+        setsockopt(tx_fd, IPPROTO_UDP, UDP_SEGMENT, &gso_size,
+                   sizeof(gso_size)) ||
+        sendto(tx_fd, buf, len, 0, (struct sockaddr *)&addr, sizeof(addr)) !=
+            (ssize_t)len) {
+        /* no sockets, or a kernel without UDP segmentation offload */
+        *num_ok = SIZE_MAX;
+        goto done;
+    }
+
+    while (status == srtp_err_status_ok && *num_ok < expected) {
+        size_t num_packets = sizeof(packets) / sizeof(packets[0]);
+        size_t rx_stride;
+        ssize_t rx_len;
+
+        iov.iov_base = rx;
+        iov.iov_len = sizeof(rx);
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        rx_len = recvmsg(rx_fd, &msg, 0);
+        if (rx_len <= 0) {
+            status = srtp_err_status_read_fail;
+            break;
+        }
+
+        /* without a UDP_GRO message the datagram arrived on its own */
+        rx_stride = (size_t)rx_len;
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+             cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == IPPROTO_UDP &&
+                cmsg->cmsg_type == UDP_GRO) {
+                int size;
+                memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+                rx_stride = (size_t)size;
+            }
+        }
+
+        status = srtp_unprotect_segments(receiver, rx, (size_t)rx_len,
+                                         rx_stride, packets, &num_packets);
+        for (size_t i = 0; status == srtp_err_status_ok && i < num_packets;
+             i++) {
+            if (packets[i].status != srtp_err_status_ok) {
+                status = packets[i].status;
+            }
+        }
+        *num_ok += num_packets;
+    }
+
+done:
+    if (tx_fd >= 0) {
+        close(tx_fd);
+    }
+    if (rx_fd >= 0) {
+        close(rx_fd);
+    }
+    return status;
+}
+#endif
+
+/*
+ * four RTP packets, three of them 100 octets long and the last 52, are
+ * packed at a stride of 100, protected as one buffer, and unprotected
+ * again both from the buffer and after a trip through loopback
+ */
+srtp_err_status_t srtp_test_segments(void)
+{
+    const size_t stride = 100;
+    const size_t num_segments = 4;
+    srtp_policy_t policy;
+    srtp_t sender, receiver, loop_receiver;
+    srtp_mux_packet_t packets[8];
+    uint32_t buf_words[128];
+    uint8_t *buf = (uint8_t *)buf_words;
+    uint8_t plain[512];
+    uint8_t sent[512];
+    srtp_err_status_t status;
+    size_t len = 0;
+    size_t out_len = 0;
+    size_t out_stride = 0;
+    size_t num_packets;
+    size_t tag_len;
+
+    memset(&policy, 0, sizeof(policy));
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.key = test_key;
+    policy.window_size = 128;
+    policy.expected_payload_len = stride - 12;
+    policy.ssrc.type = ssrc_any_outbound;
+    status = srtp_create(&sender, &policy);
+    if (status) {
+        return status;
+    }
+    policy.ssrc.type = ssrc_any_inbound;
+    status = srtp_create(&receiver, &policy);
+    if (status) {
+        srtp_dealloc(sender);
+        return status;
+    }
+    status = srtp_create(&loop_receiver, &policy);
+    if (status) {
+        srtp_dealloc(sender);
+        srtp_dealloc(receiver);
+        return status;
+    }
+
+    for (size_t i = 0; i < num_segments; i++) {
+        size_t payload = i + 1 < num_segments ? stride - 12 : 40;
+        size_t pkt_len;
+        uint8_t *pkt = create_rtp_test_packet(payload, 0xcafebabe,
+                                              (uint16_t)(i + 1), 1, false,
+                                              &pkt_len, NULL);
+        memcpy(buf + len, pkt, pkt_len);
+        len += pkt_len;
+        free(pkt);
+    }
+    memcpy(plain, buf, len);
+    status = srtp_get_protect_trailer_length(sender, 0, &tag_len);
+
+    /* too little room for the trailers */
+    if (status == srtp_err_status_ok &&
+        srtp_protect_segments(sender, buf, len + 1, len, stride, 0, &out_len,
+                              &out_stride) != srtp_err_status_buffer_small) {
+        status = srtp_err_status_algo_fail;
+    }
+
+    /* a stride that would leave packets unaligned */
+    if (status == srtp_err_status_ok &&
+        srtp_protect_segments(sender, buf, sizeof(buf_words), len, stride - 2,
+                              0, &out_len,
+                              &out_stride) != srtp_err_status_bad_param) {
+        status = srtp_err_status_algo_fail;
+    }
+
+    /* a last header claiming more CSRCs than fit leaves buf untouched */
+    buf[(num_segments - 1) * stride] |= 0x0f;
+    if (status == srtp_err_status_ok &&
+        srtp_protect_segments(sender, buf, sizeof(buf_words), len, stride, 0,
+                              &out_len,
+                              &out_stride) != srtp_err_status_bad_param) {
+        status = srtp_err_status_algo_fail;
+    }
+    buf[(num_segments - 1) * stride] &= 0xf0;
+    if (status == srtp_err_status_ok && memcmp(buf, plain, len)) {
+        status = srtp_err_status_algo_fail;
+    }
+
+    if (status == srtp_err_status_ok) {
+        status = srtp_protect_segments(sender, buf, sizeof(buf_words), len,
+                                       stride, 0, &out_len, &out_stride);
+    }
+    if (status == srtp_err_status_ok &&
+        (out_stride != stride + tag_len ||
+         out_len != len + num_segments * tag_len)) {
+        status = srtp_err_status_algo_fail;
+    }
+    memcpy(sent, buf, out_len);
+
+    /* a GRO buffer of the same layout unprotects segment by segment */
+    num_packets = 2;
+    if (status == srtp_err_status_ok &&
+        srtp_unprotect_segments(receiver, buf, out_len, out_stride, packets,
+                                &num_packets) !=
+            srtp_err_status_buffer_small) {
+        status = srtp_err_status_algo_fail;
+    }
+    num_packets = sizeof(packets) / sizeof(packets[0]);
+    if (status == srtp_err_status_ok) {
+        status = srtp_unprotect_segments(receiver, buf, out_len, out_stride,
+                                         packets, &num_packets);
+    }
+    if (status == srtp_err_status_ok && num_packets != num_segments) {
+        status = srtp_err_status_algo_fail;
+    }
+    for (size_t i = 0; status == srtp_err_status_ok && i < num_packets; i++) {
+        size_t expected = i + 1 < num_segments ? stride : len - i * stride;
+        if (packets[i].status != srtp_err_status_ok ||
+            packets[i].data != buf + i * out_stride ||
+            packets[i].len != expected ||
+            memcmp(packets[i].data, plain + i * stride, expected)) {
+            status = srtp_err_status_algo_fail;
+        }
+    }
+
+#if defined(UDP_SEGMENT) && defined(UDP_GRO)
+    if (status == srtp_err_status_ok) {
+        size_t num_ok;
+        status = segments_loopback(loop_receiver, sent, out_len, out_stride,
+                                   &num_ok);
+        if (status == srtp_err_status_ok && num_ok != SIZE_MAX &&
+            num_ok != num_segments) {
+            status = srtp_err_status_algo_fail;
+        }
+    }
+#endif
+
+    srtp_dealloc(sender);
+    srtp_dealloc(receiver);
+    srtp_dealloc(loop_receiver);
+
+    return status;
+}
+
+#if defined(GCM) && !defined(OPENSSL) && !defined(WOLFSSL) &&                 \
+    !defined(MBEDTLS) && !defined(NSS)
+/*
+ * the built-in AES-GCM checks the tag before decrypting, so a packet that
+ * fails authentication must not write to the output buffer at all
+ */
+srtp_err_status_t srtp_test_aead_reject_no_write(void)
+{
+    srtp_policy_t policy;
+    srtp_t sender, receiver;
+    srtp_err_status_t status;
+    uint8_t out[128];
+    uint8_t *pkt;
+    size_t len, out_len;
+
+    memset(&policy, 0, sizeof(policy));
+    srtp_crypto_policy_set_aes_gcm_128_16_auth(&policy.rtp);
+    srtp_crypto_policy_set_aes_gcm_128_16_auth(&policy.rtcp);
+    policy.ssrc.type = ssrc_any_outbound;
+    policy.key = test_key;
+    policy.window_size = 128;
+    status = srtp_create(&sender, &policy);
+    if (status) {
+        return status;
+    }
+    policy.ssrc.type = ssrc_any_inbound;
+    status = srtp_create(&receiver, &policy);
+    if (status) {
+        srtp_dealloc(sender);
+        return status;
+    }
+
+    pkt = create_rtp_test_packet(64, 0xcafebabe, 1, 1, false, &len, NULL);
+    status = call_srtp_protect(sender, pkt, &len, 0);
+
+    /* a flipped payload bit is rejected and out is left as it was */
+    if (status == srtp_err_status_ok) {
+        pkt[len - 20] ^= 0x01;
+        memset(out, 0xa5, sizeof(out));
+        out_len = sizeof(out);
+        if (srtp_unprotect(receiver, pkt, len, out, &out_len) !=
+            srtp_err_status_auth_fail) {
+            status = srtp_err_status_algo_fail;
+        }
+        for (size_t i = 0; i < sizeof(out); i++) {
+            if (out[i] != 0xa5) {
+                status = srtp_err_status_algo_fail;
+            }
+        }
+        pkt[len - 20] ^= 0x01;
+    }
+
+    /* while the genuine packet still decrypts */
+    if (status == srtp_err_status_ok) {
+        out_len = sizeof(out);
+        status = srtp_unprotect(receiver, pkt, len, out, &out_len);
+        if (status == srtp_err_status_ok &&
+            (out_len != len - 16 || memcmp(out, pkt, 12))) {
+            status = srtp_err_status_algo_fail;
+        }
+    }
+
+    free(pkt);
+    srtp_dealloc(sender);
+    srtp_dealloc(receiver);
+
+    return status;
+}
+#endif
+
+/*
+ * srtp policy definitions - these definitions are used above
+ */
+
+// clang-format off
+uint8_t test_key[46] = {
+    0xe1, 0xf9, 0x7a, 0x0d, 0x3e, 0x01, 0x8b, 0xe0,
+    0xd6, 0x4f, 0xa3, 0x2c, 0x06, 0xde, 0x41, 0x39,
+    0x0e, 0xc6, 0x75, 0xad, 0x49, 0x8a, 0xfe, 0xeb,
+    0xb6, 0x96, 0x0b, 0x3a, 0xab, 0xe6, 0xc1, 0x73,
+    0xc3, 0x17, 0xf2, 0xda, 0xbe, 0x35, 0x77, 0x93,
+    0xb6, 0x96, 0x0b, 0x3a, 0xab, 0xe6
+};
+
+uint8_t test_key_2[46] = {
+    0xf0, 0xf0, 0x49, 0x14, 0xb5, 0x13, 0xf2, 0x76,
+    0x3a, 0x1b, 0x1f, 0xa1, 0x30, 0xf1, 0x0e, 0x29,
+    0x98, 0xf6, 0xf6, 0xe4, 0x3e, 0x43, 0x09, 0xd1,
+    0xe6, 0x22, 0xa0, 0xe3, 0x32, 0xb9, 0xf1, 0xb6,
+    0xc3, 0x17, 0xf2, 0xda, 0xbe, 0x35, 0x77, 0x93,
+    0xb6, 0x96, 0x0b, 0x3a, 0xab, 0xe6
+};
+
+uint8_t test_key_gcm[28] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+    0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xab
+};
+
+uint8_t test_mki_id[TEST_MKI_ID_SIZE] = {
+    0xe1, 0xf9, 0x7a, 0x0d
+};
+
+uint8_t test_mki_id_2[TEST_MKI_ID_SIZE] = {
+    0xf3, 0xa1, 0x46, 0x71
+};
+// clang-format on
+
+const srtp_policy_t default_policy = {
+    { ssrc_any_outbound, 0 }, /* SSRC */
+    {
+        /* SRTP policy */
+        SRTP_AES_ICM_128,               /* cipher type                 */
+        SRTP_AES_ICM_128_KEY_LEN_WSALT, /* cipher key length in octets */
+        SRTP_HMAC_SHA1,                 /* authentication func type    */
+        16,                             /* auth key length in octets   */
+        10,                             /* auth tag length in octets   */
+        sec_serv_conf_and_auth          /* security services flag      */
+    },
+    {
+        /* SRTCP policy */
+        SRTP_AES_ICM_128,               /* cipher type                 */
+        SRTP_AES_ICM_128_KEY_LEN_WSALT, /* cipher key length in octets */
         SRTP_HMAC_SHA1,                 /* authentication func type    */
         16,                             /* auth key length in octets   */
         10,                             /* auth tag length in octets   */
@@ -4738,7 +7504,10 @@ const srtp_policy_t default_policy = {
     0,                /* retransmission not allowed                   */
     NULL,             /* no encrypted extension headers               */
     0,                /* list of encrypted extension headers is empty */
-    NULL
+    NULL,
+    0,     /* fixed replay window */
+    false, /* not exportable */
+    0      /* no payload size hint */
 };
 
 const srtp_policy_t aes_only_policy = {
@@ -4768,7 +7537,10 @@ const srtp_policy_t aes_only_policy = {
     0,                /* retransmission not allowed                   */
     NULL,             /* no encrypted extension headers               */
     0,                /* list of encrypted extension headers is empty */
-    NULL
+    NULL,
+    0,     /* fixed replay window */
+    false, /* not exportable */
+    0      /* no payload size hint */
 };
 
 const srtp_policy_t hmac_only_policy = {
@@ -4798,7 +7570,10 @@ const srtp_policy_t hmac_only_policy = {
     0,                /* retransmission not allowed                       */
     NULL,             /* no encrypted extension headers                   */
     0,                /* list of encrypted extension headers is empty     */
-    NULL
+    NULL,
+    0,     /* fixed replay window */
+    false, /* not exportable */
+    0      /* no payload size hint */
 };
 
 #ifdef GCM
@@ -4831,7 +7606,10 @@ const srtp_policy_t aes128_gcm_8_policy = {
     0,                /* retransmission not allowed                   */
     NULL,             /* no encrypted extension headers               */
     0,                /* list of encrypted extension headers is empty */
-    NULL
+    NULL,
+    0,     /* fixed replay window */
+    false, /* not exportable */
+    0      /* no payload size hint */
 };
 
 const srtp_policy_t aes128_gcm_8_cauth_policy = {
@@ -4863,7 +7641,10 @@ const srtp_policy_t aes128_gcm_8_cauth_policy = {
     0,                /* retransmission not allowed                   */
     NULL,             /* no encrypted extension headers               */
     0,                /* list of encrypted extension headers is empty */
-    NULL
+    NULL,
+    0,     /* fixed replay window */
+    false, /* not exportable */
+    0      /* no payload size hint */
 };
 
 const srtp_policy_t aes256_gcm_8_policy = {
@@ -4895,7 +7676,10 @@ const srtp_policy_t aes256_gcm_8_policy = {
     0,                /* retransmission not allowed                   */
     NULL,             /* no encrypted extension headers               */
     0,                /* list of encrypted extension headers is empty */
-    NULL
+    NULL,
+    0,     /* fixed replay window */
+    false, /* not exportable */
+    0      /* no payload size hint */
 };
 
 const srtp_policy_t aes256_gcm_8_cauth_policy = {
@@ -4927,7 +7711,10 @@ const srtp_policy_t aes256_gcm_8_cauth_policy = {
     0,                /* retransmission not allowed                   */
     NULL,             /* no encrypted extension headers               */
     0,                /* list of encrypted extension headers is empty */
-    NULL
+    NULL,
+    0,     /* fixed replay window */
+    false, /* not exportable */
+    0      /* no payload size hint */
 };
 #endif
 
@@ -4958,7 +7745,10 @@ const srtp_policy_t null_policy = {
     0,                /* retransmission not allowed                   */
     NULL,             /* no encrypted extension headers               */
     0,                /* list of encrypted extension headers is empty */
-    NULL
+    NULL,
+    0,     /* fixed replay window */
+    false, /* not exportable */
+    0      /* no payload size hint */
 };
 
 // clang-format off
@@ -5026,7 +7816,10 @@ const srtp_policy_t aes_256_hmac_policy = {
     0,                /* retransmission not allowed                   */
     NULL,             /* no encrypted extension headers               */
     0,                /* list of encrypted extension headers is empty */
-    NULL
+    NULL,
+    0,     /* fixed replay window */
+    false, /* not exportable */
+    0      /* no payload size hint */
 };
 
 const srtp_policy_t hmac_only_with_no_master_key = {
@@ -5056,7 +7849,10 @@ const srtp_policy_t hmac_only_with_no_master_key = {
     false, /* retransmission not allowed                   */
     NULL,  /* no encrypted extension headers               */
     0,     /* list of encrypted extension headers is empty */
-    NULL
+    NULL,
+    0,     /* fixed replay window */
+    false, /* not exportable */
+    0      /* no payload size hint */
 };
 
 /*
@@ -5122,7 +7918,10 @@ const srtp_policy_t wildcard_policy = {
     0,     /* retransmission not allowed                   */
     NULL,  /* no encrypted extension headers               */
     0,     /* list of encrypted extension headers is empty */
-    NULL
+    NULL,
+    0,     /* fixed replay window */
+    false, /* not exportable */
+    0      /* no payload size hint */
 };
 
 static srtp_stream_t stream_list_test_create_stream(uint32_t ssrc)
@@ -89,6 +89,186 @@ uint32_t ut_next_index(ut_connection *utc)
     return tmp;
 }
 
+/*
+ * the impaired connection uses its own xorshift generator so that a
+ * given seed always reproduces the same packet schedule, independent
+ * of whatever else consumes srtp_cipher_rand_for_tests()
+ */
+
+static uint32_t ut_rand(ut_impaired_connection *c)
+{
+    uint64_t x = c->rng;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    c->rng = x;
+    return (uint32_t)(x >> 32);
+}
+
+static bool ut_chance(ut_impaired_connection *c, uint32_t rate)
+{
+    return rate != 0 && (ut_rand(c) & (UT_RATE_ONE - 1)) < rate;
+}
+
+/* uniform in [1, max] */
+static uint32_t ut_between(ut_impaired_connection *c, uint32_t max)
+{
+    return max <= 1 ? 1 : 1 + ut_rand(c) % max;
+}
+
+static bool ut_entry_before(const ut_queue_entry_t *a,
+                            const ut_queue_entry_t *b)
+{
+    if (a->release != b->release) {
+        return a->release < b->release;
+    }
+    return a->order < b->order;
+}
+
+static void ut_queue_push(ut_impaired_connection *c,
+                          const ut_packet_t *pkt,
+                          uint64_t release)
+{
+    ut_queue_entry_t e;
+    size_t i;
+
+    e.pkt = *pkt;
+    e.release = release;
+    e.order = c->order++;
+
+    i = c->queue_len++;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!ut_entry_before(&e, &c->queue[parent])) {
+            break;
+        }
+        c->queue[i] = c->queue[parent];
+        i = parent;
+    }
+    c->queue[i] = e;
+}
+
+static void ut_queue_pop(ut_impaired_connection *c, ut_packet_t *pkt)
+{
+    ut_queue_entry_t last;
+    size_t i = 0;
+
+    *pkt = c->queue[0].pkt;
+    last = c->queue[--c->queue_len];
+
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= c->queue_len) {
+            break;
+        }
+        if (child + 1 < c->queue_len &&
+            ut_entry_before(&c->queue[child + 1], &c->queue[child])) {
+            child++;
+        }
+        if (!ut_entry_before(&c->queue[child], &last)) {
+            break;
+        }
+        c->queue[i] = c->queue[child];
+        i = child;
+    }
+    c->queue[i] = last;
+}
+
+srtp_err_status_t ut_impaired_init(ut_impaired_connection *c,
+                                   const ut_impairment_t *imp,
+                                   uint64_t limit,
+                                   ut_send_func_t send,
+                                   void *arg)
+{
+    if (imp->reorder_max > UT_MAX_DELAY || imp->loss_rate > UT_RATE_ONE ||
+        imp->reorder_rate > UT_RATE_ONE || imp->dup_rate > UT_RATE_ONE ||
+        imp->jump_rate > UT_RATE_ONE) {
+        return srtp_err_status_bad_param;
+    }
+
+    memset(c, 0, sizeof(*c));
+    c->imp = *imp;
+    c->send = send;
+    c->send_arg = arg;
+    c->rng = imp->seed ? imp->seed : 0x9e3779b97f4a7c15ULL;
+    c->next_index = imp->start_seq;
+    c->limit = limit;
+
+    /*
+     * each sent packet queues at most two copies, and neither stays
+     * longer than 2 * reorder_max ticks
+     */
+    c->queue_size = 4 * (size_t)imp->reorder_max + 4;
+    c->queue = malloc(c->queue_size * sizeof(ut_queue_entry_t));
+    if (c->queue == NULL) {
+        return srtp_err_status_alloc_fail;
+    }
+
+    return srtp_err_status_ok;
+}
+
+/* sends one packet and queues whatever copies of it reach the receiver */
+static void ut_impaired_send(ut_impaired_connection *c)
+{
+    ut_packet_t pkt;
+    uint64_t now = c->sent;
+    uint64_t delay = 0;
+
+    if (c->sent != 0 && ut_chance(c, c->imp.jump_rate)) {
+        c->next_index += ut_between(c, c->imp.jump_max);
+        c->jumps++;
+    }
+
+    pkt.index = c->next_index++;
+    pkt.sent = c->sent++;
+    if (c->send != NULL) {
+        c->send(c->send_arg, &pkt);
+    }
+
+    if (c->loss_left == 0 && ut_chance(c, c->imp.loss_rate)) {
+        c->loss_left = ut_between(c, c->imp.loss_burst_max);
+    }
+    if (c->loss_left != 0) {
+        c->loss_left--;
+        c->lost++;
+        return;
+    }
+
+    if (c->imp.reorder_max != 0 && ut_chance(c, c->imp.reorder_rate)) {
+        delay = ut_between(c, c->imp.reorder_max);
+        c->reordered++;
+    }
+    ut_queue_push(c, &pkt, now + delay);
+
+    if (ut_chance(c, c->imp.dup_rate)) {
+        ut_queue_push(c, &pkt,
+                      now + delay + ut_rand(c) % (c->imp.reorder_max + 1));
+        c->duplicated++;
+    }
+}
+
+bool ut_impaired_next(ut_impaired_connection *c, ut_packet_t *pkt)
+{
+    for (;;) {
+        if (c->queue_len != 0 &&
+            (c->queue[0].release < c->sent || c->sent == c->limit)) {
+            ut_queue_pop(c, pkt);
+            return true;
+        }
+        if (c->sent == c->limit) {
+            return false;
+        }
+        ut_impaired_send(c);
+    }
+}
+
+void ut_impaired_dealloc(ut_impaired_connection *c)
+{
+    free(c->queue);
+    c->queue = NULL;
+    c->queue_len = 0;
+}
+
 #ifdef UT_TEST
 
 #include <stdio.h>
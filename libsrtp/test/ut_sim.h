@@ -48,6 +48,7 @@
 #define UT_SIM_H
 
 #include "datatypes.h"
+#include "err.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -76,6 +77,96 @@ void ut_init(ut_connection *utc);
 
 uint32_t ut_next_index(ut_connection *utc);
 
+/*
+ * ut_impaired_connection simulates a lossy network path between one
+ * SRTP sender and one receiver.  Unlike ut_connection it tracks full
+ * 48-bit packet indices, so it can be used to push streams across a
+ * rollover counter wrap, and it can lose, delay, duplicate and skip
+ * packets according to an ut_impairment_t.
+ *
+ * All rates are expressed as a probability per sent packet in units
+ * of 1/65536, e.g. 655 is roughly one percent.
+ */
+
+#define UT_RATE_ONE 65536
+
+#define UT_MAX_DELAY 8192 /* maximum delay of a reordered packet */
+
+typedef struct {
+    uint32_t loss_rate;      /* chance that a loss burst starts        */
+    uint32_t loss_burst_max; /* longest loss burst, in packets         */
+    uint32_t reorder_rate;   /* chance that a packet is delayed        */
+    uint32_t reorder_max;    /* longest delay, in packets              */
+    uint32_t dup_rate;       /* chance that a packet is duplicated     */
+    uint32_t jump_rate;      /* chance of a forward sequence jump      */
+    uint32_t jump_max;       /* largest sequence jump, in packets      */
+    uint16_t start_seq;      /* first sequence number, e.g. 0xff00 to  */
+                             /* cross the first ROC wrap early         */
+    uint64_t seed;           /* seed of the connection's own PRNG      */
+} ut_impairment_t;
+
+typedef struct {
+    uint64_t index; /* packet index, ROC << 16 | SEQ                */
+    uint64_t sent;  /* position in the sender's output, from zero   */
+} ut_packet_t;
+
+/*
+ * ut_send_func_t is called for every packet the sender emits, in
+ * sending order, including the ones that are later lost.  It is the
+ * place to protect the packet.
+ */
+typedef void (*ut_send_func_t)(void *arg, const ut_packet_t *pkt);
+
+typedef struct {
+    ut_packet_t pkt;
+    uint64_t release; /* sender clock at which the packet arrives */
+    uint64_t order;   /* tie breaker, keeps the queue stable      */
+} ut_queue_entry_t;
+
+typedef struct {
+    ut_impairment_t imp;
+    ut_send_func_t send;
+    void *send_arg;
+    uint64_t rng;
+    uint64_t next_index;
+    uint64_t sent;  /* packets sent so far    */
+    uint64_t limit; /* packets to send        */
+    uint32_t loss_left;
+    ut_queue_entry_t *queue; /* min-heap on (release, order) */
+    size_t queue_len;
+    size_t queue_size;
+    uint64_t order;
+
+    /* statistics */
+    uint64_t lost;
+    uint64_t reordered;
+    uint64_t duplicated;
+    uint64_t jumps;
+} ut_impaired_connection;
+
+/*
+ * ut_impaired_init(&c, &imp, limit, send, arg) initializes an impaired
+ * connection that sends limit packets; returns srtp_err_status_bad_param
+ * if imp is out of range and srtp_err_status_alloc_fail if the delay
+ * queue could not be allocated
+ */
+
+srtp_err_status_t ut_impaired_init(ut_impaired_connection *c,
+                                   const ut_impairment_t *imp,
+                                   uint64_t limit,
+                                   ut_send_func_t send,
+                                   void *arg);
+
+/*
+ * ut_impaired_next(&c, &pkt) returns the next packet arriving at the
+ * receiver in pkt, or false once every packet has been sent and the
+ * delay queue is drained
+ */
+
+bool ut_impaired_next(ut_impaired_connection *c, ut_packet_t *pkt);
+
+void ut_impaired_dealloc(ut_impaired_connection *c);
+
 #ifdef __cplusplus
 }
 #endif